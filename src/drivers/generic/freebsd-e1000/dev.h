@@ -4,6 +4,7 @@
 #include <error.h>
 
 #include <vfs/vnode.h>
+#include <vfs/irp.h>
 
 #include <e1000/e1000_hw.h>
 
@@ -15,6 +16,9 @@
 
 #include <mm/page.h>
 
+#include <net/rx_pool.h>
+#include <net/poll.h>
+
 #include <driver_interface/pci.h>
 
 #include <utils/list.h>
@@ -22,8 +26,14 @@
 #define RX_QUEUE_SIZE (OBOS_PAGE_SIZE / sizeof(union e1000_rx_desc_extended))
 #define TX_QUEUE_SIZE (OBOS_PAGE_SIZE / sizeof(struct e1000_tx_desc))
 #define TX_BUFFER_PAGES (16)
+// Leave enough spare buffers to refill the whole ring while
+// the network stack holds on to received frames.
+#define RX_POOL_SIZE (RX_QUEUE_SIZE * 2)
+// The interrupts that are masked while the RX ring is polled.
+#define E1000_RX_IRQS (E1000_IMS_RXT0 | E1000_IMS_RXDMT0)
 
 typedef struct e1000_frame {
+    shared_ptr* ptr;
     void* buff;
     size_t size;
     size_t refs;
@@ -41,11 +51,12 @@ typedef struct e1000_device {
     pci_resource* irq_res;
     irq irq;
     uint32_t icr;
-    dpc dpc;
     dpc dpc_tx;
+    net_poll poll;
 
     uintptr_t rx_ring;
-    uintptr_t rx_ring_buffers[RX_QUEUE_SIZE];
+    net_rx_buffer* rx_ring_buffers[RX_QUEUE_SIZE];
+    net_rx_pool rx_pool;
     page* rx_ring_phys_pg;
     event rx_evnt;
     uint32_t rx_idx;
@@ -55,6 +66,8 @@ typedef struct e1000_device {
     size_t tx_index;
     event tx_done_evnt;
     uintptr_t tx_buffers[TX_QUEUE_SIZE];
+    // The transmit offloads supported by the MAC (NET_OFFLOAD_*).
+    uint32_t tx_offloads;
 
     size_t refs;
 
@@ -84,7 +97,8 @@ typedef struct e1000_handle {
 
 void e1000_init_rx(e1000_device* dev);
 void e1000_init_tx(e1000_device* dev);
-event* e1000_tx_packet(e1000_device* dev, const void* buffer, size_t size, bool dry, obos_status* status);
+// 'offload' can be nullptr, see nic_irp_data.
+event* e1000_tx_packet(e1000_device* dev, const void* buffer, size_t size, const nic_irp_data* offload, bool dry, obos_status* status);
 
 void e1000_irq_handler(struct irq* i, interrupt_frame* frame, void* userdata, irql oldIrql);
 bool e1000_check_irq_callback(struct irq* i, void* userdata);
\ No newline at end of file
@@ -51,17 +51,23 @@ LIST_GENERATE(e1000_frame_list, e1000_frame, node);
 #define MAX_INTS_PER_SEC 8000
 #define DEFAULT_ITR (1000000000 / (MAX_INTS_PER_SEC * 256))
 
+static size_t rx_poll(net_poll* np, size_t budget);
+static void rx_enable_irqs(net_poll* np);
+
 static void e1000_init_rx_desc(e1000_device* dev)
 {
     OBOS_STATIC_ASSERT((RX_QUEUE_SIZE * sizeof(union e1000_rx_desc_extended)) <= OBOS_PAGE_SIZE, "RX_QUEUE_SIZE is too large!");
     dev->rx_ring_phys_pg = MmH_PgAllocatePhysical(false, false);
     dev->rx_ring = dev->rx_ring_phys_pg->phys;
+    // RCTL.BSIZE is set to 2048 bytes, and a page is the smallest buffer the pool can give us.
+    OBOS_ENSURE(obos_is_success(NetH_InitializeRxPool(&dev->rx_pool, RX_POOL_SIZE, 2048)));
     union e1000_rx_desc_extended* desc = MmS_MapVirtFromPhys(dev->rx_ring);
     memzero(desc, sizeof(*desc) * RX_QUEUE_SIZE);
     for (size_t i = 0; i < RX_QUEUE_SIZE; i++)
     {
-        dev->rx_ring_buffers[i] = Mm_AllocatePhysicalPages(1, 1, nullptr);
-        desc[i].read.buffer_addr = dev->rx_ring_buffers[i];
+        dev->rx_ring_buffers[i] = NetH_RxPoolGet(&dev->rx_pool);
+        OBOS_ENSURE(dev->rx_ring_buffers[i]);
+        desc[i].read.buffer_addr = dev->rx_ring_buffers[i]->phys;
         desc[i].wb.upper.status_error = 0;
     }
 }
@@ -69,6 +75,7 @@ static void e1000_init_rx_desc(e1000_device* dev)
 void e1000_init_rx(e1000_device* dev)
 {
     e1000_init_rx_desc(dev);
+    OBOS_ENSURE(obos_is_success(NetH_InitializePoll(&dev->poll, rx_poll, rx_enable_irqs, dev)));
 
     uint32_t rctl = E1000_READ_REG(&dev->hw, E1000_RCTL);
 
@@ -201,6 +208,15 @@ void e1000_init_rx(e1000_device* dev)
 
 void e1000_init_tx(e1000_device* dev)
 {
+    // Checksums are offloaded with legacy context descriptors, which the 82542
+    // doesn't support, and the 82575 and later replaced with advanced descriptors.
+    dev->tx_offloads = 0;
+    if (dev->hw.mac.type >= e1000_82543 && dev->hw.mac.type < e1000_82575)
+        dev->tx_offloads |= NET_OFFLOAD_IPv4_CHECKSUM|NET_OFFLOAD_TCP_CHECKSUM|NET_OFFLOAD_UDP_CHECKSUM;
+    // TSO on the earlier MACs has too many errata.
+    if (dev->hw.mac.type >= e1000_82571 && dev->hw.mac.type < e1000_82575)
+        dev->tx_offloads |= NET_OFFLOAD_TCP_TSO;
+
     dev->tx_ring_phys_pg = MmH_PgAllocatePhysical(false, false);
     dev->tx_ring = dev->tx_ring_phys_pg->phys;
 
@@ -312,10 +328,59 @@ void e1000_init_tx(e1000_device* dev)
 
 void e1000_tx_reap(e1000_device* dev);
 
-event* e1000_tx_packet(e1000_device* dev, const void* buffer, size_t size, bool dry, obos_status* status)
+// Writes a context descriptor describing the offloads of the next data descriptor.
+// Returns the POPTS field of the data descriptor.
+static uint8_t setup_tx_context(e1000_device* dev, void* frame, size_t size, const nic_irp_data* offload, uint32_t flags)
+{
+    volatile struct e1000_context_desc* ctx = &((volatile struct e1000_context_desc*)MmS_MapVirtFromPhys(dev->tx_ring))[dev->tx_index % TX_QUEUE_SIZE];
+    uint8_t popts = 0;
+    uint32_t cmd = E1000_TXD_CMD_DEXT | E1000_TXD_DTYP_C | E1000_TXD_CMD_IP;
+
+    ctx->lower_setup.ip_fields.ipcss = offload->l3_offset;
+    ctx->lower_setup.ip_fields.ipcso = offload->l3_offset + 10 /* offset of the IPv4 checksum */;
+    ctx->lower_setup.ip_fields.ipcse = offload->l4_offset - 1;
+    popts |= E1000_TXD_POPTS_IXSM;
+
+    ctx->upper_setup.tcp_config = 0;
+    if (flags & (NET_OFFLOAD_TCP_CHECKSUM|NET_OFFLOAD_UDP_CHECKSUM|NET_OFFLOAD_TCP_TSO))
+    {
+        bool tcp = flags & (NET_OFFLOAD_TCP_CHECKSUM|NET_OFFLOAD_TCP_TSO);
+        ctx->upper_setup.tcp_fields.tucss = offload->l4_offset;
+        ctx->upper_setup.tcp_fields.tucso = offload->l4_offset + (tcp ? 16 : 6);
+        ctx->upper_setup.tcp_fields.tucse = 0; // To the end of the packet.
+        if (tcp)
+            cmd |= E1000_TXD_CMD_TCP;
+        popts |= E1000_TXD_POPTS_TXSM;
+    }
+
+    ctx->tcp_seg_setup.data = 0;
+    if (flags & NET_OFFLOAD_TCP_TSO)
+    {
+        // The NIC puts the length of each segment into the IPv4 header and the
+        // TCP pseudo header itself, so take it out of both.
+        uint8_t* ip_hdr = (uint8_t*)frame + offload->l3_offset;
+        uint16_t* tcp_chksum = (uint16_t*)((uint8_t*)frame + offload->l4_offset + 16);
+        uint16_t tcp_len = size - offload->l4_offset;
+        uint32_t sum = be16_to_host(*tcp_chksum) + (uint16_t)~tcp_len;
+        sum = (sum & 0xffff) + (sum >> 16);
+        sum = (sum & 0xffff) + (sum >> 16);
+        *tcp_chksum = host_to_be16(sum);
+        memzero(ip_hdr + 2, 2); // Total length
+        memzero(ip_hdr + 10, 2); // Checksum
+
+        cmd |= E1000_TXD_CMD_TSE | (size - offload->payload_offset);
+        ctx->tcp_seg_setup.fields.hdr_len = offload->payload_offset;
+        ctx->tcp_seg_setup.fields.mss = offload->mss;
+    }
+    ctx->cmd_and_length = cmd;
+
+    dev->tx_index++;
+    return popts;
+}
+
+event* e1000_tx_packet(e1000_device* dev, const void* buffer, size_t size, const nic_irp_data* offload, bool dry, obos_status* status)
 {
     e1000_tx_reap(dev);
-    volatile struct e1000_tx_desc* desc = &((volatile struct e1000_tx_desc*)MmS_MapVirtFromPhys(dev->tx_ring))[dev->tx_index % TX_QUEUE_SIZE];
     if (dry)
         return nullptr;
     irql oldIrql = Core_RaiseIrql(IRQL_E1000);
@@ -331,11 +396,30 @@ event* e1000_tx_packet(e1000_device* dev, const void* buffer, size_t size, bool
         return nullptr;
     }
 
-    uintptr_t buff = dev->tx_buffers[dev->tx_index % TX_QUEUE_SIZE];
-    memcpy(MmS_MapVirtFromPhys(buff), buffer, size);
-    desc->buffer_addr = buff;
-    desc->upper.data = 0;
-    desc->lower.data = size | E1000_TXD_CMD_EOP | E1000_TXD_CMD_RS;
+    uint32_t flags = offload ? (offload->offload & dev->tx_offloads) : 0;
+    uint8_t popts = 0;
+    if (flags)
+    {
+        // The context descriptor takes a slot in the ring, so the frame goes into the next one.
+        void* frame = MmS_MapVirtFromPhys(dev->tx_buffers[(dev->tx_index + 1) % TX_QUEUE_SIZE]);
+        memcpy(frame, buffer, size);
+        popts = setup_tx_context(dev, frame, size, offload, flags);
+    }
+    else
+        memcpy(MmS_MapVirtFromPhys(dev->tx_buffers[dev->tx_index % TX_QUEUE_SIZE]), buffer, size);
+
+    volatile struct e1000_tx_desc* desc = &((volatile struct e1000_tx_desc*)MmS_MapVirtFromPhys(dev->tx_ring))[dev->tx_index % TX_QUEUE_SIZE];
+    desc->buffer_addr = dev->tx_buffers[dev->tx_index % TX_QUEUE_SIZE];
+    desc->upper.data = (uint32_t)popts << 8;
+    if (flags)
+    {
+        // Offloaded frames have no FCS (see nic_irp_data).
+        desc->lower.data = size | E1000_TXD_CMD_EOP | E1000_TXD_CMD_RS | E1000_TXD_CMD_DEXT | E1000_TXD_DTYP_D | E1000_TXD_CMD_IFCS;
+        if (flags & NET_OFFLOAD_TCP_TSO)
+            desc->lower.data |= E1000_TXD_CMD_TSE;
+    }
+    else
+        desc->lower.data = size | E1000_TXD_CMD_EOP | E1000_TXD_CMD_RS;
     E1000_WRITE_REG(&dev->hw, E1000_TDBAH(0), (u32)(dev->tx_ring >> 32));
     E1000_WRITE_REG(&dev->hw, E1000_TDBAL(0), (u32)dev->tx_ring);
     E1000_WRITE_REG(&dev->hw, E1000_TDT(0), ++dev->tx_index % TX_QUEUE_SIZE);
@@ -351,91 +435,129 @@ event* e1000_tx_packet(e1000_device* dev, const void* buffer, size_t size, bool
     return nullptr;
 }
 
-
-static void rx_dpc(dpc* d, void* udata)
+static void deliver_frame(e1000_device* dev, shared_ptr* buf)
 {
-    OBOS_UNUSED(d);
-    e1000_device* dev = udata;
-    
     vnode* const nic = dev->vn;
+    // The vnode might not exist yet.
+    const bool has_stack = nic && nic->net_tables;
+    OBOS_SharedPtrRef(buf);
+    // Every handle except the network stack's reads frames through IRPs.
+    size_t readers = dev->refs;
+    if (has_stack && readers)
+        readers--;
+    if (readers)
+    {
+        e1000_frame* frame = ZeroAllocate(OBOS_NonPagedPoolAllocator, 1, sizeof(e1000_frame), nullptr);
+        frame->ptr = OBOS_SharedPtrCopy(buf);
+        frame->buff = buf->obj;
+        frame->size = buf->szObj;
+        frame->refs = readers;
+        LIST_APPEND(e1000_frame_list, &dev->rx_frames, frame);
+    }
+    if (has_stack)
+        NetH_PollQueueFrame(&dev->poll, buf);
+    OBOS_SharedPtrUnref(buf);
+}
+
+static size_t rx_poll(net_poll* np, size_t budget)
+{
+    e1000_device* dev = np->userdata;
+
+    // Frames that span more than one descriptor are copied into here.
+    void* partial = nullptr;
+    size_t partial_size = 0;
 
-    e1000_frame* current_frame = nullptr;
-    size_t offset = 0;
-        
-    while (true)
+    size_t nFrames = 0;
+    const uint32_t first_idx = dev->rx_idx;
+    // Only stop at the end of a frame, so that partial frames never outlive a poll.
+    while (nFrames < budget || partial)
     {
+        const size_t idx = dev->rx_idx % RX_QUEUE_SIZE;
+        union e1000_rx_desc_extended* ext_desc = nullptr;
+        struct e1000_rx_desc* desc = nullptr;
         uint32_t length = 0;
         bool eop = false;
         if(dev->hw.mac.type >= e1000_82547)
         {
-            union e1000_rx_desc_extended* desc = &((union e1000_rx_desc_extended*)MmS_MapVirtFromPhys(dev->rx_ring))[(dev->rx_idx % RX_QUEUE_SIZE)];
-            if (~desc->wb.upper.status_error & E1000_RXD_STAT_DD)
+            ext_desc = &((union e1000_rx_desc_extended*)MmS_MapVirtFromPhys(dev->rx_ring))[idx];
+            if (~ext_desc->wb.upper.status_error & E1000_RXD_STAT_DD)
                 break;
-            length = desc->wb.upper.length;
-            eop = desc->wb.upper.status_error & E1000_RXD_STAT_EOP;
-            desc->wb.upper.status_error = 0;
-            desc->read.buffer_addr = dev->rx_ring_buffers[(dev->rx_idx % RX_QUEUE_SIZE)];
+            length = ext_desc->wb.upper.length;
+            eop = ext_desc->wb.upper.status_error & E1000_RXD_STAT_EOP;
         }
         else
         {
-            struct e1000_rx_desc* desc = &((struct e1000_rx_desc*)MmS_MapVirtFromPhys(dev->rx_ring))[(dev->rx_idx % RX_QUEUE_SIZE)];
+            desc = &((struct e1000_rx_desc*)MmS_MapVirtFromPhys(dev->rx_ring))[idx];
             if (~desc->status & E1000_RXD_STAT_DD)
                 break;
             eop = desc->status & E1000_RXD_STAT_EOP;
             length = desc->length;
-            desc->status = 0;
         }
-        if (!current_frame)
-            current_frame = ZeroAllocate(OBOS_NonPagedPoolAllocator, 1, sizeof(e1000_frame), nullptr);
-        current_frame->size += length;
-        current_frame->buff = Reallocate(OBOS_NonPagedPoolAllocator, current_frame->buff, current_frame->size, current_frame->size - length, nullptr);
-        current_frame->refs = dev->refs;
-        memcpy((char*)current_frame->buff + offset, MmS_MapVirtFromPhys(dev->rx_ring_buffers[(dev->rx_idx % RX_QUEUE_SIZE)]), length);
+
+        shared_ptr* buf = nullptr;
         if (eop)
+            nFrames++;
+        if (eop && !partial)
         {
-            if (current_frame->size < 14)
+            // The whole frame is in this descriptor's buffer, so hand the buffer
+            // itself to the network stack.
+            if (length >= 14)
+                buf = NetH_RxPoolTakeFrame(&dev->rx_pool, &dev->rx_ring_buffers[idx], length);
+            else
+                NetError("e1000: dropping misplaced runt!\n");
+        }
+        else
+        {
+            partial = Reallocate(OBOS_NonPagedPoolAllocator, partial, partial_size + length, partial_size, nullptr);
+            memcpy((char*)partial + partial_size, dev->rx_ring_buffers[idx]->virt, length);
+            partial_size += length;
+            if (eop && partial_size < 14)
             {
                 NetError("e1000: dropping misplaced runt!\n");
-                Free(OBOS_NonPagedPoolAllocator, current_frame->buff, current_frame->size);
-                Free(OBOS_NonPagedPoolAllocator, current_frame, sizeof(e1000_frame));
-                current_frame = nullptr;
-                offset = 0;
-                ++dev->rx_idx;
-                continue;
+                Free(OBOS_NonPagedPoolAllocator, partial, partial_size);
             }
-
-            if (nic->net_tables)
+            else if (eop)
             {
-                shared_ptr* buf = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(shared_ptr), nullptr);
-                OBOS_SharedPtrConstructSz(buf, current_frame->buff, current_frame->size);
+                buf = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(shared_ptr), nullptr);
+                OBOS_SharedPtrConstructSz(buf, partial, partial_size);
                 buf->free = OBOS_SharedPtrDefaultFree;
                 buf->onDeref = NetFreeSharedPtr;
                 buf->freeUdata = OBOS_NonPagedPoolAllocator;
-                current_frame->refs--;
-                if (!current_frame->refs)
-                    Free(OBOS_NonPagedPoolAllocator, current_frame, sizeof(e1000_frame));
-    
-                Net_EthernetProcess(nic, 0, OBOS_SharedPtrCopy(buf), buf->obj, buf->szObj, nullptr);
             }
+            if (eop)
+            {
+                partial = nullptr;
+                partial_size = 0;
+            }
+        }
 
-            LIST_APPEND(e1000_frame_list, &dev->rx_frames, current_frame);
-            current_frame = nullptr;
-            offset = 0;
+        // Give the descriptor back to the NIC, with whatever buffer is now in its slot.
+        if (ext_desc)
+        {
+            ext_desc->wb.upper.status_error = 0;
+            ext_desc->read.buffer_addr = dev->rx_ring_buffers[idx]->phys;
         }
         else
-            offset += length;
-
+        {
+            desc->status = 0;
+            desc->buffer_addr = dev->rx_ring_buffers[idx]->phys;
+        }
         ++dev->rx_idx;
+
+        if (buf)
+            deliver_frame(dev, buf);
+    }
+    if (dev->rx_idx != first_idx)
+    {
+        E1000_WRITE_REG(&dev->hw, E1000_RDT(0), ((dev->rx_idx-1) % RX_QUEUE_SIZE));
+        Core_EventSet(&dev->rx_evnt, false);
     }
-    E1000_WRITE_REG(&dev->hw, E1000_RDT(0), ((dev->rx_idx-1) % RX_QUEUE_SIZE));
-    if (nic->net_tables)
-        Net_TCPFlushACKs(nic->net_tables);
-    Core_EventSet(&dev->rx_evnt, false);
+    return nFrames;
 }
-void e1000_rx(e1000_device* dev)
+static void rx_enable_irqs(net_poll* np)
 {
-    dev->dpc.userdata = dev;
-    CoreH_InitializeDPC(&dev->dpc, rx_dpc, Core_DefaultThreadAffinity);
+    e1000_device* dev = np->userdata;
+    E1000_WRITE_REG(&dev->hw, E1000_IMS, E1000_RX_IRQS);
 }
 
 static void tx_event_set_dpc(dpc* d, void* udata)
@@ -464,8 +586,12 @@ void e1000_irq_handler(struct irq* i, interrupt_frame* frame, void* userdata, ir
 {
     OBOS_UNUSED(i && frame && oldIrql);
     e1000_device* dev = userdata;
-    if (dev->icr & E1000_ICR_RXT0)
-        e1000_rx(dev);
+    if (dev->icr & E1000_RX_IRQS)
+    {
+        // Receive by polling until the ring is drained.
+        E1000_WRITE_REG(&dev->hw, E1000_IMC, E1000_RX_IRQS);
+        NetH_SchedulePoll(&dev->poll);
+    }
     dev->icr = 0;
 }
 
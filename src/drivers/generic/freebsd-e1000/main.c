@@ -61,6 +61,18 @@ obos_status ioctl(dev_desc what, uint32_t request, void* argp)
             memcpy(argp, hnd->dev->hw.mac.addr, sizeof(mac_address));
             break;
         }
+        case IOCTL_IFACE_GET_POLL_STATS:
+            memcpy(argp, &hnd->dev->poll.stats, sizeof(net_poll_stats));
+            break;
+        case IOCTL_IFACE_GET_OFFLOAD_CAPS:
+        {
+            net_offload_caps* caps = argp;
+            memzero(caps, sizeof(*caps));
+            caps->flags = hnd->dev->tx_offloads;
+            if (caps->flags & NET_OFFLOAD_TCP_TSO)
+                caps->tso_max_size = OBOS_MIN(TX_BUFFER_PAGES*OBOS_PAGE_SIZE - sizeof(ethernet2_header), 0xffffUL);
+            break;
+        }
         default:
             return Net_InterfaceIoctl(hnd->dev->vn, request, argp);
     }
@@ -74,6 +86,12 @@ obos_status ioctl_argp_size(uint32_t request, size_t* out)
             *out = sizeof(mac_address);
             break;
         }
+        case IOCTL_IFACE_GET_POLL_STATS:
+            *out = sizeof(net_poll_stats);
+            break;
+        case IOCTL_IFACE_GET_OFFLOAD_CAPS:
+            *out = sizeof(net_offload_caps);
+            break;
         default:
             return Net_InterfaceIoctlArgpSize(request, out);
     }
@@ -116,7 +134,7 @@ static void irp_on_rx_event_set(irp* req)
         {
             hnd->last_rx = nullptr;
             LIST_REMOVE(e1000_frame_list, &dev->rx_frames, hnd->rx_curr);
-            Free(OBOS_NonPagedPoolAllocator, hnd->rx_curr->buff, hnd->rx_curr->size);
+            OBOS_SharedPtrUnref(hnd->rx_curr->ptr);
             Free(OBOS_NonPagedPoolAllocator, hnd->rx_curr, sizeof(*hnd->rx_curr));
             // hnd->rx_curr = 0;
         }
@@ -134,7 +152,7 @@ static void irp_on_tx_event_set(irp* req)
     if (req->evnt)
         Core_EventClear(req->evnt);
     req->status = OBOS_STATUS_SUCCESS;
-    req->evnt = e1000_tx_packet(hnd->dev, req->cbuff,req->blkCount, req->dryOp, &req->status);
+    req->evnt = e1000_tx_packet(hnd->dev, req->cbuff,req->blkCount, req->nic_data, req->dryOp, &req->status);
     req->on_event_set = nullptr;
     if (obos_is_success(req->status))
         req->status = req->evnt ? OBOS_STATUS_IRP_RETRY : OBOS_STATUS_SUCCESS;
@@ -164,7 +182,7 @@ obos_status submit_irp(void* request)
     else
     {
         req->status = OBOS_STATUS_SUCCESS;
-        req->evnt = e1000_tx_packet(hnd->dev, req->cbuff, req->blkCount, req->dryOp, &req->status);
+        req->evnt = e1000_tx_packet(hnd->dev, req->cbuff, req->blkCount, req->nic_data, req->dryOp, &req->status);
         req->on_event_set = irp_on_tx_event_set;
         if (obos_is_success(req->status))
             req->nBlkWritten = req->blkCount;
@@ -270,10 +288,7 @@ static void* map_registers(uintptr_t phys, size_t size, bool uc, bool mmio, bool
         page_info page = {.virt=offset+(uintptr_t)virt};
         MmS_QueryPageInfo(Mm_KernelContext.pt, page.virt, &page, nullptr);
         do {
-            struct page what = {.phys=page.phys};
-            Core_MutexAcquire(&Mm_PhysicalPagesLock);
-            struct page* pg = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what);
-            Core_MutexRelease(&Mm_PhysicalPagesLock);
+            struct page* pg = MmH_LookupPage(page.phys);
             MmH_DerefPage(pg);
         } while(0);
         page.prot.uc = uc;
@@ -498,6 +513,7 @@ driver_init_status OBOS_DriverEntry(driver_id* this)
     {
         Devices[i].interface_name = DrvH_MakePCIDeviceName(Devices[i].osdep.pci->location, ETHERNET_DEVICE_PREFIX);
         Devices[i].vn = Drv_AllocateVNode(this, (dev_desc)&Devices[i], 0, nullptr, VNODE_TYPE_CHR);
+        Devices[i].poll.nic = Devices[i].vn;
         Devices[i].vn->flags |= VFLAGS_NIC_NO_FCS;
         Devices[i].vn->flags |= VFLAGS_NIC_PACKET_INJECT;
         Drv_RegisterVNode(Devices[i].vn, Devices[i].interface_name);
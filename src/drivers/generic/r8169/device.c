@@ -26,11 +26,16 @@
 #include <allocators/base.h>
 
 #include <utils/list.h>
+#include <utils/shared_ptr.h>
 
 #include <power/shutdown.h>
 
 #include <locks/spinlock.h>
 
+#include <net/eth.h>
+#include <net/tables.h>
+#include <net/rx_pool.h>
+
 #include "structs.h"
 
 static void write_reg64(r8169_device* dev, uint8_t off, uint64_t val)
@@ -48,6 +53,8 @@ static void write_or_register(r8169_device* dev, uint8_t off, uint32_t mask, uin
 }
 
 static void dpc_handler(dpc* obj, void* userdata);
+static size_t rx_poll(net_poll* np, size_t budget);
+static void rx_enable_irqs(net_poll* np);
 static void* map_registers(uintptr_t phys, size_t size, bool uc, bool mmio, bool ref_twice);
 
 bool r8169_irq_checker(struct irq* i, void* userdata)
@@ -72,20 +79,58 @@ void r8169_irq_handler(struct irq* i, interrupt_frame* frame, void* userdata, ir
     DrvS_WriteIOSpaceBar(dev->bar->bar, IntrStatus, isr, 2);
     DrvS_ReadIOSpaceBar(dev->bar->bar, IntrStatus, &isr, 2);
 
-    CoreH_InitializeDPC(&dev->dpc, dpc_handler, Core_DefaultThreadAffinity);
+    if (dev->isr & RX_IRQS)
+    {
+        // Receive by polling until the RX set is drained.
+        r8169_set_irq_mask(dev, ENABLED_IRQS & ~RX_IRQS);
+        NetH_SchedulePoll(&dev->poll);
+    }
+    if (dev->isr & ~RX_IRQS)
+        CoreH_InitializeDPC(&dev->dpc, dpc_handler, Core_DefaultThreadAffinity);
 }
 
-void r8169_rx(r8169_device* dev)
+static void deliver_frame(r8169_device* dev, shared_ptr* buf)
+{
+    vnode* const nic = dev->vn;
+    // The vnode might not exist yet.
+    const bool has_stack = nic && nic->net_tables;
+    OBOS_SharedPtrRef(buf);
+    // Every handle except the network stack's reads frames from the RX buffer.
+    size_t readers = dev->refcount;
+    if (has_stack && readers)
+        readers--;
+    if (readers)
+    {
+        r8169_frame frame = {};
+        frame.ptr = OBOS_SharedPtrCopy(buf);
+        frame.buf = buf->obj;
+        frame.sz = buf->szObj;
+        frame.purpose = FRAME_PURPOSE_RX;
+        frame.refcount = readers;
+        frame.idx = dev->rx_count;
+        irql oldIrql = Core_SpinlockAcquire(&dev->rx_buffer_lock);
+        r8169_buffer_add_frame(&dev->rx_buffer, &frame);
+        Core_SpinlockRelease(&dev->rx_buffer_lock, oldIrql);
+        Core_EventPulse(&dev->rx_buffer.envt, false);
+    }
+    if (has_stack)
+        NetH_PollQueueFrame(&dev->poll, buf);
+    OBOS_SharedPtrUnref(buf);
+}
+
+size_t r8169_rx(r8169_device* dev, size_t budget)
 {
     OBOS_ENSURE(~dev->isr & RxOverflow);
     OBOS_ENSURE(~dev->isr & TxErr);
-    irql oldIrql = Core_SpinlockAcquire(&dev->rx_buffer_lock);
-    for (size_t i = 0; i < DESCS_IN_SET; i++)
+    size_t nFrames = 0;
+    for (; nFrames < budget; dev->rx_idx = (dev->rx_idx + 1) % DESCS_IN_SET)
     {
+        const size_t i = dev->rx_idx;
         r8169_descriptor* desc = &dev->sets[Rx_Set][i];
         if (desc->command & NIC_OWN)
-            continue;
+            break;
 
+        nFrames++;
         dev->rx_count++;
 
         if (desc->command & RES_ERR)
@@ -109,22 +154,33 @@ void r8169_rx(r8169_device* dev)
 
         size_t packet_len = desc->command & PACKET_LEN_MASK;
 
-        r8169_frame frame = {};
-        void* buff = map_registers(desc->buf, packet_len, false, true, false);
-        r8169_frame_generate(dev, &frame, buff, packet_len, FRAME_PURPOSE_RX /* We're receiving a packet */);
-        r8169_buffer_add_frame(&dev->rx_buffer, &frame);
-        // if (memcmp(buff, "OBOS_Shutdown", 13))
-        //     OBOS_Shutdown();
-        Mm_VirtualMemoryFree(&Mm_KernelContext, buff, packet_len);
-        buff = nullptr;
-
+        // Hand the buffer itself to the network stack, and put a free one in the set.
+        shared_ptr* buf = NetH_RxPoolTakeFrame(&dev->rx_pool, &dev->rx_buffers[i], packet_len);
+        desc->buf = dev->rx_buffers[i]->phys;
+        if (!buf)
+        {
+            dev->rx_dropped++;
+            goto done;
+        }
         dev->rx_bytes += packet_len;
-        Core_EventPulse(&dev->rx_buffer.envt, false);
+        r8169_release_desc(dev, desc, Rx_Set);
+        deliver_frame(dev, buf);
+        continue;
 
         done:
         r8169_release_desc(dev, desc, Rx_Set);
     }
-    Core_SpinlockRelease(&dev->rx_buffer_lock, oldIrql);
+    return nFrames;
+}
+
+static size_t rx_poll(net_poll* np, size_t budget)
+{
+    return r8169_rx(np->userdata, budget);
+}
+
+static void rx_enable_irqs(net_poll* np)
+{
+    r8169_set_irq_mask(np->userdata, ENABLED_IRQS);
 }
 
 static void tx_set(r8169_device* dev, uint8_t set)
@@ -147,10 +203,7 @@ static void tx_set(r8169_device* dev, uint8_t set)
             sz += (OBOS_PAGE_SIZE-(sz%OBOS_PAGE_SIZE));
         for (uintptr_t phys = desc->buf; phys < (desc->buf + sz); phys += OBOS_PAGE_SIZE)
         {
-            page what = {.phys=phys};
-            Core_MutexAcquire(&Mm_PhysicalPagesLock);
-            page* pg = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what);
-            Core_MutexRelease(&Mm_PhysicalPagesLock);
+            page* pg = MmH_LookupPage(phys);
             MmH_DerefPage(pg);
         }
         // Mm_FreePhysicalPages(desc->buf, TX_PACKET_SIZE*128);
@@ -185,7 +238,6 @@ static void dpc_handler(dpc* obj, void* userdata)
     OBOS_UNUSED(obj);
     
     r8169_device* dev = userdata;
-    r8169_rx(dev);
     r8169_tx(dev);
 }
 
@@ -302,6 +354,7 @@ void r8169_reset(r8169_device* dev)
         dev->irq_res->irq->irq->handlerUserdata = dev;
 
         dev->dpc.userdata = dev;
+        OBOS_ENSURE(obos_is_success(NetH_InitializePoll(&dev->poll, rx_poll, rx_enable_irqs, dev)));
 
         dev->rx_buffer.envt = EVENT_INITIALIZE(EVENT_NOTIFICATION);
         dev->rx_buffer_lock = Core_SpinlockCreate();
@@ -322,6 +375,9 @@ void r8169_reset(r8169_device* dev)
 
     r8169_init_rxcfg(dev);
 
+    // The NIC starts at the beginning of the RX set after a reset.
+    dev->rx_idx = 0;
+
     DrvS_WriteIOSpaceBar(dev->bar->bar, IntrStatus, 0xffffffff, 2);
     DrvS_WriteIOSpaceBar(dev->bar->bar, IntrMask, 0x0, 2);
 
@@ -372,10 +428,7 @@ static void* map_registers(uintptr_t phys, size_t size, bool uc, bool mmio, bool
         page_info page = {.virt=offset+(uintptr_t)virt};
         MmS_QueryPageInfo(Mm_KernelContext.pt, page.virt, &page, nullptr);
         do {
-            struct page what = {.phys=page.phys};
-            Core_MutexAcquire(&Mm_PhysicalPagesLock);
-            struct page* pg = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what);
-            Core_MutexRelease(&Mm_PhysicalPagesLock);
+            struct page* pg = MmH_LookupPage(page.phys);
             MmH_DerefPage(pg);
         } while(0);
         page.prot.uc = uc;
@@ -427,18 +480,20 @@ void r8169_alloc_set(r8169_device* dev, uint8_t set)
 
     phys = 0;
 
+    if (set == Rx_Set)
+    {
+        OBOS_ENSURE(obos_is_success(NetH_InitializeRxPool(&dev->rx_pool, DESCS_IN_SET + RX_POOL_SPARES, RX_PACKET_SIZE)));
+        dev->rx_buffers = ZeroAllocate(OBOS_NonPagedPoolAllocator, DESCS_IN_SET, sizeof(net_rx_buffer*), nullptr);
+    }
+
     for (size_t i = 0; i < DESCS_IN_SET && (set == Rx_Set); i++)
     {
         dev->sets[set][i].vlan = 0; // we don't use this, so we zero it.
         dev->sets[set][i].command = (RX_PACKET_SIZE & PACKET_LEN_MASK) & ~0x7;
 
-        nPages = RX_PACKET_SIZE;
-        if (nPages % OBOS_PAGE_SIZE)
-            nPages += (OBOS_PAGE_SIZE-(nPages%OBOS_PAGE_SIZE));
-        nPages /= OBOS_PAGE_SIZE;
-
-        phys = Mm_AllocatePhysicalPages(nPages, 1, nullptr);
-        dev->sets[set][i].buf = phys;
+        dev->rx_buffers[i] = NetH_RxPoolGet(&dev->rx_pool);
+        OBOS_ENSURE(dev->rx_buffers[i]);
+        dev->sets[set][i].buf = dev->rx_buffers[i]->phys;
 
         r8169_release_desc(dev, &dev->sets[set][i], set);
     }
@@ -490,12 +545,22 @@ obos_status r8169_tx_queue_flush(r8169_device* dev, bool wait)
         desc->command = (desc->command & EOR) | (tx_frame->sz & TX_PACKET_LEN_MASK);
         desc->command |= FS;
         desc->command |= LS;
-        if (dev->ip_checksum_offload)
-            desc->command |= IPCS;
-        if (dev->udp_checksum_offload)
-            desc->command |= UDPCS;
-        if (dev->tcp_checksum_offload)
-            desc->command |= TCPCS;
+        if (tx_frame->offload & NET_OFFLOAD_TCP_TSO && dev->tso_offload)
+        {
+            // The NIC computes the checksums of each segment itself.
+            desc->command |= LGSEND;
+            desc->command |= (uint32_t)(tx_frame->mss & TX_MSS_MASK) << TX_MSS_SHIFT;
+        }
+        else
+        {
+            // The IPv4 checksum must be computed for the NIC to compute the TCP or UDP checksum.
+            if (tx_frame->offload & (NET_OFFLOAD_IPv4_CHECKSUM|NET_OFFLOAD_UDP_CHECKSUM|NET_OFFLOAD_TCP_CHECKSUM) && dev->ip_checksum_offload)
+                desc->command |= IPCS;
+            if (tx_frame->offload & NET_OFFLOAD_UDP_CHECKSUM && dev->udp_checksum_offload)
+                desc->command |= UDPCS;
+            if (tx_frame->offload & NET_OFFLOAD_TCP_CHECKSUM && dev->tcp_checksum_offload)
+                desc->command |= TCPCS;
+        }
         desc->command |= NIC_OWN;
         if (tx_frame->tx_priority_high)
         {
@@ -540,17 +605,6 @@ obos_status r8169_frame_generate(r8169_device* dev, r8169_frame* frame, const vo
     switch (purpose)
     {
         case FRAME_PURPOSE_GENERAL: break;
-        case FRAME_PURPOSE_RX:
-        {
-            if (obos_expect(sz > RX_PACKET_SIZE, false))
-            {
-                dev->rx_dropped++;
-                return OBOS_STATUS_INVALID_ARGUMENT;
-            }
-            frame->refcount = dev->refcount;
-            frame->idx = dev->rx_count;
-            break;
-        }
         case FRAME_PURPOSE_TX:
         {
             if (obos_expect(sz > (TX_PACKET_SIZE*128), false))
@@ -562,13 +616,12 @@ obos_status r8169_frame_generate(r8169_device* dev, r8169_frame* frame, const vo
             frame->idx = dev->tx_count;
             break;
         }
+        // Received frames reference the RX buffer directly, see r8169_rx.
+        case FRAME_PURPOSE_RX:
         default:
             return OBOS_STATUS_INVALID_ARGUMENT;
     }
-    if (purpose == FRAME_PURPOSE_RX)
-        frame->buf = OBOS_KernelAllocator->Allocate(OBOS_KernelAllocator, sz, nullptr);
-    else
-        frame->buf = map_registers(Mm_AllocatePhysicalPages(((TX_PACKET_SIZE*128) + (OBOS_PAGE_SIZE-((TX_PACKET_SIZE*128)%OBOS_PAGE_SIZE))) / OBOS_PAGE_SIZE, 1, nullptr), ((TX_PACKET_SIZE*128) + (OBOS_PAGE_SIZE-((TX_PACKET_SIZE*128)%OBOS_PAGE_SIZE))), false, true, true);
+    frame->buf = map_registers(Mm_AllocatePhysicalPages(((TX_PACKET_SIZE*128) + (OBOS_PAGE_SIZE-((TX_PACKET_SIZE*128)%OBOS_PAGE_SIZE))) / OBOS_PAGE_SIZE, 1, nullptr), ((TX_PACKET_SIZE*128) + (OBOS_PAGE_SIZE-((TX_PACKET_SIZE*128)%OBOS_PAGE_SIZE))), false, true, true);
     memcpy(frame->buf, data, sz);
     frame->sz = sz;
     frame->purpose = purpose;
@@ -592,7 +645,7 @@ obos_status r8169_buffer_remove_frame(r8169_buffer* buff, r8169_frame* frame)
     {
         LIST_REMOVE(r8169_frame_list, &buff->frames, frame);
         if (frame->purpose == FRAME_PURPOSE_RX)
-            OBOS_KernelAllocator->Free(OBOS_KernelAllocator, frame->buf, frame->sz);
+            OBOS_SharedPtrUnref(frame->ptr);
         OBOS_NonPagedPoolAllocator->Free(OBOS_NonPagedPoolAllocator, frame, sizeof(*frame));
     }
     return OBOS_STATUS_SUCCESS;
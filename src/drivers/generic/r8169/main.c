@@ -230,6 +230,12 @@ obos_status ioctl_argp_size(uint32_t request, size_t *ret)
         case IOCTL_IFACE_MAC_REQUEST:
             *ret = sizeof(mac_address);
             return OBOS_STATUS_SUCCESS;
+        case IOCTL_IFACE_GET_POLL_STATS:
+            *ret = sizeof(net_poll_stats);
+            return OBOS_STATUS_SUCCESS;
+        case IOCTL_IFACE_GET_OFFLOAD_CAPS:
+            *ret = sizeof(net_offload_caps);
+            return OBOS_STATUS_SUCCESS;
         default:
             return Net_InterfaceIoctlArgpSize(request, ret);
     }
@@ -255,6 +261,27 @@ obos_status ioctl(dev_desc what, uint32_t request, void* argp)
             memcpy(argp, dev->mac, sizeof(mac_address));
             return OBOS_STATUS_SUCCESS;
         }
+        case IOCTL_IFACE_GET_POLL_STATS:
+            memcpy(argp, &dev->poll.stats, sizeof(net_poll_stats));
+            return OBOS_STATUS_SUCCESS;
+        case IOCTL_IFACE_GET_OFFLOAD_CAPS:
+        {
+            net_offload_caps* caps = argp;
+            memzero(caps, sizeof(*caps));
+            if (dev->ip_checksum_offload)
+                caps->flags |= NET_OFFLOAD_IPv4_CHECKSUM;
+            if (dev->ip_checksum_offload && dev->udp_checksum_offload)
+                caps->flags |= NET_OFFLOAD_UDP_CHECKSUM;
+            if (dev->ip_checksum_offload && dev->tcp_checksum_offload)
+                caps->flags |= NET_OFFLOAD_TCP_CHECKSUM;
+            if (dev->tso_offload)
+            {
+                caps->flags |= NET_OFFLOAD_TCP_TSO;
+                // Large sends must fit in one TX buffer.
+                caps->tso_max_size = (TX_PACKET_SIZE*128) - sizeof(ethernet2_header);
+            }
+            return OBOS_STATUS_SUCCESS;
+        }
         default:
             return Net_InterfaceIoctl(dev->vn, request, argp);
     }
@@ -358,6 +385,11 @@ obos_status submit_irp(void* req_)
         else
         {
             r8169_frame_generate(dev, &frame, req->cbuff, req->blkCount, FRAME_PURPOSE_TX);
+            if (req->nic_data)
+            {
+                frame.offload = req->nic_data->offload;
+                frame.mss = req->nic_data->mss;
+            }
             r8169_buffer_add_frame(&dev->tx_buffer, &frame);
             r8169_tx_queue_flush(dev, true);
         }
@@ -482,6 +514,13 @@ static void search_bus(pci_bus* bus)
 
             Devices[nDevices-1].isr = 0;
 
+            // The TX descriptors can ask the NIC to compute IPv4, TCP and UDP checksums,
+            // and to split large TCP segments.
+            Devices[nDevices-1].ip_checksum_offload = true;
+            Devices[nDevices-1].udp_checksum_offload = true;
+            Devices[nDevices-1].tcp_checksum_offload = true;
+            Devices[nDevices-1].tso_offload = true;
+
             Devices[nDevices-1].suspended = false;
         }
 
@@ -505,10 +544,13 @@ OBOS_PAGEABLE_FUNCTION driver_init_status OBOS_DriverEntry(driver_id* this)
         r8169_reset(Devices+i);
         OBOS_ENSURE(this_driver);
         vnode* vn = Drv_AllocateVNode(this_driver, (uintptr_t)&Devices[i], 0, nullptr, VNODE_TYPE_CHR);
+        // Received frames are given to the network stack from the DPC.
+        vn->flags |= VFLAGS_NIC_PACKET_INJECT;
         const char* dev_name = Devices[i].interface_name;
         OBOS_Debug("%*s: Registering r8169 NIC card at %s%c%s\n", strnlen(this_driver->header.driverName, 64), this_driver->header.driverName, OBOS_DEV_PREFIX, OBOS_DEV_PREFIX[sizeof(OBOS_DEV_PREFIX)-1] == '/' ? 0 : '/', dev_name);
         Drv_RegisterVNode(vn, dev_name);
-        Devices[0].vn = vn;
+        Devices[i].vn = vn;
+        Devices[i].poll.nic = vn;
     }
 
     return (driver_init_status){.status=OBOS_STATUS_SUCCESS};
@@ -18,6 +18,8 @@
 #include <locks/spinlock.h>
 
 #include <net/eth.h>
+#include <net/rx_pool.h>
+#include <net/poll.h>
 
 #include <utils/list.h>
 
@@ -43,11 +45,16 @@ enum {
 };
 
 typedef struct r8169_frame {
+    // For received frames, the buffer that buf points into.
+    shared_ptr* ptr;
     void* buf;
     size_t sz;
     size_t idx;
     uint32_t purpose;
     bool tx_priority_high;
+    // For transmitted frames, the requested offloads (NET_OFFLOAD_*), see nic_irp_data.
+    uint32_t offload;
+    uint16_t mss;
     _Atomic(size_t) refcount;
     LIST_NODE(r8169_frame_list, struct r8169_frame) node;
 } r8169_frame;
@@ -89,10 +96,18 @@ typedef struct r8169_device
     bool ip_checksum_offload : 1;
     bool udp_checksum_offload : 1;
     bool tcp_checksum_offload : 1;
+    bool tso_offload : 1;
 
     r8169_descriptor* sets[3];
     uintptr_t sets_phys[3];
 
+    // The buffers currently in the RX set, indexed like the set.
+    net_rx_buffer** rx_buffers;
+    net_rx_pool rx_pool;
+    // The next descriptor in the RX set that the NIC will fill.
+    size_t rx_idx;
+    net_poll poll;
+
     bool suspended;
 
     _Atomic(size_t) refcount;
@@ -209,6 +224,9 @@ enum {
     IPCS = BIT(18), // tx packet
     UDPCS = BIT(17), // tx packet
     TCPCS = BIT(16), // tx packet
+    // bits 16-26, only with LGSEND
+    TX_MSS_SHIFT = 16,
+    TX_MSS_MASK = 0x7ff,
 };
 
 enum {
@@ -233,6 +251,9 @@ enum {
 // TODO: Should we set this to something that would make this <= OBOS_PAGE_SIZE to facilitate
 // allocation?
 #define DESCS_IN_SET MAX_DESCS_IN_SET
+// The amount of RX buffers to allocate on top of the RX set, so
+// that the set can be refilled while the network stack holds on to frames.
+#define RX_POOL_SPARES 256
 
 #define RxOk BIT(0)
 #define RxErr BIT(1)
@@ -244,7 +265,9 @@ enum {
 #define Cfg9346_Lock 0x00
 #define Cfg9346_Unlock 0xc0
 
-#define ENABLED_IRQS RxOk|RxErr|TxOk|TxErr|LinkStatus|RxOverflow
+#define ENABLED_IRQS (RxOk|RxErr|TxOk|TxErr|LinkStatus|RxOverflow)
+// The interrupts that are masked while the RX set is polled.
+#define RX_IRQS (RxOk|RxErr|RxOverflow)
 
 void r8169_reset(r8169_device* dev);
 void r8169_save_phy(r8169_device* dev);
@@ -256,7 +279,8 @@ void r8169_set_rxcfg_mode(r8169_device *dev);
 void r8169_set_txcfg(r8169_device *dev);
 void r8169_lock_config(r8169_device* dev);
 void r8169_unlock_config(r8169_device* dev);
-void r8169_rx(r8169_device* dev);
+// Receives at most 'budget' frames, returning the amount of frames received.
+size_t r8169_rx(r8169_device* dev, size_t budget);
 void r8169_tx(r8169_device* dev);
 void r8169_set_irq_mask(r8169_device* dev, uint16_t mask);
 
@@ -9,6 +9,8 @@
 #include <int.h>
 #include <error.h>
 
+#include <locks/spinlock.h>
+
 // Defines a struct that defines the base info and interfaces for an allocator.
 
 typedef struct allocator_info
@@ -77,3 +79,115 @@ OBOS_EXPORT obos_status QueryBlockSize(struct allocator_info* This, void* base,
 
 extern OBOS_EXPORT allocator_info* OBOS_KernelAllocator;
 extern OBOS_EXPORT allocator_info* OBOS_NonPagedPoolAllocator;
+
+// Typed object caches.
+// Objects of one type are carved out of page-sized slabs, so they are not rounded up to a power of two,
+// and objects can be kept in a constructed state between uses.
+
+/// <summary>
+/// Constructs or destructs an object in an object cache.<para/>
+/// The constructor is called once when an object's slab is allocated, and the destructor once when the slab is freed,
+/// not on every allocation and free.
+/// </summary>
+/// <param name="obj">The object.</param>
+/// <param name="userdata">The userdata passed when creating the cache.</param>
+typedef void(*object_cache_ctor)(void* obj, void* userdata);
+typedef object_cache_ctor object_cache_dtor;
+
+enum {
+	// Zero each object on allocation, like ZeroAllocate.
+	// Incompatible with constructors.
+	OBJECT_CACHE_ZERO = 0x1,
+};
+
+typedef struct object_cache_stats {
+	size_t nSlabs;
+	size_t nObjectsInUse;
+	size_t nObjectsFree;
+	size_t nAllocations;
+	size_t nFrees;
+	size_t nSlabsReclaimed;
+} object_cache_stats;
+
+typedef struct object_cache_slab_list {
+	struct object_cache_slab *head, *tail;
+	size_t nNodes;
+} object_cache_slab_list;
+
+typedef struct object_cache {
+	const char* name;
+	size_t objectSize;
+	object_cache_ctor ctor;
+	object_cache_dtor dtor;
+	void* userdata;
+	uint32_t flags;
+	// Everything below is initialized on first use.
+	bool initialized;
+	size_t objectsPerSlab;
+	object_cache_slab_list partial;
+	object_cache_slab_list full;
+	object_cache_slab_list empty;
+	object_cache_stats stats;
+	spinlock lock;
+	struct object_cache *next, *prev;
+} object_cache;
+
+/// <summary>
+/// Statically initializes an object cache for objects of type 'type'.
+/// </summary>
+#define OBJECT_CACHE_INITIALIZE(name_, type, ctor_, dtor_, userdata_, flags_) \
+	{ .name=(name_), .objectSize=sizeof(type), .ctor=(ctor_), .dtor=(dtor_), .userdata=(userdata_), .flags=(flags_) }
+
+/// <summary>
+/// Creates an object cache.
+/// </summary>
+/// <param name="name">The name of the cache, used for debugging.</param>
+/// <param name="objectSize">The size of each object. Must be small enough to fit in a page with the slab header.</param>
+/// <param name="ctor">[optional] The object constructor.</param>
+/// <param name="dtor">[optional] The object destructor.</param>
+/// <param name="userdata">The userdata to pass to the constructor and destructor.</param>
+/// <param name="flags">The cache's flags.</param>
+/// <param name="status">[out,optional] The status code of the function.</param>
+/// <returns>The object cache, or nullptr on failure.</returns>
+OBOS_EXPORT object_cache* OBOS_CreateObjectCache(const char* name, size_t objectSize, object_cache_ctor ctor, object_cache_dtor dtor, void* userdata, uint32_t flags, obos_status* status);
+/// <summary>
+/// Frees all objects in an object cache, then the cache itself.<para/>
+/// All objects must have been freed. Only caches made with OBOS_CreateObjectCache can be destroyed.
+/// </summary>
+/// <param name="cache">The object cache.</param>
+/// <returns>The status of the function.</returns>
+OBOS_EXPORT obos_status OBOS_DestroyObjectCache(object_cache* cache);
+/// <summary>
+/// Allocates an object from an object cache.
+/// </summary>
+/// <param name="cache">The object cache.</param>
+/// <param name="status">[out,optional] The status code of the function.</param>
+/// <returns>The object, in its constructed state, or nullptr on failure.</returns>
+OBOS_EXPORT void* OBOS_ObjectCacheAllocate(object_cache* cache, obos_status* status);
+/// <summary>
+/// Returns an object to its object cache.<para/>
+/// If the cache has a constructor, the object must be returned in its constructed state.
+/// </summary>
+/// <param name="cache">The object cache.</param>
+/// <param name="obj">The object.</param>
+/// <returns>The status of the function.</returns>
+OBOS_EXPORT obos_status OBOS_ObjectCacheFree(object_cache* cache, void* obj);
+/// <summary>
+/// Gets the statistics of an object cache.
+/// </summary>
+/// <param name="cache">The object cache.</param>
+/// <param name="stats">[out] The statistics.</param>
+/// <returns>The status of the function.</returns>
+OBOS_EXPORT obos_status OBOS_ObjectCacheGetStats(object_cache* cache, object_cache_stats* stats);
+/// <summary>
+/// Frees the empty slabs of an object cache.
+/// </summary>
+/// <param name="cache">The object cache.</param>
+/// <returns>The amount of pages freed.</returns>
+OBOS_EXPORT size_t OBOS_ObjectCacheReclaim(object_cache* cache);
+/// <summary>
+/// Frees the empty slabs of all object caches.<para/>
+/// Called by the PMM when it runs out of free pages.
+/// </summary>
+/// <returns>The amount of pages freed.</returns>
+OBOS_EXPORT size_t OBOS_ReclaimObjectCaches();
@@ -24,6 +24,12 @@
 
 #include <irq/irql.h>
 
+#include <scheduler/cpu_local.h>
+
+#include <cmdline.h>
+
+#include <stdatomic.h>
+
 #if __x86_64__
 #	include <arch/x86_64/pmm.h>
 #elif defined(__m68k__)
@@ -215,6 +221,217 @@ static OBOS_NO_KASAN int allocate_region(basic_allocator* alloc, cache* c, size_
 	return 1;
 }
 
+// Takes an object off of the free lists of a cache, allocating a new region if needed.
+// c->lock must be held.
+static OBOS_NO_KASAN void* cache_pop(basic_allocator* This, cache* c, size_t cache_index, bool* clean)
+{
+	freelist* list = &c->clean;
+	*clean = true;
+	if (obos_expect(!list->tail, true))
+	{
+		list = &c->free;
+		*clean = false;
+	}
+	if (obos_expect(!list->tail, false))
+	{
+		if (!allocate_region(This, c, cache_index))
+			return nullptr;
+		list = &c->clean;
+		*clean = true;
+	}
+	void* ret = list->tail;
+	remove_node(*list, list->tail);
+	return ret;
+}
+
+/*
+ * Per-CPU magazines.
+ * Each CPU has two magazines (a loaded one and the previous one) per small size class,
+ * which hold up to MAGAZINE_ROUNDS free objects. Allocating and freeing objects only
+ * touches the current CPU's magazines, unless both are empty (or full).
+ * In that case, the CPU exchanges magazines with the cache's depot, which is protected
+ * by the cache's lock, or refills a magazine straight from the free lists.
+ * The per-CPU state is protected by raising the IRQL to IRQL_DISPATCH, so that the
+ * thread cannot be preempted or migrated while touching it. Allocations at a higher
+ * IRQL could have interrupted the CPU's own magazine operation, so they skip the magazines.
+ */
+
+static bool s_magazines_enabled;
+
+void OBOSH_BasicAllocatorEnableMagazines()
+{
+	s_magazines_enabled = !OBOS_GetOPTF("no-allocator-magazines");
+}
+
+// Allocates internal memory straight from the free lists, bypassing the magazines.
+static OBOS_NO_KASAN void* raw_allocate(basic_allocator* This, size_t nBytes)
+{
+	if (nBytes <= 16)
+		nBytes = 16;
+	size_t cache_index = (64-__builtin_clzll(nBytes-1))-4;
+	cache* c = &This->caches[cache_index];
+	bool clean = false;
+	irql oldIrql = lock(c);
+	void* ret = cache_pop(This, c, cache_index, &clean);
+	unlock(c, oldIrql);
+	if (ret)
+		memzero(ret, (size_t)1 << (cache_index+4));
+	return ret;
+}
+static OBOS_NO_KASAN void raw_free(basic_allocator* This, void* blk, size_t nBytes)
+{
+	if (nBytes <= 16)
+		nBytes = 16;
+	size_t cache_index = (64-__builtin_clzll(nBytes-1))-4;
+	cache* c = &This->caches[cache_index];
+	memzero(blk, sizeof(freelist_node));
+	irql oldIrql = lock(c);
+	append_node(c->free, (freelist_node*)blk);
+	unlock(c, oldIrql);
+}
+
+// The IRQL must be IRQL_DISPATCH.
+static OBOS_NO_KASAN cpu_magazines* get_magazines(basic_allocator* This)
+{
+	cpu_local* cpu = CoreS_GetCPULocalPtr();
+	if (!cpu || cpu < Core_CpuInfo || cpu >= (Core_CpuInfo + Core_CpuCount))
+		return nullptr;
+	cpu_magazines* mags = atomic_load_explicit(&This->magazines, memory_order_acquire);
+	if (obos_expect(!mags, false))
+	{
+		cpu_magazines* new_mags = raw_allocate(This, Core_CpuCount*sizeof(cpu_magazines));
+		if (!new_mags)
+			return nullptr;
+		if (!atomic_compare_exchange_strong(&This->magazines, &mags, new_mags))
+			raw_free(This, new_mags, Core_CpuCount*sizeof(cpu_magazines)); // Someone beat us to it.
+		else
+			mags = new_mags;
+	}
+	return &mags[cpu - Core_CpuInfo];
+}
+
+// c->lock must be held.
+static OBOS_NO_KASAN void depot_push(magazine** list, size_t* nMagazines, magazine* mag)
+{
+	mag->next = *list;
+	*list = mag;
+	(*nMagazines)++;
+}
+// c->lock must be held.
+static OBOS_NO_KASAN magazine* depot_pop(magazine** list, size_t* nMagazines)
+{
+	magazine* mag = *list;
+	if (!mag)
+		return nullptr;
+	*list = mag->next;
+	mag->next = nullptr;
+	(*nMagazines)--;
+	return mag;
+}
+static OBOS_NO_KASAN magazine* magazine_new(basic_allocator* This)
+{
+	return raw_allocate(This, sizeof(magazine));
+}
+
+static OBOS_NO_KASAN void* magazine_alloc(basic_allocator* This, size_t cache_index)
+{
+	if (!s_magazines_enabled || Core_GetIrql() > IRQL_DISPATCH)
+		return nullptr;
+	irql oldIrql = IRQL_INVALID;
+	if (Core_GetIrql() < IRQL_DISPATCH)
+		oldIrql = Core_RaiseIrqlNoThread(IRQL_DISPATCH);
+	void* ret = nullptr;
+	cpu_magazines* mags = get_magazines(This);
+	if (!mags)
+		goto done;
+	magazine** loaded = &mags->caches[cache_index].loaded;
+	magazine** previous = &mags->caches[cache_index].previous;
+	if (obos_expect(*loaded && (*loaded)->nRounds, true))
+		goto pop;
+	if (*previous && (*previous)->nRounds)
+	{
+		magazine* tmp = *loaded;
+		*loaded = *previous;
+		*previous = tmp;
+		goto pop;
+	}
+	// Both magazines are empty, try to get a full one from the depot.
+	cache* c = &This->caches[cache_index];
+	irql oldIrql2 = lock(c);
+	if (c->full)
+	{
+		if (*previous)
+			depot_push(&c->empty, &c->nEmpty, *previous);
+		*previous = *loaded;
+		*loaded = depot_pop(&c->full, &c->nFull);
+		unlock(c, oldIrql2);
+		goto pop;
+	}
+	if (!*loaded)
+		*loaded = depot_pop(&c->empty, &c->nEmpty);
+	unlock(c, oldIrql2);
+	if (!*loaded && !(*loaded = magazine_new(This)))
+		goto done;
+	// Refill half of the magazine straight from the free lists.
+	oldIrql2 = lock(c);
+	while ((*loaded)->nRounds < (MAGAZINE_ROUNDS/2+1))
+	{
+		bool clean = false;
+		void* obj = cache_pop(This, c, cache_index, &clean);
+		if (!obj)
+			break;
+		(*loaded)->rounds[(*loaded)->nRounds++] = obj;
+	}
+	unlock(c, oldIrql2);
+	if (!(*loaded)->nRounds)
+		goto done;
+	pop:
+	ret = (*loaded)->rounds[--(*loaded)->nRounds];
+	done:
+	Core_LowerIrqlNoThread(oldIrql);
+	return ret;
+}
+
+static OBOS_NO_KASAN bool magazine_free(basic_allocator* This, size_t cache_index, void* blk)
+{
+	if (!s_magazines_enabled || Core_GetIrql() > IRQL_DISPATCH)
+		return false;
+	irql oldIrql = IRQL_INVALID;
+	if (Core_GetIrql() < IRQL_DISPATCH)
+		oldIrql = Core_RaiseIrqlNoThread(IRQL_DISPATCH);
+	bool ret = false;
+	cpu_magazines* mags = get_magazines(This);
+	if (!mags)
+		goto done;
+	magazine** loaded = &mags->caches[cache_index].loaded;
+	magazine** previous = &mags->caches[cache_index].previous;
+	if (obos_expect(*loaded && (*loaded)->nRounds < MAGAZINE_ROUNDS, true))
+		goto push;
+	if (*previous && (*previous)->nRounds < MAGAZINE_ROUNDS)
+	{
+		magazine* tmp = *loaded;
+		*loaded = *previous;
+		*previous = tmp;
+		goto push;
+	}
+	// Both magazines are full, give one to the depot in exchange for an empty one.
+	cache* c = &This->caches[cache_index];
+	irql oldIrql2 = lock(c);
+	if (*previous)
+		depot_push(&c->full, &c->nFull, *previous);
+	*previous = *loaded;
+	*loaded = depot_pop(&c->empty, &c->nEmpty);
+	unlock(c, oldIrql2);
+	if (!*loaded && !(*loaded = magazine_new(This)))
+		goto done;
+	push:
+	(*loaded)->rounds[(*loaded)->nRounds++] = blk;
+	ret = true;
+	done:
+	Core_LowerIrqlNoThread(oldIrql);
+	return ret;
+}
+
 // OBOS_NO_UBSAN OBOS_NO_KASAN void* Allocate(allocator_info* This_, size_t nBytes, obos_status* status)
 // {
 // 	void* blk = _Allocate(This_, nBytes, status, false);
@@ -254,38 +471,26 @@ static OBOS_NO_UBSAN OBOS_NO_KASAN void* DoAllocation(allocator_info* This_, siz
 	size_t cache_index = __builtin_ctzll(nBytes)-4;
 	cache* c = &This->caches[cache_index];
 
-	irql oldIrql = lock((cache*)c);
-
-	const bool izero_out = zero_out;
-	freelist* list = &c->clean;
-	void* ret = c->clean.tail;
-	zero_out = false;
-
-	if (obos_expect(!ret, true))
-	{
-		ret = c->free.tail;
-		list = &c->free;
-		zero_out = izero_out;
-	}
+	void* ret = nullptr;
+	if (cache_index < MAGAZINE_CACHES)
+		ret = magazine_alloc(This, cache_index);
 
 	if (obos_expect(!ret, false))
 	{
-		if (!allocate_region(This, (cache*)c, cache_index))
+		bool clean = false;
+		irql oldIrql = lock(c);
+		ret = cache_pop(This, c, cache_index, &clean);
+		unlock(c, oldIrql);
+		if (obos_expect(!ret, false))
 		{
-			unlock((cache*)c, oldIrql);
 			if (status) *status = OBOS_STATUS_NOT_ENOUGH_MEMORY;
 			return NULL; // OOM
 		}
-
-		ret = c->clean.tail;
-		list = &c->clean;
-		zero_out = false;
+		// Objects from the clean list are already zeroed.
+		if (clean)
+			zero_out = false;
 	}
 
-	remove_node(*list, list->tail);
-
-	unlock((cache*)c, oldIrql);
-
 #if OBOS_KASAN_ENABLED
 	nBytes -= 32;
 	unrounded_nBytes -= 32;
@@ -439,13 +644,17 @@ OBOS_NO_KASAN OBOS_NO_UBSAN obos_status Free(allocator_info* This_, void* blk, s
 	// 	return OBOS_STATUS_SUCCESS;
 	// }
 	
-	irql oldIrql = lock(c);
-	append_node(c->free, (freelist_node*)blk);
 #if OBOS_KASAN_ENABLED
 	memset(((freelist_node*)blk)+1, OBOS_ASANPoisonValues[ASAN_POISON_FREED], nBytes-sizeof(freelist_node));
 #elif OBOS_DEBUG
 	memset(((freelist_node*)blk)+1, 0xde, nBytes-sizeof(freelist_node));
 #endif
+
+	if (cache_index < MAGAZINE_CACHES && magazine_free(alloc, cache_index, blk))
+		return OBOS_STATUS_SUCCESS;
+
+	irql oldIrql = lock(c);
+	append_node(c->free, (freelist_node*)blk);
 	unlock(c, oldIrql);
 
 	return OBOS_STATUS_SUCCESS;
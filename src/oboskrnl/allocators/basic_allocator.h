@@ -43,9 +43,33 @@ enum {
 	REGION_MAGIC = 0xb49ad907c56c8
 };
 
+// The amount of objects a magazine can hold.
+#define MAGAZINE_ROUNDS 15
+// Only size classes up to (and including) 2048 bytes are cached per-CPU.
+#define MAGAZINE_CACHES 8
+
+typedef struct magazine {
+	struct magazine* next;
+	size_t nRounds;
+	void* rounds[MAGAZINE_ROUNDS];
+} magazine;
+
+// The magazines of one CPU.
+typedef struct cpu_magazines {
+	struct {
+		magazine* loaded;
+		magazine* previous;
+	} caches[MAGAZINE_CACHES];
+} cpu_magazines;
+
 typedef struct cache {
 	freelist free;
 	freelist clean;
+	// The depot, protected by lock.
+	magazine* full;
+	magazine* empty;
+	size_t nFull;
+	size_t nEmpty;
 	spinlock lock;
 } cache;
 
@@ -54,6 +78,13 @@ typedef struct basic_allocator
 	allocator_info header;
 	cache caches[28];
 	enum blockSource blkSource;
+	// Indexed by (cpu - Core_CpuInfo), nullptr until it is first needed.
+	_Atomic(cpu_magazines*) magazines;
 } basic_allocator;
 
 OBOS_EXPORT obos_status OBOSH_ConstructBasicAllocator(basic_allocator* This);
+/// <summary>
+/// Allows basic allocators to cache objects per-CPU.<para/>
+/// Must be called after Core_CpuInfo has been set up for all CPUs.
+/// </summary>
+void OBOSH_BasicAllocatorEnableMagazines();
@@ -0,0 +1,325 @@
+/*
+ * oboskrnl/allocators/slab.c
+ *
+ * Copyright (c) 2026 Omar Berrow
+ */
+
+#include <int.h>
+#include <klog.h>
+#include <memmanip.h>
+#include <error.h>
+
+#include <allocators/base.h>
+
+#include <mm/pmm.h>
+
+#include <locks/spinlock.h>
+
+#include <irq/irql.h>
+
+#if __x86_64__
+#	include <arch/x86_64/pmm.h>
+#elif defined(__m68k__)
+#	include <arch/m68k/pmm.h>
+#endif
+
+/*
+ * Each slab is one physical page, accessed through the HHDM.
+ * The slab header is at the start of the page, and the objects follow it,
+ * so the slab of an object can be found by rounding the object down to a page.
+ * Free objects are linked through their first word, or through a word after
+ * the object if the cache has a constructor, so that the object stays constructed.
+ */
+
+#define OBJECT_ALIGNMENT 0x10
+
+typedef struct object_cache_slab {
+	struct object_cache_slab *next, *prev;
+	object_cache* cache;
+	void* free;
+	size_t nInUse;
+} object_cache_slab;
+
+#define SLAB_HEADER_SIZE ((sizeof(object_cache_slab) + (OBJECT_ALIGNMENT-1)) & ~(OBJECT_ALIGNMENT-1))
+#define slab_of(obj) ((object_cache_slab*)((uintptr_t)(obj) & ~(uintptr_t)(OBOS_PAGE_SIZE-1)))
+
+static struct {
+	object_cache *head, *tail;
+	size_t nNodes;
+	spinlock lock;
+} s_caches;
+
+static void slab_list_append(object_cache_slab_list* list, object_cache_slab* slab)
+{
+	slab->next = nullptr;
+	slab->prev = list->tail;
+	if (list->tail)
+		list->tail->next = slab;
+	if (!list->head)
+		list->head = slab;
+	list->tail = slab;
+	list->nNodes++;
+}
+static void slab_list_remove(object_cache_slab_list* list, object_cache_slab* slab)
+{
+	if (slab->next)
+		slab->next->prev = slab->prev;
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	if (list->head == slab)
+		list->head = slab->next;
+	if (list->tail == slab)
+		list->tail = slab->prev;
+	slab->next = slab->prev = nullptr;
+	list->nNodes--;
+}
+
+static size_t link_offset(const object_cache* cache)
+{
+	if (!cache->ctor)
+		return 0;
+	return (cache->objectSize + (sizeof(void*)-1)) & ~(sizeof(void*)-1);
+}
+#define free_link(cache, obj) (*(void**)((uintptr_t)(obj) + link_offset(cache)))
+static size_t object_stride(const object_cache* cache)
+{
+	size_t sz = cache->objectSize;
+	if (cache->ctor)
+		sz = link_offset(cache) + sizeof(void*);
+	if (sz < sizeof(void*))
+		sz = sizeof(void*);
+	return (sz + (OBJECT_ALIGNMENT-1)) & ~(OBJECT_ALIGNMENT-1);
+}
+
+// Lock order: s_caches.lock, then cache->lock, then the PMM's lock.
+static void register_cache(object_cache* cache)
+{
+	irql oldIrql = Core_SpinlockAcquire(&s_caches.lock);
+	if (cache->initialized)
+	{
+		// Someone beat us to it.
+		Core_SpinlockRelease(&s_caches.lock, oldIrql);
+		return;
+	}
+	cache->objectsPerSlab = (OBOS_PAGE_SIZE - SLAB_HEADER_SIZE) / object_stride(cache);
+	cache->next = nullptr;
+	cache->prev = s_caches.tail;
+	if (s_caches.tail)
+		s_caches.tail->next = cache;
+	if (!s_caches.head)
+		s_caches.head = cache;
+	s_caches.tail = cache;
+	s_caches.nNodes++;
+	cache->initialized = true;
+	Core_SpinlockRelease(&s_caches.lock, oldIrql);
+}
+
+// Must be called without cache->lock held, as the PMM might reclaim object caches.
+static object_cache_slab* allocate_slab(object_cache* cache)
+{
+	uintptr_t phys = Mm_AllocatePhysicalPages(1, 1, nullptr);
+	if (!phys)
+		return nullptr;
+	object_cache_slab* slab = Arch_MapToHHDM(phys);
+	memzero(slab, SLAB_HEADER_SIZE);
+	slab->cache = cache;
+	const size_t stride = object_stride(cache);
+	uintptr_t objects = (uintptr_t)slab + SLAB_HEADER_SIZE;
+	// Link the objects so that the first object is allocated first.
+	for (size_t i = cache->objectsPerSlab; i > 0; i--)
+	{
+		void* obj = (void*)(objects + (i-1)*stride);
+		if (cache->ctor)
+			cache->ctor(obj, cache->userdata);
+		free_link(cache, obj) = slab->free;
+		slab->free = obj;
+	}
+	return slab;
+}
+static void free_slab(object_cache* cache, object_cache_slab* slab)
+{
+	OBOS_ASSERT(!slab->nInUse);
+	if (cache->dtor)
+	{
+		const size_t stride = object_stride(cache);
+		uintptr_t objects = (uintptr_t)slab + SLAB_HEADER_SIZE;
+		for (size_t i = 0; i < cache->objectsPerSlab; i++)
+			cache->dtor((void*)(objects + i*stride), cache->userdata);
+	}
+	Mm_FreePhysicalPages(Arch_UnmapFromHHDM(slab), 1);
+}
+
+object_cache* OBOS_CreateObjectCache(const char* name, size_t objectSize, object_cache_ctor ctor, object_cache_dtor dtor, void* userdata, uint32_t flags, obos_status* status)
+{
+	if (!objectSize || (objectSize + sizeof(void*) + SLAB_HEADER_SIZE) > OBOS_PAGE_SIZE || (ctor && (flags & OBJECT_CACHE_ZERO)))
+	{
+		if (status) *status = OBOS_STATUS_INVALID_ARGUMENT;
+		return nullptr;
+	}
+	object_cache* cache = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(object_cache), status);
+	if (!cache)
+		return nullptr;
+	*cache = (object_cache){ .name=name, .objectSize=objectSize, .ctor=ctor, .dtor=dtor, .userdata=userdata, .flags=flags };
+	register_cache(cache);
+	if (status) *status = OBOS_STATUS_SUCCESS;
+	return cache;
+}
+
+obos_status OBOS_DestroyObjectCache(object_cache* cache)
+{
+	if (!cache)
+		return OBOS_STATUS_INVALID_ARGUMENT;
+	if (cache->partial.nNodes || cache->full.nNodes)
+		return OBOS_STATUS_IN_USE;
+	if (cache->initialized)
+	{
+		irql oldIrql = Core_SpinlockAcquire(&s_caches.lock);
+		if (cache->next)
+			cache->next->prev = cache->prev;
+		if (cache->prev)
+			cache->prev->next = cache->next;
+		if (s_caches.head == cache)
+			s_caches.head = cache->next;
+		if (s_caches.tail == cache)
+			s_caches.tail = cache->prev;
+		s_caches.nNodes--;
+		Core_SpinlockRelease(&s_caches.lock, oldIrql);
+	}
+	OBOS_ObjectCacheReclaim(cache);
+	return Free(OBOS_KernelAllocator, cache, sizeof(*cache));
+}
+
+void* OBOS_ObjectCacheAllocate(object_cache* cache, obos_status* status)
+{
+	if (!cache)
+	{
+		if (status) *status = OBOS_STATUS_INVALID_ARGUMENT;
+		return nullptr;
+	}
+	if (obos_expect(!cache->initialized, false))
+	{
+		if (!cache->objectSize || (cache->objectSize + sizeof(void*) + SLAB_HEADER_SIZE) > OBOS_PAGE_SIZE)
+		{
+			if (status) *status = OBOS_STATUS_INVALID_ARGUMENT;
+			return nullptr;
+		}
+		register_cache(cache);
+	}
+	irql oldIrql = Core_SpinlockAcquire(&cache->lock);
+	object_cache_slab* slab = cache->partial.head;
+	if (!slab && (slab = cache->empty.head))
+	{
+		slab_list_remove(&cache->empty, slab);
+		slab_list_append(&cache->partial, slab);
+	}
+	if (obos_expect(!slab, false))
+	{
+		Core_SpinlockRelease(&cache->lock, oldIrql);
+		slab = allocate_slab(cache);
+		if (!slab)
+		{
+			if (status) *status = OBOS_STATUS_NOT_ENOUGH_MEMORY;
+			return nullptr;
+		}
+		oldIrql = Core_SpinlockAcquire(&cache->lock);
+		slab_list_append(&cache->partial, slab);
+		cache->stats.nSlabs++;
+		cache->stats.nObjectsFree += cache->objectsPerSlab;
+	}
+	void* obj = slab->free;
+	OBOS_ASSERT(obj);
+	slab->free = free_link(cache, obj);
+	if (++slab->nInUse == cache->objectsPerSlab)
+	{
+		slab_list_remove(&cache->partial, slab);
+		slab_list_append(&cache->full, slab);
+	}
+	cache->stats.nObjectsInUse++;
+	cache->stats.nObjectsFree--;
+	cache->stats.nAllocations++;
+	Core_SpinlockRelease(&cache->lock, oldIrql);
+
+	if (cache->flags & OBJECT_CACHE_ZERO)
+		memzero(obj, cache->objectSize);
+	else if (!cache->ctor)
+		*(void**)obj = nullptr;
+	if (status) *status = OBOS_STATUS_SUCCESS;
+	return obj;
+}
+
+obos_status OBOS_ObjectCacheFree(object_cache* cache, void* obj)
+{
+	if (!cache || !obj)
+		return OBOS_STATUS_INVALID_ARGUMENT;
+	object_cache_slab* slab = slab_of(obj);
+	if (slab->cache != cache)
+		OBOS_Panic(OBOS_PANIC_ALLOCATOR_ERROR, "Object %p freed to object cache '%s', but it belongs to '%s'.\n", obj, cache->name, slab->cache ? slab->cache->name : "(null)");
+#if OBOS_DEBUG
+	if (!cache->ctor)
+		memset(obj, 0xde, cache->objectSize);
+#endif
+	irql oldIrql = Core_SpinlockAcquire(&cache->lock);
+	OBOS_ASSERT(slab->nInUse);
+	if (slab->nInUse-- == cache->objectsPerSlab)
+	{
+		slab_list_remove(&cache->full, slab);
+		slab_list_append(&cache->partial, slab);
+	}
+	free_link(cache, obj) = slab->free;
+	slab->free = obj;
+	if (!slab->nInUse)
+	{
+		slab_list_remove(&cache->partial, slab);
+		slab_list_append(&cache->empty, slab);
+	}
+	cache->stats.nObjectsInUse--;
+	cache->stats.nObjectsFree++;
+	cache->stats.nFrees++;
+	Core_SpinlockRelease(&cache->lock, oldIrql);
+	return OBOS_STATUS_SUCCESS;
+}
+
+obos_status OBOS_ObjectCacheGetStats(object_cache* cache, object_cache_stats* stats)
+{
+	if (!cache || !stats)
+		return OBOS_STATUS_INVALID_ARGUMENT;
+	irql oldIrql = Core_SpinlockAcquire(&cache->lock);
+	*stats = cache->stats;
+	Core_SpinlockRelease(&cache->lock, oldIrql);
+	return OBOS_STATUS_SUCCESS;
+}
+
+size_t OBOS_ObjectCacheReclaim(object_cache* cache)
+{
+	if (!cache)
+		return 0;
+	irql oldIrql = Core_SpinlockAcquire(&cache->lock);
+	object_cache_slab* slabs = cache->empty.head;
+	size_t nSlabs = cache->empty.nNodes;
+	cache->empty.head = cache->empty.tail = nullptr;
+	cache->empty.nNodes = 0;
+	cache->stats.nSlabs -= nSlabs;
+	cache->stats.nObjectsFree -= nSlabs*cache->objectsPerSlab;
+	cache->stats.nSlabsReclaimed += nSlabs;
+	Core_SpinlockRelease(&cache->lock, oldIrql);
+	// Free the slabs without the lock, as destructors might need to allocate from this cache.
+	while (slabs)
+	{
+		object_cache_slab* next = slabs->next;
+		free_slab(cache, slabs);
+		slabs = next;
+	}
+	return nSlabs;
+}
+
+size_t OBOS_ReclaimObjectCaches()
+{
+	size_t nPages = 0;
+	irql oldIrql = Core_SpinlockAcquire(&s_caches.lock);
+	for (object_cache* cache = s_caches.head; cache; cache = cache->next)
+		nPages += OBOS_ObjectCacheReclaim(cache);
+	Core_SpinlockRelease(&s_caches.lock, oldIrql);
+	if (nPages)
+		OBOS_Debug("%s: Reclaimed %d pages from object caches.\n", __func__, nPages);
+	return nPages;
+}
@@ -233,7 +233,7 @@ OBOS_NO_UBSAN OBOS_NO_KASAN void Arch_InitializePageTables()
     OBOSH_BasicMMAddRegion(&kernel_region, (void*)(uintptr_t)Arch_KernelAddressRequest.response->virtual_base, kernelSize);
     OBOSH_BasicMMAddRegion(&hhdm_region, (void*)Arch_MapToHHDM(0), Mm_PhysicalMemoryBoundaries);
 }
-OBOS_NO_UBSAN OBOS_NO_KASAN obos_status MmS_QueryPageInfo(page_table pt, uintptr_t addr, page_info* ppage, uintptr_t* phys)
+OBOS_NO_UBSAN OBOS_NO_KASAN static obos_status query_page_info(page_table pt, uintptr_t addr, page_info* ppage, uintptr_t* phys, bool clear_ad)
 {
     if (!pt)
         return OBOS_STATUS_INVALID_ARGUMENT;
@@ -266,7 +266,7 @@ OBOS_NO_UBSAN OBOS_NO_KASAN obos_status MmS_QueryPageInfo(page_table pt, uintptr
     page.dirty = entry & PT_FLAGS_MODIFIED;
     page.prot.user = !(entry & PT_FLAGS_SUPERVISOR);
     page.prot.uc = ((entry >> 5) & 0b11) == (PT_FLAGS_CACHE_DISABLE >> 5);
-    if (page.accessed || page.dirty)
+    if (clear_ad && (page.accessed || page.dirty))
     {
         // Unset the bit(s).
         // NOTE(oberrow): I just realized I forgot to do this on x86-64
@@ -285,9 +285,19 @@ OBOS_NO_UBSAN OBOS_NO_KASAN obos_status MmS_QueryPageInfo(page_table pt, uintptr
         memcpy(&ppage->prot, &page.prot, sizeof(page.prot));
         ppage->phys = MASK_PTE(entry);
         ppage->virt = page.virt;
+        ppage->accessed = page.accessed;
+        ppage->dirty = page.dirty;
     }
     return OBOS_STATUS_SUCCESS;
 }
+obos_status MmS_QueryPageInfo(page_table pt, uintptr_t addr, page_info* ppage, uintptr_t* phys)
+{
+    return query_page_info(pt, addr, ppage, phys, true);
+}
+obos_status MmS_PeekPageInfo(page_table pt, uintptr_t addr, page_info* ppage, uintptr_t* phys)
+{
+    return query_page_info(pt, addr, ppage, phys, false);
+}
 OBOS_NO_UBSAN OBOS_NO_KASAN obos_status MmS_SetPageMapping(page_table pt, const page_info* page, uintptr_t phys, bool free_pte)
 {
     if (!pt || !page)
@@ -42,6 +42,12 @@ typedef struct cpu_local_arch
 	void* ist_stack;
 	void* startup_stack; // Size: 0x4000 bytes, freed after smp initialization.
 	bool initializedSchedulerTimer;
+	// The LAPIC timer count for one scheduler tick.
+	uint32_t lapicTimerCount;
+	// The timer tick at which the LAPIC timer was last programmed (tickless mode only).
+	uint64_t tickArmedAt;
+	// The timer tick at which the LAPIC timer will next fire, or UINT64_MAX if it is stopped (tickless mode only).
+	_Atomic(uint64_t) nextTickDeadline;
 	bool pf_handler_running;
 	gdb_ctx dbg_ctx;
 	dpc dbg_dpc;
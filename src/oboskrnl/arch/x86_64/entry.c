@@ -625,10 +625,7 @@ void OBOSS_KernelPostVMMInit()
                 // Present,Write,XD,Write-Combining (PAT: 0b110)
                 Arch_MapHugePage(Mm_KernelContext.pt, (void*)addr, phys, BIT_TYPE(0, UL)|BIT_TYPE(1, UL)|BIT_TYPE(63, UL)|BIT_TYPE(4, UL)|BIT_TYPE(12, UL), false);
                 offset = info.prot.huge_page ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE;
-                page what = {.phys=oldPhys};
-                Core_MutexAcquire(&Mm_PhysicalPagesLock);
-                page* pg = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what);
-                Core_MutexRelease(&Mm_PhysicalPagesLock);
+                page* pg = MmH_LookupPage(oldPhys);
                 MmH_DerefPage(pg);
             }
         }
@@ -305,6 +305,10 @@ obos_status MmS_TLBShootdown(page_table pt, uintptr_t base, size_t size)
 {
 	if (Core_CpuCount == 1 || !Arch_SMPInitialized)
 	{
+		// User page tables are only loaded while in user mode, and switching to the kernel's page table
+		// on kernel entry already flushed their entries.
+		if (pt != Arch_KernelCR3)
+			return OBOS_STATUS_SUCCESS;
 		for (uintptr_t addr = base; addr < (base + size); addr += OBOS_PAGE_SIZE)
 			invlpg(addr);
 		return OBOS_STATUS_SUCCESS;
@@ -463,7 +467,7 @@ obos_status Arch_InitializeKernelPageTable()
 	Arch_KernelCR3 = newCR3;
 	return OBOS_STATUS_SUCCESS;
 }
-obos_status MmS_QueryPageInfo(page_table pt, uintptr_t addr, page_info* ppage, uintptr_t* phys)
+static obos_status query_page_info(page_table pt, uintptr_t addr, page_info* ppage, uintptr_t* phys, bool clear_ad)
 {
 	if (!pt)
 		return OBOS_STATUS_INVALID_ARGUMENT;
@@ -508,13 +512,13 @@ obos_status MmS_QueryPageInfo(page_table pt, uintptr_t addr, page_info* ppage, u
 	page.prot.executable = !(entry & BIT_TYPE(63, UL));
 	page.prot.is_swap_phys = entry & BIT_TYPE(9, UL);
     // page.prot.uc = (entry & BIT_TYPE(4, UL));
-	if (page.prot.huge_page)
+	if (clear_ad && page.prot.huge_page)
 	{
 		uintptr_t pml3Entry = Arch_MaskPhysicalAddressFromEntry(Arch_GetPML3Entry(pt, addr));
 		pml3Entry = (uintptr_t)MmS_MapVirtFromPhys(pml3Entry);
 		((uintptr_t*)pml3Entry)[AddressToIndex(addr, 1)] &= ~(BIT_TYPE(5, UL) | BIT_TYPE(6, UL));
 	}
-	else 
+	else if (clear_ad)
 	{
 		pml2Entry = Arch_MaskPhysicalAddressFromEntry(pml2Entry);
 		pml2Entry = (uintptr_t)MmS_MapVirtFromPhys(pml2Entry);
@@ -525,11 +529,21 @@ obos_status MmS_QueryPageInfo(page_table pt, uintptr_t addr, page_info* ppage, u
 		ppage->virt = addr;
 		ppage->phys = page.prot.huge_page ? (entry & 0xFFFFFFFE00000) : Arch_MaskPhysicalAddressFromEntry(entry);
 		memcpy(&ppage->prot, &page.prot, sizeof(page.prot));
+		ppage->accessed = page.accessed;
+		ppage->dirty = page.dirty;
 	}
 	if (phys)
 		*phys = page.prot.huge_page ? (entry & 0xFFFFFFFE00000) : Arch_MaskPhysicalAddressFromEntry(entry);
 	return OBOS_STATUS_SUCCESS;	
 }
+obos_status MmS_QueryPageInfo(page_table pt, uintptr_t addr, page_info* ppage, uintptr_t* phys)
+{
+	return query_page_info(pt, addr, ppage, phys, true);
+}
+obos_status MmS_PeekPageInfo(page_table pt, uintptr_t addr, page_info* ppage, uintptr_t* phys)
+{
+	return query_page_info(pt, addr, ppage, phys, false);
+}
 obos_status MmS_SetPageMapping(page_table pt, const page_info* page, uintptr_t phys, bool free_pte)
 {
 	if (!page || !pt)
@@ -571,6 +585,83 @@ obos_status MmS_SetPageMapping(page_table pt, const page_info* page, uintptr_t p
 	return status;
 }
 
+// Copies a leaf entry for MmS_ForkPageTables, write-protecting it in 'from' if the callback asks for it.
+static uintptr_t fork_leaf(uintptr_t* pte, uintptr_t virt, bool huge, void(*cb)(page_info* info, void* udata), void* udata)
+{
+	uintptr_t entry = *pte;
+	page_info info = {};
+	info.virt = virt;
+	info.phys = huge ? (entry & 0xFFFFFFFE00000) : Arch_MaskPhysicalAddressFromEntry(entry);
+	info.prot.present = entry & BIT_TYPE(0, UL);
+	info.prot.huge_page = huge;
+	info.prot.rw = entry & BIT_TYPE(1, UL);
+	info.prot.user = entry & BIT_TYPE(2, UL);
+	info.accessed = entry & BIT_TYPE(5, UL);
+	info.dirty = entry & BIT_TYPE(6, UL);
+	info.prot.lck = entry & BIT_TYPE(52, UL);
+	info.prot.executable = !(entry & BIT_TYPE(63, UL));
+	info.prot.is_swap_phys = entry & BIT_TYPE(9, UL);
+	cb(&info, udata);
+	if (!info.prot.rw && (entry & BIT_TYPE(1, UL)))
+	{
+		entry &= ~BIT_TYPE(1, UL);
+		*pte = entry;
+	}
+	// The accessed and dirty bits stay with the parent.
+	return entry & ~(BIT_TYPE(5, UL) | BIT_TYPE(6, UL));
+}
+// Copies the entries of a table at 'level' that are in [base, top), where the table maps the memory starting at tableBase.
+static obos_status fork_table(uintptr_t* into, uintptr_t* from, uintptr_t tableBase, uint8_t level, uintptr_t base, uintptr_t top, void(*cb)(page_info* info, void* udata), void* udata)
+{
+	const uintptr_t span = (uintptr_t)1 << (9 * level + 12);
+	const size_t first = (base - tableBase) / span;
+	const size_t last = (top - 1 - tableBase) / span;
+	for (size_t i = first; i <= last; i++)
+	{
+		const uintptr_t entry = from[i];
+		// Nothing was ever mapped under this entry, so there is nothing to copy, nor to allocate in 'into'.
+		if (!entry)
+			continue;
+		const uintptr_t entryBase = tableBase + i * span;
+		if (level == 0 || (level == 1 && (entry & BIT_TYPE(7, UL))))
+		{
+			into[i] = fork_leaf(&from[i], entryBase, level == 1, cb, udata);
+			continue;
+		}
+		// 1GiB pages are never used in user space.
+		if (!(entry & BIT_TYPE(0, UL)) || (entry & BIT_TYPE(7, UL)))
+			continue;
+		if (!into[i])
+		{
+			uintptr_t newTable = Mm_AllocatePhysicalPages(1, 1, nullptr);
+			if (!newTable)
+				return OBOS_STATUS_NOT_ENOUGH_MEMORY;
+			memzero(MmS_MapVirtFromPhys(newTable), OBOS_PAGE_SIZE);
+			into[i] = newTable | (entry & ~0xffffffffff000 & ~BIT_TYPE(5, UL));
+		}
+		uintptr_t* intoNext = (uintptr_t*)MmS_MapVirtFromPhys(Arch_MaskPhysicalAddressFromEntry(into[i]));
+		uintptr_t* fromNext = (uintptr_t*)MmS_MapVirtFromPhys(Arch_MaskPhysicalAddressFromEntry(entry));
+		const uintptr_t entryTop = entryBase + span;
+		obos_status status = fork_table(intoNext, fromNext, entryBase, level - 1, base > entryBase ? base : entryBase, top < entryTop ? top : entryTop, cb, udata);
+		if (obos_is_error(status))
+			return status;
+	}
+	return OBOS_STATUS_SUCCESS;
+}
+obos_status MmS_ForkPageTables(page_table into, page_table from, uintptr_t base, size_t size, void(*cb)(page_info* info, void* udata), void* udata)
+{
+	if (!into || !from || !cb || !size)
+		return OBOS_STATUS_INVALID_ARGUMENT;
+	if ((base & 0xfff) || (size & 0xfff))
+		return OBOS_STATUS_INVALID_ARGUMENT;
+	// Only the lower half (user space) can be forked.
+	if ((base + size) < base || (base + size) > 0x800000000000)
+		return OBOS_STATUS_INVALID_ARGUMENT;
+	uintptr_t* intoPML4 = (uintptr_t*)MmS_MapVirtFromPhys(Arch_MaskPhysicalAddressFromEntry(into));
+	uintptr_t* fromPML4 = (uintptr_t*)MmS_MapVirtFromPhys(Arch_MaskPhysicalAddressFromEntry(from));
+	return fork_table(intoPML4, fromPML4, 0, 3, base, base + size, cb, udata);
+}
+
 page_table cached_root = {};
 extern char Arch_StartISRHandlersText;
 extern char Arch_EndISRHandlersText;
@@ -218,6 +218,7 @@ void Arch_SMPStartup()
 		if (s_lapicIDs[i] == Arch_LAPICReadID())
 		{
 			cpu_info[i].curr = cpu_info + i;
+			cpu_info[i].arch_specific.lapicId = s_lapicIDs[i];
 			Arch_CPUInitializeGDT(&cpu_info[i], (uintptr_t)(cpu_info[i].arch_specific.ist_stack = OBOS_BasicMMAllocatePages(0x20000, nullptr)), 0x20000);
 			wrmsr(0xC0000101 /* GS_BASE */, (uintptr_t)&cpu_info[0]);
 			// UC UC- WT WB UC WC WT WB
@@ -371,4 +372,19 @@ void CoreS_ForceYieldOnSyscallReturn()
 		.info.shorthand=LAPIC_DESTINATION_SHORTHAND_SELF
 	};
     Arch_LAPICSendIPI(self, vector);    
-}
\ No newline at end of file
+}
+
+void CoreS_SendSchedulerIPI(cpu_local* target)
+{
+	if (!Core_SchedulerIRQ || !target->arch_specific.initializedSchedulerTimer)
+		return;
+	ipi_lapic_info lapic = {
+		.isShorthand = false,
+		.info.lapicId = target->arch_specific.lapicId,
+	};
+	ipi_vector_info vector = {
+		.deliveryMode = LAPIC_DELIVERY_MODE_FIXED,
+		.info.vector = Core_SchedulerIRQ->vector->id + 0x20
+	};
+	Arch_LAPICSendIPI(lapic, vector);
+}
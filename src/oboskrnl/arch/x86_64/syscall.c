@@ -268,6 +268,13 @@ const char* syscall_to_string[] = {
     "Sys_GetHDADevices",
     "Sys_SetSid",
     "Sys_GetSid",
+    "Sys_SchedulerGetCPUStats",
+    "Sys_GetPMMStats",
+    "Sys_GetPageCacheStats",
+    "Sys_SendMMsg",
+    "Sys_RecvMMsg",
+    "Sys_ContextSetFaultAround",
+    "Sys_GetReclaimStats",
 };
 
 const char* status_to_string[] = {
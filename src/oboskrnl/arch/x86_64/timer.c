@@ -39,22 +39,111 @@ extern uint64_t Arch_FindCounter(uint64_t hz);
 atomic_size_t nCPUsWithInitializedTimer;
 
 static irq_handler s_timer_cb;
+// Set by the 'tickless' command line option.
+// In tickless mode, the LAPIC timer is programmed as a one-shot timer for the end of the current thread's quantum,
+// and is stopped completely on idle CPUs.
+static bool s_tickless;
+
+// The scheduler counts quanta in scheduler ticks (Core_SchedulerTimerFrequency),
+// while timer objects and CoreS_GetTimerTick use timer ticks (CoreS_TimerFrequency).
+static timer_tick sched_ticks_to_timer_ticks(uint64_t ticks)
+{
+    if (ticks >= UINT64_MAX / CoreS_TimerFrequency)
+        return UINT64_MAX;
+    return ticks * CoreS_TimerFrequency / Core_SchedulerTimerFrequency;
+}
+static uint64_t timer_ticks_to_sched_ticks(timer_tick ticks)
+{
+    if (ticks >= UINT64_MAX / Core_SchedulerTimerFrequency)
+        return ticks / CoreS_TimerFrequency * Core_SchedulerTimerFrequency;
+    return ticks * Core_SchedulerTimerFrequency / CoreS_TimerFrequency;
+}
+
+void CoreS_SetNextSchedulerTick(uint64_t ticks)
+{
+    cpu_local* cpu = CoreS_GetCPULocalPtr();
+    if (!s_tickless || !cpu->arch_specific.initializedSchedulerTimer)
+        return;
+    timer_tick now = 0;
+    if (Core_TimerInterfaceInitialized)
+    {
+        now = CoreS_GetTimerTick();
+        cpu->arch_specific.tickArmedAt = now;
+        // This CPU also dispatches timer objects, so it cannot sleep past the next one.
+        if (s_timer_cb && cpu == Core_CpuInfo)
+        {
+            timer_tick deadline = Core_TimerNextDeadline();
+            if (deadline != UINT64_MAX)
+                ticks = OBOS_MIN(ticks, deadline > now ? timer_ticks_to_sched_ticks(deadline - now) : 1);
+        }
+    }
+    if (ticks == UINT64_MAX)
+    {
+        cpu->arch_specific.nextTickDeadline = UINT64_MAX;
+        // An initial count of zero stops the timer.
+        Arch_LAPICSetTimerConfiguration(Core_SchedulerIRQ->vector->id + 0x20, 0, 0xb);
+        return;
+    }
+    if (!ticks)
+        ticks = 1;
+    if (Core_TimerInterfaceInitialized)
+    {
+        timer_tick delta = sched_ticks_to_timer_ticks(ticks);
+        cpu->arch_specific.nextTickDeadline = delta < UINT64_MAX - now ? now + delta : UINT64_MAX;
+    }
+    uint64_t count = ticks * cpu->arch_specific.lapicTimerCount;
+    if (count > UINT32_MAX)
+        count = UINT32_MAX;
+    Arch_LAPICSetTimerConfiguration(Core_SchedulerIRQ->vector->id + 0x20, count, 0xb);
+}
+
+void CoreS_TimerQueued(timer_tick deadline)
+{
+    // Wake up the CPU dispatching timer objects if it is sleeping past the new deadline.
+    if (!s_tickless || !s_timer_cb)
+        return;
+    if (deadline < Core_CpuInfo->arch_specific.nextTickDeadline)
+        CoreS_SendSchedulerIPI(Core_CpuInfo);
+}
 
 void Arch_SchedulerIRQHandlerEntry(irq* obj, interrupt_frame* frame, void* userdata, irql oldIrql)
 {
-    if (!CoreS_GetCPULocalPtr()->arch_specific.initializedSchedulerTimer)
+    cpu_local* cpu = CoreS_GetCPULocalPtr();
+    if (!cpu->arch_specific.initializedSchedulerTimer)
     {
-        Arch_LAPICSetTimerConfiguration(0x20000 | (Core_SchedulerIRQ->vector->id + 0x20),
-                                        Arch_FindCounter(Core_SchedulerTimerFrequency),
-                                        0xb);
-        OBOS_Debug("Initialized timer for CPU %d.\n", CoreS_GetCPULocalPtr()->id);
-        CoreS_GetCPULocalPtr()->arch_specific.initializedSchedulerTimer = true;
+        cpu->arch_specific.lapicTimerCount = Arch_FindCounter(Core_SchedulerTimerFrequency);
+        cpu->arch_specific.nextTickDeadline = UINT64_MAX;
+        if (s_tickless)
+            Arch_LAPICSetTimerConfiguration((Core_SchedulerIRQ->vector->id + 0x20),
+                                            cpu->arch_specific.lapicTimerCount,
+                                            0xb);
+        else
+            Arch_LAPICSetTimerConfiguration(0x20000 | (Core_SchedulerIRQ->vector->id + 0x20),
+                                            cpu->arch_specific.lapicTimerCount,
+                                            0xb);
+        OBOS_Debug("Initialized timer for CPU %d.\n", cpu->id);
+        cpu->arch_specific.initializedSchedulerTimer = true;
         nCPUsWithInitializedTimer++;
     }
     else
     {
-        if (s_timer_cb && CoreS_GetCPULocalPtr() == Core_CpuInfo)
+        if (s_timer_cb && cpu == Core_CpuInfo)
             s_timer_cb(obj, frame, userdata, oldIrql);
+        if (s_tickless)
+        {
+            // Account for the ticks that we skipped.
+            // Core_Yield accounts for one tick itself.
+            thread* cur = Core_GetCurrentThread();
+            if (cur && Core_TimerInterfaceInitialized)
+            {
+                uint64_t elapsed = timer_ticks_to_sched_ticks(CoreS_GetTimerTick() - cpu->arch_specific.tickArmedAt);
+                if (elapsed > 1)
+                    cur->quantum += elapsed - 1;
+            }
+            // If the current thread keeps running, this is its next tick.
+            // Otherwise, the scheduler reprograms the timer for the new thread.
+            CoreH_ProgramSchedulerTimer();
+        }
         if (frame->cs & 0x3)
             Arch_UserYield(Core_GetCurrentThread()->kernelStack); // switches to the kernel stack passed, then yields, then returns.
         else
@@ -292,6 +381,7 @@ void Arch_InitializeSchedulerTimer()
     // Hopefully this won't cause trouble.
     Core_SchedulerIRQ->choseVector = true;
     Core_SchedulerIRQ->vector->nIRQsWithChosenID = 1;
+    s_tickless = OBOS_GetOPTF("tickless");
     ipi_lapic_info target = {
         .isShorthand = true,
         .info = {
@@ -306,5 +396,5 @@ void Arch_InitializeSchedulerTimer()
     Arch_LAPICSendIPI(target, vector);
     while (nCPUsWithInitializedTimer != Core_CpuCount)
         pause();
-    OBOS_Debug("%s: Scheduler timer is running at %d hz.\n", __func__, Core_SchedulerTimerFrequency);
+    OBOS_Debug("%s: Scheduler timer is running at %d hz%s.\n", __func__, Core_SchedulerTimerFrequency, s_tickless ? " (tickless)" : "");
 }
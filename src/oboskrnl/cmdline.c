@@ -36,8 +36,23 @@ static const char* const help_message =
 "                     is used as root.\n"
 "--working-set-cap=bytes: Specifies the kernel's working-set size in bytes.\n"
 "--initial-swap-size=bytes: Specifies the size (in bytes) of the initial, in-ram swap.\n"
+"--fault-around-pages=integer: The size (in pages) of the window around a faulting page that is mapped from the page cache\n"
+"                              or the standby list, and read ahead from swap, along with it. 0 disables it. Defaults to 16, at most 64.\n"
 "--log-level=integer: Specifies the log level of the kernel, 0 meaning all, 4 meaning none.\n"
 "--disable-network-error-logs: Disable error logs from the network stack\n"
+"--net-poll-budget=integer: The maximum amount of frames a NIC driver receives per poll. Defaults to 64.\n"
+"--net-dispatch-workers=integer: The amount of threads that process received frames for each NIC. Frames are spread across them by flow. Defaults to the amount of CPUs, which is also the maximum.\n"
+"--disable-net-offloads: Compute checksums and segment TCP data in software, even if the NIC can do it.\n"
+"--net-checksum-impl=string: The internet checksum implementation to use, either reference or word64. Defaults to word64, unless it fails its self-test at boot.\n"
+"--net-crc32-impl=string: The ethernet CRC32 implementation to use, either bytewise or slice-by-8. Defaults to slice-by-8, unless it fails its self-test at boot.\n"
+"--net-checksum-benchmark: Log the throughput of each checksum and CRC32 implementation at boot.\n"
+"--arp-reachable-time=integer: The amount of milliseconds a resolved address is trusted before it is probed again. Defaults to 30000.\n"
+"--arp-retransmit-time=integer: The amount of milliseconds between ARP requests for an address that is being resolved. Defaults to 1000.\n"
+"--arp-max-probes=integer: The amount of ARP requests sent for an address before it is considered unreachable. Defaults to 3.\n"
+"--arp-failed-time=integer: The amount of milliseconds frames to an unreachable address are dropped before it is resolved again. Defaults to 20000.\n"
+"--arp-queue-length=integer: The maximum amount of frames queued for an address that is being resolved, at least one. Defaults to 32.\n"
+"--tcp-congestion-control=newreno|cubic: The TCP congestion control algorithm. Defaults to cubic.\n"
+"--tcp-max-rcvbuf=bytes: The maximum size a TCP receive buffer can grow to. Defaults to 4MiB.\n"
 "--init-path=path: Specifies the path of init. If not present, assumes /init.\n"
 "--init-args: Special argument, makes the kernel assume all following arguments are to be passed to the init process.\n"
 "--no-init: Disables loading the init process.\n"
@@ -45,6 +60,8 @@ static const char* const help_message =
 "--acpi-bad-xsdt: Use the RSDT, even if the XSDT is present. For more info, see documenation for UACPI_FLAG_BAD_XSDT.\n"
 "--no-smp: Disables SMP. Has the equivalent effect of passing OBOS_UP at build-time.\n"
 "--pnp-module-path=pathspec: Where to find kernel modules for PnP during kernel init.\n"
+"--no-allocator-magazines: Disables the per-CPU object caches of the kernel's allocators.\n"
+"--no-pmm-hot-pages: Disables the per-CPU lists of free pages kept by the physical memory manager.\n"
 "--disable-libc-log: Disables the logs from the C library (see Sys_LibcLog) .\n"
 "--disable-syscall-error-log: Makes all syscall logs happen at DEBUG level.\n"
 "--disable-syscall-logs: Disables all syscall logs.\n"
@@ -55,6 +72,10 @@ static const char* const help_message =
 "--tjec-max-acc-loop-bits=<1-8>: Specifies a maximum number of random additional memory accesses TJEC makes per block in 2^k, default k=7 or 128.\n"
 "--tjec-max-hash-loop-bits=<1-8>: Specifies a maximum number of random additional hash iterations TJEC makes per block in 2^k, default k=3 or 8.\n"
 "--tjec-osr=<1-255>: Specifies the over sampling ratio for TJEC, in other words, how many blocks to collect per block generated.\n"
+"--starvation-quantum-{idle,low,normal,high}=ticks: Specifies how many scheduler ticks a ready thread of that priority\n"
+"                                                 can wait before its priority is temporarily raised.\n"
+"--tickless: Only interrupts a CPU when its current thread's quantum ends, instead of on every scheduler tick.\n"
+"            Idle CPUs are not interrupted at all. Only supported on x86-64.\n"
 "--x86-disable-tsc: (x86 only) Disables use of the TSC.\n"
 "--help: Displays this help message.\n";
 
@@ -22,11 +22,11 @@
 
 LIST_GENERATE(dpc_queue, dpc, node);
 
+static object_cache dpc_cache = OBJECT_CACHE_INITIALIZE("dpc", dpc, nullptr, nullptr, nullptr, OBJECT_CACHE_ZERO);
+
 dpc* CoreH_AllocateDPC(obos_status* status)
 {
-    if (!OBOS_NonPagedPoolAllocator)
-        return ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(dpc), status);
-    return ZeroAllocate(OBOS_NonPagedPoolAllocator, 1, sizeof(dpc), status);
+    return OBOS_ObjectCacheAllocate(&dpc_cache, status);
 }
 obos_status CoreH_InitializeDPC(dpc* dpc, void(*handler)(struct dpc* obj, void* userdata), thread_affinity affinity)
 {
@@ -65,5 +65,5 @@ obos_status CoreH_FreeDPC(dpc* dpc, bool dealloc)
         Core_SpinlockRelease(&dpc->cpu->dpc_queue_lock, oldIrql);
         dpc->cpu = nullptr;
     }
-    return dealloc ? Free(OBOS_NonPagedPoolAllocator, dpc, sizeof(*dpc)) : OBOS_STATUS_SUCCESS;
+    return dealloc ? OBOS_ObjectCacheFree(&dpc_cache, dpc) : OBOS_STATUS_SUCCESS;
 }
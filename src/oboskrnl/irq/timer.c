@@ -34,13 +34,144 @@
 
 bool Core_TimerInterfaceInitialized;
 irq* Core_TimerIRQ;
-static struct
+
+/*
+ * Timer objects are kept in a hierarchical timing wheel.
+ * Level 0 has a slot for each of the next TIMER_WHEEL_SLOTS ticks, and each slot of level n
+ * covers TIMER_WHEEL_SLOTS^n ticks. When level n wraps around, the next slot of level n+1 is
+ * cascaded, in other words, its timers are reinserted into the lower levels.
+ * This makes inserting and cancelling a timer O(1), and the dispatcher only needs to look at
+ * the slot for the current tick.
+ * Timers too far in the future are put in the last level, and are reinserted
+ * until they come into range.
+ */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_MAX_DELTA ((timer_tick)1 << (TIMER_WHEEL_BITS*TIMER_WHEEL_LEVELS))
+#define level_shift(level) ((level)*TIMER_WHEEL_BITS)
+#define level_index(tick, level) (((tick) >> level_shift(level)) & TIMER_WHEEL_MASK)
+
+struct timer_wheel_slot
 {
     timer* head;
     timer* tail;
-    size_t nNodes;
+};
+static struct
+{
+    struct timer_wheel_slot slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    // The next tick to be processed.
+    timer_tick current;
+    size_t nTimers;
     spinlock lock;
-} timer_list;
+} timer_wheel;
+
+static timer_tick timer_expiry(const timer* t)
+{
+    switch (t->mode)
+    {
+        case TIMER_MODE_DEADLINE:
+            return t->timing.deadline;
+        case TIMER_MODE_INTERVAL:
+            return t->timing.interval + t->lastTimeTicked;
+        default:
+            return UINT64_MAX;
+    }
+}
+// timer_wheel.lock must be held.
+static void wheel_insert(timer* t)
+{
+    timer_tick expires = timer_expiry(t);
+    timer_tick delta = expires > timer_wheel.current ? expires - timer_wheel.current : 0;
+    if (delta >= TIMER_WHEEL_MAX_DELTA)
+    {
+        delta = TIMER_WHEEL_MAX_DELTA - 1;
+        expires = timer_wheel.current + delta;
+    }
+    else if (!delta)
+        expires = timer_wheel.current;
+    size_t level = 0;
+    while (level < (TIMER_WHEEL_LEVELS - 1) && delta >= ((timer_tick)1 << level_shift(level + 1)))
+        level++;
+    struct timer_wheel_slot* slot = &timer_wheel.slots[level][level_index(expires, level)];
+    t->next = nullptr;
+    t->prev = slot->tail;
+    if (slot->tail)
+        slot->tail->next = t;
+    if (!slot->head)
+        slot->head = t;
+    slot->tail = t;
+    t->slot = slot;
+}
+// timer_wheel.lock must be held.
+static void wheel_remove(timer* t)
+{
+    struct timer_wheel_slot* slot = t->slot;
+    if (!slot)
+        return;
+    if (t->next)
+        t->next->prev = t->prev;
+    if (t->prev)
+        t->prev->next = t->next;
+    if (slot->head == t)
+        slot->head = t->next;
+    if (slot->tail == t)
+        slot->tail = t->prev;
+    t->next = t->prev = nullptr;
+    t->slot = nullptr;
+}
+// timer_wheel.lock must be held.
+static void wheel_cascade(size_t level, size_t index)
+{
+    struct timer_wheel_slot* slot = &timer_wheel.slots[level][index];
+    timer* t = slot->head;
+    slot->head = slot->tail = nullptr;
+    while (t)
+    {
+        timer* next = t->next;
+        wheel_insert(t);
+        t = next;
+    }
+}
+
+// Returns the first tick starting at timer_wheel.current at which the dispatcher has anything to do,
+// in other words, the first tick whose level 0 slot has timers, or that cascades a slot that has timers.
+// timer_wheel.lock must be held, and the wheel must have timers.
+static timer_tick wheel_next_event()
+{
+    const timer_tick current = timer_wheel.current;
+    timer_tick ret = UINT64_MAX;
+    // Timers in level 0 expire exactly at the tick of their slot.
+    for (timer_tick i = 0; i < TIMER_WHEEL_SLOTS; i++)
+    {
+        if (timer_wheel.slots[0][level_index(current + i, 0)].head)
+        {
+            ret = current + i;
+            break;
+        }
+    }
+    // Timers in the higher levels are only looked at again when their slot is cascaded.
+    // A cascade can move timers to a tick before the first occupied level 0 slot, so
+    // every level has to be looked at.
+    for (size_t level = 1; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        const timer_tick base = current & ~(((timer_tick)1 << level_shift(level)) - 1);
+        for (timer_tick i = (base == current) ? 0 : 1; i <= TIMER_WHEEL_SLOTS; i++)
+        {
+            timer_tick tick = base + (i << level_shift(level));
+            if (tick >= ret)
+                break;
+            if (timer_wheel.slots[level][level_index(tick, level)].head)
+            {
+                ret = tick;
+                break;
+            }
+        }
+    }
+    return ret;
+}
+
 static void timer_dispatcher(dpc* obj, void* userdata);
 dpc* work = nullptr;
 OBOS_NO_KASAN OBOS_NO_UBSAN static void timer_irq(struct irq* i, interrupt_frame* frame, void* userdata, irql oldIrql)
@@ -52,6 +183,8 @@ OBOS_NO_KASAN OBOS_NO_UBSAN static void timer_irq(struct irq* i, interrupt_frame
 #ifdef OBOS_TIMER_IS_DEADLINE
     CoreS_ResetTimer();
 #endif
+    if (!timer_wheel.nTimers)
+        return;
     if (!work->cpu || LIST_IS_NODE_UNLINKED(dpc_queue, &work->cpu->dpcs, work))
         CoreH_InitializeDPC(work, timer_dispatcher, CoreH_CPUIdToAffinity(CoreS_GetCPULocalPtr()->id));
 }
@@ -62,12 +195,18 @@ static void notify_timer_dpc(dpc* dpc, void* userdata)
     if (timer)
         timer->handler(timer->userdata);
 }
-static void notify_timer(timer* timer)
+// timer_wheel.lock must be held, and the timer must already be removed from the wheel.
+static void notify_timer(timer* timer, timer_tick now)
 {
     // TODO: Use signals instead of calling the handler directly.
-    timer->lastTimeTicked = CoreS_GetTimerTick();
+    timer->lastTimeTicked = now;
     if (timer->mode == TIMER_MODE_DEADLINE)
-        Core_CancelTimer(timer);
+    {
+        timer->mode = TIMER_EXPIRED;
+        timer_wheel.nTimers--;
+    }
+    else
+        wheel_insert(timer);
     timer->handler_dpc.userdata = timer;
     CoreH_InitializeDPC(&timer->handler_dpc, notify_timer_dpc, Core_DefaultThreadAffinity);
     // timer->handler(timer->userdata);
@@ -76,36 +215,42 @@ static void timer_dispatcher(dpc* obj, void* userdata)
 {
     OBOS_UNUSED(obj);
     OBOS_UNUSED(userdata);
-    // Search for expired timer objects, and notify them.
-    for(timer* t = timer_list.head; t; )
+    timer_tick now = CoreS_GetTimerTick();
+    irql oldIrql = Core_SpinlockAcquireExplicit(&timer_wheel.lock, IRQL_TIMER, false);
+    while (timer_wheel.current <= now)
     {
-        bool expired = false;
-        switch (t->mode) 
+        // Skip the ticks with nothing to do, so that catching up after a long
+        // tickless idle period does not walk every tick of it.
+        const timer_tick next = timer_wheel.nTimers ? wheel_next_event() : UINT64_MAX;
+        if (next > now)
         {
-            case TIMER_MODE_DEADLINE:
-            {
-                expired = CoreS_GetTimerTick() >= t->timing.deadline;
-                break;
-            }
-            case TIMER_MODE_INTERVAL:
-            {
-                timer_tick deadline = t->timing.interval + t->lastTimeTicked;
-                expired = CoreS_GetTimerTick() >= deadline;
-                break;
-            }
-            default:
+            timer_wheel.current = now + 1;
+            break;
+        }
+        timer_wheel.current = next;
+        // Cascade the higher levels every time a lower level wraps around.
+        for (size_t level = 1; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            if (level_index(timer_wheel.current, level - 1) != 0)
                 break;
+            wheel_cascade(level, level_index(timer_wheel.current, level));
+        }
+        // Everything in this slot is due.
+        struct timer_wheel_slot* slot = &timer_wheel.slots[0][level_index(timer_wheel.current, 0)];
+        timer* t = slot->head;
+        slot->head = slot->tail = nullptr;
+        while (t)
+        {
+            timer* next = t->next;
+            t->next = t->prev = nullptr;
+            t->slot = nullptr;
+            OBOS_ASSERT(t->mode != TIMER_EXPIRED);
+            notify_timer(t, now);
+            t = next;
         }
-        if (!expired)
-            goto end;
-        OBOS_ASSERT(t->mode != TIMER_EXPIRED);
-        notify_timer(t);
-        end:
-        (void)0;
-        irql oldIrql = Core_SpinlockAcquireExplicit(&timer_list.lock, IRQL_TIMER, false);
-        t = t->next;
-        Core_SpinlockRelease(&timer_list.lock, oldIrql);
+        timer_wheel.current++;
     }
+    Core_SpinlockRelease(&timer_wheel.lock, oldIrql);
 }
 obos_status Core_InitializeTimerInterface()
 {
@@ -126,11 +271,10 @@ obos_status Core_InitializeTimerInterface()
     Core_LowerIrql(oldIrql);
     return status;
 }
+static object_cache timer_cache = OBJECT_CACHE_INITIALIZE("timer", timer, nullptr, nullptr, nullptr, OBJECT_CACHE_ZERO);
 timer* Core_TimerObjectAllocate(obos_status* status)
 {
-    if (!OBOS_NonPagedPoolAllocator)
-		return ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(timer), status);
-	return ZeroAllocate(OBOS_NonPagedPoolAllocator, 1, sizeof(timer), status);
+    return OBOS_ObjectCacheAllocate(&timer_cache, status);
 }
 obos_status Core_TimerObjectFree(timer* obj)
 {
@@ -139,7 +283,7 @@ obos_status Core_TimerObjectFree(timer* obj)
     if (obj->mode > TIMER_EXPIRED)
         return OBOS_STATUS_ACCESS_DENIED;
     CoreH_FreeDPC(&obj->handler_dpc, false);
-    return Free(OBOS_KernelAllocator, obj, sizeof(*obj));
+    return OBOS_ObjectCacheFree(&timer_cache, obj);
 }
 obos_status Core_TimerObjectInitialize(timer* obj, timer_mode mode, uint64_t us)
 {
@@ -160,19 +304,33 @@ obos_status Core_TimerObjectInitialize(timer* obj, timer_mode mode, uint64_t us)
             Core_LowerIrql(oldIrql);
             return OBOS_STATUS_INVALID_ARGUMENT;
     }
+    irql oldIrql2 = Core_SpinlockAcquireExplicit(&timer_wheel.lock, IRQL_TIMER, false);
+    if (obj->mode > TIMER_EXPIRED)
+    {
+        // Re-arming a running timer.
+        wheel_remove(obj);
+        timer_wheel.nTimers--;
+    }
     obj->mode = mode;
-    irql oldIrql2 = Core_SpinlockAcquireExplicit(&timer_list.lock, IRQL_TIMER, false);
-    if (timer_list.tail)
-        timer_list.tail->next = obj;
-    if (!timer_list.head)
-        timer_list.head = obj;
-    obj->prev = timer_list.tail;
-    timer_list.tail = obj;
-    timer_list.nNodes++;
-    Core_SpinlockRelease(&timer_list.lock, oldIrql2);
+    if (!timer_wheel.nTimers && timer_wheel.current < obj->lastTimeTicked)
+        timer_wheel.current = obj->lastTimeTicked;
+    wheel_insert(obj);
+    timer_wheel.nTimers++;
+    Core_SpinlockRelease(&timer_wheel.lock, oldIrql2);
+    if (CoreS_TimerQueued)
+        CoreS_TimerQueued(timer_expiry(obj));
     Core_LowerIrql(oldIrql);
     return OBOS_STATUS_SUCCESS;
 }
+timer_tick Core_TimerNextDeadline()
+{
+    timer_tick ret = UINT64_MAX;
+    irql oldIrql = Core_SpinlockAcquireExplicit(&timer_wheel.lock, IRQL_TIMER, false);
+    if (timer_wheel.nTimers)
+        ret = wheel_next_event();
+    Core_SpinlockRelease(&timer_wheel.lock, oldIrql);
+    return ret;
+}
 obos_status Core_CancelTimer(timer* timer)
 {
     if (!timer)
@@ -181,21 +339,16 @@ obos_status Core_CancelTimer(timer* timer)
         return OBOS_STATUS_INVALID_ARGUMENT;
     if (timer->mode == TIMER_EXPIRED)
         return OBOS_STATUS_SUCCESS;
-    irql oldIrql = Core_SpinlockAcquireExplicit(&timer_list.lock, IRQL_TIMER, false);
-    // Remove the timer from the list.
-    if (timer->next)
-        timer->next->prev = timer->prev;
-    if (timer->prev)
-        timer->prev->next = timer->next;
-    if (timer == timer_list.head)
-        timer_list.head = timer->next;
-    if (timer == timer_list.tail)
-        timer_list.tail = timer->prev;
-    timer_list.nNodes--;
-    Core_SpinlockRelease(&timer_list.lock, oldIrql);
-    timer->mode = TIMER_EXPIRED;
+    irql oldIrql = Core_SpinlockAcquireExplicit(&timer_wheel.lock, IRQL_TIMER, false);
+    // The timer might have expired while we were waiting for the lock.
+    if (timer->mode > TIMER_EXPIRED)
+    {
+        wheel_remove(timer);
+        timer_wheel.nTimers--;
+        timer->mode = TIMER_EXPIRED;
+    }
+    Core_SpinlockRelease(&timer_wheel.lock, oldIrql);
     return OBOS_STATUS_SUCCESS;
-    
 }
 timer_tick CoreH_TimeFrameToTick(uint64_t us)
 {
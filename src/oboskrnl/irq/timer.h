@@ -46,6 +46,8 @@ typedef struct timer {
     dpc handler_dpc;
     struct timer* next;
     struct timer* prev;
+    // The timer wheel slot this timer is in, or nullptr.
+    struct timer_wheel_slot* slot;
 } timer;
 
 /// <summary>
@@ -80,6 +82,17 @@ OBOS_EXPORT obos_status Core_TimerObjectInitialize(timer* obj, timer_mode mode,
 /// <param name="obj">The timer object.</param>
 /// <returns>The status of the function.</returns>
 OBOS_EXPORT obos_status Core_CancelTimer(timer* obj);
+/// <summary>
+/// Gets the tick at which the next timer object expires.
+/// </summary>
+/// <returns>The tick of the earliest deadline, or UINT64_MAX if there are no timers.</returns>
+timer_tick Core_TimerNextDeadline();
+/// <summary>
+/// Called after a timer object is registered.<para/>
+/// Lets a tickless timer implementation program an earlier interrupt if needed.
+/// </summary>
+/// <param name="deadline">The tick at which the timer expires.</param>
+OBOS_WEAK void CoreS_TimerQueued(timer_tick deadline);
 
 /// <summary>
 /// Gets the current tick.
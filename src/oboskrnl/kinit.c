@@ -44,6 +44,7 @@
 #include <vfs/fd.h>
 
 #include <net/lo.h>
+#include <net/checksum.h>
 
 #include <elf/elf.h>
 
@@ -229,6 +230,9 @@ void OBOS_KernelInit()
 
     if (OBOSS_InitializeSMP)
         OBOSS_InitializeSMP();
+    Core_LoadSchedulerTunables();
+    OBOSH_BasicAllocatorEnableMagazines();
+    Mm_EnablePMMHotPages();
 
     OBOS_Debug("%s: Initializing IRQ interface.\n", __func__);
     if (obos_is_error(status = Core_InitializeIRQInterface()))
@@ -328,6 +332,7 @@ void OBOS_KernelInit()
     OBOS_Debug("%s: Finalizing VFS initialization...\n", __func__);
     Vfs_FinalizeInitialization();
 
+    Net_InitializeChecksums();
     Net_InitializeLoopbackDevice();
 
     Core_ProcessGroupTreeLock = MUTEX_INITIALIZE();
@@ -133,13 +133,21 @@ obos_status Mm_AgingReferencePage(context* ctx, working_set_node* node)
 }
 #else
 #include <int.h>
+#include <error.h>
 #include <klog.h>
-obos_status Mm_AgingPRA(struct context* ctx)
+
+#include <mm/context.h>
+
+obos_status Mm_AgingPRA(context* ctx)
 {
+    OBOS_UNUSED(ctx);
     OBOS_ASSERT(!"what the hell?");
+    return OBOS_STATUS_UNIMPLEMENTED;
 }
-obos_status Mm_AgingReferencePage(struct context* ctx, struct working_set_node* node)
+obos_status Mm_AgingReferencePage(context* ctx, working_set_node* node)
 {
+    OBOS_UNUSED(ctx && node);
     OBOS_ASSERT(!"what the hell?");
+    return OBOS_STATUS_UNIMPLEMENTED;
 }
 #endif
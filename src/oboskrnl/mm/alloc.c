@@ -342,10 +342,7 @@ void* Mm_VirtualMemoryAllocEx(context* ctx, void* base_, size_t size, prot_flags
                     {
                         page_info info = {};
                         MmS_QueryPageInfo(ctx->pt, jaddr, &info, nullptr);
-                        page key = {.phys=info.phys};
-                        Core_MutexAcquire(&Mm_PhysicalPagesLock);
-                        page* curr_pg = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &key);
-                        Core_MutexRelease(&Mm_PhysicalPagesLock);
+                        page* curr_pg = MmH_LookupPage(info.phys);
                         curr_pg->pagedCount--;
                         MmH_DerefPage(curr_pg);
                         info.prot.present = false;
@@ -360,8 +357,8 @@ void* Mm_VirtualMemoryAllocEx(context* ctx, void* base_, size_t size, prot_flags
             else if (file)
             {
                 // File page.
-                page what = {.backing_vn=file->vn,.file_offset=currFileOff};
-                phys = RB_FIND(pagecache_tree, &file->vn->cache, &what);
+                // We hold the context's lock, so we can't wait for the page to be read.
+                phys = VfsH_PageCacheLookup(file->vn, currFileOff, false);
                 if (flags & VMA_FLAGS_PREFAULT && !phys)
                     phys = VfsH_PageCacheCreateEntry(file->vn, currFileOff);
                 if (phys)
@@ -564,10 +561,7 @@ obos_status Mm_VirtualMemoryFree(context* ctx, void* base_, size_t size)
         info.range = rng;
         if (!info.prot.is_swap_phys && info.phys)
         {
-            page what = {.phys=info.phys};
-            Core_MutexAcquire(&Mm_PhysicalPagesLock);
-            page* pg = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what);
-            Core_MutexRelease(&Mm_PhysicalPagesLock);
+            page* pg = MmH_LookupPage(info.phys);
             if (pg)
             {
                 pg->pagedCount--;
@@ -832,10 +826,7 @@ void* Mm_MapViewOfUserMemory(context* const user_context, void* ubase_, void* kb
         page_info info = {};
         MmS_QueryPageInfo(user_context->pt, uaddr, &info, nullptr);
 
-        page what = {.phys=info.phys};
-        Core_MutexAcquire(&Mm_PhysicalPagesLock);
-        phys = (info.phys && !info.prot.is_swap_phys) ? RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what) : nullptr;
-        Core_MutexRelease(&Mm_PhysicalPagesLock);
+        phys = (info.phys && !info.prot.is_swap_phys) ? MmH_LookupPage(info.phys) : nullptr;
         if (user_rng->un.mapped_vn && !phys)
         {
             Core_SpinlockRelease(&user_context->lock, oldIrql2);
@@ -843,7 +834,6 @@ void* Mm_MapViewOfUserMemory(context* const user_context, void* ubase_, void* kb
             VfsH_PageCacheGetEntry(user_rng->un.mapped_vn, uaddr-(user_rng->virt), &phys);
             oldIrql = Core_SpinlockAcquire(&Mm_KernelContext.lock);
             oldIrql2 = Core_SpinlockAcquire(&user_context->lock);
-            what.phys = phys->phys;
             info.phys = phys->phys;
             if (~prot & OBOS_PROTECTION_READ_ONLY)
                 Mm_MarkAsDirtyPhys(phys);
@@ -861,10 +851,7 @@ void* Mm_MapViewOfUserMemory(context* const user_context, void* ubase_, void* kb
             oldIrql = Core_SpinlockAcquire(&Mm_KernelContext.lock);
             oldIrql2 = Core_SpinlockAcquire(&user_context->lock);
             MmS_QueryPageInfo(user_context->pt, uaddr, nullptr, &info.phys);
-            what.phys = info.phys;
-            Core_MutexAcquire(&Mm_PhysicalPagesLock);
-            phys = (info.phys && !info.prot.is_swap_phys) ? RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what) : nullptr;
-            Core_MutexRelease(&Mm_PhysicalPagesLock);
+            phys = (info.phys && !info.prot.is_swap_phys) ? MmH_LookupPage(info.phys) : nullptr;
             OBOS_ASSERT(phys != Mm_AnonPage);
         }
 
@@ -973,10 +960,7 @@ void* Mm_QuickVMAllocate(size_t sz, bool non_pageable)
                 {
                     page_info info = {};
                     MmS_QueryPageInfo(ctx->pt, jaddr, &info, nullptr);
-                    page key = {.phys=info.phys};
-                    Core_MutexAcquire(&Mm_PhysicalPagesLock);
-                    page* curr_pg = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &key);
-                    Core_MutexRelease(&Mm_PhysicalPagesLock);
+                    page* curr_pg = MmH_LookupPage(info.phys);
                     curr_pg->pagedCount--;
                     MmH_DerefPage(curr_pg);
                     info.prot.present = false;
@@ -1043,10 +1027,7 @@ obos_status DrvH_ScatterGather(context* ctx, void* base_, size_t size, struct ph
         page_info info = {};
         MmS_QueryPageInfo(ctx->pt, addr, &info, nullptr);
 
-        page key = {.phys=info.phys};
-        Core_MutexAcquire(&Mm_PhysicalPagesLock);
-        page* pg = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &key);
-        Core_MutexRelease(&Mm_PhysicalPagesLock);
+        page* pg = MmH_LookupPage(info.phys);
         OBOS_ASSERT(pg != Mm_AnonPage);
         OBOS_ASSERT(pg != Mm_UserAnonPage);
         
@@ -1099,10 +1080,7 @@ obos_status DrvH_FreeScatterGatherList(context* ctx, void* base_, size_t size, s
     {
         page_info info = {};
         MmS_QueryPageInfo(ctx->pt, addr, &info, nullptr);
-        page key = {.phys=info.phys};
-        Core_MutexAcquire(&Mm_PhysicalPagesLock);
-        page* pg = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &key);
-        Core_MutexRelease(&Mm_PhysicalPagesLock);
+        page* pg = MmH_LookupPage(info.phys);
         MmH_DerefPage(pg);
         pgSize = info.prot.huge_page ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE;
     }
@@ -1150,10 +1128,7 @@ obos_status Mm_VirtualMemoryLock(context* ctx, void* base_, size_t size)
             status = fault_page(ctx, &info, &oldIrql);
         else
         {
-            page key = {.phys=info.phys};
-            Core_MutexAcquire(&Mm_PhysicalPagesLock);
-            page* pg = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &key);
-            Core_MutexRelease(&Mm_PhysicalPagesLock);
+            page* pg = MmH_LookupPage(info.phys);
             if (!pg)
             {
                 Core_SpinlockRelease(&ctx->lock, oldIrql);
@@ -0,0 +1,380 @@
+/*
+ * oboskrnl/mm/clock.c
+ *
+ * Copyright (c) 2026 Omar Berrow
+*/
+
+#include <int.h>
+#include <error.h>
+#include <klog.h>
+#include <memmanip.h>
+
+#include <mm/reclaim.h>
+
+#if defined(OBOS_PAGE_REPLACEMENT_CLOCK)
+#include <mm/handler.h>
+#include <mm/context.h>
+#include <mm/page.h>
+#include <mm/swap.h>
+#include <mm/pmm.h>
+#include <mm/alloc.h>
+
+#include <allocators/base.h>
+
+#include <scheduler/thread.h>
+#include <scheduler/thread_context_info.h>
+#include <scheduler/schedule.h>
+
+#include <irq/irql.h>
+#include <irq/timer.h>
+
+#include <utils/tree.h>
+#include <utils/list.h>
+
+#include <locks/spinlock.h>
+#include <locks/mutex.h>
+#include <locks/event.h>
+#include <locks/wait.h>
+
+#include <stdatomic.h>
+
+// See mm/reclaim.h for an overview.
+
+typedef struct clock_list {
+    working_set_node *head, *tail;
+    size_t nNodes;
+} clock_list;
+
+// Both lists are in the order the clock hands go over them, from head to tail.
+static clock_list active_list;
+static clock_list inactive_list;
+// Protects both lists. Taken after context::lock.
+static spinlock clock_lock;
+// Held by the reclaim thread while it has nodes off the lists, so that
+// Mm_ReclaimForgetContext can't free their context under it.
+static mutex reclaim_lock = MUTEX_INITIALIZE();
+
+static thread reclaim_thread;
+static bool reclaim_thread_initialized;
+static event reclaim_wake = EVENT_INITIALIZE(EVENT_SYNC);
+static _Atomic(bool) reclaim_pending;
+
+// Protected by stats_lock. The reclaim thread counts into a local copy,
+// which it adds to these once per run.
+static mm_reclaim_stats stats;
+static spinlock stats_lock;
+static uint64_t sample_time;
+static uint64_t sample_scanned;
+static uint64_t sample_evicted;
+static uint64_t scan_rate;
+static uint64_t eviction_rate;
+
+#define PAGE_SIZE_OF(ent) ((ent)->info.prot.huge_page ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE)
+
+obos_status Mm_ClockReferencePage(context* ctx, working_set_node* node)
+{
+    // Mm_SwapOut releases the lock of the kernel context by itself, which the reclaim thread can't deal with.
+    if (ctx == &Mm_KernelContext)
+        return OBOS_STATUS_UNPAGED_POOL;
+    working_set_entry* const ent = node->data;
+    ent->ctx = ctx;
+    ent->active = false;
+    irql oldIrql = Core_SpinlockAcquire(&clock_lock);
+    APPEND_WORKINGSET_PAGE_NODE(inactive_list, node);
+    Core_SpinlockRelease(&clock_lock, oldIrql);
+    return OBOS_STATUS_SUCCESS;
+}
+
+obos_status Mm_ClockPRA(context* ctx)
+{
+    OBOS_UNUSED(ctx);
+    Mm_CheckReclaimWatermark();
+    return OBOS_STATUS_SUCCESS;
+}
+
+static working_set_node* take_node(clock_list* list)
+{
+    irql oldIrql = Core_SpinlockAcquire(&clock_lock);
+    working_set_node* node = list->head;
+    if (node)
+        REMOVE_WORKINGSET_PAGE_NODE(*list, node);
+    Core_SpinlockRelease(&clock_lock, oldIrql);
+    return node;
+}
+
+static void put_node(working_set_node* node, bool active)
+{
+    node->data->active = active;
+    irql oldIrql = Core_SpinlockAcquire(&clock_lock);
+    if (active)
+        APPEND_WORKINGSET_PAGE_NODE(active_list, node);
+    else
+        APPEND_WORKINGSET_PAGE_NODE(inactive_list, node);
+    Core_SpinlockRelease(&clock_lock, oldIrql);
+}
+
+static void free_node(working_set_node* node)
+{
+    Free(Mm_Allocator, node->data, sizeof(*node->data));
+    Free(Mm_Allocator, node, sizeof(*node));
+}
+
+enum {
+    // The page was accessed since the last time it was looked at.
+    PAGE_REFERENCED,
+    // The page was not accessed.
+    PAGE_IDLE,
+    // The page was swapped out.
+    PAGE_EVICTED,
+    // The page is not resident anymore, or can't be swapped out, so it should be forgotten.
+    PAGE_GONE,
+    // The page could not be swapped out, and should be kept.
+    PAGE_EVICT_FAILED,
+};
+
+// Looks at the accessed bit of a page (clearing it), and swaps it out if it was not accessed and 'evict' is set.
+static int check_page(working_set_entry* ent, bool evict)
+{
+    context* const ctx = ent->ctx;
+    int res = PAGE_GONE;
+    irql oldIrql = Core_SpinlockAcquire(&ctx->lock);
+    page_range what = {.virt=ent->info.virt,.size=OBOS_PAGE_SIZE};
+    page_range* rng = RB_FIND(page_tree, &ctx->pages, &what);
+    if (!rng || !rng->pageable)
+        goto done;
+    page_info info = {};
+    MmS_QueryPageInfo(ctx->pt, ent->info.virt, &info, nullptr);
+    if (!info.prot.present || info.prot.is_swap_phys || info.prot.lck || !info.phys)
+        goto done;
+    page* pg = MmH_LookupPage(info.phys);
+    // Page cache pages are not swapped out.
+    if (!pg || pg->backing_vn || (pg->flags & PHYS_PAGE_LOCKED))
+        goto done;
+    if (info.accessed || info.dirty)
+    {
+        res = PAGE_REFERENCED;
+        goto done;
+    }
+    res = PAGE_IDLE;
+    if (!evict)
+        goto done;
+    obos_status status = Mm_SwapOut(ent->info.virt, ctx);
+    if (obos_is_success(status))
+    {
+        ctx->stat.paged += PAGE_SIZE_OF(ent);
+        Mm_GlobalMemoryUsage.paged += PAGE_SIZE_OF(ent);
+        res = PAGE_EVICTED;
+    }
+    else
+        res = status == OBOS_STATUS_UNPAGED_POOL ? PAGE_GONE : PAGE_EVICT_FAILED;
+    done:
+    Core_SpinlockRelease(&ctx->lock, oldIrql);
+    return res;
+}
+
+// The front hand.
+// Moves pages that were not accessed since the last pass from the head of the active list
+// to the inactive list, until the inactive list is at least half as large as the active list.
+static void balance_lists(size_t* budget, mm_reclaim_stats* run)
+{
+    while (*budget && inactive_list.nNodes <= active_list.nNodes / 2)
+    {
+        working_set_node* node = take_node(&active_list);
+        if (!node)
+            break;
+        (*budget)--;
+        run->nScanned++;
+        switch (check_page(node->data, false)) {
+            case PAGE_REFERENCED:
+                put_node(node, true);
+                break;
+            case PAGE_IDLE:
+                run->nDeactivated++;
+                put_node(node, false);
+                break;
+            default:
+                free_node(node);
+                break;
+        }
+    }
+}
+
+// Free and standby pages can both be allocated without any I/O.
+static size_t available_pages()
+{
+    return Mm_FreePhysicalPageCount() + LIST_GET_NODE_COUNT(phys_page_list, &Mm_StandbyPageList);
+}
+
+static void add_run_stats(const mm_reclaim_stats* run)
+{
+    irql oldIrql = Core_SpinlockAcquire(&stats_lock);
+    stats.nRuns += run->nRuns;
+    stats.nScanned += run->nScanned;
+    stats.nEvicted += run->nEvicted;
+    stats.nActivated += run->nActivated;
+    stats.nDeactivated += run->nDeactivated;
+    Core_SpinlockRelease(&stats_lock, oldIrql);
+}
+
+static void reclaim()
+{
+    mm_reclaim_stats run = {.nRuns=1};
+    Core_MutexAcquire(&reclaim_lock);
+    const size_t available = available_pages();
+    if (available >= Mm_HighWatermark)
+    {
+        Core_MutexRelease(&reclaim_lock);
+        add_run_stats(&run);
+        return;
+    }
+    const size_t target = Mm_HighWatermark - available;
+    size_t nEvicted = 0;
+    // Each hand goes around its list at most twice, once to clear the accessed bits, and once to find
+    // the pages that were not accessed since.
+    size_t budget = (active_list.nNodes + inactive_list.nNodes) * 2;
+    while (nEvicted < target && budget)
+    {
+        // The back hand.
+        balance_lists(&budget, &run);
+        working_set_node* node = take_node(&inactive_list);
+        if (!node)
+        {
+            if (!active_list.nNodes)
+                break;
+            continue;
+        }
+        budget--;
+        run.nScanned++;
+        bool stop = false;
+        switch (check_page(node->data, true)) {
+            case PAGE_REFERENCED:
+                run.nActivated++;
+                put_node(node, true);
+                break;
+            case PAGE_EVICTED:
+                run.nEvicted++;
+                nEvicted++;
+                free_node(node);
+                break;
+            case PAGE_EVICT_FAILED:
+                // Most likely out of swap space, so there's no point in going on.
+                put_node(node, false);
+                stop = true;
+                break;
+            default:
+                free_node(node);
+                break;
+        }
+        if (stop)
+            break;
+    }
+    Core_MutexRelease(&reclaim_lock);
+    add_run_stats(&run);
+
+    // The pages that were swapped out are dirty, and are only reusable once they are written back.
+    if (nEvicted)
+    {
+        Mm_PageWriterOperation |= PAGE_WRITER_SYNC_ANON;
+        Mm_WakePageWriter(false);
+    }
+}
+
+static __attribute__((no_instrument_function)) void reclaim_thread_entry()
+{
+    while (1)
+    {
+        OBOS_MAYBE_UNUSED obos_status status = Core_WaitOnObject(WAITABLE_OBJECT(reclaim_wake));
+        OBOS_ASSERT(obos_is_success(status));
+        reclaim();
+        atomic_store(&reclaim_pending, false);
+    }
+}
+
+void Mm_InitializeReclaimThread()
+{
+    thread_ctx ctx = {};
+    CoreS_SetupThreadContext(&ctx, (uintptr_t)reclaim_thread_entry, 0, false, Mm_VirtualMemoryAlloc(&Mm_KernelContext, nullptr, 0x10000, 0, VMA_FLAGS_KERNEL_STACK, nullptr, nullptr), 0x10000);
+    CoreH_ThreadInitialize(&reclaim_thread, THREAD_PRIORITY_LOW, Core_DefaultThreadAffinity, &ctx);
+    CoreH_ThreadReady(&reclaim_thread);
+    reclaim_thread_initialized = true;
+}
+
+void Mm_CheckReclaimWatermark()
+{
+    if (!reclaim_thread_initialized || Core_GetIrql() > IRQL_DISPATCH)
+        return;
+    // Use the same measure as reclaim(), otherwise a large standby list wakes up
+    // the reclaim thread on every allocation, only for it to find nothing to do.
+    if (available_pages() >= Mm_LowWatermark)
+        return;
+    if (atomic_exchange(&reclaim_pending, true))
+        return;
+    Core_EventSet(&reclaim_wake, false);
+}
+
+static void forget_context(clock_list* list, context* ctx)
+{
+    for (working_set_node* node = list->head; node; )
+    {
+        working_set_node* const next = node->next;
+        if (node->data->ctx == ctx)
+        {
+            REMOVE_WORKINGSET_PAGE_NODE(*list, node);
+            free_node(node);
+        }
+        node = next;
+    }
+}
+
+void Mm_ReclaimForgetContext(context* ctx)
+{
+    Core_MutexAcquire(&reclaim_lock);
+    irql oldIrql = Core_SpinlockAcquire(&clock_lock);
+    forget_context(&active_list, ctx);
+    forget_context(&inactive_list, ctx);
+    Core_SpinlockRelease(&clock_lock, oldIrql);
+    Core_MutexRelease(&reclaim_lock);
+}
+
+obos_status Mm_GetReclaimStats(mm_reclaim_stats* out)
+{
+    if (!out)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    const uint64_t now = CoreH_TickToNS(CoreS_GetTimerTick(), false);
+    irql oldIrql = Core_SpinlockAcquire(&stats_lock);
+    *out = stats;
+    const uint64_t elapsed = now - sample_time;
+    if (elapsed >= 1000000000)
+    {
+        scan_rate = (out->nScanned - sample_scanned) * 1000000000 / elapsed;
+        eviction_rate = (out->nEvicted - sample_evicted) * 1000000000 / elapsed;
+        sample_time = now;
+        sample_scanned = out->nScanned;
+        sample_evicted = out->nEvicted;
+    }
+    out->scanRate = scan_rate;
+    out->evictionRate = eviction_rate;
+    Core_SpinlockRelease(&stats_lock, oldIrql);
+    oldIrql = Core_SpinlockAcquire(&clock_lock);
+    out->nActivePages = active_list.nNodes;
+    out->nInactivePages = inactive_list.nNodes;
+    Core_SpinlockRelease(&clock_lock, oldIrql);
+    return OBOS_STATUS_SUCCESS;
+}
+#else
+void Mm_InitializeReclaimThread()
+{
+}
+void Mm_CheckReclaimWatermark()
+{
+}
+void Mm_ReclaimForgetContext(context* ctx)
+{
+    OBOS_UNUSED(ctx);
+}
+obos_status Mm_GetReclaimStats(mm_reclaim_stats* stats)
+{
+    OBOS_UNUSED(stats);
+    return OBOS_STATUS_UNIMPLEMENTED;
+}
+#endif
@@ -10,6 +10,8 @@
 #include <klog.h>
 #include <memmanip.h>
 
+#include <stdatomic.h>
+
 #include <locks/spinlock.h>
 
 #include <allocators/base.h>
@@ -104,14 +106,23 @@ page* MmH_PgAllocatePhysical(bool phys32, bool huge)
 	return MmH_AllocatePage(phys, huge);
 }
 
-page* MmH_AllocatePage(uintptr_t phys, bool huge)
+page* MmH_LookupPage(uintptr_t phys)
 {
-	if (!phys)
-		return nullptr;
+	const uintptr_t pfn = phys / OBOS_PAGE_SIZE;
+	if (obos_expect(pfn < Mm_PageArraySize, true))
+		return atomic_load_explicit(&Mm_PageArray[pfn], memory_order_acquire);
 	page key = {.phys=phys};
 	Core_MutexAcquire(&Mm_PhysicalPagesLock);
 	page* buf = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &key);
 	Core_MutexRelease(&Mm_PhysicalPagesLock);
+	return buf;
+}
+
+page* MmH_AllocatePage(uintptr_t phys, bool huge)
+{
+	if (!phys)
+		return nullptr;
+	page* buf = MmH_LookupPage(phys);
 	if (buf)
 	{
 		MmH_RefPage(buf);
@@ -123,9 +134,24 @@ page* MmH_AllocatePage(uintptr_t phys, bool huge)
 		buf->flags |= PHYS_PAGE_HUGE_PAGE;
 	buf->pagedCount = 0;
 	MmH_RefPage(buf);
-	Core_MutexAcquire(&Mm_PhysicalPagesLock);
-	RB_INSERT(phys_page_tree, &Mm_PhysicalPages, buf);
-	Core_MutexRelease(&Mm_PhysicalPagesLock);
+	const uintptr_t pfn = phys / OBOS_PAGE_SIZE;
+	if (obos_expect(pfn < Mm_PageArraySize, true))
+	{
+		page* existing = nullptr;
+		if (!atomic_compare_exchange_strong(&Mm_PageArray[pfn], &existing, buf))
+		{
+			// Someone else made a page struct for this address first.
+			Free(Mm_Allocator, buf, sizeof(*buf));
+			MmH_RefPage(existing);
+			return existing;
+		}
+	}
+	else
+	{
+		Core_MutexAcquire(&Mm_PhysicalPagesLock);
+		RB_INSERT(phys_page_tree, &Mm_PhysicalPages, buf);
+		Core_MutexRelease(&Mm_PhysicalPagesLock);
+	}
 	Mm_PhysicalMemoryUsage += (huge ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE);
 	return buf;
 }
@@ -137,11 +163,24 @@ page* MmH_RefPage(page* buf)
 	return buf;
 }
 
+void MmH_RemoveFromPagecacheLocked(page* buf)
+{
+	vnode* const vn = buf->backing_vn;
+	if (!vn)
+		return;
+	RB_REMOVE(pagecache_tree, &vn->cache, buf);
+	buf->backing_vn = nullptr;
+	// The caller keeps the vnode alive, so it is never freed here.
+	vn->refs--;
+}
+
 void MmH_RemoveFromPagecache(page* buf)
 {
 	if (buf->backing_vn)
 	{
+		irql oldIrql = Core_SpinlockAcquire(&buf->backing_vn->readahead.lock);
 		RB_REMOVE(pagecache_tree, &buf->backing_vn->cache, buf);
+		Core_SpinlockRelease(&buf->backing_vn->readahead.lock, oldIrql);
 		if (!(--buf->backing_vn->refs))
 		{
 			if (buf->backing_vn->vtype == VNODE_TYPE_CHR || buf->backing_vn->vtype == VNODE_TYPE_BLK || buf->backing_vn->vtype == VNODE_TYPE_FIFO || buf->backing_vn->vtype == VNODE_TYPE_SOCK)
@@ -159,6 +198,20 @@ void MmH_DerefPage(page* buf)
 	if (!(--buf->refcount))
 	{
 		OBOS_ASSERT(Mm_AnonPage != buf);
+		// Remove the page struct before freeing the page, so that whoever gets the page next
+		// cannot find this page struct.
+		const uintptr_t pfn = buf->phys / OBOS_PAGE_SIZE;
+		if (obos_expect(pfn < Mm_PageArraySize, true))
+		{
+			page* expected = buf;
+			atomic_compare_exchange_strong(&Mm_PageArray[pfn], &expected, nullptr);
+		}
+		else
+		{
+			Core_MutexAcquire(&Mm_PhysicalPagesLock);
+			RB_REMOVE(phys_page_tree, &Mm_PhysicalPages, buf);
+			Core_MutexRelease(&Mm_PhysicalPagesLock);
+		}
 		if (~buf->flags & PHYS_PAGE_MMIO)
 			Mm_FreePhysicalPages(buf->phys, ((buf->flags & PHYS_PAGE_HUGE_PAGE) ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE) / OBOS_PAGE_SIZE);
 
@@ -167,11 +220,6 @@ void MmH_DerefPage(page* buf)
 		else if (buf->flags & PHYS_PAGE_STANDBY)
 			LIST_REMOVE(phys_page_list, &Mm_StandbyPageList, buf);
 
-		// printf("removed page from tree (refcount %d)\n", buf->refcount);
-		Core_MutexAcquire(&Mm_PhysicalPagesLock);
-		RB_REMOVE(phys_page_tree, &Mm_PhysicalPages, buf);
-		Core_MutexRelease(&Mm_PhysicalPagesLock);
-
 		MmH_RemoveFromPagecache(buf);
 		
 		Mm_PhysicalMemoryUsage -= ((buf->flags & PHYS_PAGE_HUGE_PAGE) ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE);
@@ -209,27 +257,36 @@ void MmH_RefSwapAllocation(swap_allocation* alloc)
 }
 void MmH_DerefSwapAllocation(swap_allocation* alloc)
 {
+	// Every reference to the allocation is also a reference to its provider.
+	swap_dev* const provider = alloc->provider;
+	provider->refs--;
 	if (!(--alloc->refs))
 	{
 		LIST_REMOVE(swap_allocation_list, &Mm_SwapAllocations, alloc);
-		alloc->provider->swap_free(alloc->provider, alloc->id, alloc->phys->flags & PHYS_PAGE_DIRTY);
-		if (alloc->provider->awaiting_deinit && !(--alloc->provider->refs))
-		{
-			alloc->provider->deinit_dev(alloc->provider);
-			if (alloc->provider->free_obj)
-				alloc->provider->free_obj(alloc->provider);
-		}
+		// The page might still be on the standby list (e.g., if it was read ahead).
+		if (alloc->phys && alloc->phys->swap_alloc == alloc)
+			alloc->phys->swap_alloc = nullptr;
+		provider->swap_free(provider, alloc->id, alloc->phys && (alloc->phys->flags & PHYS_PAGE_HUGE_PAGE));
 		Free(Mm_Allocator, alloc, sizeof(*alloc));
 	}
+	if (provider->awaiting_deinit && !provider->refs)
+	{
+		provider->deinit_dev(provider);
+		if (provider->free_obj)
+			provider->free_obj(provider);
+	}
 }
 LIST_GENERATE(swap_allocation_list, struct swap_allocation, node);
 
+size_t Mm_DefaultFaultAroundPages = MM_DEFAULT_FAULT_AROUND_PAGES;
+
 void Mm_ConstructContext(context* ctx)
 {
 	OBOS_ASSERT(ctx);
 	memzero(ctx, sizeof(*ctx));
 	ctx->pt = MmS_AllocatePageTable();
 	ctx->lock = Core_SpinlockCreate();
+	ctx->faultAroundPages = Mm_DefaultFaultAroundPages;
 }
 
 OBOS_EXPORT obos_status Drv_TLBShootdown(page_table pt, uintptr_t base, size_t size)
@@ -19,7 +19,8 @@
 
 /// <summary>
 /// Populates a page structure with protection info about a page in a page table.</para>
-/// Note: If the page is unmapped, the physical address should still be populated.
+/// Note: If the page is unmapped, the physical address should still be populated.<para/>
+/// The accessed and dirty bits of the page are cleared.
 /// </summary>
 /// <param name="pt">The page table.</param>
 /// <param name="addr">The base address the page to query.</param>
@@ -28,6 +29,16 @@
 /// <returns>The status of the function.</returns>
 OBOS_EXPORT obos_status MmS_QueryPageInfo(page_table pt, uintptr_t addr, page_info* info, uintptr_t* phys);
 /// <summary>
+/// Same as MmS_QueryPageInfo, but leaves the accessed and dirty bits of the page alone.<para/>
+/// Use this to look at pages without taking away the reference information of the page replacement algorithm.
+/// </summary>
+/// <param name="pt">The page table.</param>
+/// <param name="addr">The base address the page to query.</param>
+/// <param name="info">[out] The page struct to put the info into. Can be nullptr.</param>
+/// <param name="phys">[out] The physical address of the addr. Can be nullptr.</param>
+/// <returns>The status of the function.</returns>
+OBOS_EXPORT obos_status MmS_PeekPageInfo(page_table pt, uintptr_t addr, page_info* info, uintptr_t* phys);
+/// <summary>
 /// Gets the current page table.
 /// <para/>NOTE: This always returns the kernel page table.
 /// </summary>
@@ -44,6 +55,20 @@ OBOS_EXPORT page_table MmS_GetCurrentPageTable();
 OBOS_EXPORT obos_status MmS_SetPageMapping(page_table pt, const page_info* page, uintptr_t phys, bool free_pte);
 
 OBOS_WEAK obos_status MmS_TLBShootdown(page_table pt, uintptr_t base, size_t size);
+/// <summary>
+/// Copies the mappings in [base, base+size) from one page table to another, for fork.<para/>
+/// Only the page tables that map something are walked, empty subtrees are skipped, and are not allocated in 'into'.<para/>
+/// 'cb' is called on every page that has an entry, and the value it leaves in info->prot.rw is written to both page tables.<para/>
+/// The TLB is not invalidated.
+/// </summary>
+/// <param name="into">The page table to copy the mappings to.</param>
+/// <param name="from">The page table to copy the mappings from.</param>
+/// <param name="base">The base of the range. Must be page aligned.</param>
+/// <param name="size">The size of the range. Must be page aligned.</param>
+/// <param name="cb">The function called on every page.</param>
+/// <param name="udata">The userdata passed to cb.</param>
+/// <returns>The status of the function.</returns>
+OBOS_WEAK obos_status MmS_ForkPageTables(page_table into, page_table from, uintptr_t base, size_t size, void(*cb)(page_info* info, void* udata), void* udata);
 
 OBOS_EXPORT obos_status Drv_TLBShootdown(page_table pt, uintptr_t base, size_t size);
 
@@ -119,6 +144,13 @@ typedef struct context
     spinlock lock;
     dpc file_mapping_dpc;
     memstat stat;
+    // The size (in pages) of the aligned window of pages around a faulting page that are mapped
+    // with it if they are resident, and read ahead with it if they are in swap.
+    // Zero or one disables fault-around. Always zero for the kernel context.
+    size_t faultAroundPages;
+    // Incremented (with the swap lock held) every time a swapped out page of this context is mapped back in,
+    // dropping the reference its page table entry had to its swap allocation.
+    _Atomic(size_t) swapInGeneration;
 } context;
 extern OBOS_EXPORT context Mm_KernelContext;
 extern char MmS_MMPageableRangeStart[];
@@ -127,6 +159,13 @@ bool MmH_IsAddressUnPageable(uintptr_t addr);
 
 extern memstat Mm_GlobalMemoryUsage;
 
+#ifndef MM_DEFAULT_FAULT_AROUND_PAGES
+#   define MM_DEFAULT_FAULT_AROUND_PAGES 16
+#endif
+#define MM_MAX_FAULT_AROUND_PAGES 64
+// The fault-around window of new contexts, set with --fault-around-pages.
+extern size_t Mm_DefaultFaultAroundPages;
+
 // Constructs a new (user-mode) context.
 void Mm_ConstructContext(context* ctx);
 
@@ -32,43 +32,120 @@
 
 #include <utils/tree.h>
 
+#include <stdatomic.h>
+
+struct cluster_write {
+    // Allocated up front along with the buffer, and reused by every write.
+    irp* req;
+    // Set if req was submitted for the current write.
+    bool submitted;
+    // Physical address of the buffer the pages are gathered into, SWAP_CLUSTER_MAX pages long.
+    uintptr_t buffer;
+    size_t nPages;
+    // The status of the write if it was done synchronously.
+    obos_status status;
+    // Set while the buffer is used by a write.
+    bool used;
+};
+
+// Swap space is allocated in page-sized slots, the slot of a swap id being id/OBOS_PAGE_SIZE.
+// Which slots are in use is tracked in a bitmap kept in memory, so reserving and freeing swap
+// space never touches the disk.
+// Swapped out pages do not survive a reboot, so the bitmap is never written to disk, and is
+// rebuilt from scratch by Mm_InitializeDiskSwap.
 struct metadata {
     vnode* vn;
-    uint64_t freelist_head;
+    // The LBA of the partition on its drive.
+    uint64_t base_lba;
     uint32_t magic; // same as DISK_SWAP_MAGIC
+    // Set bits are slots in use (including the slots of the header).
+    uint64_t* bitmap;
+    size_t nSlots;
+    size_t nFreeSlots;
+    // Where the next search starts, right after the last reservation.
+    size_t hint;
+    // The buffers and IRPs used by swap_write_start, allocated up front, as the page writer can't wait for memory.
+    struct cluster_write writes[SWAP_WRITES_IN_FLIGHT];
+    // The buffer used by swap_read_range, MM_MAX_FAULT_AROUND_PAGES pages long.
+    // Allocated up front, as swap_read_range is called with the swap lock held.
+    uintptr_t read_buffer;
+    atomic_flag read_buffer_used;
+    spinlock lock;
 };
 
 #define PAGE_SHIFT(huge) __builtin_ctz((huge) ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE)
 #define BLOCKS_PER_PAGE(block_size, huge) (((huge) ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE) / (block_size))
+#define SLOTS_PER_PAGE(huge) (((huge) ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE) / OBOS_PAGE_SIZE)
+#define BITMAP_WORD_BITS (sizeof(uint64_t)*8)
 
 static uint64_t block_id_to_lba(struct metadata* data, uintptr_t id, bool huge_page)
 {
     return (id >> PAGE_SHIFT(huge_page)) * BLOCKS_PER_PAGE(data->vn->blkSize, huge_page);
 }
-static uintptr_t lba_to_block_id(struct metadata* data, uint64_t lba, bool huge_page)
+
+static bool slot_used(const struct metadata* data, size_t slot)
 {
-    return (lba / BLOCKS_PER_PAGE(data->vn->blkSize, huge_page)) << PAGE_SHIFT(huge_page);
+    return data->bitmap[slot / BITMAP_WORD_BITS] & ((uint64_t)1 << (slot % BITMAP_WORD_BITS));
 }
 
-static obos_status read_freelist_node(struct metadata* data, uint64_t curr_lba, disk_swap_node* out)
+static void mark_slots(struct metadata* data, size_t slot, size_t nSlots, bool used)
 {
-    char buff[data->vn->blkSize];
-    memzero(buff, sizeof(buff));
-    const driver_header* hdr = Vfs_GetVnodeDriver(data->vn);
-    if (!hdr)
-        OBOS_Panic(OBOS_PANIC_FATAL_ERROR, "disk swap: driver pulled out from under our feet! (Vfs_GetVnodeDriver() returned nullptr)");
-    obos_status status = hdr->ftable.read_sync(data->vn->desc, buff, 1, curr_lba, nullptr);
-    if (obos_is_success(status))
-        memcpy(out, buff, sizeof(*out));
-    return status;
+    for (size_t i = slot; i < (slot + nSlots); i++)
+    {
+        if (used)
+            data->bitmap[i / BITMAP_WORD_BITS] |= ((uint64_t)1 << (i % BITMAP_WORD_BITS));
+        else
+            data->bitmap[i / BITMAP_WORD_BITS] &= ~((uint64_t)1 << (i % BITMAP_WORD_BITS));
+    }
 }
-static obos_status write_freelist_node(struct metadata* data, uint64_t curr_lba, const disk_swap_node* in)
+
+// Finds nSlots free contiguous slots in [begin, end), starting at a multiple of 'alignment'.
+// Returns SIZE_MAX if there are none.
+static size_t find_free_slots(const struct metadata* data, size_t begin, size_t end, size_t nSlots, size_t alignment)
 {
-    char buff[data->vn->blkSize];
-    memzero(buff, sizeof(buff));
-    memcpy(buff, in, sizeof(*in));
-    const driver_header* hdr = Vfs_GetVnodeDriver(data->vn);
-    return hdr->ftable.write_sync(data->vn->desc, buff, 1, curr_lba, nullptr);
+    size_t slot = (begin + (alignment-1)) & ~(alignment-1);
+    while ((slot + nSlots) <= end)
+    {
+        // Skip whole words of used slots at a time.
+        if (!(slot % BITMAP_WORD_BITS) && data->bitmap[slot / BITMAP_WORD_BITS] == UINT64_MAX)
+        {
+            slot += BITMAP_WORD_BITS;
+            continue;
+        }
+        size_t run = 0;
+        while (run < nSlots && !slot_used(data, slot + run))
+            run++;
+        if (run == nSlots)
+            return slot;
+        // Restart after the used slot.
+        slot = (slot + run + 1 + (alignment-1)) & ~(alignment-1);
+    }
+    return SIZE_MAX;
+}
+
+static obos_status reserve_slots(struct metadata* data, size_t nSlots, size_t alignment, uintptr_t* id)
+{
+    irql oldIrql = Core_SpinlockAcquire(&data->lock);
+    if (data->nFreeSlots < nSlots)
+    {
+        Core_SpinlockRelease(&data->lock, oldIrql);
+        return OBOS_STATUS_NO_SPACE;
+    }
+    // Next-fit, so that consecutive reservations tend to be contiguous on disk.
+    size_t slot = find_free_slots(data, data->hint, data->nSlots, nSlots, alignment);
+    if (slot == SIZE_MAX)
+        slot = find_free_slots(data, 0, data->nSlots, nSlots, alignment);
+    if (slot == SIZE_MAX)
+    {
+        Core_SpinlockRelease(&data->lock, oldIrql);
+        return OBOS_STATUS_NO_SPACE;
+    }
+    mark_slots(data, slot, nSlots, true);
+    data->nFreeSlots -= nSlots;
+    data->hint = slot + nSlots;
+    Core_SpinlockRelease(&data->lock, oldIrql);
+    *id = (uintptr_t)slot * OBOS_PAGE_SIZE;
+    return OBOS_STATUS_SUCCESS;
 }
 
 static obos_status swap_resv(struct swap_device* dev, uintptr_t* id, bool huge_page)
@@ -79,85 +156,135 @@ static obos_status swap_resv(struct swap_device* dev, uintptr_t* id, bool huge_p
     struct metadata* data = dev->metadata;
     if (!data || data->magic != DISK_SWAP_MAGIC)
         return OBOS_STATUS_INVALID_ARGUMENT;
-        
-    size_t nPages = huge_page ? OBOS_HUGE_PAGE_SIZE/OBOS_PAGE_SIZE : 1;
-    size_t alignment = nPages;
 
-    if (!data->freelist_head)
-        return OBOS_STATUS_NO_SPACE;
+    return reserve_slots(data, SLOTS_PER_PAGE(huge_page), SLOTS_PER_PAGE(huge_page), id);
+}
 
-    uint64_t lba = 0;
+static obos_status swap_free(struct swap_device* dev, uintptr_t id, bool huge_page)
+{
+    if (!dev || !id)
+        return OBOS_STATUS_INVALID_ARGUMENT;
 
-    disk_swap_node curr_data = {};
-    uint64_t curr_lba = data->freelist_head;
-    disk_swap_node prev_data = {};
-    uint64_t prev_lba = 0;
-    size_t alignment_diff = 0;
-    do 
-    {
-        read_freelist_node(data, curr_lba, &curr_data);
-        
-        alignment_diff = (((curr_lba + (alignment-1)) & ~(alignment-1)) - curr_lba) / BLOCKS_PER_PAGE(data->vn->blkSize, false);
-        if (curr_data.nPages >= (nPages+alignment_diff))
-        {
-            lba = curr_lba;
-            break;
-        }
+    struct metadata* data = dev->metadata;
+    if (!data || data->magic != DISK_SWAP_MAGIC)
+        return OBOS_STATUS_INVALID_ARGUMENT;
 
-        prev_data = curr_data;
-        prev_lba = curr_lba;
-        curr_lba = curr_data.next_lba;
-    } while(curr_lba);
+    size_t slot = id / OBOS_PAGE_SIZE;
+    size_t nSlots = SLOTS_PER_PAGE(huge_page);
+    if ((id % OBOS_PAGE_SIZE) || (slot + nSlots) > data->nSlots)
+        return OBOS_STATUS_INVALID_ARGUMENT;
 
-    curr_data.nPages -= nPages+alignment_diff;
-    write_freelist_node(data, curr_lba, &curr_data);
-    if (!curr_data.nPages)
+    irql oldIrql = Core_SpinlockAcquire(&data->lock);
+    for (size_t i = slot; i < (slot + nSlots); i++)
     {
-        if (curr_lba == data->freelist_head)
-            data->freelist_head = curr_data.next_lba;
-        if (prev_lba)
+        if (!slot_used(data, i))
         {
-            prev_data.next_lba = curr_data.next_lba;
-            write_freelist_node(data, prev_lba, &prev_data);
+            Core_SpinlockRelease(&data->lock, oldIrql);
+            OBOS_Error("disk swap: Double free of swap id 0x%p\n", id);
+            return OBOS_STATUS_INVALID_ARGUMENT;
         }
     }
-    lba = curr_lba+curr_data.nPages*BLOCKS_PER_PAGE(data->vn->blkSize, false);
-
-    *id = lba_to_block_id(data, lba, huge_page);
+    mark_slots(data, slot, nSlots, false);
+    data->nFreeSlots += nSlots;
+    Core_SpinlockRelease(&data->lock, oldIrql);
     return OBOS_STATUS_SUCCESS;
 }
 
-static obos_status swap_free(struct swap_device* dev, uintptr_t id, bool huge_page)
+static obos_status swap_write(struct swap_device* dev, uintptr_t id, page* pg)
 {
-    if (!dev || !id)
+    if (!dev || !id || !pg)
         return OBOS_STATUS_INVALID_ARGUMENT;
 
     struct metadata* data = dev->metadata;
     if (!data || data->magic != DISK_SWAP_MAGIC)
         return OBOS_STATUS_INVALID_ARGUMENT;
 
-    disk_swap_node node = {};
-    node.nPages = huge_page ? OBOS_HUGE_PAGE_SIZE/OBOS_PAGE_SIZE : 1;
-    node.next_lba = data->freelist_head;
+    uint64_t blkOffset = block_id_to_lba(data, id, pg->flags & PHYS_PAGE_HUGE_PAGE);
+    uint32_t blkCount = BLOCKS_PER_PAGE(data->vn->blkSize, pg->flags & PHYS_PAGE_HUGE_PAGE);
 
-    data->freelist_head = block_id_to_lba(data, id, huge_page);
-    return write_freelist_node(data, data->freelist_head, &node);
+    const driver_header* hdr = Vfs_GetVnodeDriver(data->vn);
+    return hdr->ftable.write_sync(data->vn->desc, MmS_MapVirtFromPhys(pg->phys), blkCount, blkOffset + data->base_lba, nullptr);
 }
 
-static obos_status swap_write(struct swap_device* dev, uintptr_t id, page* pg)
+static obos_status swap_write_start(struct swap_device* dev, uintptr_t id, page** pages, size_t nPages, void** out)
 {
-    if (!dev || !id || !pg)
+    if (!dev || !id || !pages || !nPages || !out)
         return OBOS_STATUS_INVALID_ARGUMENT;
 
     struct metadata* data = dev->metadata;
     if (!data || data->magic != DISK_SWAP_MAGIC)
         return OBOS_STATUS_INVALID_ARGUMENT;
 
-    uint32_t blkOffset = block_id_to_lba(data, id, pg->flags & PHYS_PAGE_HUGE_PAGE);
-    uint32_t blkCount = BLOCKS_PER_PAGE(data->vn->blkSize, pg->flags & PHYS_PAGE_HUGE_PAGE);
+    if (nPages > SWAP_CLUSTER_MAX)
+        return OBOS_STATUS_INVALID_ARGUMENT;
 
+    // The pages are scattered in physical memory, so they are gathered into one buffer to be written with one command.
+    struct cluster_write* w = nullptr;
+    irql oldIrql = Core_SpinlockAcquire(&data->lock);
+    for (size_t i = 0; i < SWAP_WRITES_IN_FLIGHT && !w; i++)
+        if (!data->writes[i].used && data->writes[i].buffer)
+            w = &data->writes[i];
+    if (w)
+        w->used = true;
+    Core_SpinlockRelease(&data->lock, oldIrql);
+    // The buffers could not be allocated, so the page writer writes the pages one at a time instead.
+    if (!w)
+        return OBOS_STATUS_NOT_ENOUGH_MEMORY;
+    w->submitted = false;
+    w->nPages = nPages;
+    w->status = OBOS_STATUS_SUCCESS;
+    *out = w;
+
+    for (size_t i = 0; i < nPages; i++)
+        memcpy(MmS_MapVirtFromPhys(w->buffer + i*OBOS_PAGE_SIZE), MmS_MapVirtFromPhys(pages[i]->phys), OBOS_PAGE_SIZE);
+
+    const uint64_t blkOffset = block_id_to_lba(data, id, false);
+    const size_t blkCount = nPages * BLOCKS_PER_PAGE(data->vn->blkSize, false);
     const driver_header* hdr = Vfs_GetVnodeDriver(data->vn);
-    return hdr->ftable.write_sync(data->vn->desc, MmS_MapVirtFromPhys(pg->phys), blkCount, blkOffset, nullptr);
+    if (hdr->ftable.submit_irp && w->req)
+    {
+        irp* req = w->req;
+        // Nobody else holds a reference once the last write was waited on.
+        OBOS_ASSERT(req->refs == 1);
+        memzero(req, sizeof(*req));
+        req->refs = 1;
+        req->vn = data->vn;
+        req->cbuff = MmS_MapVirtFromPhys(w->buffer);
+        req->op = IRP_WRITE;
+        req->dryOp = false;
+        req->status = OBOS_STATUS_SUCCESS;
+        req->blkCount = blkCount;
+        req->blkOffset = blkOffset;
+        // VfsH_IRPSubmit adds the offset of the partition itself.
+        if (obos_is_success(VfsH_IRPSubmit(req, nullptr)))
+        {
+            w->submitted = true;
+            return OBOS_STATUS_SUCCESS;
+        }
+    }
+    w->status = hdr->ftable.write_sync(data->vn->desc, MmS_MapVirtFromPhys(w->buffer), blkCount, blkOffset + data->base_lba, nullptr);
+    return OBOS_STATUS_SUCCESS;
+}
+
+static obos_status swap_write_finish(struct swap_device* dev, void* req)
+{
+    if (!dev || !req)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+
+    struct cluster_write* w = req;
+    obos_status status = w->status;
+    if (w->submitted)
+    {
+        status = VfsH_IRPWait(w->req);
+        if (obos_is_success(status) && w->req->nBlkWritten != w->req->blkCount)
+            status = OBOS_STATUS_INTERNAL_ERROR;
+    }
+    struct metadata* data = dev->metadata;
+    irql oldIrql = Core_SpinlockAcquire(&data->lock);
+    w->submitted = false;
+    w->used = false;
+    Core_SpinlockRelease(&data->lock, oldIrql);
+    return status;
 }
 
 static obos_status swap_read(struct swap_device* dev, uintptr_t id, page* pg)
@@ -169,11 +296,41 @@ static obos_status swap_read(struct swap_device* dev, uintptr_t id, page* pg)
     if (!data || data->magic != DISK_SWAP_MAGIC)
         return OBOS_STATUS_INVALID_ARGUMENT;
 
-    uint32_t blkOffset = block_id_to_lba(data, id, pg->flags & PHYS_PAGE_HUGE_PAGE);
+    uint64_t blkOffset = block_id_to_lba(data, id, pg->flags & PHYS_PAGE_HUGE_PAGE);
     uint32_t blkCount = BLOCKS_PER_PAGE(data->vn->blkSize, pg->flags & PHYS_PAGE_HUGE_PAGE);
 
     const driver_header* hdr = Vfs_GetVnodeDriver(data->vn);
-    return hdr->ftable.read_sync(data->vn->desc, MmS_MapVirtFromPhys(pg->phys), blkCount, blkOffset, nullptr);
+    return hdr->ftable.read_sync(data->vn->desc, MmS_MapVirtFromPhys(pg->phys), blkCount, blkOffset + data->base_lba, nullptr);
+}
+
+static obos_status swap_read_range(struct swap_device* dev, uintptr_t id, page** pages, size_t nPages)
+{
+    if (!dev || !id || !pages || !nPages)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+
+    struct metadata* data = dev->metadata;
+    if (!data || data->magic != DISK_SWAP_MAGIC)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+
+    // Like swap_write_start, the pages are read into one buffer then scattered.
+    // If the buffer is in use (or could not be allocated), the pages are read one at a time.
+    if (nPages > MM_MAX_FAULT_AROUND_PAGES || !data->read_buffer || atomic_flag_test_and_set(&data->read_buffer_used))
+    {
+        obos_status status = OBOS_STATUS_SUCCESS;
+        for (size_t i = 0; i < nPages && obos_is_success(status); i++)
+            status = swap_read(dev, id + i*OBOS_PAGE_SIZE, pages[i]);
+        return status;
+    }
+
+    const uint64_t blkOffset = block_id_to_lba(data, id, false);
+    const size_t blkCount = nPages * BLOCKS_PER_PAGE(data->vn->blkSize, false);
+    const driver_header* hdr = Vfs_GetVnodeDriver(data->vn);
+    obos_status status = hdr->ftable.read_sync(data->vn->desc, MmS_MapVirtFromPhys(data->read_buffer), blkCount, blkOffset + data->base_lba, nullptr);
+    if (obos_is_success(status))
+        for (size_t i = 0; i < nPages; i++)
+            memcpy(MmS_MapVirtFromPhys(pages[i]->phys), MmS_MapVirtFromPhys(data->read_buffer + i*OBOS_PAGE_SIZE), OBOS_PAGE_SIZE);
+    atomic_flag_clear(&data->read_buffer_used);
+    return status;
 }
 
 static obos_status deinit_dev(struct swap_device* dev)
@@ -185,6 +342,15 @@ static obos_status deinit_dev(struct swap_device* dev)
     if (!data || data->magic != DISK_SWAP_MAGIC)
         return OBOS_STATUS_INVALID_ARGUMENT;
 
+    for (size_t i = 0; i < SWAP_WRITES_IN_FLIGHT; i++)
+    {
+        if (data->writes[i].buffer)
+            Mm_FreePhysicalPages(data->writes[i].buffer, SWAP_CLUSTER_MAX);
+        VfsH_IRPUnref(data->writes[i].req);
+    }
+    if (data->read_buffer)
+        Mm_FreePhysicalPages(data->read_buffer, MM_MAX_FAULT_AROUND_PAGES);
+    Free(OBOS_NonPagedPoolAllocator, data->bitmap, ((data->nSlots + BITMAP_WORD_BITS-1) / BITMAP_WORD_BITS) * sizeof(uint64_t));
     return Free(OBOS_NonPagedPoolAllocator, dev->metadata, sizeof(struct metadata));
 }
 
@@ -237,21 +403,44 @@ obos_status Mm_InitializeDiskSwap(swap_dev* dev, partition* part)
     if (hdr.flags & DISK_SWAP_FLAGS_HIBERNATE)
         return OBOS_STATUS_INVALID_FILE;
     
+    size_t nSlots = vn->filesize / OBOS_PAGE_SIZE;
+    // The header takes up the first reserved_block_count blocks.
+    size_t nReservedSlots = (hdr.reserved_block_count * vn->blkSize + (OBOS_PAGE_SIZE-1)) / OBOS_PAGE_SIZE;
+    if (nReservedSlots >= nSlots)
+        return OBOS_STATUS_NO_SPACE;
+
     struct metadata* data = ZeroAllocate(OBOS_NonPagedPoolAllocator, 1, sizeof(struct metadata), nullptr);
-    data->freelist_head = hdr.reserved_block_count;
     data->vn = vn;
+    data->base_lba = (vn->flags & VFLAGS_PARTITION) ? vn->partitions[0].off / vn->blkSize : 0;
     data->magic = DISK_SWAP_MAGIC;
-
-    size_t blockCount = vn->filesize/vn->blkSize;
-    disk_swap_node node = {};
-    node.nPages = (blockCount-hdr.reserved_block_count) / BLOCKS_PER_PAGE(vn->blkSize, false);
-    write_freelist_node(data, data->freelist_head, &node);
+    data->lock = Core_SpinlockCreate();
+    data->nSlots = nSlots;
+    data->bitmap = ZeroAllocate(OBOS_NonPagedPoolAllocator, (nSlots + BITMAP_WORD_BITS-1) / BITMAP_WORD_BITS, sizeof(uint64_t), &st);
+    if (obos_is_error(st))
+    {
+        Free(OBOS_NonPagedPoolAllocator, data, sizeof(*data));
+        return st;
+    }
+    mark_slots(data, 0, nReservedSlots, true);
+    data->nFreeSlots = nSlots - nReservedSlots;
+    data->hint = nReservedSlots;
+    // If a buffer can't be allocated, there are just fewer writes in flight at once.
+    // Writes without an IRP are done synchronously.
+    for (size_t i = 0; i < SWAP_WRITES_IN_FLIGHT; i++)
+    {
+        data->writes[i].buffer = Mm_AllocatePhysicalPages(SWAP_CLUSTER_MAX, 1, nullptr);
+        data->writes[i].req = VfsH_IRPAllocate();
+    }
+    data->read_buffer = Mm_AllocatePhysicalPages(MM_MAX_FAULT_AROUND_PAGES, 1, nullptr);
 
     dev->metadata = data;
     dev->swap_resv = swap_resv;
     dev->swap_free = swap_free;
     dev->swap_write = swap_write;
     dev->swap_read = swap_read;
+    dev->swap_read_range = swap_read_range;
+    dev->swap_write_start = swap_write_start;
+    dev->swap_write_finish = swap_write_finish;
     dev->deinit_dev = deinit_dev;
 
     return OBOS_STATUS_SUCCESS;
@@ -26,11 +26,6 @@ enum {
 
 // In little-endian
 
-typedef struct disk_swap_node {
-    uint64_t next_lba;
-    size_t nPages;
-} disk_swap_node;
-
 #define DISK_SWAP_VERSION (1U)
 typedef struct disk_swap_header
 {
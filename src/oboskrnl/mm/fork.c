@@ -12,6 +12,7 @@
 #include <mm/context.h>
 #include <mm/alloc.h>
 #include <mm/page.h>
+#include <mm/swap.h>
 
 #include <vfs/pagecache.h>
 
@@ -24,6 +25,131 @@
 #include <utils/list.h>
 
 #include <locks/spinlock.h>
+#include <locks/mutex.h>
+
+typedef struct fork_swap_entry {
+    uintptr_t id;
+    // Where the page is mapped in both contexts.
+    uintptr_t virt;
+} fork_swap_entry;
+
+typedef struct fork_state {
+    // The pages that are swapped out, sorted by swap id.
+    // Allocated before the lock of the context is taken, with room for every swap allocation.
+    fork_swap_entry* swaps;
+    size_t nSwaps;
+    size_t maxSwaps;
+    // The span of the pages that were write-protected in the parent.
+    uintptr_t wp_base;
+    uintptr_t wp_top;
+} fork_state;
+
+static void record_swap_id(fork_state* state, uintptr_t id, uintptr_t virt)
+{
+    // The storage has room for every swap allocation, and a context can't have more swapped out pages than that.
+    OBOS_ENSURE(state->nSwaps < state->maxSwaps);
+    // Ranges are walked in order, and swap ids are mostly handed out in order,
+    // so this rarely has to move anything.
+    size_t i = state->nSwaps++;
+    for (; i && state->swaps[i - 1].id > id; i--)
+        state->swaps[i] = state->swaps[i - 1];
+    state->swaps[i].id = id;
+    state->swaps[i].virt = virt;
+}
+
+// References the swap allocations of every swapped out page that was recorded, in one pass over Mm_SwapAllocations,
+// instead of one lookup per page.
+// Must be called with the swap lock held.
+static void ref_swap_allocations(fork_state* state)
+{
+    swap_allocation* curr = LIST_GET_HEAD(swap_allocation_list, &Mm_SwapAllocations);
+    for (; curr && state->nSwaps; )
+    {
+        size_t lo = 0, hi = state->nSwaps;
+        while (lo < hi)
+        {
+            const size_t mid = lo + (hi - lo) / 2;
+            if (state->swaps[mid].id < curr->id)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (; lo < state->nSwaps && state->swaps[lo].id == curr->id; lo++)
+            MmH_RefSwapAllocation(curr);
+        curr = LIST_GET_NEXT(swap_allocation_list, &Mm_SwapAllocations, curr);
+    }
+}
+
+/*
+ * We need to:
+ * If the pages are already CoW, but are asym CoW, map them into the new context "as is".
+ * If the pages are sym cow, TODO.
+ * If a page is paged out at time of call, page it in if !pagedCount
+ * Map both page ranges as Sym CoW
+ * Go to the next range
+ */
+static void fork_page(page_info* info, void* udata)
+{
+    fork_state* state = udata;
+    if (info->prot.is_swap_phys)
+    {
+        record_swap_id(state, info->phys, info->virt);
+        return;
+    }
+    page* phys = MmH_LookupPage(info->phys);
+    if (!phys)
+        return;
+    MmH_RefPage(phys);
+    phys->pagedCount++;
+    if (!phys->backing_vn && phys->cow_type == COW_DISABLED)
+    {
+        phys->cow_type = COW_SYMMETRIC;
+        if (info->prot.rw)
+        {
+            const uintptr_t top = info->virt + (info->prot.huge_page ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE);
+            if (info->virt < state->wp_base)
+                state->wp_base = info->virt;
+            if (top > state->wp_top)
+                state->wp_top = top;
+        }
+        info->prot.rw = false;
+    }
+}
+
+static void fork_one_page(context* into, context* toFork, uintptr_t addr, fork_state* state)
+{
+    page_info info = {};
+    MmS_QueryPageInfo(toFork->pt, addr, &info, nullptr);
+    fork_page(&info, state);
+    MmS_SetPageMapping(toFork->pt, &info, info.phys, false);
+    MmS_SetPageMapping(into->pt, &info, info.phys, false);
+}
+
+// For architectures that can't walk their page tables for us.
+static void fork_range_generic(context* into, context* toFork, page_range* rng, fork_state* state)
+{
+    for (uintptr_t addr = rng->virt; addr < (rng->virt + rng->size); addr += (rng->prot.huge_page ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE))
+        fork_one_page(into, toFork, addr, state);
+}
+
+// Forks the pages that were recorded as swapped out again, in case they were swapped in since.
+// Must be called with the lock of toFork held.
+static void refork_swapped_pages(context* into, context* toFork, fork_state* state)
+{
+    // Entries are only ever written back at or before the index being read.
+    const size_t nSwaps = state->nSwaps;
+    state->nSwaps = 0;
+    for (size_t i = 0; i < nSwaps; i++)
+    {
+        const fork_swap_entry ent = state->swaps[i];
+        page_info info = {};
+        MmS_QueryPageInfo(toFork->pt, ent.virt, &info, nullptr);
+        if (info.prot.is_swap_phys && info.phys == ent.id)
+            record_swap_id(state, ent.id, ent.virt);
+        else
+            fork_one_page(into, toFork, ent.virt, state);
+    }
+}
 
 obos_status Mm_ForkContext(context* into, context* toFork)
 {
@@ -40,60 +166,84 @@ obos_status Mm_ForkContext(context* into, context* toFork)
     Mm_GlobalMemoryUsage.nonPaged += into->stat.nonPaged;
     Mm_GlobalMemoryUsage.paged += into->stat.paged;
 
-    irql oldIrql = Core_SpinlockAcquire(&toFork->lock);
+    fork_state state = {.wp_base=UINTPTR_MAX};
+    obos_status status = OBOS_STATUS_SUCCESS;
+
+    // Every swapped out page of toFork holds a reference to a swap allocation, and pages of toFork can't be
+    // swapped out while its lock is held, so there can't be more of them than there are swap allocations.
+    // The swap lock is a mutex, which can't be taken with the lock of the context held, so the storage is
+    // allocated beforehand, and allocated again if more pages were swapped out in the meantime.
+    irql oldIrql = IRQL_INVALID;
+    while (1)
+    {
+        const size_t nAllocations = LIST_GET_NODE_COUNT(swap_allocation_list, &Mm_SwapAllocations);
+        if (nAllocations > state.maxSwaps)
+        {
+            if (state.swaps)
+                Free(Mm_Allocator, state.swaps, state.maxSwaps * sizeof(fork_swap_entry));
+            state.maxSwaps = nAllocations + 64;
+            state.swaps = Allocate(Mm_Allocator, state.maxSwaps * sizeof(fork_swap_entry), &status);
+            if (!state.swaps || obos_is_error(status))
+                return obos_is_error(status) ? status : OBOS_STATUS_NOT_ENOUGH_MEMORY;
+        }
+        oldIrql = Core_SpinlockAcquire(&toFork->lock);
+        if (LIST_GET_NODE_COUNT(swap_allocation_list, &Mm_SwapAllocations) <= state.maxSwaps)
+            break;
+        Core_SpinlockRelease(&toFork->lock, oldIrql);
+    }
+
+    size_t swapInGeneration = atomic_load(&toFork->swapInGeneration);
     page_range* curr = nullptr;
     RB_FOREACH(curr, page_tree, &toFork->pages)
     {
-        if (curr->can_fork)
+        if (!curr->can_fork)
+            continue;
+
+        page_range* clone = ZeroAllocate(Mm_Allocator, 1, sizeof(page_range), nullptr);
+        memcpy(clone, curr, sizeof(*curr));
+        memzero(&clone->rb_node, sizeof(clone->rb_node));
+        RB_INSERT(page_tree, &into->pages, clone);
+
+        status = MmS_ForkPageTables ?
+            MmS_ForkPageTables(into->pt, toFork->pt, curr->virt, curr->size, fork_page, &state) :
+            OBOS_STATUS_UNIMPLEMENTED;
+        if (status == OBOS_STATUS_UNIMPLEMENTED)
         {
-            /*
-             * We need to:
-             * If the pages are already CoW, but are asym CoW, map them into the new context "as is".
-             * If the pages are sym cow, TODO.
-             * If a page is paged out at time of call, page it in if !pagedCount
-             * Map both page ranges as Sym CoW
-             * Go to the next range
-             */
-            page_range* clone = ZeroAllocate(Mm_Allocator, 1, sizeof(page_range), nullptr);
-            memcpy(clone, curr, sizeof(*curr));
-            memzero(&clone->rb_node, sizeof(clone->rb_node));
-            RB_INSERT(page_tree, &into->pages, clone);
-
-            for (uintptr_t addr = curr->virt; addr < (curr->virt + curr->size); addr += (curr->prot.huge_page ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE))
-            {
-                page_info info = {};
-                MmS_QueryPageInfo(toFork->pt, addr, &info, nullptr);
-                page what = {.phys=info.phys};
-                Core_MutexAcquire(&Mm_PhysicalPagesLock);
-                page* phys = (info.prot.is_swap_phys) ? nullptr : RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what);
-                Core_MutexRelease(&Mm_PhysicalPagesLock);
-                if (phys)
-                {
-                    MmH_RefPage(phys);
-                    phys->pagedCount++;
-                    if (!phys->backing_vn)
-                    {
-                        if (phys->cow_type == COW_DISABLED)
-                        {
-                            phys->cow_type = COW_SYMMETRIC;
-                            info.prot.rw = false;
-                        }
-                        // else
-                        //     info.prot.present = false;
-                    }
-                    
-                } else if (info.prot.is_swap_phys)
-                {
-                    swap_allocation* swap_alloc = MmH_LookupSwapAllocation(info.phys);
-                    MmH_RefSwapAllocation(swap_alloc);
-                }
-                MmS_SetPageMapping(toFork->pt, &info, info.phys, false);
-                MmS_SetPageMapping(into->pt, &info, info.phys, false);
-            }
-            MmS_TLBShootdown(toFork->pt, curr->virt, curr->size);
+            fork_range_generic(into, toFork, curr, &state);
+            status = OBOS_STATUS_SUCCESS;
         }
+        // Whatever was copied so far is consistent, and is cleaned up with the rest of the context.
+        if (obos_is_error(status))
+            break;
     }
     Core_SpinlockRelease(&toFork->lock, oldIrql);
 
-    return OBOS_STATUS_SUCCESS;
+    // The swap allocations are kept alive by the page table entries of toFork, which only drop their reference
+    // when the page is swapped in, so if nothing was swapped in since the pages were recorded, all of them can
+    // be referenced. Otherwise, the pages that were swapped in are forked again.
+    while (state.nSwaps)
+    {
+        irql oldIrql2 = Mm_TakeSwapLock();
+        if (atomic_load(&toFork->swapInGeneration) == swapInGeneration)
+        {
+            ref_swap_allocations(&state);
+            Mm_ReleaseSwapLock(oldIrql2);
+            break;
+        }
+        Mm_ReleaseSwapLock(oldIrql2);
+
+        oldIrql = Core_SpinlockAcquire(&toFork->lock);
+        swapInGeneration = atomic_load(&toFork->swapInGeneration);
+        refork_swapped_pages(into, toFork, &state);
+        Core_SpinlockRelease(&toFork->lock, oldIrql);
+    }
+
+    // One shootdown for every page that was write-protected, instead of one per range.
+    if (state.wp_base < state.wp_top)
+        MmS_TLBShootdown(toFork->pt, state.wp_base, state.wp_top - state.wp_base);
+
+    if (state.swaps)
+        Free(Mm_Allocator, state.swaps, state.maxSwaps * sizeof(fork_swap_entry));
+
+    return status;
 }
@@ -35,6 +35,8 @@
 
 obos_status Mm_AgingPRA(context* ctx);
 obos_status Mm_AgingReferencePage(context* ctx, working_set_node* node);
+obos_status Mm_ClockPRA(context* ctx);
+obos_status Mm_ClockReferencePage(context* ctx, working_set_node* node);
 
 static void map_file_region(context* ctx, page_range* rng, uintptr_t addr, uint32_t ec, fault_type *type, page_info *info)
 {
@@ -44,7 +46,7 @@ static void map_file_region(context* ctx, page_range* rng, uintptr_t addr, uint3
         return;
     }
     page what = {.backing_vn=rng->un.mapped_vn,.file_offset = rng->base_file_offset + (addr-rng->virt)};
-    page* phys = RB_FIND(pagecache_tree, &rng->un.mapped_vn->cache, &what);
+    page* phys = VfsH_PageCacheLookup(rng->un.mapped_vn, what.file_offset, true);
     if (!phys)
     {
         *type = HARD_FAULT;
@@ -77,6 +79,96 @@ static void map_file_region(context* ctx, page_range* rng, uintptr_t addr, uint3
     Core_SpinlockRelease(&ctx->lock, oldIrql);
 }
 
+bool MmH_FaultAroundWindow(context* ctx, page_range* rng, uintptr_t addr, uintptr_t* base, uintptr_t* end)
+{
+    size_t window = ctx->faultAroundPages;
+    if (window <= 1 || rng->prot.huge_page)
+        return false;
+    if (window > MM_MAX_FAULT_AROUND_PAGES)
+        window = MM_MAX_FAULT_AROUND_PAGES;
+    addr -= (addr % OBOS_PAGE_SIZE);
+    *base = addr - ((addr / OBOS_PAGE_SIZE) % window) * OBOS_PAGE_SIZE;
+    *end = *base + window * OBOS_PAGE_SIZE;
+    uintptr_t rng_base = rng->virt + (rng->hasGuardPage ? OBOS_PAGE_SIZE : 0);
+    if (*base < rng_base)
+        *base = rng_base;
+    if (*end > rng->virt + rng->size)
+        *end = rng->virt + rng->size;
+    return true;
+}
+
+// Maps the page at info->virt if it is already in the page cache, without waiting for any reads.
+static bool map_cached_file_page(context* ctx, page_range* rng, page_info* info)
+{
+    page* phys = VfsH_PageCacheLookup(rng->un.mapped_vn, rng->base_file_offset + (info->virt-rng->virt), false);
+    if (!phys || (phys->flags & PHYS_PAGE_INVALID))
+        return false;
+    irql oldIrql = Core_SpinlockAcquire(&ctx->lock);
+    // Someone might've mapped it while the lock was not held.
+    page_info curr = {};
+    MmS_QueryPageInfo(ctx->pt, info->virt, &curr, nullptr);
+    if (curr.prot.present || curr.phys)
+    {
+        Core_SpinlockRelease(&ctx->lock, oldIrql);
+        return false;
+    }
+    MmH_RefPage(phys);
+    info->prot = rng->prot;
+    info->prot.present = true;
+    info->phys = phys->phys;
+    if (rng->priv)
+    {
+        info->prot.rw = false;
+        phys->cow_type = COW_SYMMETRIC;
+    }
+    phys->pagedCount++;
+    MmS_SetPageMapping(ctx->pt, info, phys->phys, false);
+    Core_SpinlockRelease(&ctx->lock, oldIrql);
+    return true;
+}
+
+static obos_status ref_page(context* ctx, const page_info *curr);
+
+// Maps the pages around a serviced fault at 'addr' that can be mapped without any I/O, that is,
+// file pages already in the page cache, and swapped out pages still on the dirty or standby lists
+// (including those that were just read ahead by Mm_SwapIn).
+static void fault_around(context* ctx, page_range* rng, uintptr_t addr)
+{
+    uintptr_t base = 0, end = 0;
+    if (!MmH_FaultAroundWindow(ctx, rng, addr, &base, &end))
+        return;
+    addr -= (addr % OBOS_PAGE_SIZE);
+    bool mapped = false;
+    for (uintptr_t virt = base; virt < end; virt += OBOS_PAGE_SIZE)
+    {
+        if (virt == addr)
+            continue;
+        page_info info = {};
+        // Resident neighbours are skipped, don't take away their reference information.
+        MmS_PeekPageInfo(ctx->pt, virt, &info, nullptr);
+        if (info.prot.present || info.prot.lck)
+            continue;
+        info.range = rng;
+        if (rng->un.mapped_vn)
+        {
+            if (!info.phys && !info.prot.is_swap_phys)
+                mapped = map_cached_file_page(ctx, rng, &info) || mapped;
+            continue;
+        }
+        if (!info.prot.is_swap_phys || obos_is_error(Mm_SwapInResident(ctx, &info)))
+            continue;
+        mapped = true;
+        irql oldIrql = Core_SpinlockAcquire(&ctx->lock);
+        ctx->stat.paged -= OBOS_PAGE_SIZE;
+        Mm_GlobalMemoryUsage.paged -= OBOS_PAGE_SIZE;
+        MmS_QueryPageInfo(ctx->pt, virt, &info, nullptr);
+        ref_page(ctx, &info);
+        Core_SpinlockRelease(&ctx->lock, oldIrql);
+    }
+    if (mapped)
+        MmS_TLBShootdown(ctx->pt, base, end-base);
+}
+
 static bool sym_cow_cpy(context* ctx, page_range* rng, uintptr_t addr, uint32_t ec, page** pg, page_info* info)
 {
     OBOS_UNUSED(addr && ec);
@@ -125,6 +217,8 @@ static obos_status ref_page(context* ctx, const page_info *curr)
     node->data = ent;
 #if defined(OBOS_PAGE_REPLACEMENT_AGING)
     status = Mm_AgingReferencePage(ctx, node);
+#elif defined(OBOS_PAGE_REPLACEMENT_CLOCK)
+    status = Mm_ClockReferencePage(ctx, node);
 #else
 #   error No page replacement algorithm defined at compile time. This is a bug.
 #endif
@@ -215,10 +309,7 @@ obos_status Mm_HandlePageFault(context* ctx, uintptr_t addr, uint32_t ec)
     page* pg = nullptr;
     do
     {
-        page what = {.phys=curr.phys};
-        Core_MutexAcquire(&Mm_PhysicalPagesLock);
-        pg = (curr.phys && !curr.prot.is_swap_phys) ? RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what) : nullptr;
-        Core_MutexRelease(&Mm_PhysicalPagesLock);
+        pg = (curr.phys && !curr.prot.is_swap_phys) ? MmH_LookupPage(curr.phys) : nullptr;
         if (!pg && !rng->un.mapped_vn && !curr.prot.is_swap_phys)
         {
             OBOS_Debug("No physical page found for virtual page %p (curr.phys: %p, found nothing)\n", curr.virt, curr.phys);
@@ -244,7 +335,11 @@ obos_status Mm_HandlePageFault(context* ctx, uintptr_t addr, uint32_t ec)
         handled = true;
         fault_type curr_type = SOFT_FAULT;
         if (~ec & PF_EC_PRESENT)
+        {
             map_file_region(ctx, rng, addr, ec, &curr_type, &curr);
+            if (curr_type != ACCESS_FAULT)
+                fault_around(ctx, rng, addr);
+        }
         else
             handled = false;
         if (curr_type > type && handled)
@@ -295,6 +390,8 @@ obos_status Mm_HandlePageFault(context* ctx, uintptr_t addr, uint32_t ec)
         ref_page(ctx, &curr);
         handled = true;
         Core_SpinlockRelease(&ctx->lock, oldIrql);
+        if (curr_type != ACCESS_FAULT)
+            fault_around(ctx, rng, addr);
     }
     done:
     if (!handled && type == INVALID_FAULT)
@@ -335,6 +432,8 @@ obos_status Mm_RunPRA(context* ctx)
     obos_status status = OBOS_STATUS_SUCCESS;
 #if defined(OBOS_PAGE_REPLACEMENT_AGING)
     status = Mm_AgingPRA(ctx);
+#elif defined(OBOS_PAGE_REPLACEMENT_CLOCK)
+    status = Mm_ClockPRA(ctx);
 #else
 #   error No page replacement algorithm defined at compile time. This is a bug.
 #endif
@@ -56,6 +56,17 @@ typedef enum {
 /// <returns>OBOS_STATUS_SUCCESS if the page fault was handled, OBOS_STATUS_UNHANDLED if the page fault went unhandled, otherwise an error.</returns>
 OBOS_EXPORT obos_status Mm_HandlePageFault(context* ctx, uintptr_t addr, uint32_t ec);
 /// <summary>
+/// Gets the fault-around window of a page fault in a context, which is the block of ctx->faultAroundPages pages
+/// that contains the faulting page, clipped to the page range.
+/// </summary>
+/// <param name="ctx">The context where the fault happened.</param>
+/// <param name="rng">The page range of the faulting address.</param>
+/// <param name="addr">The faulting address.</param>
+/// <param name="base">[out] The first address of the window.</param>
+/// <param name="end">[out] The end address of the window.</param>
+/// <returns>Whether fault-around should be done.</returns>
+bool MmH_FaultAroundWindow(context* ctx, page_range* rng, uintptr_t addr, uintptr_t* base, uintptr_t* end);
+/// <summary>
 /// Runs the page replacement algorithm on pages in a context.<para/>
 /// This essentially chooses pages from within the context, and puts them within the working-set of the context.
 /// </summary>
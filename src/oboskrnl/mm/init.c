@@ -16,6 +16,7 @@
 #include <mm/pmm.h>
 #include <mm/page.h>
 #include <mm/swap.h>
+#include <mm/reclaim.h>
 #include <mm/alloc.h>
 
 #include <scheduler/cpu_local.h>
@@ -195,6 +196,9 @@ void Mm_Initialize()
     Mm_KernelContext.workingSet.capacity = OBOS_GetOPTD_Ex("working-set-cap", 4*1024*1024);
     if (Mm_KernelContext.workingSet.capacity < OBOS_PAGE_SIZE && Mm_KernelContext.workingSet.capacity != 0)
         OBOS_Warning("Working set capacity set to < PAGE_SIZE.\n");
+    Mm_DefaultFaultAroundPages = OBOS_GetOPTD_Ex("fault-around-pages", MM_DEFAULT_FAULT_AROUND_PAGES);
+    if (Mm_DefaultFaultAroundPages > MM_MAX_FAULT_AROUND_PAGES)
+        Mm_DefaultFaultAroundPages = MM_MAX_FAULT_AROUND_PAGES;
     initialized = true;
     page_range* i = nullptr;
     // size_t committedMemory;
@@ -219,6 +223,7 @@ void Mm_Initialize()
     memcpy(&Mm_GlobalMemoryUsage, &Mm_KernelContext.stat, sizeof(memstat));
     Core_SpinlockRelease(&Mm_KernelContext.lock, oldIrql);
     Mm_InitializePageWriter();
+    Mm_InitializeReclaimThread();
 #if 1
     OBOS_Log("Initialized MM.\n");
     if (OBOS_GetLogLevel() < LOG_LEVEL_LOG)
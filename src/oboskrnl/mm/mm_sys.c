@@ -172,6 +172,18 @@ obos_status Sys_ContextGetStat(handle ctx, memstat* stat)
     Core_SpinlockRelease(&vmm_ctx->lock, oldIrql);
     return status;
 }
+obos_status Sys_ContextSetFaultAround(handle ctx, size_t nPages)
+{
+    if (nPages > MM_MAX_FAULT_AROUND_PAGES)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    context* vmm_ctx = context_from_handle(ctx, true, OBOS_STATUS_SUCCESS, true);
+    if (vmm_ctx == &Mm_KernelContext)
+        return OBOS_STATUS_ACCESS_DENIED;
+    irql oldIrql = Core_SpinlockAcquire(&vmm_ctx->lock);
+    vmm_ctx->faultAroundPages = nPages;
+    Core_SpinlockRelease(&vmm_ctx->lock, oldIrql);
+    return OBOS_STATUS_SUCCESS;
+}
 
 size_t Sys_GetUsedPhysicalMemoryCount()
 {
@@ -181,6 +193,23 @@ size_t Sys_GetCachedByteCount()
 {
     return Mm_CachedBytes;
 }
+obos_status Sys_GetPMMStats(pmm_stats* ustats)
+{
+    pmm_stats stats = {};
+    obos_status status = Mm_GetPMMStats(&stats);
+    if (obos_is_error(status))
+        return status;
+    return memcpy_k_to_usr(ustats, &stats, sizeof(stats));
+}
+
+obos_status Sys_GetReclaimStats(mm_reclaim_stats* ustats)
+{
+    mm_reclaim_stats stats = {};
+    obos_status status = Mm_GetReclaimStats(&stats);
+    if (obos_is_error(status))
+        return status;
+    return memcpy_k_to_usr(ustats, &stats, sizeof(stats));
+}
 
 obos_status Sys_QueryPageInfo(handle ctx, void* base, page_info* info)
 {
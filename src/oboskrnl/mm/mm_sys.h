@@ -13,6 +13,8 @@
 #include <mm/alloc.h>
 #include <mm/context.h>
 #include <mm/page.h>
+#include <mm/pmm.h>
+#include <mm/reclaim.h>
 
 struct vma_alloc_userspace_args
 {
@@ -30,9 +32,13 @@ obos_status Sys_VirtualMemoryUnlock(handle ctx, void* base, size_t size);
 handle Sys_MakeNewContext(size_t ws_capacity);
 obos_status Sys_ContextExpandWSCapacity(handle ctx, size_t ws_capacity);
 obos_status Sys_ContextGetStat(handle ctx, memstat* stat);
+// Sets the fault-around window of a context, in pages (see context::faultAroundPages).
+obos_status Sys_ContextSetFaultAround(handle ctx, size_t nPages);
 
 size_t Sys_GetUsedPhysicalMemoryCount();
 size_t Sys_GetCachedByteCount();
+obos_status Sys_GetPMMStats(pmm_stats* stats);
+obos_status Sys_GetReclaimStats(mm_reclaim_stats* stats);
 
 obos_status Sys_QueryPageInfo(handle ctx, void* base, page_info* info);
 
@@ -52,9 +52,17 @@ typedef enum phys_page_flags
     PHYS_PAGE_MMIO = BIT(3),
     PHYS_PAGE_LOCKED = BIT(4),
     PHYS_PAGE_INVALID = BIT(5),
+    // The page was read into the page cache by readahead, and has not been accessed yet.
+    PHYS_PAGE_READAHEAD = BIT(6),
+    // The read filling this page cache entry is still in progress.
+    PHYS_PAGE_READ_PENDING = BIT(7),
+    // Accessing this page cache entry starts the next asynchronous readahead.
+    PHYS_PAGE_READAHEAD_MARK = BIT(8),
+    // The page writer is writing this page to swap.
+    PHYS_PAGE_WRITEBACK = BIT(9),
 } phys_page_flags;
 
-// TODO: Move this into an array for faster allocation and lookup?
+// Only holds pages that are outside of Mm_PageArray, such as MMIO pages.
 typedef RB_HEAD(phys_page_tree, page) phys_page_tree;
 RB_PROTOTYPE(phys_page_tree, page, rb_node, phys_page_cmp);
 
@@ -85,7 +93,7 @@ typedef struct page
     _Atomic(size_t) pagedCount;
 
     struct swap_allocation* swap_alloc;
-    phys_page_flags flags;
+    _Atomic(phys_page_flags) flags;
 
     enum {
         COW_DISABLED,
@@ -123,6 +131,9 @@ inline static int pagecache_tree_cmp(struct page* lhs, struct page* rhs)
 
 OBOS_EXPORT void MmH_DerefPage(page* buf);
 OBOS_EXPORT void MmH_RemoveFromPagecache(page* buf);
+// Same as MmH_RemoveFromPagecache, but the readahead lock of the page's vnode must be held,
+// and the caller must hold a reference to the vnode, as it is never freed here.
+OBOS_EXPORT void MmH_RemoveFromPagecacheLocked(page* buf);
 #ifndef __clang__
 // NOTE: Adds a reference to the page.
 OBOS_EXPORT  __attribute__((malloc, malloc(MmH_DerefPage, 1))) page* MmH_PgAllocatePhysical(bool phys32, bool huge);
@@ -133,8 +144,18 @@ OBOS_EXPORT page* MmH_PgAllocatePhysical(bool phys32, bool huge);
 OBOS_EXPORT page* MmH_AllocatePage(uintptr_t phys, bool huge);
 OBOS_EXPORT page* MmH_RefPage(page* buf);
 #endif
+// Looks up the page struct of a physical address.
+// This does not add a reference to the page.
+// Lock-free for any address inside of Mm_PageArray.
+OBOS_EXPORT page* MmH_LookupPage(uintptr_t phys);
 OBOS_EXPORT extern phys_page_tree Mm_PhysicalPages;
 OBOS_EXPORT extern mutex Mm_PhysicalPagesLock;
+// A PFN-indexed array of the page structs of all physical memory up to the end of the
+// highest usable memory region. Entries are nullptr for pages that have no page struct.
+// Set up by the PMM.
+OBOS_EXPORT extern _Atomic(page*)* Mm_PageArray;
+// The amount of entries in Mm_PageArray.
+OBOS_EXPORT extern size_t Mm_PageArraySize;
 // OBOS_EXPORT extern pagecache_tree Mm_Pagecache;
 OBOS_EXPORT extern size_t Mm_PhysicalMemoryUsage; // Current physical memory usage in bytes.
 
@@ -177,6 +198,12 @@ typedef struct working_set_entry
     uint16_t workingSets;
 #if OBOS_PAGE_REPLACEMENT_AGING
     uint8_t age;
+#endif
+#if OBOS_PAGE_REPLACEMENT_CLOCK
+    // The context the page is mapped in.
+    struct context* ctx;
+    // Set if the page is on the active list, otherwise, it's on the inactive list.
+    bool active : 1;
 #endif
     // Set to true when this needs to be freed.
     bool free : 1;
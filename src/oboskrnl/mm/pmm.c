@@ -13,188 +13,489 @@
 
 #include <irq/irql.h>
 
+#include <scheduler/cpu_local.h>
+
 #include <asan.h>
+#include <cmdline.h>
 
 #include <mm/pmm.h>
 #include <mm/init.h>
 #include <mm/alloc.h>
 #include <mm/page.h>
 #include <mm/swap.h>
+#include <mm/reclaim.h>
+
+#include <allocators/base.h>
+
+/*
+ * Free memory is managed by a binary buddy allocator.
+ * Each zone keeps a free list per order, where a block of order n is (1 << n) pages
+ * that are aligned to (1 << n) pages. Free blocks are linked through their first page
+ * (through the HHDM), and s_orderMap records, for each page, (order+1) if the page starts
+ * a free block, so that the buddy of a block can be found without walking any list.
+ * Single page allocations are served from a per-CPU hot page list first, which is refilled
+ * from and drained to the zones in batches.
+ */
 
 struct pmm_freelist_node
 {
-	size_t nPages;
-	struct pmm_freelist_node *next, *prev;
+	// Physical addresses.
+	uintptr_t next, prev;
 };
 
-static struct pmm_freelist_node *s_head;
-static struct pmm_freelist_node *s_tail;
-#if OBOS_ARCHITECTURE_BITS == 64
+typedef struct pmm_zone
+{
+	uintptr_t freeLists[PMM_MAX_ORDER + 1];
+	size_t nFreeBlocks[PMM_MAX_ORDER + 1];
+	size_t nFreePages;
+	spinlock lock;
+} pmm_zone;
 
-// 32-bit region start
-static struct pmm_freelist_node *s_head32;
-// 32-bit region tail
-static struct pmm_freelist_node *s_tail32;
+static pmm_zone s_zones[PMM_ZONE_MAX + 1];
+static uint8_t* s_orderMap;
+// The amount of pages covered by s_orderMap.
+static size_t s_orderMapPages;
+static _Atomic(size_t) s_nContiguousAllocations;
+static _Atomic(size_t) s_nContiguousFailures;
+// Enabled after SMP initialization, since the BSP's cpu_local is moved then.
+static bool s_hotPagesEnabled;
+
+_Atomic(page*)* Mm_PageArray;
+size_t Mm_PageArraySize;
 
-#endif
 size_t Mm_TotalPhysicalPages;
-size_t Mm_TotalPhysicalPagesUsed;
+_Atomic(size_t) Mm_TotalPhysicalPagesUsed;
 size_t Mm_UsablePhysicalPages;
 uintptr_t Mm_PhysicalMemoryBoundaries;
-static spinlock lock;
+size_t Mm_LowWatermark;
+size_t Mm_HighWatermark;
 
-obos_status Mm_InitializePMM()
+#define MAP_TO_HHDM(addr, type) ((type*)(MmS_MapVirtFromPhys((uintptr_t)(addr))))
+#define UNMAP_FROM_HHDM(addr) (MmS_UnmapVirtFromPhys((void*)(addr)))
+#define PFN(addr) ((uintptr_t)(addr) / OBOS_PAGE_SIZE)
+#define ORDER_PAGES(order) ((size_t)1 << (order))
+
+// The hot page list of a CPU is refilled and drained HOT_PAGES_BATCH pages at a time,
+// and is drained once it has more than HOT_PAGES_HIGH pages.
+#define HOT_PAGES_BATCH 16
+#define HOT_PAGES_HIGH 64
+
+static pmm_zone* zone_of(uintptr_t phys)
 {
-	uintptr_t i = 0;
-	if (!MmS_GetFirstPMemMapEntry(&i))
-		return OBOS_STATUS_INVALID_INIT_PHASE;
-	for (obos_pmem_map_entry* entry = MmS_GetFirstPMemMapEntry(&i); entry; )
-	{
-		uintptr_t phys = entry->pmem_map_base;
-		size_t nPages = entry->pmem_map_size / OBOS_PAGE_SIZE;
-		if (phys % OBOS_PAGE_SIZE)
-		{
-			phys = phys + (OBOS_PAGE_SIZE-(phys%OBOS_PAGE_SIZE));
-			nPages--;
-		}
-		if (phys == 0x0)
-		{
-#ifdef __x86_64__
-			phys = OBOS_PAGE_SIZE*3;
-			if (nPages <= 3)
-			{
-				entry = MmS_GetNextPMemMapEntry(entry, &i);
-				continue;
-			}
-			nPages -= 3;
+#if OBOS_ARCHITECTURE_BITS == 64
+	if (phys < 0x100000000)
+		return &s_zones[PMM_ZONE_32BIT];
 #else
-			phys = OBOS_PAGE_SIZE;
-			nPages--;
+	OBOS_UNUSED(phys);
 #endif
-		}
-#if __x86_64__
-		// smp trampoline is on 0x1000
-		if (phys == 0x1000)
+	return &s_zones[PMM_ZONE_NORMAL];
+}
+
+static size_t floor_log2(size_t val)
+{
+	return sizeof(size_t)*8 - 1 - __builtin_clzl(val);
+}
+static size_t ceil_log2(size_t val)
+{
+	return val <= 1 ? 0 : floor_log2(val - 1) + 1;
+}
+
+OBOS_NO_KASAN static void freelist_add(pmm_zone* zone, uintptr_t phys, size_t order)
+{
+	struct pmm_freelist_node* node = MAP_TO_HHDM(phys, struct pmm_freelist_node);
+	node->prev = 0;
+	node->next = zone->freeLists[order];
+	if (node->next)
+		MAP_TO_HHDM(node->next, struct pmm_freelist_node)->prev = phys;
+	zone->freeLists[order] = phys;
+	zone->nFreeBlocks[order]++;
+	zone->nFreePages += ORDER_PAGES(order);
+	Mm_TotalPhysicalPagesUsed -= ORDER_PAGES(order);
+	s_orderMap[PFN(phys)] = order + 1;
+}
+OBOS_NO_KASAN static void freelist_remove(pmm_zone* zone, uintptr_t phys, size_t order)
+{
+	struct pmm_freelist_node* node = MAP_TO_HHDM(phys, struct pmm_freelist_node);
+	if (node->next)
+		MAP_TO_HHDM(node->next, struct pmm_freelist_node)->prev = node->prev;
+	if (node->prev)
+		MAP_TO_HHDM(node->prev, struct pmm_freelist_node)->next = node->next;
+	if (zone->freeLists[order] == phys)
+		zone->freeLists[order] = node->next;
+	node->next = node->prev = 0;
+	zone->nFreeBlocks[order]--;
+	zone->nFreePages -= ORDER_PAGES(order);
+	Mm_TotalPhysicalPagesUsed += ORDER_PAGES(order);
+	s_orderMap[PFN(phys)] = 0;
+}
+
+// Frees a block, merging it with its buddy for as long as the buddy is free.
+// The zone's lock must be held.
+OBOS_NO_KASAN static void free_block(pmm_zone* zone, uintptr_t pfn, size_t order)
+{
+	while (order < PMM_MAX_ORDER)
+	{
+		uintptr_t buddy = pfn ^ ORDER_PAGES(order);
+		if (buddy >= s_orderMapPages || s_orderMap[buddy] != (order + 1))
+			break;
+		freelist_remove(zone, buddy * OBOS_PAGE_SIZE, order);
+		pfn &= ~ORDER_PAGES(order);
+		order++;
+	}
+	freelist_add(zone, pfn * OBOS_PAGE_SIZE, order);
+}
+// Frees an arbitrary range of pages by splitting it into aligned blocks.
+// The zone's lock must be held.
+OBOS_NO_KASAN static void free_range(pmm_zone* zone, uintptr_t pfn, size_t nPages)
+{
+	while (nPages)
+	{
+		size_t order = pfn ? __builtin_ctzl(pfn) : PMM_MAX_ORDER;
+		if (order > PMM_MAX_ORDER)
+			order = PMM_MAX_ORDER;
+		if (ORDER_PAGES(order) > nPages)
+			order = floor_log2(nPages);
+		free_block(zone, pfn, order);
+		pfn += ORDER_PAGES(order);
+		nPages -= ORDER_PAGES(order);
+	}
+}
+// Takes a block of 'order' off the free lists, splitting a larger block if needed.
+// The zone's lock must be held.
+OBOS_NO_KASAN static uintptr_t allocate_block(pmm_zone* zone, size_t order)
+{
+	size_t curr = order;
+	while (curr <= PMM_MAX_ORDER && !zone->freeLists[curr])
+		curr++;
+	if (curr > PMM_MAX_ORDER)
+		return 0;
+	uintptr_t phys = zone->freeLists[curr];
+	freelist_remove(zone, phys, curr);
+	// Keep the lower half, and give back the upper half.
+	while (curr > order)
+	{
+		curr--;
+		freelist_add(zone, phys + ORDER_PAGES(curr) * OBOS_PAGE_SIZE, curr);
+	}
+	return phys;
+}
+// Allocates more than ORDER_PAGES(PMM_MAX_ORDER) pages by looking for a run of adjacent
+// free blocks of the maximum order.
+// The zone's lock must be held.
+OBOS_NO_KASAN static uintptr_t allocate_contiguous(pmm_zone* zone, size_t nPages, size_t alignmentPages)
+{
+	const size_t maxBlock = ORDER_PAGES(PMM_MAX_ORDER);
+	const size_t nBlocks = (nPages + maxBlock - 1) / maxBlock;
+	if (alignmentPages < maxBlock)
+		alignmentPages = maxBlock;
+	s_nContiguousAllocations++;
+	for (uintptr_t phys = zone->freeLists[PMM_MAX_ORDER]; phys; phys = MAP_TO_HHDM(phys, struct pmm_freelist_node)->next)
+	{
+		const uintptr_t pfn = PFN(phys);
+		if (pfn & (alignmentPages - 1))
+			continue;
+		size_t i = 1;
+		for (; i < nBlocks; i++)
 		{
-			phys += OBOS_PAGE_SIZE;
-			nPages -= 1;
+			uintptr_t curr = pfn + i*maxBlock;
+			if (curr >= s_orderMapPages || s_orderMap[curr] != (PMM_MAX_ORDER + 1))
+				break;
 		}
-#endif
-		Mm_TotalPhysicalPages += nPages;
-		if ((phys + nPages * OBOS_PAGE_SIZE) > Mm_PhysicalMemoryBoundaries)
-			Mm_PhysicalMemoryBoundaries = (phys + nPages * OBOS_PAGE_SIZE);
-		if (entry->pmem_map_type != PHYSICAL_MEMORY_TYPE_USABLE || !nPages)
-		{
-			entry = MmS_GetNextPMemMapEntry(entry, &i);
+		if (i != nBlocks)
 			continue;
-		}
-		Mm_UsablePhysicalPages += nPages;
-		// struct freelist_node* node = (struct freelist_node*)(MmS_MapVirtFromPhys(phys));
-		// memzero(node, sizeof(*node));
-		// node->nPages = nPages;
-		// if (s_tail)
-		// 	((struct freelist_node*)(MmS_MapVirtFromPhys((uintptr_t)s_tail)))->next = (struct freelist_node*)phys;
-		// if (!s_head)
-		// 	s_head = (struct freelist_node*)phys;
-		// node->prev = s_tail;
-		// s_tail = (struct freelist_node*)phys;
-		// s_nNodes++;
-		OBOS_Debug("%s: Free physical memory region at 0x%p-0x%p.\n", __func__, phys, phys+nPages*OBOS_PAGE_SIZE);
-		Mm_FreePhysicalPages(phys, nPages);
-		entry = MmS_GetNextPMemMapEntry(entry, &i);
+		for (i = 0; i < nBlocks; i++)
+			freelist_remove(zone, (pfn + i*maxBlock) * OBOS_PAGE_SIZE, PMM_MAX_ORDER);
+		free_range(zone, pfn + nPages, nBlocks*maxBlock - nPages);
+		return phys;
 	}
-#if OBOS_ARCHITECTURE_BITS == 64
-	if (Mm_PhysicalMemoryBoundaries & 4294967295)
-		Mm_PhysicalMemoryBoundaries = (Mm_PhysicalMemoryBoundaries + 4294967295) & ~4294967295;
-#endif
-	return OBOS_STATUS_SUCCESS;
-}
-static bool IsRegionSufficient(struct pmm_freelist_node* node, size_t nPages, size_t alignmentMask, size_t *nPagesRequiredP)
-{
-	size_t nPagesRequired = nPages;
-	uintptr_t nodePhys = MmS_UnmapVirtFromPhys(node);
-	nPagesRequired += (node->nPages & ((alignmentMask + 1) / OBOS_PAGE_SIZE - 1));
-	uintptr_t mod = nodePhys & alignmentMask;
-	nPagesRequired += mod / OBOS_PAGE_SIZE;
-	if (nPagesRequiredP)
-		*nPagesRequiredP = nPagesRequired;
-	return node->nPages >= nPagesRequired;
+	if (zone->nFreePages >= nPages)
+		s_nContiguousFailures++;
+	return 0;
 }
-#define MAP_TO_HHDM(addr, type) ((type*)(MmS_MapVirtFromPhys((uintptr_t)(addr))))
-#define UNMAP_FROM_HHDM(addr) (MmS_UnmapVirtFromPhys((void*)(addr)))
-OBOS_NO_KASAN static uintptr_t allocate(size_t nPages, size_t alignmentPages, obos_status *status, struct pmm_freelist_node** const head, struct pmm_freelist_node** const tail)
+
+OBOS_NO_KASAN static uintptr_t allocate(size_t nPages, size_t alignmentPages, obos_status *status, pmm_zone* zone)
 {
 	if (!nPages)
 	{
-		*status = OBOS_STATUS_INVALID_ARGUMENT;
+		if (status)
+			*status = OBOS_STATUS_INVALID_ARGUMENT;
 		return 0;
 	}
 	if (!alignmentPages)
 		alignmentPages = 1;
-	if (__builtin_popcount(alignmentPages) > 1)
+	if (__builtin_popcountl(alignmentPages) > 1)
 	{
 		if (status)
 			*status = OBOS_STATUS_INVALID_ARGUMENT;
 		return 0;
 	}
-	if (!(*head))
+	if (!zone->nFreePages)
 	{
 		if (status)
 			*status = OBOS_STATUS_NOT_ENOUGH_MEMORY;
 		return 0;
 	}
+	size_t order = ceil_log2(nPages > alignmentPages ? nPages : alignmentPages);
 	uintptr_t phys = 0;
-	if (nPages % alignmentPages)
-		nPages += (alignmentPages - (nPages % alignmentPages));
-	size_t alignmentMask = alignmentPages*OBOS_PAGE_SIZE-1;
-	size_t nPagesRequired = 0;
-	irql oldIrql = Core_SpinlockAcquireExplicit(&lock, IRQL_DISPATCH, true);
-	struct pmm_freelist_node* node = MAP_TO_HHDM((*head), struct pmm_freelist_node);
-	while (UNMAP_FROM_HHDM(node) && !IsRegionSufficient(node, nPages, alignmentMask, &nPagesRequired))
-		node = MAP_TO_HHDM(node->next, struct pmm_freelist_node);
-	if (!UNMAP_FROM_HHDM(node))
+	irql oldIrql = Core_SpinlockAcquireExplicit(&zone->lock, IRQL_DISPATCH, true);
+	if (order > PMM_MAX_ORDER)
+		phys = allocate_contiguous(zone, nPages, alignmentPages);
+	else if ((phys = allocate_block(zone, order)) && ORDER_PAGES(order) > nPages)
+		free_range(zone, PFN(phys) + nPages, ORDER_PAGES(order) - nPages); // Give back the unused tail.
+	Core_SpinlockRelease(&zone->lock, oldIrql);
+	if (!phys)
 	{
 		if (status)
 			*status = OBOS_STATUS_NOT_ENOUGH_MEMORY;
-		Core_SpinlockRelease(&lock, oldIrql);
 		return 0;
 	}
-	OBOS_ASSERT(node->nPages >= nPagesRequired);
-	node->nPages -= nPagesRequired;
-	Mm_TotalPhysicalPagesUsed += nPages;
-	if (!node->nPages)
-	{
-		if (node->next)
-			MAP_TO_HHDM(node->next, struct pmm_freelist_node)->prev = node->prev;
-		if (node->prev)
-			MAP_TO_HHDM(node->prev, struct pmm_freelist_node)->next = node->next;
-		if ((uintptr_t)(*head) == UNMAP_FROM_HHDM(node))
-			(*head) = node->next;
-		if ((uintptr_t)(*tail) == UNMAP_FROM_HHDM(node))
-			(*tail) = node->prev;
-	}
-	phys = ((uintptr_t)node) + node->nPages * OBOS_PAGE_SIZE;
-	phys = UNMAP_FROM_HHDM(phys);
-	if (!node->nPages)
-		memzero(node, sizeof(*node));
 	if (status)
 		*status = OBOS_STATUS_SUCCESS;
-	Core_SpinlockRelease(&lock, oldIrql);
-	OBOS_ASSERT(phys);
 	OBOS_ASSERT(phys < Mm_PhysicalMemoryBoundaries);
-	if (phys == 0x1000)
-		printf("allocated %d pages at 0x%p\n", nPages, phys);
 	return phys;
 }
+OBOS_NO_KASAN static void free(uintptr_t addr, size_t nPages, pmm_zone* zone)
+{
+	if (!nPages)
+		return; // nothing freed, no-op.
+#if OBOS_DEBUG
+	memset(MAP_TO_HHDM(addr, void), 0xcc, nPages * OBOS_PAGE_SIZE);
+#endif
+	irql oldIrql = Core_SpinlockAcquireExplicit(&zone->lock, IRQL_DISPATCH, true);
+	free_range(zone, PFN(addr), nPages);
+	Core_SpinlockRelease(&zone->lock, oldIrql);
+}
+
+// Tries to allocate a single page from the current CPU's hot page list.
+OBOS_NO_KASAN static uintptr_t hot_page_allocate()
+{
+	if (!s_hotPagesEnabled || Core_GetIrql() > IRQL_DISPATCH)
+		return 0;
+	irql oldIrql = IRQL_INVALID;
+	if (Core_GetIrql() < IRQL_DISPATCH)
+		oldIrql = Core_RaiseIrqlNoThread(IRQL_DISPATCH);
+	cpu_local* cpu = CoreS_GetCPULocalPtr();
+	if (!cpu->hotPages.nPages)
+	{
+		// Refill from the normal zone first, like allocate_phys_or_fail does.
+		for (size_t zone_id = PMM_ZONE_MAX+1; zone_id > 0 && cpu->hotPages.nPages < HOT_PAGES_BATCH; zone_id--)
+		{
+			pmm_zone* zone = &s_zones[zone_id-1];
+			if (!zone->nFreePages)
+				continue;
+			irql zoneIrql = Core_SpinlockAcquireExplicit(&zone->lock, IRQL_DISPATCH, true);
+			while (cpu->hotPages.nPages < HOT_PAGES_BATCH)
+			{
+				uintptr_t phys = allocate_block(zone, 0);
+				if (!phys)
+					break;
+				*MAP_TO_HHDM(phys, uintptr_t) = cpu->hotPages.head;
+				cpu->hotPages.head = phys;
+				cpu->hotPages.nPages++;
+			}
+			Core_SpinlockRelease(&zone->lock, zoneIrql);
+		}
+	}
+	uintptr_t phys = cpu->hotPages.head;
+	if (phys)
+	{
+		cpu->hotPages.head = *MAP_TO_HHDM(phys, uintptr_t);
+		cpu->hotPages.nPages--;
+	}
+	if (oldIrql != IRQL_INVALID)
+		Core_LowerIrqlNoThread(oldIrql);
+	return phys;
+}
+// Gives back up to nPages pages from the hot page list of 'cpu' to the zones.
+// Must be called at IRQL_DISPATCH on the CPU that owns the list.
+OBOS_NO_KASAN static void hot_pages_drain(cpu_local* cpu, size_t nPages)
+{
+	uintptr_t pages = 0;
+	for (size_t i = 0; i < nPages && cpu->hotPages.head; i++)
+	{
+		uintptr_t phys = cpu->hotPages.head;
+		cpu->hotPages.head = *MAP_TO_HHDM(phys, uintptr_t);
+		cpu->hotPages.nPages--;
+		*MAP_TO_HHDM(phys, uintptr_t) = pages;
+		pages = phys;
+	}
+	for (size_t zone_id = 0; zone_id <= PMM_ZONE_MAX && pages; zone_id++)
+	{
+		pmm_zone* zone = &s_zones[zone_id];
+		uintptr_t *prev = &pages;
+		irql oldIrql = Core_SpinlockAcquireExplicit(&zone->lock, IRQL_DISPATCH, true);
+		for (uintptr_t phys = pages; phys; )
+		{
+			uintptr_t next = *MAP_TO_HHDM(phys, uintptr_t);
+			if (zone_of(phys) == zone)
+			{
+				*prev = next;
+				free_block(zone, PFN(phys), 0);
+			}
+			else
+				prev = MAP_TO_HHDM(phys, uintptr_t);
+			phys = next;
+		}
+		Core_SpinlockRelease(&zone->lock, oldIrql);
+	}
+	OBOS_ASSERT(!pages);
+}
+// Tries to free a single page to the current CPU's hot page list.
+OBOS_NO_KASAN static bool hot_page_free(uintptr_t phys)
+{
+	if (!s_hotPagesEnabled || Core_GetIrql() > IRQL_DISPATCH)
+		return false;
+	irql oldIrql = IRQL_INVALID;
+	if (Core_GetIrql() < IRQL_DISPATCH)
+		oldIrql = Core_RaiseIrqlNoThread(IRQL_DISPATCH);
+	cpu_local* cpu = CoreS_GetCPULocalPtr();
+	*MAP_TO_HHDM(phys, uintptr_t) = cpu->hotPages.head;
+	cpu->hotPages.head = phys;
+	if (++cpu->hotPages.nPages > HOT_PAGES_HIGH)
+		hot_pages_drain(cpu, HOT_PAGES_BATCH);
+	if (oldIrql != IRQL_INVALID)
+		Core_LowerIrqlNoThread(oldIrql);
+	return true;
+}
+
+void Mm_EnablePMMHotPages()
+{
+	s_hotPagesEnabled = !OBOS_GetOPTF("no-pmm-hot-pages");
+}
+
+void Mm_DrainHotPages()
+{
+	if (!s_hotPagesEnabled || Core_GetIrql() > IRQL_DISPATCH)
+		return;
+	irql oldIrql = IRQL_INVALID;
+	if (Core_GetIrql() < IRQL_DISPATCH)
+		oldIrql = Core_RaiseIrqlNoThread(IRQL_DISPATCH);
+	cpu_local* cpu = CoreS_GetCPULocalPtr();
+	hot_pages_drain(cpu, cpu->hotPages.nPages);
+	if (oldIrql != IRQL_INVALID)
+		Core_LowerIrqlNoThread(oldIrql);
+}
+
+// Returns false if the memory map entry should be skipped.
+static bool get_entry_range(obos_pmem_map_entry* entry, uintptr_t* physp, size_t* nPagesp)
+{
+	uintptr_t phys = entry->pmem_map_base;
+	size_t nPages = entry->pmem_map_size / OBOS_PAGE_SIZE;
+	if (phys % OBOS_PAGE_SIZE)
+	{
+		phys = phys + (OBOS_PAGE_SIZE-(phys%OBOS_PAGE_SIZE));
+		nPages--;
+	}
+	if (phys == 0x0)
+	{
+#ifdef __x86_64__
+		phys = OBOS_PAGE_SIZE*3;
+		if (nPages <= 3)
+			return false;
+		nPages -= 3;
+#else
+		phys = OBOS_PAGE_SIZE;
+		nPages--;
+#endif
+	}
+#if __x86_64__
+	// smp trampoline is on 0x1000
+	if (phys == 0x1000)
+	{
+		phys += OBOS_PAGE_SIZE;
+		nPages -= 1;
+	}
+#endif
+	*physp = phys;
+	*nPagesp = nPages;
+	return true;
+}
+
+obos_status Mm_InitializePMM()
+{
+	uintptr_t i = 0;
+	if (!MmS_GetFirstPMemMapEntry(&i))
+		return OBOS_STATUS_INVALID_INIT_PHASE;
+	uintptr_t phys = 0;
+	size_t nPages = 0;
+	uintptr_t usableEnd = 0;
+	for (obos_pmem_map_entry* entry = MmS_GetFirstPMemMapEntry(&i); entry; entry = MmS_GetNextPMemMapEntry(entry, &i))
+	{
+		if (!get_entry_range(entry, &phys, &nPages))
+			continue;
+		Mm_TotalPhysicalPages += nPages;
+		if ((phys + nPages * OBOS_PAGE_SIZE) > Mm_PhysicalMemoryBoundaries)
+			Mm_PhysicalMemoryBoundaries = (phys + nPages * OBOS_PAGE_SIZE);
+		if (entry->pmem_map_type != PHYSICAL_MEMORY_TYPE_USABLE || !nPages)
+			continue;
+		Mm_UsablePhysicalPages += nPages;
+		if ((phys + nPages * OBOS_PAGE_SIZE) > usableEnd)
+			usableEnd = phys + nPages * OBOS_PAGE_SIZE;
+	}
+	// Every usable page is used until it is freed below.
+	Mm_TotalPhysicalPagesUsed = Mm_UsablePhysicalPages;
+
+	// Carve the page array and the order map out of the end of the first usable region that can fit them.
+	s_orderMapPages = PFN(usableEnd);
+	const size_t pageArrayBytes = (s_orderMapPages * sizeof(*Mm_PageArray) + OBOS_PAGE_SIZE - 1) & ~(OBOS_PAGE_SIZE - 1);
+	const size_t metadataPages = (pageArrayBytes + s_orderMapPages + OBOS_PAGE_SIZE - 1) / OBOS_PAGE_SIZE;
+	uintptr_t metadataPhys = 0;
+	for (obos_pmem_map_entry* entry = MmS_GetFirstPMemMapEntry(&i); entry && !metadataPhys; entry = MmS_GetNextPMemMapEntry(entry, &i))
+	{
+		if (entry->pmem_map_type != PHYSICAL_MEMORY_TYPE_USABLE || !get_entry_range(entry, &phys, &nPages))
+			continue;
+		if (nPages > metadataPages)
+			metadataPhys = phys + (nPages - metadataPages) * OBOS_PAGE_SIZE;
+	}
+	if (!metadataPhys)
+		return OBOS_STATUS_NOT_ENOUGH_MEMORY;
+	memzero(MAP_TO_HHDM(metadataPhys, void), metadataPages * OBOS_PAGE_SIZE);
+	Mm_PageArray = MAP_TO_HHDM(metadataPhys, _Atomic(page*));
+	Mm_PageArraySize = s_orderMapPages;
+	s_orderMap = MAP_TO_HHDM(metadataPhys + pageArrayBytes, uint8_t);
+
+	for (obos_pmem_map_entry* entry = MmS_GetFirstPMemMapEntry(&i); entry; entry = MmS_GetNextPMemMapEntry(entry, &i))
+	{
+		if (entry->pmem_map_type != PHYSICAL_MEMORY_TYPE_USABLE || !get_entry_range(entry, &phys, &nPages) || !nPages)
+			continue;
+		if (metadataPhys >= phys && metadataPhys < (phys + nPages * OBOS_PAGE_SIZE))
+			nPages -= metadataPages;
+		OBOS_Debug("%s: Free physical memory region at 0x%p-0x%p.\n", __func__, phys, phys+nPages*OBOS_PAGE_SIZE);
+		Mm_FreePhysicalPages(phys, nPages);
+	}
+	// 1/64th of memory, but at least 1MiB, and at most 64MiB.
+	Mm_LowWatermark = Mm_UsablePhysicalPages / 64;
+	if (Mm_LowWatermark < (0x100000 / OBOS_PAGE_SIZE))
+		Mm_LowWatermark = 0x100000 / OBOS_PAGE_SIZE;
+	if (Mm_LowWatermark > (0x4000000 / OBOS_PAGE_SIZE))
+		Mm_LowWatermark = 0x4000000 / OBOS_PAGE_SIZE;
+	Mm_HighWatermark = Mm_LowWatermark * 2;
+#if OBOS_ARCHITECTURE_BITS == 64
+	if (Mm_PhysicalMemoryBoundaries & 4294967295)
+		Mm_PhysicalMemoryBoundaries = (Mm_PhysicalMemoryBoundaries + 4294967295) & ~4294967295;
+#endif
+	return OBOS_STATUS_SUCCESS;
+}
+
 OBOS_NO_KASAN static uintptr_t allocate_phys_or_fail(size_t nPages, size_t alignmentPages, obos_status *status)
 {
-	uintptr_t res = allocate(nPages, alignmentPages, status, &s_head, &s_tail);
+	if (nPages == 1 && alignmentPages <= 1)
+	{
+		uintptr_t res = hot_page_allocate();
+		if (res)
+		{
+			if (status)
+				*status = OBOS_STATUS_SUCCESS;
+			return res;
+		}
+	}
+	uintptr_t res = allocate(nPages, alignmentPages, status, &s_zones[PMM_ZONE_NORMAL]);
 	if (res)
 		return res;
 #if OBOS_ARCHITECTURE_BITS == 64
 	if (status)
 		*status = OBOS_STATUS_SUCCESS;
-	return allocate(nPages, alignmentPages, status, &s_head32, &s_tail32);
+	return allocate(nPages, alignmentPages, status, &s_zones[PMM_ZONE_32BIT]);
 #else
 	return 0;
 #endif
@@ -205,6 +506,7 @@ OBOS_NO_KASAN void* Mm_AllocatePhysicalPages_p(size_t nPages, size_t alignmentPa
 	if (res)
 	{
 		//printf("pmm alloc 0x%p %d\n", res, nPages);
+		Mm_CheckReclaimWatermark();
 		return (void*)res;
 	}
 	if (Core_GetIrql() > IRQL_DISPATCH)
@@ -214,6 +516,15 @@ OBOS_NO_KASAN void* Mm_AllocatePhysicalPages_p(size_t nPages, size_t alignmentPa
 	}
 	if (!Mm_IsInitialized())
 		return 0; // oof.
+	// Give the empty slabs of object caches and this CPU's hot pages back before taking standby pages.
+	// Draining the hot pages can also let larger blocks coalesce.
+	Mm_DrainHotPages();
+	if (OBOS_ReclaimObjectCaches() || nPages > 1)
+	{
+		res = allocate_phys_or_fail(nPages, alignmentPages, status);
+		if (res)
+			return (void*)res;
+	}
 	if (nPages > (OBOS_HUGE_PAGE_SIZE / OBOS_PAGE_SIZE))
 	{
 		if (status)
@@ -246,7 +557,8 @@ OBOS_NO_KASAN void* Mm_AllocatePhysicalPages_p(size_t nPages, size_t alignmentPa
 		res = node->phys;
 		if (node->backing_vn)
 			Mm_CachedBytes -= (node->end_offset - node->file_offset);
-		node->swap_alloc->phys = nullptr;
+		if (node->swap_alloc)
+			node->swap_alloc->phys = nullptr;
 		node->swap_alloc = nullptr;
     }
 	else
@@ -264,35 +576,15 @@ OBOS_NO_KASAN void* Mm_AllocatePhysicalPages_p(size_t nPages, size_t alignmentPa
 OBOS_NO_KASAN void* Mm_AllocatePhysicalPages32_p(size_t nPages, size_t alignmentPages, obos_status *status)
 {
 #if OBOS_ARCHITECTURE_BITS == 64
-	void* res = (void*)allocate(nPages, alignmentPages, status, &s_head32, &s_tail32);
+	void* res = (void*)allocate(nPages, alignmentPages, status, &s_zones[PMM_ZONE_32BIT]);
 	//printf("pmm alloc 0x%p %d\n", res, nPages);
+	if (res)
+		Mm_CheckReclaimWatermark();
 	return res;
 #else
 	return (void*)Mm_AllocatePhysicalPages(nPages, alignmentPages, status);
 #endif
 }
-OBOS_NO_KASAN static obos_status free(uintptr_t addr, size_t nPages, struct pmm_freelist_node** const head, struct pmm_freelist_node** const tail)
-{
-	if (!nPages)
-		return OBOS_STATUS_SUCCESS; // nothing freed, no-op.
-	irql oldIrql = Core_SpinlockAcquireExplicit(&lock, IRQL_DISPATCH, true);
-	struct pmm_freelist_node* node = MAP_TO_HHDM(addr, struct pmm_freelist_node);
-	memzero(node, sizeof(*node));
-#if OBOS_DEBUG
-	memset(node+1, 0xcc, nPages * OBOS_PAGE_SIZE - sizeof(*node));
-#endif
-	node->nPages = nPages;
-	if ((*tail))
-		MAP_TO_HHDM((*tail), struct pmm_freelist_node)->next = (struct pmm_freelist_node*)UNMAP_FROM_HHDM(node);
-	if (!(*head))
-		(*head) = (struct pmm_freelist_node*)UNMAP_FROM_HHDM(node);
-	node->prev = (*tail);
-	(*tail) = (struct pmm_freelist_node*)UNMAP_FROM_HHDM(node);
-	Mm_TotalPhysicalPagesUsed -= nPages;
-	//printf("pmm free 0x%p %d\n", addr, nPages);
-	Core_SpinlockRelease(&lock, oldIrql);
-	return OBOS_STATUS_SUCCESS;
-}
 OBOS_NO_KASAN obos_status Mm_FreePhysicalPages_p(void* addr_, size_t nPages)
 {
 	uintptr_t addr = (uintptr_t)addr_;
@@ -302,48 +594,58 @@ OBOS_NO_KASAN obos_status Mm_FreePhysicalPages_p(void* addr_, size_t nPages)
 	addr -= (addr%OBOS_PAGE_SIZE);
 	if (!addr)
 		return OBOS_STATUS_INVALID_ARGUMENT;
+	if (nPages == 1 && hot_page_free(addr))
+		return OBOS_STATUS_SUCCESS;
 #if OBOS_ARCHITECTURE_BITS == 64
-	if (addr < 0xffffffff)
+	if (addr < 0x100000000 && (addr + (nPages*OBOS_PAGE_SIZE)) > 0x100000000)
 	{
-		if ((addr + (nPages*OBOS_PAGE_SIZE)) >= 0xffffffff)
-		{
-			size_t pages = ((addr + (nPages*OBOS_PAGE_SIZE)) & ~0xffffffff) / OBOS_PAGE_SIZE;
-			free(0x100000000, pages, &s_head, &s_tail);
-			nPages -= pages;
-			OBOS_ASSERT((addr + (nPages*OBOS_PAGE_SIZE)) < 0xffffffff);
-		}
-		if (nPages)
-			free(addr, nPages, &s_head32, &s_tail32);
+		size_t pages = ((addr + (nPages*OBOS_PAGE_SIZE)) - 0x100000000) / OBOS_PAGE_SIZE;
+		free(0x100000000, pages, &s_zones[PMM_ZONE_NORMAL]);
+		nPages -= pages;
 	}
-	else
-		free(addr, nPages, &s_head, &s_tail);
-#else
-	free(addr, nPages, &s_head, &s_tail);
 #endif
+	free(addr, nPages, zone_of(addr));
 	// OBOS_Debug("%s: Marking physical memory region at 0x%p-0x%p as free.\n", __func__, addr, addr+nPages*OBOS_PAGE_SIZE);
 	return OBOS_STATUS_SUCCESS;
 }
 
 bool Mm_PhysicalPageFree(uintptr_t phys)
 {
-#if OBOS_ARCHITECTURE_BITS == 64
-	for (struct pmm_freelist_node* node_addr = s_head32; node_addr;)
+	// Pages in hot page lists are counted as used.
+	uintptr_t pfn = PFN(phys);
+	if (pfn >= s_orderMapPages)
+		return false;
+	for (size_t order = 0; order <= PMM_MAX_ORDER; order++)
 	{
-		struct pmm_freelist_node* const node = MAP_TO_HHDM(node_addr, struct pmm_freelist_node);
-		if (phys >= (uintptr_t)node_addr && phys < (uintptr_t)node_addr + node->nPages*OBOS_PAGE_SIZE)
+		uintptr_t head = pfn & ~(ORDER_PAGES(order) - 1);
+		if (s_orderMap[head] == (order + 1))
 			return true;
-
-		node_addr = node->next;
 	}
-#endif
-	for (struct pmm_freelist_node* node_addr = s_head; node_addr;)
-	{
-		struct pmm_freelist_node* const node = MAP_TO_HHDM(node_addr, struct pmm_freelist_node);
-		if (phys >= (uintptr_t)node_addr && phys < (uintptr_t)node_addr + node->nPages*OBOS_PAGE_SIZE)
-			return true;
+	return false;
+}
 
-		node_addr = node->next;
-	}
+size_t Mm_FreePhysicalPageCount()
+{
+	size_t nUsed = Mm_TotalPhysicalPagesUsed;
+	return nUsed < Mm_UsablePhysicalPages ? Mm_UsablePhysicalPages - nUsed : 0;
+}
 
-	return false;
-}
\ No newline at end of file
+obos_status Mm_GetPMMStats(pmm_stats* stats)
+{
+	if (!stats)
+		return OBOS_STATUS_INVALID_ARGUMENT;
+	memzero(stats, sizeof(*stats));
+	for (size_t zone_id = 0; zone_id <= PMM_ZONE_MAX; zone_id++)
+	{
+		pmm_zone* zone = &s_zones[zone_id];
+		irql oldIrql = Core_SpinlockAcquireExplicit(&zone->lock, IRQL_DISPATCH, true);
+		memcpy(stats->zones[zone_id].nFreeBlocks, zone->nFreeBlocks, sizeof(zone->nFreeBlocks));
+		stats->zones[zone_id].nFreePages = zone->nFreePages;
+		Core_SpinlockRelease(&zone->lock, oldIrql);
+	}
+	stats->nContiguousAllocations = s_nContiguousAllocations;
+	stats->nContiguousFailures = s_nContiguousFailures;
+	for (size_t cpu = 0; cpu < Core_CpuCount; cpu++)
+		stats->nHotPages += Core_CpuInfo[cpu].hotPages.nPages;
+	return OBOS_STATUS_SUCCESS;
+}
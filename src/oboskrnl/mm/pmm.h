@@ -12,10 +12,46 @@
 #include <scheduler/thread.h>
 
 extern OBOS_EXPORT size_t Mm_TotalPhysicalPages;
-extern OBOS_EXPORT size_t Mm_TotalPhysicalPagesUsed;
+extern OBOS_EXPORT _Atomic(size_t) Mm_TotalPhysicalPagesUsed;
 extern size_t Mm_UsablePhysicalPages;
 extern uintptr_t Mm_PhysicalMemoryBoundaries;
 
+// Free memory watermarks, in pages (see mm/reclaim.h).
+// When the amount of free and standby pages drops below Mm_LowWatermark, pages are reclaimed
+// until there are at least Mm_HighWatermark free (or standby) pages.
+extern size_t Mm_LowWatermark;
+extern size_t Mm_HighWatermark;
+
+// The largest block the buddy allocator keeps on its free lists is (1 << PMM_MAX_ORDER) pages.
+#define PMM_MAX_ORDER 10
+
+typedef enum pmm_zone_id {
+	// Physical memory below 4GiB. Only exists on 64-bit architectures.
+	PMM_ZONE_32BIT,
+	// All other physical memory.
+	PMM_ZONE_NORMAL,
+	PMM_ZONE_MAX = PMM_ZONE_NORMAL,
+} pmm_zone_id;
+
+typedef struct pmm_zone_stats {
+	// The amount of free blocks of each order.
+	size_t nFreeBlocks[PMM_MAX_ORDER + 1];
+	// The amount of free pages in the zone.
+	size_t nFreePages;
+} pmm_zone_stats;
+
+typedef struct pmm_stats {
+	pmm_zone_stats zones[PMM_ZONE_MAX + 1];
+	// The amount of pages cached in per-CPU hot page lists.
+	// These are counted as used.
+	size_t nHotPages;
+	// The amount of allocations that needed more than (1 << PMM_MAX_ORDER) pages.
+	size_t nContiguousAllocations;
+	// The amount of contiguous allocations that failed due to fragmentation
+	// while there were enough free pages to satisfy them.
+	size_t nContiguousFailures;
+} pmm_stats;
+
 /// <summary>
 /// Initializes the PMM.
 /// </summary>
@@ -59,6 +95,25 @@ OBOS_EXPORT void* Mm_AllocatePhysicalPages32_p(size_t nPages, size_t alignmentPa
 #endif
 
 bool Mm_PhysicalPageFree(uintptr_t phys);
+// Returns the amount of free physical pages, not counting pages in the per-CPU hot page lists.
+size_t Mm_FreePhysicalPageCount();
+
+/// <summary>
+/// Gets the free list statistics of the PMM.<br></br>
+/// Fragmentation can be measured by comparing the free pages of a zone to its free blocks of high orders.
+/// </summary>
+/// <param name="stats">The buffer to store the statistics in.</param>
+/// <returns>The function status.</returns>
+OBOS_EXPORT obos_status Mm_GetPMMStats(pmm_stats* stats);
+/// <summary>
+/// Enables the per-CPU hot page lists, unless --no-pmm-hot-pages was passed.<br></br>
+/// Must be called after SMP initialization.
+/// </summary>
+void Mm_EnablePMMHotPages();
+/// <summary>
+/// Returns the pages in the current CPU's hot page list to the buddy allocator.
+/// </summary>
+void Mm_DrainHotPages();
 
 // This returns a virtual address given a physical address.
 // For example, on x86-64, this can offset the physical address by the hhdm.
@@ -0,0 +1,56 @@
+/*
+ * oboskrnl/mm/reclaim.h
+ *
+ * Copyright (c) 2026 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+#include <error.h>
+
+#include <mm/context.h>
+
+// With the clock page replacement algorithm, every resident page referenced through a page fault
+// is on one of two global lists, the active list and the inactive list.
+// New pages start on the inactive list.
+// When the amount of free and standby pages drops below Mm_LowWatermark, the reclaim thread is woken up, and runs
+// two clock hands over the lists until enough pages were evicted to bring it back to Mm_HighWatermark:
+// - The front hand goes over the active list, and moves pages which were not accessed since the last pass
+//   to the inactive list. This keeps the inactive list at least half as large as the active list.
+// - The back hand goes over the inactive list, moves pages which were accessed back to the active list,
+//   and swaps out the rest.
+// The cost of reclaiming is proportional to the amount of pages reclaimed, rather than the size of
+// any process, and the per-context working-set capacity is not used.
+
+typedef struct mm_reclaim_stats {
+    // The amount of pages on each list.
+    size_t nActivePages;
+    size_t nInactivePages;
+    // The amount of times the reclaim thread ran.
+    uint64_t nRuns;
+    // The amount of pages the clock hands looked at.
+    uint64_t nScanned;
+    // The amount of pages swapped out.
+    uint64_t nEvicted;
+    // The amount of pages moved to the active list.
+    uint64_t nActivated;
+    // The amount of pages moved to the inactive list.
+    uint64_t nDeactivated;
+    // The amount of pages scanned and evicted per second, over the last sampling interval
+    // (at least one second).
+    uint64_t scanRate;
+    uint64_t evictionRate;
+} mm_reclaim_stats;
+
+// Starts the reclaim thread.
+void Mm_InitializeReclaimThread();
+// Wakes up the reclaim thread if the amount of free and standby pages is below Mm_LowWatermark.
+// Can be called at any IRQL, but does nothing above IRQL_DISPATCH.
+void Mm_CheckReclaimWatermark();
+// Removes the pages of a context from the lists of the page replacement algorithm.
+// Must be called before the context is freed.
+void Mm_ReclaimForgetContext(context* ctx);
+// Gets the statistics of the reclaim thread.
+// Returns OBOS_STATUS_UNIMPLEMENTED if the page replacement algorithm is not the clock.
+OBOS_EXPORT obos_status Mm_GetReclaimStats(mm_reclaim_stats* stats);
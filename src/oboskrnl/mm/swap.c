@@ -34,6 +34,8 @@
 
 #include <irq/irql.h>
 
+#include <stdatomic.h>
+
 swap_dev* Mm_SwapProvider;
 
 static thread page_writer_thread;
@@ -61,10 +63,7 @@ obos_status Mm_SwapOut(uintptr_t virt, context* ctx)
     if (page.prot.lck)
         return OBOS_STATUS_UNPAGED_POOL;
 
-    struct page key = { .phys = page.phys };
-    Core_MutexAcquire(&Mm_PhysicalPagesLock);
-    struct page* pg = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &key);
-    Core_MutexRelease(&Mm_PhysicalPagesLock);
+    struct page* pg = MmH_LookupPage(page.phys);
     if (!pg)
     {
         OBOS_Warning("%s: Could not find 'struct page' for physical page 0x%p\n", __func__, page.phys);
@@ -105,12 +104,201 @@ obos_status Mm_SwapOut(uintptr_t virt, context* ctx)
         OBOS_Warning("%s: MmS_SetPageMapping returned %d\n", __func__, status);
         return status;
     }
-    if (page.dirty)
-        Mm_MarkAsDirtyPhys(pg);
-    else
-        Mm_MarkAsStandbyPhys(pg);
+    // The swap id was just reserved, so the page has no copy in swap yet, and must be written
+    // whether its dirty bit is set or not (which the page replacement algorithm might have cleared).
+    Mm_MarkAsDirtyPhys(pg);
     return OBOS_STATUS_SUCCESS;
 }
+// Maps the page of 'alloc' at 'page', taking it off the dirty or standby list, and drops
+// the reference of the page table entry to 'alloc'.
+// If the page was on either list, **type is set to SOFT_FAULT, and *type is set to nullptr.
+// Must be called with the swap lock held, and a reference to alloc->phys for the mapping.
+static obos_status map_swapped_page(context* ctx, page_info* page, swap_allocation* alloc, fault_type** type)
+{
+    if (alloc->phys->flags & PHYS_PAGE_STANDBY)
+    {
+        LIST_REMOVE(phys_page_list, &Mm_StandbyPageList, alloc->phys);
+        if (type && *type)
+            **type = SOFT_FAULT;
+        if (type)
+            *type = nullptr;
+    }
+    else if (alloc->phys->flags & PHYS_PAGE_DIRTY)
+    {
+        if (!alloc->phys->pagedCount)
+            LIST_REMOVE(phys_page_list, &Mm_DirtyPageList, alloc->phys);
+        Mm_DirtyPagesBytes -= page->prot.huge_page ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE;
+        if (type && *type)
+            **type = SOFT_FAULT;
+        if (type)
+            *type = nullptr;
+    }
+    alloc->phys->flags &= ~PHYS_PAGE_DIRTY;
+    alloc->phys->flags &= ~PHYS_PAGE_STANDBY;
+    uintptr_t phys = alloc->phys->phys;
+    if (page->range)
+        page->prot = page->range->prot;
+    page->prot.present = true;
+    page->prot.is_swap_phys = false;
+    page->phys = phys;
+    alloc->phys->pagedCount++;
+    obos_status status = MmS_SetPageMapping(ctx->pt, page, phys, false);
+    if (obos_is_error(status))
+    {
+        alloc->phys->pagedCount--;
+        MmH_DerefPage(alloc->phys);
+        return status;
+    }
+    MmH_DerefSwapAllocation(alloc);
+    atomic_fetch_add(&ctx->swapInGeneration, 1);
+    return OBOS_STATUS_SUCCESS;
+}
+
+// The pages a swap-in reads into, allocated before the swap lock is taken, as allocating memory with the
+// swap lock held deadlocks if the PMM needs to take pages off the standby list.
+typedef struct swapin_pages {
+    // The page to read the faulting page into.
+    struct page* fault_page;
+    // The pages to read the pages around it into.
+    struct page* readahead[MM_MAX_FAULT_AROUND_PAGES];
+    size_t nReadahead;
+} swapin_pages;
+
+// Whether the page at 'virt' is swapped out, and its swap id is 'id'.
+static bool swapped_out_as(context* ctx, uintptr_t virt, uintptr_t id)
+{
+    page_info info = {};
+    // Most neighbours are resident, don't clear their accessed and dirty bits.
+    MmS_PeekPageInfo(ctx->pt, virt, &info, nullptr);
+    return info.prot.is_swap_phys && !info.prot.huge_page && info.phys == id;
+}
+
+// Allocates the page to read the page swapped out at 'page' into, and a page for every page around it in
+// the fault-around window whose swap id is contiguous with it.
+// The swap allocations are not looked up, as that needs the swap lock, so swap_readahead might
+// not use all of them.
+static void allocate_swapin_pages(context* ctx, page_info* page, swapin_pages* out)
+{
+    out->nReadahead = 0;
+    out->fault_page = MmH_PgAllocatePhysical(page->range->phys32, page->range->prot.huge_page);
+    if (!out->fault_page || page->range->prot.huge_page)
+        return;
+    // Don't read ahead when memory is low.
+    if (Mm_FreePhysicalPageCount() < Mm_LowWatermark)
+        return;
+    uintptr_t base = 0, end = 0;
+    if (!MmH_FaultAroundWindow(ctx, page->range, page->virt, &base, &end))
+        return;
+    size_t nPages = 0;
+    for (uintptr_t virt = page->virt; virt > base && swapped_out_as(ctx, virt - OBOS_PAGE_SIZE, page->phys - (page->virt - (virt - OBOS_PAGE_SIZE))); virt -= OBOS_PAGE_SIZE)
+        nPages++;
+    for (uintptr_t virt = page->virt + OBOS_PAGE_SIZE; virt < end && swapped_out_as(ctx, virt, page->phys + (virt - page->virt)); virt += OBOS_PAGE_SIZE)
+        nPages++;
+    for (; out->nReadahead < nPages; out->nReadahead++)
+    {
+        out->readahead[out->nReadahead] = MmH_PgAllocatePhysical(page->range->phys32, false);
+        if (!out->readahead[out->nReadahead])
+            break;
+    }
+}
+
+// Frees the pages that were not used.
+// Must be called without the swap lock held.
+static void free_swapin_pages(swapin_pages* pages)
+{
+    if (pages->fault_page)
+        MmH_DerefPage(pages->fault_page);
+    for (size_t i = 0; i < pages->nReadahead; i++)
+        MmH_DerefPage(pages->readahead[i]);
+    pages->fault_page = nullptr;
+    pages->nReadahead = 0;
+}
+
+// Reads the page of 'alloc', which faulted at 'page', along with the pages around it in the
+// fault-around window whose swap ids are contiguous with it, in one read.
+// The pages read ahead are taken from 'pool', and are put on the standby list, so that they can be
+// mapped by fault-around, or by a soft fault later on.
+// Returns false if nothing was read, in which case the caller must read the page itself.
+// Must be called with the swap lock held.
+static bool swap_readahead(context* ctx, page_info* page, swap_allocation* alloc, swapin_pages* pool)
+{
+    swap_dev* const provider = alloc->provider;
+    if (!provider->swap_read_range || !pool->nReadahead)
+        return false;
+    uintptr_t base = 0, end = 0;
+    if (!MmH_FaultAroundWindow(ctx, page->range, page->virt, &base, &end))
+        return false;
+
+    swap_allocation* allocs[MM_MAX_FAULT_AROUND_PAGES];
+    struct page* pages[MM_MAX_FAULT_AROUND_PAGES];
+    size_t nPages = 0;
+    // The index of the faulting page.
+    size_t faulting = 0;
+
+    // Find the run of pages with contiguous swap ids around the faulting page.
+    uintptr_t first = page->virt;
+    for (uintptr_t virt = page->virt; virt > base; virt -= OBOS_PAGE_SIZE)
+    {
+        page_info info = {};
+        MmS_PeekPageInfo(ctx->pt, virt - OBOS_PAGE_SIZE, &info, nullptr);
+        if (!info.prot.is_swap_phys || info.prot.huge_page || info.phys != alloc->id - (page->virt - (virt - OBOS_PAGE_SIZE)))
+            break;
+        swap_allocation* curr = MmH_LookupSwapAllocation(info.phys);
+        if (!curr || curr->phys || curr->provider != provider)
+            break;
+        first = virt - OBOS_PAGE_SIZE;
+    }
+    for (uintptr_t virt = first; virt < end; virt += OBOS_PAGE_SIZE)
+    {
+        swap_allocation* curr = alloc;
+        if (virt != page->virt)
+        {
+            page_info info = {};
+            MmS_PeekPageInfo(ctx->pt, virt, &info, nullptr);
+            if (!info.prot.is_swap_phys || info.prot.huge_page || info.phys != alloc->id + (virt - page->virt))
+                break;
+            curr = MmH_LookupSwapAllocation(info.phys);
+            if (!curr || curr->phys || curr->provider != provider)
+                break;
+        }
+        else
+            faulting = nPages;
+        allocs[nPages++] = curr;
+    }
+    if (nPages <= 1)
+        return false;
+
+    // The page tables might have changed since the pages were allocated, so only read as much as there are pages for.
+    if (faulting > pool->nReadahead)
+        return false;
+    if (nPages - 1 > pool->nReadahead)
+        nPages = pool->nReadahead + 1;
+    for (size_t i = 0; i < nPages; i++)
+        pages[i] = (i == faulting) ? alloc->phys : pool->readahead[--pool->nReadahead];
+
+    obos_status status = provider->swap_read_range(provider, allocs[0]->id, pages, nPages);
+    if (obos_is_error(status))
+    {
+        for (size_t i = 0; i < nPages; i++)
+            if (i != faulting)
+                pool->readahead[pool->nReadahead++] = pages[i];
+        return false;
+    }
+
+    for (size_t i = 0; i < nPages; i++)
+    {
+        if (i == faulting)
+            continue;
+        // Like Mm_SwapOut, the allocation and the standby list each hold a reference to the page.
+        allocs[i]->phys = pages[i];
+        pages[i]->swap_alloc = allocs[i];
+        MmH_RefPage(pages[i]);
+        pages[i]->flags |= PHYS_PAGE_STANDBY;
+        LIST_APPEND(phys_page_list, &Mm_StandbyPageList, pages[i]);
+    }
+    return true;
+}
+
 obos_status Mm_SwapIn(context* ctx, page_info* page, fault_type* type)
 {
     if (!Mm_SwapProvider)
@@ -124,15 +312,15 @@ obos_status Mm_SwapIn(context* ctx, page_info* page, fault_type* type)
     //     return OBOS_STATUS_INVALID_ARGUMENT;
     if (!page->range->pageable)
         return OBOS_STATUS_UNPAGED_POOL;
+    swapin_pages pool = {};
+    if (page->prot.is_swap_phys)
+        allocate_swapin_pages(ctx, page, &pool);
     irql oldIrql = Mm_TakeSwapLock();
     page_info arch_pg_info = {.virt=page->virt};
     MmS_QueryPageInfo(ctx->pt, arch_pg_info.virt, &arch_pg_info, nullptr);
     if (arch_pg_info.prot.is_swap_phys)
         goto down;
-    struct page what = {.phys=page->phys};
-    Core_MutexAcquire(&Mm_PhysicalPagesLock);
-    struct page* node = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what);
-    Core_MutexRelease(&Mm_PhysicalPagesLock);
+    struct page* node = MmH_LookupPage(page->phys);
     const bool onDirtyList = (node->flags & PHYS_PAGE_DIRTY);
     const bool onStandbyList = (node->flags & PHYS_PAGE_STANDBY);
     if ((onDirtyList||onStandbyList))
@@ -158,9 +346,11 @@ obos_status Mm_SwapIn(context* ctx, page_info* page, fault_type* type)
         {
             // Unlikely error.
             Mm_ReleaseSwapLock(oldIrql);
+            free_swapin_pages(&pool);
             return status;
         }
         Mm_ReleaseSwapLock(oldIrql);
+        free_swapin_pages(&pool);
         if (type)
             *type = SOFT_FAULT;
         return OBOS_STATUS_SUCCESS;
@@ -169,25 +359,34 @@ obos_status Mm_SwapIn(context* ctx, page_info* page, fault_type* type)
     {
         // Not swapped out.
         Mm_ReleaseSwapLock(oldIrql);
+        free_swapin_pages(&pool);
         return OBOS_STATUS_SUCCESS; 
     }
     down:
     OBOS_UNUSED(0);
-    size_t nPages = (page->prot.huge_page ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE)/OBOS_PAGE_SIZE;
     obos_status status = OBOS_STATUS_SUCCESS;
-    uintptr_t phys = 0;
     swap_allocation* alloc = MmH_LookupSwapAllocation(page->phys);
     if (!alloc)
     {
         Mm_ReleaseSwapLock(oldIrql);
+        free_swapin_pages(&pool);
         return OBOS_STATUS_NOT_FOUND;
     }
     if (!alloc->phys)
     {
-        alloc->phys = MmH_PgAllocatePhysical(page->range->phys32, page->range->prot.huge_page);
-        if (obos_is_error(alloc->provider->swap_read(alloc->provider, alloc->id, alloc->phys)))
+        alloc->phys = pool.fault_page;
+        pool.fault_page = nullptr;
+        if (!alloc->phys)
+            status = OBOS_STATUS_NOT_ENOUGH_MEMORY;
+        else if (page->prot.huge_page || !swap_readahead(ctx, page, alloc, &pool))
+            status = alloc->provider->swap_read(alloc->provider, alloc->id, alloc->phys);
+        if (obos_is_error(status))
         {
+            // Freed with the rest of the pages, once the swap lock is released.
+            pool.fault_page = alloc->phys;
+            alloc->phys = nullptr;
             Mm_ReleaseSwapLock(oldIrql);
+            free_swapin_pages(&pool);
             if (type)
                 *type = ACCESS_FAULT;
             return OBOS_STATUS_SUCCESS;
@@ -195,46 +394,40 @@ obos_status Mm_SwapIn(context* ctx, page_info* page, fault_type* type)
     }
     else
         MmH_RefPage(alloc->phys);
-    
-    if (alloc->phys->flags & PHYS_PAGE_STANDBY)
-    {
-        LIST_REMOVE(phys_page_list, &Mm_StandbyPageList, alloc->phys);
-        if (type)
-            *type = SOFT_FAULT;
-        type = nullptr;
-    }
-    else if (alloc->phys->flags & PHYS_PAGE_DIRTY)
-    {
-        if (!alloc->phys->pagedCount)
-            LIST_REMOVE(phys_page_list, &Mm_DirtyPageList, alloc->phys);
-        Mm_DirtyPagesBytes -= page->prot.huge_page ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE;
-        if (type)
-            *type = SOFT_FAULT;
-        type = nullptr;
-    }
-    alloc->phys->flags &= ~PHYS_PAGE_DIRTY;
-    alloc->phys->flags &= ~PHYS_PAGE_STANDBY;
-    phys = alloc->phys->phys;
-    if (page->range)
-        page->prot = page->range->prot;
-    page->prot.present = true;
-    page->prot.is_swap_phys = false;
-    page->phys = phys;
-    alloc->phys->pagedCount++;
-    status = MmS_SetPageMapping(ctx->pt, page, phys, false);
+
+    status = map_swapped_page(ctx, page, alloc, &type);
+    Mm_ReleaseSwapLock(oldIrql);
+    free_swapin_pages(&pool);
     if (obos_is_error(status))
-    {
-        Mm_FreePhysicalPages(phys, nPages);
-        Mm_ReleaseSwapLock(oldIrql);
         return status;
-    }
-    MmH_DerefSwapAllocation(alloc);
-    Mm_ReleaseSwapLock(oldIrql);
     if (type)
         *type = HARD_FAULT;
     return OBOS_STATUS_SUCCESS;
 }
 
+obos_status Mm_SwapInResident(context* ctx, page_info* page)
+{
+    if (!Mm_SwapProvider)
+        return OBOS_STATUS_INVALID_INIT_PHASE;
+    if (!page || !page->range)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    if (!page->prot.is_swap_phys)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    if (!page->range->pageable)
+        return OBOS_STATUS_UNPAGED_POOL;
+    irql oldIrql = Mm_TakeSwapLock();
+    swap_allocation* alloc = MmH_LookupSwapAllocation(page->phys);
+    if (!alloc || !alloc->phys || (alloc->phys->flags & PHYS_PAGE_WRITEBACK))
+    {
+        Mm_ReleaseSwapLock(oldIrql);
+        return OBOS_STATUS_NOT_FOUND;
+    }
+    MmH_RefPage(alloc->phys);
+    obos_status status = map_swapped_page(ctx, page, alloc, nullptr);
+    Mm_ReleaseSwapLock(oldIrql);
+    return status;
+}
+
 obos_status Mm_ChangeSwapProvider(swap_dev* to)
 {
     Mm_SwapProvider->awaiting_deinit = true;
@@ -244,6 +437,185 @@ obos_status Mm_ChangeSwapProvider(swap_dev* to)
 
 uint32_t Mm_PageWriterOperation = 0;
 
+// Anonymous pages are written back in clusters of pages with contiguous swap ids, with one
+// write per cluster. Up to SWAP_WRITES_IN_FLIGHT clusters are written at once, and the pages
+// of a cluster are moved to the standby list when its write completes.
+
+// The maximum amount of pages taken off the dirty list at a time.
+#define SWAP_WRITEBACK_BATCH (SWAP_CLUSTER_MAX*SWAP_WRITES_IN_FLIGHT)
+
+typedef struct swap_writeback {
+    page* pg;
+    // Referenced while the page is written, so that its swap id can't be reused
+    // until the write is done.
+    swap_allocation* alloc;
+} swap_writeback;
+
+typedef struct swap_cluster {
+    swap_dev* provider;
+    // Set if the write was started with swap_write_start.
+    void* req;
+    // The status of the write if it was synchronous.
+    obos_status status;
+    swap_writeback* pages;
+    size_t nPages;
+} swap_cluster;
+
+// Only used by the page writer thread.
+static swap_writeback writeback_batch[SWAP_WRITEBACK_BATCH];
+static swap_cluster writes_in_flight[SWAP_WRITES_IN_FLIGHT];
+
+// Takes up to SWAP_WRITEBACK_BATCH anonymous pages off the dirty list and marks them as being
+// written back, sorted by swap id.
+static size_t collect_anon_pages()
+{
+    size_t nPages = 0;
+    irql oldIrql = Mm_TakeSwapLock();
+    for (page* pg = LIST_GET_HEAD(phys_page_list, &Mm_DirtyPageList); pg && nPages < SWAP_WRITEBACK_BATCH; )
+    {
+        page* next = LIST_GET_NEXT(phys_page_list, &Mm_DirtyPageList, pg);
+        if (next == pg)
+            next = nullptr;
+        if (~pg->flags & PHYS_PAGE_DIRTY)
+        {
+            // Funny business
+            LIST_REMOVE(phys_page_list, &Mm_DirtyPageList, pg);
+            pg = next;
+            continue;
+        }
+        if (pg->backing_vn || !pg->swap_alloc || (pg->flags & PHYS_PAGE_WRITEBACK))
+        {
+            pg = next;
+            continue;
+        }
+        pg->flags |= PHYS_PAGE_WRITEBACK;
+        MmH_RefPage(pg);
+        MmH_RefSwapAllocation(pg->swap_alloc);
+
+        // Insertion sort, swap ids are mostly allocated in order, so this is usually cheap.
+        size_t i = nPages++;
+        for (; i && writeback_batch[i-1].alloc->id > pg->swap_alloc->id; i--)
+            writeback_batch[i] = writeback_batch[i-1];
+        writeback_batch[i].pg = pg;
+        writeback_batch[i].alloc = pg->swap_alloc;
+
+        pg = next;
+    }
+    Mm_ReleaseSwapLock(oldIrql);
+    return nPages;
+}
+
+static void start_cluster(swap_cluster* cluster)
+{
+    swap_dev* const provider = cluster->provider;
+    swap_writeback* const first = &cluster->pages[0];
+    cluster->req = nullptr;
+    cluster->status = OBOS_STATUS_SUCCESS;
+    if (provider->swap_write_start && !(first->pg->flags & PHYS_PAGE_HUGE_PAGE))
+    {
+        page* pages[SWAP_CLUSTER_MAX];
+        for (size_t i = 0; i < cluster->nPages; i++)
+            pages[i] = cluster->pages[i].pg;
+        cluster->status = provider->swap_write_start(provider, first->alloc->id, pages, cluster->nPages, &cluster->req);
+        if (obos_is_success(cluster->status))
+            return;
+        cluster->req = nullptr;
+    }
+    // Fall back to writing the pages one at a time.
+    cluster->status = OBOS_STATUS_SUCCESS;
+    for (size_t i = 0; i < cluster->nPages && obos_is_success(cluster->status); i++)
+        cluster->status = provider->swap_write(provider, cluster->pages[i].alloc->id, cluster->pages[i].pg);
+}
+
+// Returns the amount of pages moved to the standby list.
+static size_t finish_cluster(swap_cluster* cluster)
+{
+    size_t nWritten = 0;
+    obos_status status = cluster->status;
+    if (cluster->req)
+        status = cluster->provider->swap_write_finish(cluster->provider, cluster->req);
+    if (obos_is_error(status))
+        OBOS_Error("I/O Error while writing pages to swap. Status: %d\n", status);
+
+    irql oldIrql = Mm_TakeSwapLock();
+    for (size_t i = 0; i < cluster->nPages; i++)
+    {
+        page* const pg = cluster->pages[i].pg;
+        pg->flags &= ~PHYS_PAGE_WRITEBACK;
+        // If the write failed, the page is left on the dirty list, and is written again later.
+        // If the page was swapped in (and maybe out again) while it was written,
+        // it is not dirty anymore, or is dirty with a different swap id, so leave it alone.
+        if (obos_is_error(status) || (~pg->flags & PHYS_PAGE_DIRTY) || pg->swap_alloc != cluster->pages[i].alloc)
+            continue;
+        Mm_GlobalMemoryUsage.paged += pg->flags & PHYS_PAGE_HUGE_PAGE ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE;
+        pg->flags &= ~PHYS_PAGE_DIRTY;
+        LIST_REMOVE(phys_page_list, &Mm_DirtyPageList, pg);
+        LIST_APPEND(phys_page_list, &Mm_StandbyPageList, pg);
+        pg->flags |= PHYS_PAGE_STANDBY;
+        nWritten++;
+    }
+    Mm_ReleaseSwapLock(oldIrql);
+
+    for (size_t i = 0; i < cluster->nPages; i++)
+    {
+        MmH_DerefSwapAllocation(cluster->pages[i].alloc);
+        MmH_DerefPage(cluster->pages[i].pg);
+    }
+    cluster->nPages = 0;
+    return nWritten;
+}
+
+static void write_anon_pages()
+{
+    size_t nInFlight = 0;
+    size_t oldest = 0;
+    size_t nPages = 0;
+    size_t nWritten = 0;
+    do {
+        nWritten = 0;
+        nPages = collect_anon_pages();
+        for (size_t i = 0; i < nPages; )
+        {
+            // Extend the cluster for as long as the swap ids are contiguous.
+            const swap_writeback* const first = &writeback_batch[i];
+            const bool huge = first->pg->flags & PHYS_PAGE_HUGE_PAGE;
+            size_t nClusterPages = 1;
+            while (!huge && (i + nClusterPages) < nPages && nClusterPages < SWAP_CLUSTER_MAX)
+            {
+                const swap_writeback* const curr = &writeback_batch[i + nClusterPages];
+                if (curr->alloc->provider != first->alloc->provider || (curr->pg->flags & PHYS_PAGE_HUGE_PAGE))
+                    break;
+                if (curr->alloc->id != first->alloc->id + nClusterPages*OBOS_PAGE_SIZE)
+                    break;
+                nClusterPages++;
+            }
+
+            if (nInFlight == SWAP_WRITES_IN_FLIGHT)
+            {
+                nWritten += finish_cluster(&writes_in_flight[oldest]);
+                oldest = (oldest + 1) % SWAP_WRITES_IN_FLIGHT;
+                nInFlight--;
+            }
+            swap_cluster* cluster = &writes_in_flight[(oldest + nInFlight) % SWAP_WRITES_IN_FLIGHT];
+            cluster->provider = first->alloc->provider;
+            cluster->pages = &writeback_batch[i];
+            cluster->nPages = nClusterPages;
+            start_cluster(cluster);
+            nInFlight++;
+
+            i += nClusterPages;
+        }
+        // The batch is reused by the next iteration, so wait for everything in it to be written.
+        for (; nInFlight; nInFlight--)
+        {
+            nWritten += finish_cluster(&writes_in_flight[oldest]);
+            oldest = (oldest + 1) % SWAP_WRITES_IN_FLIGHT;
+        }
+        // Pages that failed to be written are still on the dirty list, so stop if
+        // nothing could be written instead of retrying them forever.
+    } while (nPages == SWAP_WRITEBACK_BATCH && nWritten);
+}
+
 static __attribute__((no_instrument_function)) void page_writer()
 {
     // const char* const This = "Page Writer";
@@ -257,43 +629,10 @@ static __attribute__((no_instrument_function)) void page_writer()
         // FOR EACH dirty page.
         // Write them back :)
         // also while we're at it, we'll make them standby
-        irql oldIrql = Mm_TakeSwapLock();
-        for (page* pg = LIST_GET_HEAD(phys_page_list, &Mm_DirtyPageList); pg && (Mm_PageWriterOperation & PAGE_WRITER_SYNC_ANON); )
-        {
-            page* next = LIST_GET_NEXT(phys_page_list, &Mm_DirtyPageList, pg);
-            if (next == pg)
-                next = nullptr;
-            // OBOS_ASSERT(pg->flags & PHYS_PAGE_DIRTY);
-            if (~pg->flags & PHYS_PAGE_DIRTY)
-            {
-                // Funny business
-                LIST_REMOVE(phys_page_list, &Mm_DirtyPageList, pg);
-                pg = next;
-                continue;
-            }
-            if (!pg->backing_vn)
-            {
-                Mm_ReleaseSwapLock(oldIrql);
-                if (obos_is_error(Mm_SwapProvider->swap_write(Mm_SwapProvider, pg->swap_alloc->id, pg)))
-                {
-                    pg->swap_alloc->refs--;
-                    MmH_DerefSwapAllocation(pg->swap_alloc);
-                    pg = next;
-                    continue;
-                }
-                Mm_GlobalMemoryUsage.paged += pg->flags & PHYS_PAGE_HUGE_PAGE ? OBOS_HUGE_PAGE_SIZE : OBOS_PAGE_SIZE;
-                oldIrql = Mm_TakeSwapLock();
-                pg->flags &= ~PHYS_PAGE_DIRTY;
-                LIST_REMOVE(phys_page_list, &Mm_DirtyPageList, pg);
-
-                LIST_APPEND(phys_page_list, &Mm_StandbyPageList, pg);
-                pg->flags |= PHYS_PAGE_STANDBY;
-            }
-
-            // abort:
-            pg = next;
-        }
+        if (Mm_PageWriterOperation & PAGE_WRITER_SYNC_ANON)
+            write_anon_pages();
 
+        irql oldIrql = Mm_TakeSwapLock();
         for (page* pg = LIST_GET_HEAD(phys_page_list, &Mm_DirtyPageList); pg && (Mm_PageWriterOperation & PAGE_WRITER_SYNC_FILE); )
         {
             page* next = LIST_GET_NEXT(phys_page_list, &Mm_DirtyPageList, pg);
@@ -359,10 +698,7 @@ void Mm_MarkAsDirty(page_info* pg)
     OBOS_ASSERT(pg->phys);
     if (pg->prot.is_swap_phys)
         return;
-    page what = {.phys=pg->phys};
-    Core_MutexAcquire(&Mm_PhysicalPagesLock);
-    page* node = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what);
-    Core_MutexRelease(&Mm_PhysicalPagesLock);
+    page* node = MmH_LookupPage(pg->phys);
     Mm_MarkAsDirtyPhys(node);
 }
 
@@ -370,10 +706,7 @@ void Mm_MarkAsStandby(page_info* pg)
 {
     if (pg->prot.is_swap_phys)
         return;
-    page what = {.phys=pg->phys};
-    Core_MutexAcquire(&Mm_PhysicalPagesLock);
-    page* node = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what);
-    Core_MutexRelease(&Mm_PhysicalPagesLock);
+    page* node = MmH_LookupPage(pg->phys);
     Mm_MarkAsStandbyPhys(node);
 }
 
@@ -439,10 +772,7 @@ obos_status Mm_LockPage(context* ctx, page_info* pg)
     OBOS_ASSERT(pg->phys);
     OBOS_ASSERT (!pg->prot.is_swap_phys);
     
-    page what = {.phys=pg->phys};
-    Core_MutexAcquire(&Mm_PhysicalPagesLock);
-    page* node = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what);
-    Core_MutexRelease(&Mm_PhysicalPagesLock);
+    page* node = MmH_LookupPage(pg->phys);
     
     obos_status status = Mm_LockPagePhys(node);
     if (obos_is_error(status))
@@ -457,10 +787,7 @@ obos_status Mm_UnlockPage(context* ctx, page_info* pg)
     OBOS_ASSERT(pg->phys);
     OBOS_ASSERT (!pg->prot.is_swap_phys);
 
-    page what = {.phys=pg->phys};
-    Core_MutexAcquire(&Mm_PhysicalPagesLock);
-    page* node = RB_FIND(phys_page_tree, &Mm_PhysicalPages, &what);
-    Core_MutexRelease(&Mm_PhysicalPagesLock);
+    page* node = MmH_LookupPage(pg->phys);
 
     if (~node->flags & PHYS_PAGE_LOCKED)
         return OBOS_STATUS_SUCCESS;
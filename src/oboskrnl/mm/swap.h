@@ -14,6 +14,11 @@
 #include <mm/page.h>
 #include <mm/handler.h>
 
+// The maximum amount of pages written by one call to swap_write_start.
+#define SWAP_CLUSTER_MAX 64
+// The maximum amount of writes started with swap_write_start that are not finished yet.
+#define SWAP_WRITES_IN_FLIGHT 8
+
 typedef struct swap_device
 {
     // *id needs to be aligned to OBOS_PAGE_SIZE if !huge_page, otherwise it needs to be aligned to OBOS_HUGE_PAGE_SIZE
@@ -21,6 +26,18 @@ typedef struct swap_device
     obos_status(* swap_free)(struct swap_device* dev, uintptr_t id, bool huge_page);
     obos_status(*swap_write)(struct swap_device* dev, uintptr_t id, page* pg);
     obos_status(* swap_read)(struct swap_device* dev, uintptr_t id, page* pg);
+    // Optional.
+    // Reads nPages (non-huge) pages from the contiguous ids starting at 'id', preferably with one command.
+    // nPages is at most MM_MAX_FAULT_AROUND_PAGES. This is called with the swap lock held, so it must not allocate memory.
+    obos_status(*swap_read_range)(struct swap_device* dev, uintptr_t id, page** pages, size_t nPages);
+    // Optional.
+    // Starts writing nPages (non-huge) pages to the contiguous ids starting at 'id'.
+    // The contents of the pages are captured by the time this returns.
+    // This is called by the page writer, so it must not wait for memory to be freed. If it fails, the pages are
+    // written one at a time with swap_write instead.
+    // *req must be passed to swap_write_finish, which waits for the write and returns its status.
+    obos_status(*swap_write_start)(struct swap_device* dev, uintptr_t id, page** pages, size_t nPages, void** req);
+    obos_status(*swap_write_finish)(struct swap_device* dev, void* req);
     obos_status(*deinit_dev)(struct swap_device* dev);
     void* metadata;
     size_t refs;
@@ -33,6 +50,9 @@ extern swap_dev* Mm_SwapProvider;
 
 obos_status Mm_SwapOut(uintptr_t virt, context* ctx);
 obos_status Mm_SwapIn(context* ctx, page_info* page, fault_type* type);
+// Like Mm_SwapIn, except the page is only mapped if it is still in memory (i.e., on the dirty or standby list).
+// Returns OBOS_STATUS_NOT_FOUND if it is not.
+obos_status Mm_SwapInResident(context* ctx, page_info* page);
 
 enum {
     PAGE_WRITER_SYNC_FILE = BIT(0),
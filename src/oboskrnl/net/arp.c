@@ -4,18 +4,23 @@
  * Copyright (c) 2025 Omar Berrow
  */
 
-#include "irq/timer.h"
-#include "locks/wait.h"
 #include <int.h>
 #include <klog.h>
 #include <error.h>
+#include <cmdline.h>
 #include <memmanip.h>
 #include <struct_packing.h>
 
+#include <stdatomic.h>
+
 #include <vfs/vnode.h>
 
 #include <locks/mutex.h>
 #include <locks/event.h>
+#include <locks/wait.h>
+#include <locks/spinlock.h>
+
+#include <irq/timer.h>
 
 #include <net/eth.h>
 #include <net/arp.h>
@@ -39,44 +44,54 @@ struct OBOS_PACK arp_header_payload
     ip_addr target_ip;
 };
 
-obos_status NetH_ARPRequest(vnode* nic, ip_addr addr, mac_address* out, address_table_entry **address_table_ent)
+static struct {
+    uint64_t reachable_time;
+    uint64_t retransmit_time;
+    uint64_t failed_time;
+    uint32_t max_probes;
+    size_t queue_length;
+} arp_params;
+
+static void init_params()
 {
-    if (!nic || !out)
-        return OBOS_STATUS_INVALID_ARGUMENT;
+    static bool initialized = false;
+    if (initialized)
+        return;
+    arp_params.reachable_time = OBOS_GetOPTD_Ex("arp-reachable-time", ARP_DEFAULT_REACHABLE_TIME);
+    arp_params.retransmit_time = OBOS_GetOPTD_Ex("arp-retransmit-time", ARP_DEFAULT_RETRANSMIT_TIME);
+    arp_params.failed_time = OBOS_GetOPTD_Ex("arp-failed-time", ARP_DEFAULT_FAILED_TIME);
+    arp_params.max_probes = OBOS_GetOPTD_Ex("arp-max-probes", ARP_DEFAULT_MAX_PROBES);
+    arp_params.queue_length = OBOS_GetOPTD_Ex("arp-queue-length", ARP_DEFAULT_QUEUE_LENGTH);
+    if (!arp_params.retransmit_time)
+        arp_params.retransmit_time = ARP_DEFAULT_RETRANSMIT_TIME;
+    if (!arp_params.max_probes)
+        arp_params.max_probes = 1;
+    // The frame that starts resolving an address must be queued.
+    if (!arp_params.queue_length)
+        arp_params.queue_length = 1;
+    initialized = true;
+}
 
-    address_table_entry what = {.addr = addr};
-    Core_PushlockAcquire(&nic->net_tables->arp_cache_lock, true);
-    address_table_entry* ent = RB_FIND(address_table, &nic->net_tables->arp_cache, &what);
-    Core_PushlockRelease(&nic->net_tables->arp_cache_lock, true);
-    
-    obos_status status = OBOS_STATUS_SUCCESS;
-    if (ent) 
-    {
-        status = Core_WaitOnObject(WAITABLE_OBJECT(ent->sync));
-        if (obos_is_error(status))
-            return status;
-        if (memcmp_b(ent->phys, 0, sizeof(mac_address)))
-        {
-            Core_PushlockAcquire(&nic->net_tables->arp_cache_lock, true);
-            RB_REMOVE(address_table, &nic->net_tables->arp_cache, ent);
-            Core_PushlockRelease(&nic->net_tables->arp_cache_lock, true);
-            ent = nullptr;
-            goto down;
-        }
-        if (out)
-            memcpy(*out, ent->phys, sizeof(mac_address));
-        if (address_table_ent)
-            *address_table_ent = ent;
-        return OBOS_STATUS_SUCCESS;
-    }
+static uint64_t now_ms()
+{
+    return CoreH_TickToNS(CoreS_GetTimerTick(), false) / 1000000;
+}
 
-    down:
-    ent = ZeroAllocate(OBOS_NonPagedPoolAllocator, 1, sizeof(address_table_entry), nullptr);
-    ent->addr = addr;
-    ent->sync = EVENT_INITIALIZE(EVENT_NOTIFICATION);
-    Core_PushlockAcquire(&nic->net_tables->arp_cache_lock, false);
-    RB_INSERT(address_table, &nic->net_tables->arp_cache, ent);
-    Core_PushlockRelease(&nic->net_tables->arp_cache_lock, false);
+static void neighbor_ref(address_table_entry* ent)
+{
+    atomic_fetch_add(&ent->refs, 1);
+}
+
+static void neighbor_unref(address_table_entry* ent)
+{
+    if (atomic_fetch_sub(&ent->refs, 1) == 1)
+        Free(OBOS_NonPagedPoolAllocator, ent, sizeof(*ent));
+}
+
+// Sends an ARP request for 'target', broadcast if 'dest' is nullptr, or unicast to 'dest' otherwise.
+static obos_status send_request(vnode* nic, ip_addr target, const mac_address* dest)
+{
+    net_tables* tables = nic->net_tables;
 
     size_t sz_hdr = sizeof(arp_header)+sizeof(ip_addr)*2+sizeof(mac_address)*2;
     char hdr_buf[sz_hdr];
@@ -88,92 +103,472 @@ obos_status NetH_ARPRequest(vnode* nic, ip_addr addr, mac_address* out, address_
     hdr->len_hw_address = 6;
 
     struct arp_header_payload* payload = (void*)hdr->data;
-    Core_PushlockAcquire(&nic->net_tables->table_lock, true);
-    payload->sender_ip = LIST_GET_HEAD(ip_table, &nic->net_tables->table)->address;
-    Core_PushlockRelease(&nic->net_tables->table_lock, true);
-    memcpy(payload->sender_mac, nic->net_tables->mac, sizeof(mac_address));
-    payload->target_ip = addr;
+    // Prefer an address on the target's subnet.
+    Core_PushlockAcquire(&tables->table_lock, true);
+    ip_table_entry* ent = LIST_GET_HEAD(ip_table, &tables->table);
+    for (ip_table_entry* curr = ent; curr; curr = LIST_GET_NEXT(ip_table, &tables->table, curr))
+    {
+        if ((curr->address.addr & curr->subnet) == (target.addr & curr->subnet))
+        {
+            ent = curr;
+            break;
+        }
+    }
+    if (ent)
+        payload->sender_ip = ent->address;
+    Core_PushlockRelease(&tables->table_lock, true);
+    if (!ent)
+        return OBOS_STATUS_NETWORK_UNREACHABLE;
+    memcpy(payload->sender_mac, tables->mac, sizeof(mac_address));
+    payload->target_ip = target;
     memzero(payload->target_mac, sizeof(payload->target_mac));
 
-    event tm_evnt = EVENT_INITIALIZE(EVENT_NOTIFICATION);
-    timer* tm = nullptr;
-    CoreH_MakeTimerEvent(&tm, 1000*1000, &tm_evnt, true);
+    tables->arp_stats.nRequests++;
+    shared_ptr *eth = NetH_FormatEthernetPacket(nic, dest ? *dest : MAC_BROADCAST, hdr, sz_hdr, ETHERNET2_TYPE_ARP);
+    return NetH_SendEthernetPacket(nic, OBOS_SharedPtrCopy(eth));
+}
+
+// Puts the destination address into a frame that was queued, and recomputes its FCS.
+static void finish_frame(shared_ptr* frame, const mac_address phys, bool has_fcs)
+{
+    ethernet2_header* hdr = frame->obj;
+    memcpy(hdr->dest, phys, sizeof(mac_address));
+    if (!has_fcs)
+        return;
+    uint32_t* checksum = (uint32_t*)((uintptr_t)hdr + frame->szObj - 4);
+    *checksum = host_to_le32(NetH_CRC32Bytes(hdr, frame->szObj - 4));
+}
+
+static bool frame_has_fcs(const nic_irp_data* offload)
+{
+    // Frames sent with offloads get their FCS from the NIC.
+    return !offload || !offload->offload;
+}
 
-    struct waitable_header* signaled = nullptr;
-    struct waitable_header* objs[2] = {
-        WAITABLE_OBJECT(tm_evnt),
-        WAITABLE_OBJECT(ent->sync)
-    };
+static void send_frames(vnode* nic, neighbor_pending_frame* frames, const mac_address phys)
+{
+    while (frames)
+    {
+        neighbor_pending_frame* next = frames->next;
+        const nic_irp_data* offload = frames->has_offload ? &frames->offload : nullptr;
+        finish_frame(frames->frame, phys, frame_has_fcs(offload));
+        NetH_SendEthernetPacketEx(nic, frames->frame, offload);
+        Free(OBOS_NonPagedPoolAllocator, frames, sizeof(*frames));
+        frames = next;
+    }
+}
 
-    size_t nTimeouts = 0;
+static void drop_frames(net_tables* tables, neighbor_pending_frame* frames)
+{
+    while (frames)
+    {
+        neighbor_pending_frame* next = frames->next;
+        OBOS_SharedPtrUnref(frames->frame);
+        Free(OBOS_NonPagedPoolAllocator, frames, sizeof(*frames));
+        tables->arp_stats.nDropped++;
+        frames = next;
+    }
+}
+
+// Takes the frames queued on an entry.
+// The entry's lock must be held.
+static neighbor_pending_frame* take_frames(address_table_entry* ent)
+{
+    neighbor_pending_frame* frames = ent->pending.head;
+    ent->pending.head = nullptr;
+    ent->pending.tail = nullptr;
+    ent->pending.nFrames = 0;
+    return frames;
+}
+
+static void neighbor_timer_expired(void* userdata);
 
-    do
+// Arms the retransmission timer of an entry, if it is not armed already.
+// The entry's lock must be held, returns true if arm_timer must be called after it is released.
+static bool should_arm_timer(address_table_entry* ent)
+{
+    if (ent->timer_armed)
+        return false;
+    ent->timer_armed = true;
+    // The timer's reference.
+    neighbor_ref(ent);
+    return true;
+}
+
+static void arm_timer(address_table_entry* ent)
+{
+    ent->retransmit_timer.handler = neighbor_timer_expired;
+    ent->retransmit_timer.userdata = ent;
+    Core_TimerObjectInitialize(&ent->retransmit_timer, TIMER_MODE_DEADLINE, arp_params.retransmit_time*1000);
+}
+
+static void neighbor_timer_expired(void* userdata)
+{
+    address_table_entry* ent = userdata;
+    net_tables* tables = ent->owner;
+    vnode* nic = tables->interface;
+
+    bool send = false, arm = false, failed = false;
+    bool unicast = false;
+    mac_address phys = {};
+    neighbor_pending_frame* dropped = nullptr;
+
+    irql oldIrql = Core_SpinlockAcquire(&ent->lock);
+    ent->timer_armed = false;
+    if (!ent->removed && (ent->state == NEIGHBOR_INCOMPLETE || ent->state == NEIGHBOR_PROBE))
     {
-        shared_ptr *eth = NetH_FormatEthernetPacket(nic, MAC_BROADCAST, hdr, sz_hdr, ETHERNET2_TYPE_ARP);
-        status = NetH_SendEthernetPacket(nic, OBOS_SharedPtrCopy(eth));
-        if (obos_is_error(status))
+        if (ent->nProbes < arp_params.max_probes)
+        {
+            ent->nProbes++;
+            send = true;
+            unicast = ent->state == NEIGHBOR_PROBE;
+            memcpy(phys, ent->phys, sizeof(mac_address));
+            arm = should_arm_timer(ent);
+        }
+        else
         {
-            Core_CancelTimer(tm);
-            Core_TimerObjectFree(tm);
-            Core_PushlockAcquire(&nic->net_tables->table_lock, false);
-            RB_REMOVE(address_table, &nic->net_tables->arp_cache, ent);    
-            Core_PushlockRelease(&nic->net_tables->table_lock, false);
-            Free(OBOS_NonPagedPoolAllocator, ent, sizeof(*ent));
-            return status; // hdr_ptr isn't leaked, as we never reference it
+            ent->state = NEIGHBOR_FAILED;
+            ent->updated = now_ms();
+            dropped = take_frames(ent);
+            failed = true;
         }
+    }
+    Core_SpinlockRelease(&ent->lock, oldIrql);
 
-        status = Core_WaitOnObjects(2, objs, &signaled);
-        if (obos_is_error(status))
+    if (send)
+        send_request(nic, ent->addr, unicast ? &phys : nullptr);
+    if (arm)
+        arm_timer(ent);
+    if (failed)
+    {
+        tables->arp_stats.nFailed++;
+        Core_EventSet(&ent->sync, false);
+        drop_frames(tables, dropped);
+    }
+    neighbor_unref(ent);
+}
+
+// Removes entries that failed long enough ago, or that went stale, so that the ARP cache does not grow forever.
+// The ARP cache lock must be held exclusively.
+static void collect_entries(net_tables* tables)
+{
+    const uint64_t now = now_ms();
+    address_table_entry *ent = nullptr, *next = nullptr;
+    RB_FOREACH_SAFE(ent, address_table, &tables->arp_cache, next)
+    {
+        irql oldIrql = Core_SpinlockAcquire(&ent->lock);
+        bool collect = false;
+        if (ent->state == NEIGHBOR_FAILED)
+            collect = (now - ent->updated) >= arp_params.failed_time;
+        else if (ent->state == NEIGHBOR_REACHABLE || ent->state == NEIGHBOR_STALE)
+            collect = (now - ent->updated) >= arp_params.reachable_time;
+        if (collect)
+            ent->removed = true;
+        Core_SpinlockRelease(&ent->lock, oldIrql);
+        if (!collect)
+            continue;
+        RB_REMOVE(address_table, &tables->arp_cache, ent);
+        tables->arp_cache_size--;
+        neighbor_unref(ent);
+    }
+}
+
+// Returns a referenced entry for 'addr', creating it (in the INCOMPLETE state) if 'create' is true.
+static address_table_entry* get_entry(net_tables* tables, ip_addr addr, bool create)
+{
+    address_table_entry what = {.addr = addr};
+    Core_PushlockAcquire(&tables->arp_cache_lock, true);
+    address_table_entry* ent = RB_FIND(address_table, &tables->arp_cache, &what);
+    if (ent)
+        neighbor_ref(ent);
+    Core_PushlockRelease(&tables->arp_cache_lock, true);
+    if (ent || !create)
+        return ent;
+
+    address_table_entry* new_ent = ZeroAllocate(OBOS_NonPagedPoolAllocator, 1, sizeof(address_table_entry), nullptr);
+    if (!new_ent)
+        return nullptr;
+    new_ent->addr = addr;
+    new_ent->state = NEIGHBOR_INCOMPLETE;
+    new_ent->sync = EVENT_INITIALIZE(EVENT_NOTIFICATION);
+    new_ent->lock = Core_SpinlockCreate();
+    new_ent->owner = tables;
+    // One reference for the ARP cache, and one for the caller.
+    new_ent->refs = 2;
+
+    Core_PushlockAcquire(&tables->arp_cache_lock, false);
+    ent = RB_INSERT(address_table, &tables->arp_cache, new_ent);
+    if (ent)
+    {
+        // Someone else inserted it first.
+        neighbor_ref(ent);
+        Core_PushlockRelease(&tables->arp_cache_lock, false);
+        Free(OBOS_NonPagedPoolAllocator, new_ent, sizeof(*new_ent));
+        return ent;
+    }
+    if (++tables->arp_cache_size > ARP_CACHE_GC_THRESHOLD)
+        collect_entries(tables);
+    Core_PushlockRelease(&tables->arp_cache_lock, false);
+    return new_ent;
+}
+
+typedef enum {
+    // The address is known, and was copied.
+    RESOLVE_DONE,
+    // The address is being resolved.
+    RESOLVE_PENDING,
+    // The address recently failed to resolve.
+    RESOLVE_FAILED,
+} resolve_result;
+
+// Runs the state machine for a frame sent to 'ent'.
+// If the address is being resolved and 'frame' is not nullptr, it is queued on the entry.
+static resolve_result resolve(vnode* nic, address_table_entry* ent, mac_address phys, shared_ptr* frame, const nic_irp_data* offload)
+{
+    net_tables* tables = nic->net_tables;
+    const uint64_t now = now_ms();
+    bool send = false, unicast = false, arm = false;
+    resolve_result res = RESOLVE_DONE;
+    neighbor_pending_frame* dropped = nullptr;
+
+    irql oldIrql = Core_SpinlockAcquire(&ent->lock);
+    if (ent->state == NEIGHBOR_FAILED)
+    {
+        if ((now - ent->updated) < arp_params.failed_time)
         {
-            Core_CancelTimer(tm);
-            Core_TimerObjectFree(tm);
-            Core_PushlockAcquire(&nic->net_tables->arp_cache_lock, true);
-            RB_REMOVE(address_table, &nic->net_tables->arp_cache, ent);
-            Core_PushlockRelease(&nic->net_tables->arp_cache_lock, true);
-            Free(OBOS_NonPagedPoolAllocator, ent, sizeof(*ent));
-            return status;
+            Core_SpinlockRelease(&ent->lock, oldIrql);
+            tables->arp_stats.nNegativeHits++;
+            return RESOLVE_FAILED;
         }
-        if (signaled == WAITABLE_OBJECT(ent->sync))
+        // Try again.
+        ent->state = NEIGHBOR_INCOMPLETE;
+        ent->nProbes = 0;
+        Core_EventClear(&ent->sync);
+    }
+    if (ent->state == NEIGHBOR_REACHABLE && (now - ent->updated) >= arp_params.reachable_time)
+        ent->state = NEIGHBOR_STALE;
+    switch (ent->state)
+    {
+        case NEIGHBOR_INCOMPLETE:
+        {
+            res = RESOLVE_PENDING;
+            if (frame)
+            {
+                neighbor_pending_frame* node = ZeroAllocate(OBOS_NonPagedPoolAllocator, 1, sizeof(neighbor_pending_frame), nullptr);
+                node->frame = frame;
+                if (offload)
+                {
+                    node->offload = *offload;
+                    node->has_offload = true;
+                }
+                if (ent->pending.tail)
+                    ent->pending.tail->next = node;
+                else
+                    ent->pending.head = node;
+                ent->pending.tail = node;
+                ent->pending.nFrames++;
+                tables->arp_stats.nQueued++;
+                // Drop the oldest frame if the queue is full.
+                if (ent->pending.nFrames > arp_params.queue_length)
+                {
+                    dropped = ent->pending.head;
+                    ent->pending.head = dropped->next;
+                    if (!ent->pending.head)
+                        ent->pending.tail = nullptr;
+                    dropped->next = nullptr;
+                    ent->pending.nFrames--;
+                }
+            }
+            // Only the first sender starts resolving the address, everyone else waits on the same request.
+            if (!ent->nProbes)
+            {
+                ent->nProbes = 1;
+                send = true;
+                arm = should_arm_timer(ent);
+            }
+            break;
+        }
+        case NEIGHBOR_STALE:
+            // Keep using the old address, but make sure it is still valid.
+            ent->state = NEIGHBOR_PROBE;
+            ent->nProbes = 1;
+            send = true;
+            unicast = true;
+            arm = should_arm_timer(ent);
+            // fallthrough
+        case NEIGHBOR_REACHABLE:
+        case NEIGHBOR_PROBE:
+            memcpy(phys, ent->phys, sizeof(mac_address));
+            break;
+        default:
+            break;
+    }
+    Core_SpinlockRelease(&ent->lock, oldIrql);
+
+    if (send)
+        send_request(nic, ent->addr, unicast ? (const mac_address*)&phys : nullptr);
+    if (arm)
+        arm_timer(ent);
+    drop_frames(tables, dropped);
+    return res;
+}
+
+obos_status NetH_ARPSendFrame(vnode* nic, ip_addr addr, shared_ptr* frame, const nic_irp_data* offload)
+{
+    if (!nic || !frame)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    if (!nic->net_tables)
+    {
+        OBOS_SharedPtrUnref(frame);
+        return OBOS_STATUS_UNINITIALIZED;
+    }
+    init_params();
+
+    address_table_entry* ent = get_entry(nic->net_tables, addr, true);
+    if (!ent)
+    {
+        OBOS_SharedPtrUnref(frame);
+        return OBOS_STATUS_NOT_ENOUGH_MEMORY;
+    }
+
+    mac_address phys = {};
+    obos_status status = OBOS_STATUS_SUCCESS;
+    switch (resolve(nic, ent, phys, frame, offload)) {
+        case RESOLVE_DONE:
+            finish_frame(frame, phys, frame_has_fcs(offload));
+            status = NetH_SendEthernetPacketEx(nic, frame, offload);
+            break;
+        case RESOLVE_PENDING:
+            // The frame is owned by the entry now.
+            break;
+        case RESOLVE_FAILED:
+            OBOS_SharedPtrUnref(frame);
+            status = OBOS_STATUS_TIMED_OUT;
             break;
-        Core_EventClear(&tm_evnt);
-        // We timed out.
-        continue;
-    } while (++nTimeouts <= 10);
+    }
+    neighbor_unref(ent);
+    return status;
+}
+
+obos_status NetH_ARPRequest(vnode* nic, ip_addr addr, mac_address* out)
+{
+    if (!nic)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    if (!nic->net_tables)
+        return OBOS_STATUS_UNINITIALIZED;
+    init_params();
 
-    Core_CancelTimer(tm);
-    Core_TimerObjectFree(tm);
+    address_table_entry* ent = get_entry(nic->net_tables, addr, true);
+    if (!ent)
+        return OBOS_STATUS_NOT_ENOUGH_MEMORY;
 
-    if (signaled != WAITABLE_OBJECT(ent->sync))
+    mac_address phys = {};
+    obos_status status = OBOS_STATUS_SUCCESS;
+    resolve_result res = RESOLVE_PENDING;
+    while ((res = resolve(nic, ent, phys, nullptr, nullptr)) == RESOLVE_PENDING)
     {
+        status = Core_WaitOnObject(WAITABLE_OBJECT(ent->sync));
+        if (obos_is_error(status))
+            break;
+    }
+    if (res == RESOLVE_FAILED)
         status = OBOS_STATUS_TIMED_OUT;
-        Core_PushlockAcquire(&nic->net_tables->arp_cache_lock, true);
-        RB_REMOVE(address_table, &nic->net_tables->arp_cache, ent);
-        Core_PushlockRelease(&nic->net_tables->arp_cache_lock, true);
-        Free(OBOS_NonPagedPoolAllocator, ent, sizeof(*ent));
-        return status;
+    if (obos_is_success(status) && out)
+        memcpy(*out, phys, sizeof(mac_address));
+    neighbor_unref(ent);
+    return status;
+}
+
+// Updates the entry of 'addr' with an address from an ARP packet.
+// Replies confirm the address, requests only tell us what it is.
+static void update_entry(vnode* nic, ip_addr addr, const mac_address phys, bool is_reply, bool create)
+{
+    net_tables* tables = nic->net_tables;
+    init_params();
+    address_table_entry* ent = get_entry(tables, addr, create);
+    if (!ent)
+        return;
+
+    neighbor_pending_frame* frames = nullptr;
+    bool resolved = false;
+    mac_address new_phys = {};
+    memcpy(new_phys, phys, sizeof(mac_address));
+
+    irql oldIrql = Core_SpinlockAcquire(&ent->lock);
+    const bool changed = memcmp(ent->phys, phys, sizeof(mac_address)) != 0;
+    switch (ent->state)
+    {
+        case NEIGHBOR_INCOMPLETE:
+        case NEIGHBOR_FAILED:
+            memcpy(ent->phys, phys, sizeof(mac_address));
+            ent->state = is_reply ? NEIGHBOR_REACHABLE : NEIGHBOR_STALE;
+            ent->updated = now_ms();
+            ent->nProbes = 0;
+            frames = take_frames(ent);
+            resolved = true;
+            break;
+        case NEIGHBOR_REACHABLE:
+        case NEIGHBOR_STALE:
+        case NEIGHBOR_PROBE:
+            if (is_reply)
+            {
+                memcpy(ent->phys, phys, sizeof(mac_address));
+                ent->state = NEIGHBOR_REACHABLE;
+                ent->updated = now_ms();
+                ent->nProbes = 0;
+            }
+            else if (changed)
+            {
+                memcpy(ent->phys, phys, sizeof(mac_address));
+                ent->state = NEIGHBOR_STALE;
+                ent->updated = now_ms();
+            }
+            break;
+        default:
+            break;
     }
+    Core_SpinlockRelease(&ent->lock, oldIrql);
+
+    if (resolved)
+    {
+        tables->arp_stats.nResolved++;
+        Core_EventSet(&ent->sync, false);
+        send_frames(nic, frames, new_phys);
+    }
+    neighbor_unref(ent);
+}
+
+void Net_ARPFlushCache(net_tables* tables)
+{
+    if (!tables)
+        return;
+    address_table_entry *ent = nullptr, *next = nullptr;
+    Core_PushlockAcquire(&tables->arp_cache_lock, false);
+    RB_FOREACH_SAFE(ent, address_table, &tables->arp_cache, next)
+    {
+        RB_REMOVE(address_table, &tables->arp_cache, ent);
+        tables->arp_cache_size--;
+
+        irql oldIrql = Core_SpinlockAcquire(&ent->lock);
+        ent->removed = true;
+        // Anyone waiting on the entry gives up.
+        ent->state = NEIGHBOR_FAILED;
+        ent->updated = now_ms();
+        neighbor_pending_frame* frames = take_frames(ent);
+        Core_SpinlockRelease(&ent->lock, oldIrql);
 
-    if (out)
-        memcpy(*out, ent->phys, sizeof(mac_address));
-    if (address_table_ent)
-        *address_table_ent = ent;
-    return OBOS_STATUS_SUCCESS;
+        Core_EventSet(&ent->sync, false);
+        drop_frames(tables, frames);
+        neighbor_unref(ent);
+    }
+    Core_PushlockRelease(&tables->arp_cache_lock, false);
 }
 
 PacketProcessSignature(ARPReply, arp_header*)
 {
     OBOS_UNUSED(depth && buf && size && ptr);
     struct arp_header_payload* data = (void*)(userdata+1);
-    address_table_entry what = {.addr = data->sender_ip};
-    Core_PushlockAcquire(&nic->net_tables->table_lock, true);
-    address_table_entry* ent = RB_FIND(address_table, &nic->net_tables->arp_cache, &what);
-    Core_PushlockRelease(&nic->net_tables->table_lock, true);
-    if (!ent)
-        ExitPacketHandler();
-    if (ent->phys[0])
-        ExitPacketHandler();
-    memcpy(ent->phys, data->sender_mac, sizeof(mac_address));
-    Core_EventSet(&ent->sync, true);
+    update_entry(nic, data->sender_ip, data->sender_mac, true, false);
     ExitPacketHandler();
 }
 
@@ -190,6 +585,10 @@ PacketProcessSignature(ARPRequest, arp_header*)
             break;
     }
     Core_PushlockRelease(&nic->net_tables->table_lock, true);
+    // Update the sender's entry if we have one, and create it if we are the target,
+    // since we will probably talk to it soon.
+    if (data->sender_ip.addr)
+        update_entry(nic, data->sender_ip, data->sender_mac, false, ent != nullptr);
     if (!ent)
         ExitPacketHandler();
     if (~ent->ip_entry_flags & IP_ENTRY_ENABLE_ARP_REPLY)
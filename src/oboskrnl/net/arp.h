@@ -45,5 +45,24 @@ typedef struct OBOS_PACK arp_header {
     // char target_protocol_address[len_protocol_address];
 } arp_header;
 
+// Defaults of the --arp-* command line options.
+#define ARP_DEFAULT_REACHABLE_TIME (30*1000) /* ms */
+#define ARP_DEFAULT_RETRANSMIT_TIME 1000 /* ms */
+#define ARP_DEFAULT_FAILED_TIME (20*1000) /* ms */
+#define ARP_DEFAULT_MAX_PROBES 3
+#define ARP_DEFAULT_QUEUE_LENGTH 32
+// Once the ARP cache has more entries than this, failed and stale entries are removed from it.
+#define ARP_CACHE_GC_THRESHOLD 256
+
 PacketProcessSignature(ARP, ethernet2_header*);
-obos_status NetH_ARPRequest(vnode* nic, ip_addr addr, mac_address* out, address_table_entry **address_table_ent);
\ No newline at end of file
+// Resolves 'addr', waiting until it is resolved or fails.
+// 'out' can be nullptr.
+obos_status NetH_ARPRequest(vnode* nic, ip_addr addr, mac_address* out);
+// Sends an ethernet frame to the neighbor 'addr', filling in its destination address.
+// If 'addr' is not resolved yet, the frame is queued until it is, and all frames
+// sent meanwhile share the same ARP requests.
+// Fails immediately if 'addr' recently failed to resolve.
+// The reference held by 'frame' is taken by this function.
+obos_status NetH_ARPSendFrame(vnode* nic, ip_addr addr, shared_ptr* frame, const nic_irp_data* offload);
+// Removes every entry of the ARP cache, dropping the frames queued on them.
+void Net_ARPFlushCache(net_tables* tables);
\ No newline at end of file
@@ -0,0 +1,363 @@
+/*
+ * oboskrnl/net/checksum.c
+ *
+ * Copyright (c) 2026 Omar Berrow
+*/
+
+#include <int.h>
+#include <klog.h>
+#include <error.h>
+#include <cmdline.h>
+#include <memmanip.h>
+
+#include <net/macros.h>
+#include <net/checksum.h>
+#include <net/eth.h>
+#include <net/ip.h>
+
+#include <irq/timer.h>
+
+#include <allocators/base.h>
+
+// NOTE: The kernel is compiled with -mgeneral-regs-only, and has no way to use
+// SSE/AVX registers outside of user mode, so every implementation here only
+// uses general purpose registers.
+
+// Internet checksum
+
+static OBOS_NO_UBSAN uint16_t csum_reference(const void *buffer, size_t size)
+{
+    const uint16_t *p = buffer;
+    uint32_t sum = 0;
+    size_t i;
+    for (i = 0; i < (size & ~(size_t)1); i += 2) {
+        sum += be16_to_host(p[i >> 1]);
+    }
+
+    // An odd trailing byte is padded with zero on the right.
+    if (size & 1) {
+        sum += (uint32_t)((uint8_t *)p)[i] << 8;
+    }
+
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += sum >> 16;
+
+    uint16_t ret = ~sum;
+    return ret;
+}
+
+static inline uint64_t add_with_carry(uint64_t sum, uint64_t val)
+{
+    uint64_t res = 0;
+    // The carry is added back in (end-around carry), this cannot overflow again.
+    if (__builtin_add_overflow(sum, val, &res))
+        res++;
+    return res;
+}
+
+// Sums eight bytes at a time in native byte order.
+// The one's complement sum does not depend on the byte order (RFC 1071, section 2.B),
+// so the result only needs to be swapped once it was folded to 16 bits.
+static OBOS_NO_UBSAN uint16_t csum_word64(const void *buffer, size_t size)
+{
+    const uint8_t *p = buffer;
+    uint64_t sum0 = 0, sum1 = 0;
+    uint64_t w[4];
+    while (size >= 32)
+    {
+        __builtin_memcpy(w, p, 32);
+        // Two independent carry chains.
+        sum0 = add_with_carry(sum0, w[0]);
+        sum1 = add_with_carry(sum1, w[1]);
+        sum0 = add_with_carry(sum0, w[2]);
+        sum1 = add_with_carry(sum1, w[3]);
+        p += 32;
+        size -= 32;
+    }
+    uint64_t sum = add_with_carry(sum0, sum1);
+    while (size >= 8)
+    {
+        __builtin_memcpy(w, p, 8);
+        sum = add_with_carry(sum, w[0]);
+        p += 8;
+        size -= 8;
+    }
+    // The remaining bytes are at an even offset, so they keep their position within a 16-bit word,
+    // and an odd trailing byte is padded with zero on the right.
+    uint64_t tail = 0;
+    __builtin_memcpy(&tail, p, size);
+    sum = add_with_carry(sum, tail);
+
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    uint16_t ret = ~be16_to_host((uint16_t)sum);
+    return ret;
+}
+
+static const net_csum_impl csum_impls[] = {
+    { .name="reference", .sum=csum_reference },
+    { .name="word64", .sum=csum_word64 },
+};
+
+// CRC32
+
+static uint32_t crctab[8][256];
+static bool initialized_crc32 = false;
+
+static OBOS_NO_UBSAN void crcInit()
+{
+    uint32_t crc = 0;
+    for (uint16_t i = 0; i < 256; ++i)
+    {
+        crc = i;
+        for (uint8_t j = 0; j < 8; ++j)
+        {
+            uint32_t mask = -(crc & 1);
+            crc = (crc >> 1) ^ (0xEDB88320 & mask);
+        }
+        crctab[0][i] = crc;
+    }
+    // crctab[k][i] is the CRC of byte i followed by k zero bytes.
+    for (uint16_t i = 0; i < 256; ++i)
+        for (uint8_t k = 1; k < 8; ++k)
+            crctab[k][i] = (crctab[k-1][i] >> 8) ^ crctab[0][crctab[k-1][i] & 0xff];
+    initialized_crc32 = true;
+}
+
+static OBOS_NO_UBSAN uint32_t crc32_bytewise(const void *data, size_t sz)
+{
+    if (!initialized_crc32)
+        crcInit();
+    const uint8_t* p = data;
+    uint32_t result = ~0U;
+    for (size_t i = 0; i < sz; ++i)
+        result = (result >> 8) ^ crctab[0][(result ^ p[i]) & 0xFF];
+    return ~result;
+}
+
+// Processes eight bytes per iteration with eight table lookups that do not
+// depend on each other, instead of a chain of eight dependent lookups.
+static OBOS_NO_UBSAN uint32_t crc32_slice8(const void *data, size_t sz)
+{
+    if (!initialized_crc32)
+        crcInit();
+    const uint8_t* p = data;
+    uint32_t result = ~0U;
+    while (sz >= 8)
+    {
+        uint32_t one = 0, two = 0;
+        __builtin_memcpy(&one, p, 4);
+        __builtin_memcpy(&two, p+4, 4);
+        one = le32_to_host(one) ^ result;
+        two = le32_to_host(two);
+        result = crctab[7][one & 0xff] ^
+                 crctab[6][(one >> 8) & 0xff] ^
+                 crctab[5][(one >> 16) & 0xff] ^
+                 crctab[4][one >> 24] ^
+                 crctab[3][two & 0xff] ^
+                 crctab[2][(two >> 8) & 0xff] ^
+                 crctab[1][(two >> 16) & 0xff] ^
+                 crctab[0][two >> 24];
+        p += 8;
+        sz -= 8;
+    }
+    while (sz--)
+        result = (result >> 8) ^ crctab[0][(result ^ *p++) & 0xFF];
+    return ~result;
+}
+
+static const net_crc32_impl crc32_impls[] = {
+    { .name="bytewise", .crc=crc32_bytewise },
+    { .name="slice-by-8", .crc=crc32_slice8 },
+};
+
+const net_csum_impl* Net_ChecksumImpl = &csum_impls[0];
+const net_crc32_impl* Net_CRC32Impl = &crc32_impls[0];
+
+uint16_t NetH_OnesComplementSum(const void *buffer, size_t size)
+{
+    return Net_ChecksumImpl->sum(buffer, size);
+}
+
+uint32_t NetH_CRC32Bytes(const void* data, size_t sz)
+{
+    return Net_CRC32Impl->crc(data, sz);
+}
+
+// Self-test
+
+#define SELFTEST_BUFFER_SIZE 2048
+#define BENCHMARK_SIZE 1514
+#define BENCHMARK_ITERATIONS 4096
+
+static uint64_t xorshift(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static bool test_size(size_t sz)
+{
+    // Every size up to a few cache lines, then the sizes that matter for ethernet.
+    return sz <= 160 || sz == 576 || sz == 1499 || sz == 1500 || sz == 1514 || sz == 1515 || sz == 2040;
+}
+
+static bool csum_selftest(const net_csum_impl* impl, const uint8_t* buf)
+{
+    // RFC 1071, section 3.
+    static const uint8_t known[8] = { 0x00,0x01,0xf2,0x03,0xf4,0xf5,0xf6,0xf7 };
+    if (impl->sum(known, sizeof(known)) != (uint16_t)~0xddf2)
+        return false;
+    for (size_t offset = 0; offset < 8; offset++)
+    {
+        for (size_t sz = 0; sz <= SELFTEST_BUFFER_SIZE - 8; sz++)
+        {
+            if (!test_size(sz))
+                continue;
+            if (impl->sum(buf + offset, sz) != csum_reference(buf + offset, sz))
+            {
+                OBOS_Error("%s: %s: Wrong checksum for %ld bytes at offset %ld\n", __func__, impl->name, sz, offset);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool crc32_selftest(const net_crc32_impl* impl, const uint8_t* buf)
+{
+    if (impl->crc("123456789", 9) != 0xCBF43926)
+        return false;
+    for (size_t offset = 0; offset < 8; offset++)
+    {
+        for (size_t sz = 0; sz <= SELFTEST_BUFFER_SIZE - 8; sz++)
+        {
+            if (!test_size(sz))
+                continue;
+            if (impl->crc(buf + offset, sz) != crc32_bytewise(buf + offset, sz))
+            {
+                OBOS_Error("%s: %s: Wrong CRC32 for %ld bytes at offset %ld\n", __func__, impl->name, sz, offset);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Returns the throughput in MiB/s.
+static uint64_t benchmark(uint64_t(*run)(const void* impl, const uint8_t* buf), const void* impl, const uint8_t* buf)
+{
+    timer_tick start = CoreS_GetNativeTimerTick();
+    volatile uint64_t res = run(impl, buf);
+    OBOS_UNUSED(res);
+    uint64_t ns = CoreH_TickToNS(CoreS_GetNativeTimerTick() - start, true);
+    if (!ns)
+        ns = 1;
+    return (uint64_t)BENCHMARK_SIZE * BENCHMARK_ITERATIONS * 1000000000 / ns / 0x100000;
+}
+
+static uint64_t run_csum(const void* impl, const uint8_t* buf)
+{
+    uint64_t res = 0;
+    for (size_t i = 0; i < BENCHMARK_ITERATIONS; i++)
+        res += ((const net_csum_impl*)impl)->sum(buf, BENCHMARK_SIZE);
+    return res;
+}
+
+static uint64_t run_crc32(const void* impl, const uint8_t* buf)
+{
+    uint64_t res = 0;
+    for (size_t i = 0; i < BENCHMARK_ITERATIONS; i++)
+        res += ((const net_crc32_impl*)impl)->crc(buf, BENCHMARK_SIZE);
+    return res;
+}
+
+// Returns the implementation chosen with 'opt', or 'preferred' if none was chosen,
+// or if it failed its self-test.
+static size_t select_impl(const char* opt, const char* const* names, const bool* ok, size_t nImpls, size_t preferred)
+{
+    char* name = OBOS_GetOPTS(opt);
+    if (!name)
+        return preferred;
+    size_t i = 0;
+    for (; i < nImpls; i++)
+        if (strcmp(names[i], name))
+            break;
+    if (i == nImpls)
+    {
+        OBOS_Warning("Unknown implementation '%s' passed in --%s\n", name, opt);
+        i = preferred;
+    }
+    else if (!ok[i])
+    {
+        OBOS_Warning("Implementation '%s' passed in --%s failed its self-test\n", name, opt);
+        i = preferred;
+    }
+    Free(OBOS_KernelAllocator, name, strlen(name)+1);
+    return i;
+}
+
+void Net_InitializeChecksums()
+{
+    if (!initialized_crc32)
+        crcInit();
+
+    obos_status status = OBOS_STATUS_SUCCESS;
+    uint8_t* buf = Allocate(OBOS_KernelAllocator, SELFTEST_BUFFER_SIZE, &status);
+    if (obos_is_error(status))
+    {
+        OBOS_Warning("%s: Could not allocate the self-test buffer. Status: %d. Using reference implementations.\n", __func__, status);
+        return;
+    }
+    uint64_t state = 0x9e3779b97f4a7c15;
+    for (size_t i = 0; i < SELFTEST_BUFFER_SIZE; i += 8)
+    {
+        uint64_t val = xorshift(&state);
+        memcpy(buf + i, &val, 8);
+    }
+
+    const bool run_benchmark = OBOS_GetOPTF("net-checksum-benchmark");
+    const size_t nCsumImpls = sizeof(csum_impls)/sizeof(*csum_impls);
+    const size_t nCRC32Impls = sizeof(crc32_impls)/sizeof(*crc32_impls);
+    bool csum_ok[sizeof(csum_impls)/sizeof(*csum_impls)] = {};
+    bool crc32_ok[sizeof(crc32_impls)/sizeof(*crc32_impls)] = {};
+    const char* csum_names[sizeof(csum_impls)/sizeof(*csum_impls)] = {};
+    const char* crc32_names[sizeof(crc32_impls)/sizeof(*crc32_impls)] = {};
+
+    // The last implementation that passes the self-test is preferred.
+    size_t csum_preferred = 0, crc32_preferred = 0;
+    for (size_t i = 0; i < nCsumImpls; i++)
+    {
+        csum_names[i] = csum_impls[i].name;
+        csum_ok[i] = csum_selftest(&csum_impls[i], buf);
+        if (!csum_ok[i])
+            OBOS_Error("%s: Checksum implementation '%s' failed its self-test.\n", __func__, csum_impls[i].name);
+        else
+            csum_preferred = i;
+        if (run_benchmark)
+            OBOS_Log("%s: Checksum '%s': %ld MiB/s\n", __func__, csum_impls[i].name, benchmark(run_csum, &csum_impls[i], buf));
+    }
+    for (size_t i = 0; i < nCRC32Impls; i++)
+    {
+        crc32_names[i] = crc32_impls[i].name;
+        crc32_ok[i] = crc32_selftest(&crc32_impls[i], buf);
+        if (!crc32_ok[i])
+            OBOS_Error("%s: CRC32 implementation '%s' failed its self-test.\n", __func__, crc32_impls[i].name);
+        else
+            crc32_preferred = i;
+        if (run_benchmark)
+            OBOS_Log("%s: CRC32 '%s': %ld MiB/s\n", __func__, crc32_impls[i].name, benchmark(run_crc32, &crc32_impls[i], buf));
+    }
+
+    Free(OBOS_KernelAllocator, buf, SELFTEST_BUFFER_SIZE);
+
+    size_t csum = select_impl("net-checksum-impl", csum_names, csum_ok, nCsumImpls, csum_preferred);
+    size_t crc32 = select_impl("net-crc32-impl", crc32_names, crc32_ok, nCRC32Impls, crc32_preferred);
+    Net_ChecksumImpl = &csum_impls[csum];
+    Net_CRC32Impl = &crc32_impls[crc32];
+    OBOS_Debug("%s: Using '%s' for internet checksums, and '%s' for CRC32.\n", __func__, Net_ChecksumImpl->name, Net_CRC32Impl->name);
+}
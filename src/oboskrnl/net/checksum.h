@@ -0,0 +1,33 @@
+/*
+ * oboskrnl/net/checksum.h
+ *
+ * Copyright (c) 2026 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+
+// An implementation of the internet checksum (RFC 1071).
+typedef struct net_csum_impl {
+    const char* name;
+    // Returns the complemented one's complement sum of 'buffer', in host byte order.
+    uint16_t(*sum)(const void* buffer, size_t size);
+} net_csum_impl;
+
+// An implementation of the ethernet CRC32.
+typedef struct net_crc32_impl {
+    const char* name;
+    uint32_t(*crc)(const void* buffer, size_t size);
+} net_crc32_impl;
+
+// Checks every checksum and CRC32 implementation against the reference implementations,
+// and selects the implementations used by NetH_OnesComplementSum and NetH_CRC32Bytes.
+// The implementations can be chosen with --net-checksum-impl and --net-crc32-impl,
+// and are benchmarked if --net-checksum-benchmark is passed.
+// Until this is called, the reference implementations are used.
+void Net_InitializeChecksums();
+
+// The implementations currently in use.
+extern const net_csum_impl* Net_ChecksumImpl;
+extern const net_crc32_impl* Net_CRC32Impl;
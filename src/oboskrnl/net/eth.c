@@ -19,40 +19,6 @@
 
 #include <utils/shared_ptr.h>
 
-static bool initialized_crc32 = false;
-static uint32_t crctab[256];
-
-static OBOS_NO_UBSAN void crcInit()
-{
-    uint32_t crc = 0;
-    for (uint16_t i = 0; i < 256; ++i)
-    {
-        crc = i;
-        for (uint8_t j = 0; j < 8; ++j)
-        {
-            uint32_t mask = -(crc & 1);
-            crc = (crc >> 1) ^ (0xEDB88320 & mask);
-        }
-        crctab[i] = crc;
-    }
-}
-static OBOS_NO_UBSAN uint32_t crc(const char *data, size_t len, uint32_t result)
-{
-    for (size_t i = 0; i < len; ++i)
-        result = (result >> 8) ^ crctab[(result ^ data[i]) & 0xFF];
-    return ~result;
-}
-static OBOS_NO_UBSAN uint32_t crc32_bytes(const void *data, size_t sz)
-{
-    if (!initialized_crc32)
-    {
-        crcInit();
-        initialized_crc32 = true;
-    }
-    return crc((char *)data, sz, ~0U);
-}
-__attribute__((alias("crc32_bytes"))) uint32_t NetH_CRC32Bytes(const void* data, size_t sz);
-
 OBOS_NO_UBSAN 
 PacketProcessSignature(Ethernet, void*)
 {
@@ -72,7 +38,7 @@ PacketProcessSignature(Ethernet, void*)
     if (~nic->flags & VFLAGS_NIC_NO_FCS)
     {
         uint32_t remote_checksum = le32_to_host(*(uint32_t*)((uintptr_t)ptr + size - 4));
-        uint32_t our_checksum = crc32_bytes(ptr, size-4);
+        uint32_t our_checksum = NetH_CRC32Bytes(ptr, size-4);
         if (remote_checksum != our_checksum)
         {
             NetError("%s: Wrong checksum in packet from " MAC_ADDRESS_FORMAT ". Expected checksum is 0x%08x, remote checksum is 0x%08x\n",
@@ -108,7 +74,7 @@ PacketProcessSignature(Ethernet, void*)
 
 DefineNetFreeSharedPtr
 
-OBOS_NO_UBSAN shared_ptr* NetH_FormatEthernetPacket(vnode* nic, const mac_address dest, const void* data, size_t size, uint16_t type)
+OBOS_NO_UBSAN shared_ptr* NetH_FormatEthernetPacketEx(vnode* nic, const mac_address dest, const void* data, size_t size, uint16_t type, bool append_fcs)
 {
     if (!nic->net_tables)
         return nullptr;
@@ -116,11 +82,13 @@ OBOS_NO_UBSAN shared_ptr* NetH_FormatEthernetPacket(vnode* nic, const mac_addres
         return nullptr;
 
     shared_ptr* buf = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(shared_ptr), nullptr);
-    size_t real_size = size+4+sizeof(ethernet2_header);
-    if (real_size < 64)
-        real_size = 64;
+    const size_t fcs_size = append_fcs ? 4 : 0;
+    const size_t min_size = 60 + fcs_size;
+    size_t real_size = size+fcs_size+sizeof(ethernet2_header);
+    if (real_size < min_size)
+        real_size = min_size;
     struct ethernet2_header* hdr = Allocate(OBOS_KernelAllocator, real_size, nullptr);
-    if (real_size == 64)
+    if (real_size == min_size)
         memzero(hdr, real_size);
     OBOS_SharedPtrConstructSz(buf, hdr, real_size);
     buf->onDeref = NetFreeSharedPtr;
@@ -130,9 +98,16 @@ OBOS_NO_UBSAN shared_ptr* NetH_FormatEthernetPacket(vnode* nic, const mac_addres
     memcpy(hdr->src, nic->net_tables->mac, sizeof(mac_address));
     hdr->type = host_to_be16(type);
     memcpy(hdr+1, data, size);
+    if (!append_fcs)
+        return buf;
     uint32_t* checksum = (uint32_t*)((uintptr_t)hdr + real_size - 4);
     // this seems counterintuitive, that's because it is
     // but it's the only thing that works
-    *checksum = host_to_le32(crc32_bytes(hdr, real_size-4)); 
+    *checksum = host_to_le32(NetH_CRC32Bytes(hdr, real_size-4)); 
     return buf;
-}
\ No newline at end of file
+}
+
+shared_ptr* NetH_FormatEthernetPacket(vnode* nic, const mac_address dest, const void* data, size_t size, uint16_t type)
+{
+    return NetH_FormatEthernetPacketEx(nic, dest, data, size, type, true);
+}
@@ -53,10 +53,71 @@ enum {
     IOCTL_IFACE_SET_DEFAULT_GATEWAY,
     IOCTL_IFACE_UNSET_DEFAULT_GATEWAY,
     IOCTL_IFACE_INITIALIZE,
+    // Implemented by drivers that receive through net_poll (see net/poll.h).
+    // argp points to a `net_poll_stats`
+    IOCTL_IFACE_GET_POLL_STATS,
+    // argp points to a `struct {net_dispatch_stats* buf; size_t sz;}` (see net/tables.h)
+    IOCTL_IFACE_GET_DISPATCH_STATS,
+    // Implemented by drivers that support transmit offloads.
+    // argp points to a `net_offload_caps`
+    IOCTL_IFACE_GET_OFFLOAD_CAPS,
+    // argp points to a `net_offload_info`
+    IOCTL_IFACE_GET_OFFLOAD_INFO,
+    // argp points to a `uint32_t` holding the NET_OFFLOAD_* flags to enable.
+    // Offloads not supported by the NIC are ignored.
+    IOCTL_IFACE_SET_OFFLOADS,
+    // argp points to a `net_arp_stats` (see net/tables.h)
+    IOCTL_IFACE_GET_ARP_STATS,
 };
 
+// Transmit offloads.
+enum {
+    // The NIC computes the IPv4 header checksum.
+    NET_OFFLOAD_IPv4_CHECKSUM = BIT(0),
+    // The NIC computes the TCP checksum.
+    NET_OFFLOAD_TCP_CHECKSUM = BIT(1),
+    // The NIC computes the UDP checksum.
+    NET_OFFLOAD_UDP_CHECKSUM = BIT(2),
+    // The NIC splits a large TCP segment into MSS-sized segments (TCP segmentation offload).
+    // Implies NET_OFFLOAD_IPv4_CHECKSUM and NET_OFFLOAD_TCP_CHECKSUM for the segments.
+    NET_OFFLOAD_TCP_TSO = BIT(3),
+};
+
+typedef struct net_offload_caps {
+    // NET_OFFLOAD_*
+    uint32_t flags;
+    // The largest IPv4 packet that can be sent with NET_OFFLOAD_TCP_TSO.
+    uint32_t tso_max_size;
+} net_offload_caps;
+
+typedef struct net_offload_stats {
+    // The amount of packets whose checksums were computed by the NIC.
+    size_t nChecksumOffloaded;
+    // The amount of packets whose checksums were computed in software.
+    size_t nChecksumSoftware;
+    // The amount of large TCP segments given to the NIC.
+    size_t nTSOSends;
+    // The amount of segments the NIC made out of them.
+    size_t nTSOSegments;
+    // The amount of large TCP segments that were split in software.
+    size_t nSoftwareSplits;
+    // The amount of segments they were split into.
+    size_t nSoftwareSegments;
+} net_offload_stats;
+
+// Returned by IOCTL_IFACE_GET_OFFLOAD_INFO.
+typedef struct net_offload_info {
+    net_offload_caps caps;
+    // The offloads that are in use, a subset of caps.flags.
+    uint32_t enabled;
+    net_offload_stats stats;
+} net_offload_info;
+
 OBOS_EXPORT uint32_t NetH_CRC32Bytes(const void* data, size_t sz);
 
 OBOS_EXPORT PacketProcessSignature(Ethernet, void*);
 
-shared_ptr* NetH_FormatEthernetPacket(vnode* nic, const mac_address dest, const void* data, size_t size, uint16_t type);
\ No newline at end of file
+shared_ptr* NetH_FormatEthernetPacket(vnode* nic, const mac_address dest, const void* data, size_t size, uint16_t type);
+// Like NetH_FormatEthernetPacket, but the FCS is only appended if 'append_fcs' is true.
+// Frames that are sent with transmit offloads must not have an FCS (see nic_irp_data).
+shared_ptr* NetH_FormatEthernetPacketEx(vnode* nic, const mac_address dest, const void* data, size_t size, uint16_t type, bool append_fcs);
\ No newline at end of file
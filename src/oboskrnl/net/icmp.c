@@ -75,15 +75,9 @@ PacketProcessSignature(ICMPv4, ip_header*)
                     udp_port key = {.port=be16_to_host(udp_hdr->src_port)};
                     Core_PushlockAcquire(&nic->net_tables->udp_ports_lock, true);
                     udp_port* bound = RB_FIND(udp_port_tree, &nic->net_tables->udp_ports, &key);
+                    if (bound)
+                        NetH_UDPReportICMPError(bound, buf, hdr);
                     Core_PushlockRelease(&nic->net_tables->udp_ports_lock, true);
-                    if (!bound)
-                        break;
-                    bound->got_icmp_msg = true;
-                    bound->icmp_header = hdr;
-                    if (bound->icmp_header_ptr)
-                        OBOS_SharedPtrUnref(bound->icmp_header_ptr);
-                    bound->icmp_header_ptr = OBOS_SharedPtrCopy(buf);
-                    Core_EventSet(&bound->recv_event, false);
                     break;
                 }
                 case 0x6 /* TCP */:
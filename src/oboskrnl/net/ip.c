@@ -18,6 +18,8 @@
 #include <net/arp.h>
 #include <net/tcp.h>
 
+#include <vfs/irp.h>
+
 #include <locks/pushlock.h>
 
 #include <allocators/base.h>
@@ -25,27 +27,19 @@
 #include <utils/shared_ptr.h>
 #include <utils/list.h>
 
-uint16_t NetH_OnesComplementSum(const void *buffer, size_t size)
+uint16_t NetH_IPv4PseudoHeaderSum(ip_addr src, ip_addr dest, uint8_t protocol, uint16_t length)
 {
-    const uint16_t *p = buffer;
-    int sum = 0;
-    int i;
-    for (i = 0; i < ((int)size & ~(1)); i += 2) {
-        sum += be16_to_host(p[i >> 1]);
-    }
-
-    if (size & 1) {
-        sum += ((uint8_t *)p)[i];
-    }
-
+    uint32_t sum = 0;
+    sum += be16_to_host(src.addr & 0xffff) + be16_to_host(src.addr >> 16);
+    sum += be16_to_host(dest.addr & 0xffff) + be16_to_host(dest.addr >> 16);
+    sum += protocol;
+    sum += length;
     sum = (sum >> 16) + (sum & 0xffff);
     sum += sum >> 16;
-
-    uint16_t ret = ~sum;
-    return ret;
+    return sum & 0xffff;
 }
 
-obos_status NetH_ResolveExternalIP(vnode* nic, ip_addr addr, mac_address* out)
+obos_status NetH_IPv4NextHop(vnode* nic, ip_addr addr, ip_addr* out)
 {
     Core_PushlockAcquire(&nic->net_tables->table_lock, true);
     for (ip_table_entry* ent = LIST_GET_HEAD(ip_table, &nic->net_tables->table); ent; )
@@ -53,7 +47,8 @@ obos_status NetH_ResolveExternalIP(vnode* nic, ip_addr addr, mac_address* out)
         if ((addr.addr & ent->subnet) == (ent->address.addr & ent->subnet))
         {
             Core_PushlockRelease(&nic->net_tables->table_lock, true);
-            return NetH_ARPRequest(nic, addr, out, nullptr);
+            *out = addr;
+            return OBOS_STATUS_SUCCESS;
         }
 
         ent = LIST_GET_NEXT(ip_table, &nic->net_tables->table, ent);
@@ -65,29 +60,17 @@ obos_status NetH_ResolveExternalIP(vnode* nic, ip_addr addr, mac_address* out)
     {
         if (ap->src.addr == addr.addr)
         {
-            if (ap->cache)
-            {
-                memcpy(out, ap->cache->phys, sizeof(mac_address));
-                return OBOS_STATUS_SUCCESS;
-            }
-            else
-                return NetH_ARPRequest(nic, ap->dest, out, &ap->cache);
+            *out = ap->dest;
+            return OBOS_STATUS_SUCCESS;
         }
 
         ap = LIST_GET_NEXT(gateway_list, &nic->net_tables->gateways, ap);
     }
     gateway *const default_gateway = nic->net_tables->default_gateway;
     if (!default_gateway)
-    {
-        memzero(out, sizeof(mac_address));
         return OBOS_STATUS_NETWORK_UNREACHABLE;
-    }
-    if (default_gateway->cache)
-    {
-        memcpy(out, default_gateway->cache->phys, sizeof(mac_address));
-        return OBOS_STATUS_SUCCESS;
-    }
-    return NetH_ARPRequest(nic, default_gateway->dest, out, &default_gateway->cache);
+    *out = default_gateway->dest;
+    return OBOS_STATUS_SUCCESS;
 }
 
 static void fragmented_packet_onDeref(shared_ptr* This)
@@ -168,17 +151,19 @@ PacketProcessSignature(IPv4, ethernet2_header*)
         hdr->chksum = 0;
         hdr->chksum = be16_to_host(NetH_OnesComplementSum(hdr, IPv4_GET_HEADER_LENGTH(hdr)));
 
-        mac_address dest = {};
-        obos_status status = NetH_ResolveExternalIP(nic, hdr->dest_address, &dest);
+        ip_addr next_hop = {};
+        obos_status status = NetH_IPv4NextHop(nic, hdr->dest_address, &next_hop);
         if (obos_is_error(status))
         {
             Net_ICMPv4DestUnreachable(nic, hdr, eth, data, ICMPv4_CODE_NET_UNREACHABLE);
             ExitPacketHandler();
         }
-        shared_ptr* data_ptr = NetH_FormatEthernetPacket(nic, dest, hdr, be16_to_host(hdr->packet_length), ETHERNET2_TYPE_IPv4);
-
-        NetH_SendEthernetPacket(nic, OBOS_SharedPtrCopy(data_ptr));
-        // pckt is freed once the packet is sent
+        // The destination address is filled in once the next hop is resolved.
+        shared_ptr* data_ptr = NetH_FormatEthernetPacket(nic, (mac_address){}, hdr, be16_to_host(hdr->packet_length), ETHERNET2_TYPE_IPv4);
+        // The ICMP message can only be sent if resolving the next hop fails right away.
+        status = NetH_ARPSendFrame(nic, next_hop, OBOS_SharedPtrCopy(data_ptr), nullptr);
+        if (status == OBOS_STATUS_TIMED_OUT)
+            Net_ICMPv4DestUnreachable(nic, hdr, eth, data, ICMPv4_CODE_HOST_UNREACHABLE);
 
         ExitPacketHandler();
     }
@@ -310,14 +295,83 @@ shared_ptr NetH_IPv4ReassemblePacket(vnode* nic, unassembled_ip_packet* packet)
 RB_GENERATE(unassembled_ip_packets, unassembled_ip_packet, node, ip_packet_cmp);
 LIST_GENERATE(ip_fragments, ip_fragment, node);
 
-obos_status NetH_SendIPv4PacketMac(vnode *nic, void *ent_ /* ip_table_entry */, ip_addr dest, const mac_address dest_mac, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data)
+static shared_ptr* alloc_packet(size_t sz)
 {
-    if (!nic || !ent_ || !data)
-        return OBOS_STATUS_INVALID_ARGUMENT;
-    ip_table_entry* ent = ent_;
+    shared_ptr* ptr = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(shared_ptr), nullptr);
+    OBOS_SharedPtrConstructSz(ptr, Allocate(OBOS_KernelAllocator, sz, nullptr), sz);
+    ptr->free = OBOS_SharedPtrDefaultFree;
+    ptr->freeUdata = OBOS_KernelAllocator;
+    ptr->onDeref = NetFreeSharedPtr;
+    return ptr;
+}
+
+static obos_status send_ipv4_packet(vnode *nic, ip_table_entry* ent, ip_addr dest, const mac_address dest_mac, const ip_addr* next_hop, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data, const nic_irp_data* offload);
+
+// The software fallback of TSO.
+// Splits a TCP segment into segments of at most 'mss' bytes of payload.
+static obos_status split_tcp_segment(vnode *nic, ip_table_entry* ent, ip_addr dest, const mac_address dest_mac, const ip_addr* next_hop, uint8_t ttl, uint8_t service_type, shared_ptr *data, uint16_t mss)
+{
+    const tcp_header* hdr = data->obj;
+    const size_t hdr_len = (hdr->data_offset >> 4) * 4;
+    const size_t payload_len = data->szObj - hdr_len;
+    net_offload_stats* stats = &nic->net_tables->offload.stats;
+    stats->nSoftwareSplits++;
+
+    const nic_irp_data offload = {.offload=NET_OFFLOAD_TCP_CHECKSUM};
+    obos_status status = OBOS_STATUS_SUCCESS;
+    for (size_t offset = 0; offset < payload_len && obos_is_success(status); offset += mss)
+    {
+        size_t len = OBOS_MIN(payload_len - offset, (size_t)mss);
+        shared_ptr* seg = alloc_packet(hdr_len + len);
+        tcp_header* seg_hdr = seg->obj;
+        memcpy(seg_hdr, hdr, hdr_len);
+        memcpy((char*)seg_hdr + hdr_len, (const char*)hdr + hdr_len + offset, len);
+        seg_hdr->seq = host_to_be32(be32_to_host(hdr->seq) + offset);
+        seg_hdr->chksum = 0;
+        // Only the last segment keeps FIN and PSH.
+        if (offset + len < payload_len)
+            seg_hdr->flags &= ~(TCP_FIN|TCP_PSH);
+        stats->nSoftwareSegments++;
+        status = send_ipv4_packet(nic, ent, dest, dest_mac, next_hop, 0x6, ttl, service_type, OBOS_SharedPtrCopy(seg), &offload);
+    }
+    OBOS_SharedPtrUnref(data);
+    return status;
+}
+
+// If 'next_hop' is not nullptr, the packet is sent to it through the ARP cache, and 'dest_mac' is ignored.
+static obos_status send_ipv4_packet(vnode *nic, ip_table_entry* ent, ip_addr dest, const mac_address dest_mac, const ip_addr* next_hop, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data, const nic_irp_data* offload)
+{
+    net_offload_info* const info = &nic->net_tables->offload;
+
+    uint32_t requested = offload ? offload->offload : 0;
+    if (protocol != 0x6 || data->szObj < sizeof(tcp_header))
+        requested &= ~(NET_OFFLOAD_TCP_CHECKSUM|NET_OFFLOAD_TCP_TSO);
+    if (protocol != 0x11 || data->szObj < sizeof(udp_header))
+        requested &= ~NET_OFFLOAD_UDP_CHECKSUM;
+    size_t tcp_hdr_len = 0;
+    if (requested & NET_OFFLOAD_TCP_TSO)
+    {
+        tcp_hdr_len = (((tcp_header*)data->obj)->data_offset >> 4) * 4;
+        if (!offload->mss || (data->szObj - tcp_hdr_len) <= offload->mss)
+            requested &= ~NET_OFFLOAD_TCP_TSO; // Already small enough.
+        else if (!NetH_OffloadEnabled(nic, NET_OFFLOAD_TCP_TSO) || (data->szObj + sizeof(ip_header)) > info->caps.tso_max_size)
+            return split_tcp_segment(nic, ent, dest, dest_mac, next_hop, ttl, service_type, data, offload->mss);
+        else
+            requested |= NET_OFFLOAD_TCP_CHECKSUM;
+    }
+
     size_t sz = data->szObj + sizeof(ip_header);
+    if (sz > 0xffff)
+    {
+        OBOS_SharedPtrUnref(data);
+        return OBOS_STATUS_MESSAGE_TOO_BIG;
+    }
     char* pckt = Allocate(OBOS_KernelAllocator, sz, nullptr);
 
+    nic_irp_data nic_data = {};
+    nic_data.l3_offset = sizeof(ethernet2_header);
+    nic_data.l4_offset = sizeof(ethernet2_header) + sizeof(ip_header);
+
     ip_header* hdr = (void*)pckt;
     memzero(hdr, sizeof(*hdr)); 
     hdr->dest_address = dest;
@@ -329,22 +383,97 @@ obos_status NetH_SendIPv4PacketMac(vnode *nic, void *ent_ /* ip_table_entry */,
     hdr->flags_fragment = host_to_be16(IPv4_DONT_FRAGMENT);
     hdr->service_type = host_to_be16(service_type);
     hdr->time_to_live = ttl;
-    hdr->chksum = host_to_be16(NetH_OnesComplementSum(hdr, sizeof(*hdr)));
     memcpy(hdr+1, data->obj, data->szObj);
     OBOS_SharedPtrUnref(data); 
 
-    shared_ptr *data_ptr = NetH_FormatEthernetPacket(nic, dest_mac, hdr, sz, ETHERNET2_TYPE_IPv4);
+    uint16_t* l4_checksum = nullptr;
+    uint32_t l4_offload = 0;
+    if (requested & NET_OFFLOAD_TCP_CHECKSUM)
+    {
+        l4_checksum = (uint16_t*)((uintptr_t)(hdr+1) + offsetof(tcp_header, chksum));
+        l4_offload = NET_OFFLOAD_TCP_CHECKSUM;
+    }
+    else if (requested & NET_OFFLOAD_UDP_CHECKSUM)
+    {
+        l4_checksum = (uint16_t*)((uintptr_t)(hdr+1) + offsetof(udp_header, chksum));
+        l4_offload = NET_OFFLOAD_UDP_CHECKSUM;
+    }
+    if (l4_checksum)
+    {
+        // The NIC (or us) completes the checksum from the sum of the pseudo header.
+        *l4_checksum = host_to_be16(NetH_IPv4PseudoHeaderSum(hdr->src_address, dest, protocol, sz - sizeof(ip_header)));
+        if ((requested & NET_OFFLOAD_TCP_TSO) || NetH_OffloadEnabled(nic, l4_offload))
+            nic_data.offload |= l4_offload;
+        else
+        {
+            uint16_t chksum = NetH_OnesComplementSum(hdr+1, sz - sizeof(ip_header));
+            // A UDP checksum of zero means "no checksum".
+            if (!chksum && protocol == 0x11)
+                chksum = 0xffff;
+            *l4_checksum = host_to_be16(chksum);
+        }
+    }
+    if (requested & NET_OFFLOAD_TCP_TSO)
+    {
+        nic_data.offload |= NET_OFFLOAD_TCP_TSO;
+        nic_data.payload_offset = nic_data.l4_offset + tcp_hdr_len;
+        nic_data.mss = offload->mss;
+        size_t payload_len = sz - sizeof(ip_header) - tcp_hdr_len;
+        info->stats.nTSOSends++;
+        info->stats.nTSOSegments += (payload_len + offload->mss - 1) / offload->mss;
+    }
+    if ((requested & NET_OFFLOAD_TCP_TSO) || NetH_OffloadEnabled(nic, NET_OFFLOAD_IPv4_CHECKSUM))
+        nic_data.offload |= NET_OFFLOAD_IPv4_CHECKSUM;
+    else
+        hdr->chksum = host_to_be16(NetH_OnesComplementSum(hdr, sizeof(*hdr)));
+
+    if (nic_data.offload)
+        info->stats.nChecksumOffloaded++;
+    else
+        info->stats.nChecksumSoftware++;
+
+    // Offloaded frames get their FCS from the NIC.
+    shared_ptr *data_ptr = NetH_FormatEthernetPacketEx(nic, dest_mac, hdr, sz, ETHERNET2_TYPE_IPv4, !nic_data.offload);
     Free(OBOS_KernelAllocator, pckt, sz);
     
-    return NetH_SendEthernetPacket(nic, OBOS_SharedPtrCopy(data_ptr));
+    if (next_hop)
+        return NetH_ARPSendFrame(nic, *next_hop, OBOS_SharedPtrCopy(data_ptr), &nic_data);
+    return NetH_SendEthernetPacketEx(nic, OBOS_SharedPtrCopy(data_ptr), &nic_data);
 }
 
-obos_status NetH_SendIPv4Packet(vnode *nic, void *ent_, ip_addr dest, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data)
+obos_status NetH_SendIPv4PacketMacEx(vnode *nic, void *ent_ /* ip_table_entry */, ip_addr dest, const mac_address dest_mac, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data, const nic_irp_data* offload)
 {
-    mac_address dest_mac = {};
-    obos_status status = NetH_ResolveExternalIP(nic, dest, &dest_mac);
+    if (!nic || !ent_ || !data)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    if (!nic->net_tables)
+        return OBOS_STATUS_UNINITIALIZED;
+    return send_ipv4_packet(nic, ent_, dest, dest_mac, nullptr, protocol, ttl, service_type, data, offload);
+}
+
+obos_status NetH_SendIPv4PacketMac(vnode *nic, void *ent_ /* ip_table_entry */, ip_addr dest, const mac_address dest_mac, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data)
+{
+    return NetH_SendIPv4PacketMacEx(nic, ent_, dest, dest_mac, protocol, ttl, service_type, data, nullptr);
+}
+
+obos_status NetH_SendIPv4PacketEx(vnode *nic, void *ent_, ip_addr dest, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data, const nic_irp_data* offload)
+{
+    if (!nic || !ent_ || !data)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    if (!nic->net_tables)
+        return OBOS_STATUS_UNINITIALIZED;
+    ip_addr next_hop = {};
+    obos_status status = NetH_IPv4NextHop(nic, dest, &next_hop);
     if (obos_is_error(status))
+    {
+        OBOS_SharedPtrUnref(data);
         return status;
+    }
     
-    return NetH_SendIPv4PacketMac(nic, ent_, dest, dest_mac, protocol, ttl, service_type, data);
+    // The destination address is filled in by the ARP cache.
+    return send_ipv4_packet(nic, ent_, dest, (mac_address){}, &next_hop, protocol, ttl, service_type, data, offload);
+}
+
+obos_status NetH_SendIPv4Packet(vnode *nic, void *ent_, ip_addr dest, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data)
+{
+    return NetH_SendIPv4PacketEx(nic, ent_, dest, protocol, ttl, service_type, data, nullptr);
 }
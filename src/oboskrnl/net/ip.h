@@ -182,10 +182,24 @@ typedef RB_HEAD(unassembled_ip_packets, unassembled_ip_packet) unassembled_ip_pa
 RB_PROTOTYPE(unassembled_ip_packets, unassembled_ip_packet, node, ip_packet_cmp);
 shared_ptr NetH_IPv4ReassemblePacket(vnode* nic, unassembled_ip_packet* packet);
 
+struct nic_irp_data;
+
 uint16_t NetH_OnesComplementSum(const void *buffer, size_t size);
+// Returns the (folded, not complemented) one's complement sum of the IPv4 pseudo header
+// used by TCP and UDP checksums.
+uint16_t NetH_IPv4PseudoHeaderSum(ip_addr src, ip_addr dest, uint8_t protocol, uint16_t length);
 
 PacketProcessSignature(IPv4, ethernet2_header*);
 obos_status NetH_SendIPv4Packet(vnode *nic, void *ent /* ip_table_entry */, ip_addr dest, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data);
 obos_status NetH_SendIPv4PacketMac(vnode *nic, void *ent /* ip_table_entry */, ip_addr dest, const mac_address dest_mac, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data);
-
-obos_status NetH_ResolveExternalIP(vnode* nic, ip_addr addr, mac_address* out);
\ No newline at end of file
+// Like NetH_SendIPv4Packet(Mac), but the TCP/UDP checksum of 'data' is computed if requested by 'offload'.
+// Only the offload flags and the MSS of 'offload' are used, and the checksum field of 'data' must be zero.
+// The checksums are computed by the NIC if it supports it, and in software otherwise.
+// A TCP segment larger than the MSS can be sent with NET_OFFLOAD_TCP_TSO, in which case
+// it is split by the NIC, or in software if the NIC does not support TSO.
+obos_status NetH_SendIPv4PacketEx(vnode *nic, void *ent /* ip_table_entry */, ip_addr dest, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data, const struct nic_irp_data* offload);
+obos_status NetH_SendIPv4PacketMacEx(vnode *nic, void *ent /* ip_table_entry */, ip_addr dest, const mac_address dest_mac, uint8_t protocol, uint8_t ttl, uint8_t service_type, shared_ptr *data, const struct nic_irp_data* offload);
+
+// Returns the address of the neighbor that packets to 'addr' are sent to, which
+// is 'addr' itself if it is on the subnet of an IP table entry, or a gateway otherwise.
+obos_status NetH_IPv4NextHop(vnode* nic, ip_addr addr, ip_addr* out);
\ No newline at end of file
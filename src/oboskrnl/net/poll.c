@@ -0,0 +1,126 @@
+/*
+ * oboskrnl/net/poll.c
+ *
+ * Copyright (c) 2026 Omar Berrow
+ */
+
+#include <int.h>
+#include <error.h>
+#include <klog.h>
+#include <cmdline.h>
+#include <memmanip.h>
+
+#include <stdatomic.h>
+
+#include <net/poll.h>
+#include <net/eth.h>
+#include <net/tcp.h>
+#include <net/tables.h>
+
+#include <irq/dpc.h>
+
+#include <allocators/base.h>
+
+#include <utils/shared_ptr.h>
+
+static size_t poll_budget()
+{
+    static size_t budget = 0;
+    if (!budget)
+    {
+        budget = OBOS_GetOPTD_Ex("net-poll-budget", NET_POLL_DEFAULT_BUDGET);
+        if (!budget)
+            budget = NET_POLL_DEFAULT_BUDGET;
+    }
+    return budget;
+}
+
+obos_status NetH_InitializePoll(net_poll* np, size_t(*poll)(net_poll* np, size_t budget), void(*enable_irqs)(net_poll* np), void* userdata)
+{
+    if (!np || !poll || !enable_irqs)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    memzero(np, sizeof(*np));
+    np->poll = poll;
+    np->enable_irqs = enable_irqs;
+    np->userdata = userdata;
+    np->budget = poll_budget();
+    obos_status status = OBOS_STATUS_SUCCESS;
+    np->batch = ZeroAllocate(OBOS_NonPagedPoolAllocator, np->budget, sizeof(shared_ptr*), &status);
+    if (!np->batch)
+        return status;
+    np->dpc.userdata = np;
+    return OBOS_STATUS_SUCCESS;
+}
+
+static void deliver_batch(net_poll* np)
+{
+    if (!np->nBatch)
+        return;
+    net_tables* const tables = np->nic->net_tables;
+    for (size_t i = 0; i < np->nBatch; i++)
+    {
+        shared_ptr* buf = np->batch[i];
+        np->batch[i] = nullptr;
+        // The batch's reference is given to the dispatch worker.
+        NetH_DispatchFrame(tables, buf);
+    }
+    np->nBatch = 0;
+    // Without dispatch workers, the frames were processed inline,
+    // so ACK everything that the batch acknowledged at once.
+    // Otherwise, each worker does this once its queue is drained.
+    if (!tables->nDispatchWorkers)
+        Net_TCPFlushACKs(tables);
+}
+
+static void poll_dpc(dpc* d, void* userdata)
+{
+    OBOS_UNUSED(d);
+    net_poll* np = userdata;
+
+    size_t nFrames = np->poll(np, np->budget);
+    deliver_batch(np);
+    np->stats.nPolls++;
+    np->stats.nFrames += nFrames;
+    np->nCycleFrames += nFrames;
+
+    if (nFrames >= np->budget)
+    {
+        // The ring might still have frames in it, so keep interrupts masked, and
+        // poll again the next time DPCs are dispatched, to let everything else run.
+        np->stats.nBudgetExhausted++;
+        CoreH_InitializeDPC(&np->dpc, poll_dpc, Core_DefaultThreadAffinity);
+        return;
+    }
+
+    // The ring is drained, go back to interrupts.
+    // Only the first frame of this cycle needed an interrupt.
+    if (np->nCycleFrames > 1)
+        np->stats.nInterruptsAvoided += np->nCycleFrames - 1;
+    np->nCycleFrames = 0;
+    // This must be cleared before interrupts are unmasked, otherwise the next interrupt could be lost.
+    np->scheduled = false;
+    np->enable_irqs(np);
+}
+
+void NetH_SchedulePoll(net_poll* np)
+{
+    if (!np)
+        return;
+    np->stats.nInterrupts++;
+    bool expected = false;
+    if (!atomic_compare_exchange_strong(&np->scheduled, &expected, true))
+        return;
+    np->dpc.userdata = np;
+    CoreH_InitializeDPC(&np->dpc, poll_dpc, Core_DefaultThreadAffinity);
+}
+
+void NetH_PollQueueFrame(net_poll* np, shared_ptr* frame)
+{
+    if (!np || !frame)
+        return;
+    if (!np->nic || !np->nic->net_tables)
+        return;
+    if (np->nBatch >= np->budget)
+        deliver_batch(np);
+    np->batch[np->nBatch++] = OBOS_SharedPtrCopy(frame);
+}
@@ -0,0 +1,80 @@
+/*
+ * oboskrnl/net/poll.h
+ *
+ * Copyright (c) 2026 Omar Berrow
+ */
+
+#pragma once
+
+#include <int.h>
+#include <error.h>
+
+#include <irq/dpc.h>
+
+#include <vfs/vnode.h>
+
+#include <utils/shared_ptr.h>
+
+#define NET_POLL_DEFAULT_BUDGET 64
+
+typedef struct net_poll_stats {
+    // The amount of times the driver was polled.
+    size_t nPolls;
+    // The amount of frames received by polling.
+    size_t nFrames;
+    // The amount of interrupts that started polling.
+    size_t nInterrupts;
+    // The amount of frames that were received while the NIC's interrupts were masked.
+    size_t nInterruptsAvoided;
+    // The amount of polls that used up their whole budget.
+    size_t nBudgetExhausted;
+} net_poll_stats;
+
+// Polled (NAPI-style) receive for NIC drivers.
+// When a NIC raises an RX interrupt, the driver masks its RX interrupts and calls
+// NetH_SchedulePoll. The driver's poll callback is then called from a DPC, and receives
+// at most 'budget' frames, passing each one to NetH_PollQueueFrame. Once the poll callback
+// returns, the frames are given to the network stack as one batch.
+// If the budget was used up, the ring is polled again later, with interrupts still masked,
+// otherwise the ring is drained, and the driver's RX interrupts are unmasked.
+typedef struct net_poll {
+    // Receives at most 'budget' frames.
+    // Returns the amount of frames received.
+    size_t(*poll)(struct net_poll* np, size_t budget);
+    // Unmasks the NIC's RX interrupts.
+    void(*enable_irqs)(struct net_poll* np);
+    void* userdata;
+    // Frames are only given to the network stack if this is non-null, and has network tables.
+    vnode* nic;
+    size_t budget;
+    dpc dpc;
+    _Atomic(bool) scheduled;
+    // The frames received by the current poll.
+    shared_ptr** batch;
+    size_t nBatch;
+    // The frames received since the last interrupt.
+    size_t nCycleFrames;
+    net_poll_stats stats;
+} net_poll;
+
+/// <summary>
+/// Initializes a net_poll object.
+/// </summary>
+/// <param name="np">The object to initialize.</param>
+/// <param name="poll">The driver's poll callback.</param>
+/// <param name="enable_irqs">The callback to unmask the NIC's RX interrupts.</param>
+/// <param name="userdata">The userdata of the callbacks.</param>
+/// <returns>The status of the function.</returns>
+OBOS_EXPORT obos_status NetH_InitializePoll(net_poll* np, size_t(*poll)(net_poll* np, size_t budget), void(*enable_irqs)(net_poll* np), void* userdata);
+/// <summary>
+/// Schedules a poll. This should be called by a NIC's IRQ handler, after it masks the NIC's RX interrupts.
+/// </summary>
+/// <param name="np">The net_poll object of the NIC.</param>
+OBOS_EXPORT void NetH_SchedulePoll(net_poll* np);
+/// <summary>
+/// Queues a received frame to be given to the network stack once the current poll returns.
+/// A reference to the frame is taken.
+/// </summary>
+/// <param name="np">The net_poll object of the NIC.</param>
+/// <param name="frame">The frame.</param>
+OBOS_EXPORT void NetH_PollQueueFrame(net_poll* np, shared_ptr* frame);
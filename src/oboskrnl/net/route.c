@@ -23,8 +23,12 @@
 #include <net/icmp.h>
 #include <net/ip.h>
 #include <net/arp.h>
+#include <net/route_trie.h>
 
 #include <locks/pushlock.h>
+#include <locks/spinlock.h>
+#include <locks/event.h>
+#include <locks/wait.h>
 
 #include <utils/shared_ptr.h>
 #include <utils/tree.h>
@@ -38,8 +42,180 @@
 
 #include <allocators/base.h>
 
+#include <irq/irql.h>
+
+#include <cmdline.h>
+
 DefineNetFreeSharedPtr
 
+static uint32_t hash_mix(uint32_t hash, uint32_t val)
+{
+    hash ^= val;
+    hash *= 0x9e3779b1;
+    hash ^= hash >> 15;
+    return hash;
+}
+
+// 'ports' holds the source and destination ports as in a TCP or UDP header, or is nullptr.
+static uint32_t flow_tuple_hash(ip_addr src, ip_addr dest, uint8_t protocol, const void* ports)
+{
+    uint32_t hash = hash_mix(0, src.addr);
+    hash = hash_mix(hash, dest.addr);
+    hash = hash_mix(hash, protocol);
+    if (ports)
+    {
+        uint32_t val = 0;
+        memcpy(&val, ports, sizeof(val));
+        hash = hash_mix(hash, val);
+    }
+    return hash;
+}
+
+// Hashes the flow of an ethernet frame.
+// Frames that are not IPv4 all hash to zero.
+static uint32_t flow_hash(const void* frame, size_t sz)
+{
+    const ethernet2_header* eth = frame;
+    if (sz < sizeof(*eth) + sizeof(ip_header))
+        return 0;
+    if (be16_to_host(eth->type) != ETHERNET2_TYPE_IPv4)
+        return 0;
+    const ip_header* hdr = (const void*)(eth + 1);
+    sz -= sizeof(*eth);
+    // Fragments of a packet (after the first one) have no transport header, so
+    // only use the ports if the packet is not fragmented, to keep all fragments
+    // of a packet on one worker.
+    bool fragmented = (be32_to_host(hdr->id_flags_fragment) & IPv4_MORE_FRAGMENTS) || IPv4_GET_FRAGMENT(hdr);
+    size_t hdr_len = IPv4_GET_HEADER_LENGTH(hdr);
+    const void* ports = nullptr;
+    // Both TCP and UDP headers start with the source and destination ports.
+    if (!fragmented && (hdr->protocol == 0x06 || hdr->protocol == 0x11) && sz >= hdr_len + 4)
+        ports = (const char*)hdr + hdr_len;
+    return flow_tuple_hash(hdr->src_address, hdr->dest_address, hdr->protocol, ports);
+}
+
+net_dispatch_worker* NetH_FlowWorker(net_tables* tables, ip_addr src, ip_addr dest, uint8_t protocol, uint16_t src_port, uint16_t dest_port)
+{
+    if (!tables || !tables->nDispatchWorkers)
+        return nullptr;
+    uint16_t ports[2] = { host_to_be16(src_port), host_to_be16(dest_port) };
+    return &tables->dispatch_workers[flow_tuple_hash(src, dest, protocol, ports) % tables->nDispatchWorkers];
+}
+
+obos_status NetH_DispatchFrame(net_tables* tables, shared_ptr* frame)
+{
+    if (!tables || !frame)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    if (!tables->nDispatchWorkers)
+    {
+        // No workers, process the frame on this thread.
+        vnode* nic = tables->interface;
+        Net_EthernetProcess(nic, 0, frame, frame->obj, frame->szObj, nullptr);
+        return OBOS_STATUS_SUCCESS;
+    }
+    net_dispatch_worker* worker = &tables->dispatch_workers[0];
+    if (tables->nDispatchWorkers > 1)
+        worker = &tables->dispatch_workers[flow_hash(frame->obj, frame->szObj) % tables->nDispatchWorkers];
+
+    irql oldIrql = Core_SpinlockAcquire(&worker->lock);
+    if (worker->nQueued == NET_DISPATCH_QUEUE_SIZE)
+    {
+        worker->stats.nDropped++;
+        Core_SpinlockRelease(&worker->lock, oldIrql);
+        OBOS_SharedPtrUnref(frame);
+        return OBOS_STATUS_WOULD_BLOCK;
+    }
+    worker->queue[worker->tail] = frame;
+    worker->tail = (worker->tail + 1) % NET_DISPATCH_QUEUE_SIZE;
+    if (++worker->nQueued > worker->stats.maxQueued)
+        worker->stats.maxQueued = worker->nQueued;
+    Core_SpinlockRelease(&worker->lock, oldIrql);
+
+    Core_EventSet(&worker->evnt, false);
+    return OBOS_STATUS_SUCCESS;
+}
+
+static shared_ptr* worker_pop(net_dispatch_worker* worker)
+{
+    shared_ptr* frame = nullptr;
+    irql oldIrql = Core_SpinlockAcquire(&worker->lock);
+    if (worker->nQueued)
+    {
+        frame = worker->queue[worker->head];
+        worker->queue[worker->head] = nullptr;
+        worker->head = (worker->head + 1) % NET_DISPATCH_QUEUE_SIZE;
+        worker->nQueued--;
+    }
+    Core_SpinlockRelease(&worker->lock, oldIrql);
+    return frame;
+}
+
+static void dispatch_worker(net_dispatch_worker* worker)
+{
+    net_tables* tables = worker->tables;
+    vnode* nic = tables->interface;
+    while (!tables->kill_dispatch)
+    {
+        obos_status status = Core_WaitOnObject(WAITABLE_OBJECT(worker->evnt));
+        if (obos_is_error(status))
+        {
+            OBOS_Error("%s: Core_WaitOnObject: Status %d\n", __func__, status);
+            break;
+        }
+        shared_ptr* buf = nullptr;
+        while ((buf = worker_pop(worker)))
+        {
+            int depth = -1;
+            InvokePacketHandler(Ethernet, buf->obj, buf->szObj, nullptr);
+            OBOS_SharedPtrUnref(buf);
+            worker->stats.nFrames++;
+        }
+        // The queue is drained, ACK everything that was received.
+        Net_TCPFlushACKs(tables);
+        Net_TCPRetransmitExpired(worker);
+    }
+    Core_ExitCurrentThread();
+}
+
+static thread* start_kernel_thread(void* entry, void* arg, thread_affinity affinity)
+{
+    thread* thr = CoreH_ThreadAllocate(nullptr);
+    thread_ctx ctx = {};
+    void* stack = Mm_VirtualMemoryAlloc(&Mm_KernelContext, nullptr, 0x4000, 0, VMA_FLAGS_KERNEL_STACK, nullptr, nullptr);
+    CoreS_SetupThreadContext(&ctx, (uintptr_t)entry, (uintptr_t)arg, false, stack, 0x4000);
+    thr->stackFree = CoreH_VMAStackFree;
+    thr->stackFreeUserdata = &Mm_KernelContext;
+    CoreH_ThreadInitialize(thr, THREAD_PRIORITY_REAL_TIME, affinity, &ctx);
+    Core_ProcessAppendThread(OBOS_KernelProcess, thr);
+    CoreH_ThreadReady(thr);
+    return thr;
+}
+
+static void start_dispatch_workers(net_tables* tables)
+{
+    size_t nWorkers = OBOS_GetOPTD_Ex("net-dispatch-workers", Core_CpuCount);
+    if (nWorkers > Core_CpuCount)
+        nWorkers = Core_CpuCount;
+    if (!nWorkers)
+        return;
+    tables->dispatch_workers = ZeroAllocate(OBOS_KernelAllocator, nWorkers, sizeof(net_dispatch_worker), nullptr);
+    if (!tables->dispatch_workers)
+        return;
+    for (size_t i = 0; i < nWorkers; i++)
+    {
+        net_dispatch_worker* worker = &tables->dispatch_workers[i];
+        worker->queue = ZeroAllocate(OBOS_KernelAllocator, NET_DISPATCH_QUEUE_SIZE, sizeof(shared_ptr*), nullptr);
+        if (!worker->queue)
+            break;
+        worker->evnt = EVENT_INITIALIZE(EVENT_SYNC);
+        worker->lock = Core_SpinlockCreate();
+        worker->tables = tables;
+        worker->stats.cpu = Core_CpuInfo[i].id;
+        worker->thread = start_kernel_thread(dispatch_worker, worker, CoreH_CPUIdToAffinity(Core_CpuInfo[i].id));
+        tables->nDispatchWorkers++;
+    }
+}
+
 static void dispatcher(vnode* nic)
 {
     OBOS_Log("Entered network packet dispatcher in thread %d.%d\n", Core_GetCurrentThread()->proc->pid, Core_GetCurrentThread()->tid);
@@ -87,9 +263,8 @@ static void dispatcher(vnode* nic)
         buf->onDeref = NetFreeSharedPtr;
         buf->freeUdata = OBOS_KernelAllocator;
 
-        int depth = -1;
-        InvokePacketHandler(Ethernet, buf->obj, buf->szObj, nullptr);
-        
+        NetH_DispatchFrame(tables, OBOS_SharedPtrCopy(buf));
+
         VfsH_IRPUnref(req);
     }
     if (obos_is_error(status))
@@ -97,6 +272,25 @@ static void dispatcher(vnode* nic)
     Core_ExitCurrentThread();
 }
 
+static void query_offloads(net_tables* tables, driver_header* driver)
+{
+    net_offload_caps caps = {};
+    // Drivers that don't implement the ioctl don't support any offloads.
+    size_t argp_sz = 0;
+    if (!driver->ftable.ioctl_argp_size ||
+        obos_is_error(driver->ftable.ioctl_argp_size(IOCTL_IFACE_GET_OFFLOAD_CAPS, &argp_sz)) ||
+        argp_sz != sizeof(caps) ||
+        obos_is_error(driver->ftable.ioctl(tables->desc, IOCTL_IFACE_GET_OFFLOAD_CAPS, &caps)))
+        memzero(&caps, sizeof(caps));
+    // A TSO packet must at least fit an MSS-sized segment.
+    if (caps.tso_max_size > 0xffff)
+        caps.tso_max_size = 0xffff;
+    if (caps.tso_max_size < 1500)
+        caps.flags &= ~NET_OFFLOAD_TCP_TSO;
+    tables->offload.caps = caps;
+    tables->offload.enabled = OBOS_GetOPTF("disable-net-offloads") ? 0 : caps.flags;
+}
+
 obos_status Net_Initialize(vnode* nic)
 {
     if (!nic)
@@ -115,19 +309,7 @@ obos_status Net_Initialize(vnode* nic)
         driver->ftable.reference_device(&tables->desc);
 
     driver->ftable.ioctl(tables->desc, IOCTL_IFACE_MAC_REQUEST, &tables->mac);
-
-    if (~nic->flags & VFLAGS_NIC_PACKET_INJECT)
-    {
-        tables->dispatch_thread = CoreH_ThreadAllocate(nullptr);
-        thread_ctx ctx = {};
-        void* stack = Mm_VirtualMemoryAlloc(&Mm_KernelContext, nullptr, 0x4000, 0, VMA_FLAGS_KERNEL_STACK, nullptr, nullptr);
-        CoreS_SetupThreadContext(&ctx, (uintptr_t)dispatcher, (uintptr_t)nic, false, stack, 0x4000);
-        tables->dispatch_thread->stackFree = CoreH_VMAStackFree;
-        tables->dispatch_thread->stackFreeUserdata = &Mm_KernelContext;
-        CoreH_ThreadInitialize(tables->dispatch_thread, THREAD_PRIORITY_REAL_TIME, Core_DefaultThreadAffinity, &ctx);
-        Core_ProcessAppendThread(OBOS_KernelProcess, tables->dispatch_thread);
-        CoreH_ThreadReady(tables->dispatch_thread);
-    }
+    query_offloads(tables, driver);
 
     tables->arp_cache_lock = PUSHLOCK_INITIALIZE();
     tables->table_lock = PUSHLOCK_INITIALIZE();
@@ -136,16 +318,32 @@ obos_status Net_Initialize(vnode* nic)
     tables->udp_ports_lock = PUSHLOCK_INITIALIZE();
     tables->tcp_connections_lock = PUSHLOCK_INITIALIZE();
     tables->tcp_ports_lock = PUSHLOCK_INITIALIZE();
-    tables->cached_routes_lock = PUSHLOCK_INITIALIZE();
     tables->interface = nic;
     tables->magic = IP_TABLES_MAGIC;
 
+    start_dispatch_workers(tables);
+    // The dispatcher only reads frames from the NIC, the workers process them.
+    if (~nic->flags & VFLAGS_NIC_PACKET_INJECT)
+        tables->dispatch_thread = start_kernel_thread(dispatcher, nic, Core_DefaultThreadAffinity);
+
     nic->net_tables = tables;
     LIST_APPEND(network_interface_list, &Net_Interfaces, tables);
 
     return OBOS_STATUS_SUCCESS;
 }
+bool NetH_OffloadEnabled(vnode* nic, uint32_t flags)
+{
+    if (!nic || !nic->net_tables || nic->net_tables->magic != IP_TABLES_MAGIC)
+        return false;
+    return (nic->net_tables->offload.enabled & flags) == flags;
+}
+
 obos_status NetH_SendEthernetPacket(vnode *nic, shared_ptr* data)
+{
+    return NetH_SendEthernetPacketEx(nic, data, nullptr);
+}
+
+obos_status NetH_SendEthernetPacketEx(vnode *nic, shared_ptr* data, const nic_irp_data* offload)
 {
     if (!nic || !data)
         return OBOS_STATUS_INVALID_ARGUMENT;
@@ -160,6 +358,7 @@ obos_status NetH_SendEthernetPacket(vnode *nic, shared_ptr* data)
     req->cbuff = data->obj;
     req->op = IRP_WRITE;
     req->blkOffset = 0;
+    req->nic_data = offload && offload->offload ? offload : nullptr;
     VfsH_IRPSubmit(req, &nic->net_tables->desc);
     VfsH_IRPWait(req);
     OBOS_SharedPtrUnref(data);
@@ -167,201 +366,15 @@ obos_status NetH_SendEthernetPacket(vnode *nic, shared_ptr* data)
     return OBOS_STATUS_SUCCESS;
 }
 
-LIST_GENERATE(route_list, struct route, node);
-RB_GENERATE(route_tree, route, rb_node, route_cmp);
-
 obos_status NetH_AddressRoute(net_tables** interface, ip_table_entry** routing_entry, uint8_t* ttl, ip_addr destination)
 {
-    // Check local ip table entries and cached routes.
-    for (net_tables* curr_iface = LIST_GET_HEAD(network_interface_list, &Net_Interfaces); curr_iface; )
-    {
-        Core_PushlockAcquire(&curr_iface->table_lock, true);
-        for (ip_table_entry* ent = LIST_GET_HEAD(ip_table, &curr_iface->table); ent; )
-        {
-            if ((ent->address.addr & ent->subnet) == (destination.addr & ent->subnet))
-            {
-                *interface = curr_iface;
-                *routing_entry = ent;
-                *ttl = 64;
-                Core_PushlockRelease(&curr_iface->table_lock, true);
-                return OBOS_STATUS_SUCCESS;
-            }
-            
-            ent = LIST_GET_NEXT(ip_table, &curr_iface->table, ent);
-        }
-        Core_PushlockRelease(&curr_iface->table_lock, true);
-
-        Core_PushlockAcquire(&curr_iface->cached_routes_lock, true);
-        struct route key = {.destination=destination,.iface=curr_iface};
-        struct route* r = RB_FIND(route_tree, &curr_iface->cached_routes, &key);
-        Core_PushlockRelease(&curr_iface->cached_routes_lock, true);
-        if (r)
-        {
-            *interface = r->iface;
-            *routing_entry = r->ent;
-            *ttl = r->ttl;
-            return OBOS_STATUS_SUCCESS;
-        }
-
-        curr_iface = LIST_GET_NEXT(network_interface_list, &Net_Interfaces, curr_iface);
-    }
-    
-    route_list possible_routes = {};
-
-    // Check routing table entries, adding possible routes to the list.
-    for (net_tables* curr_iface = LIST_GET_HEAD(network_interface_list, &Net_Interfaces); curr_iface; )
-    {
-        for (gateway* ent = LIST_GET_HEAD(gateway_list, &curr_iface->gateways); ent; )
-        {
-            if (ent == curr_iface->default_gateway)
-                goto end;
-            if (ent->src.addr == destination.addr)
-            {
-                struct route* r = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(*r), nullptr);
-                r->iface = curr_iface;
-                r->ent = ent->dest_ent;
-                r->route = ent;
-                r->ttl = 60; /* initial TTL */
-                LIST_APPEND(route_list, &possible_routes, r);
-            }
-
-            end:
-            ent = LIST_GET_NEXT(gateway_list, &curr_iface->gateways, ent);
-        }
-        if (curr_iface->default_gateway)
-        {
-            struct route* r = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(*r), nullptr);
-            r->iface = curr_iface;
-            r->ent = curr_iface->default_gateway->dest_ent;
-            r->route = curr_iface->default_gateway;
-            r->ttl = 60; /* initial TTL */
-            LIST_APPEND(route_list, &possible_routes, r);
-        }
-
-        curr_iface = LIST_GET_NEXT(network_interface_list, &Net_Interfaces, curr_iface);
-    }
-
-    struct route* optimal_route = nullptr;
-    uint8_t optimal_route_hops = 0;
-
-    if (!LIST_GET_NODE_COUNT(route_list, &possible_routes))
-        goto done;
-    else if (LIST_GET_NODE_COUNT(route_list, &possible_routes) == 1)
-    {
-        optimal_route = LIST_GET_HEAD(route_list, &possible_routes);
-        goto done;
-    }
-
-    // Try each route, 
-    for (struct route* curr = LIST_GET_HEAD(route_list, &possible_routes); curr; )
-    {
-        bool tried_again = false;
-        again:
-        (void)0;
-        udp_port* port = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(udp_port), nullptr);
-        port->port = 33435;
-        port->recv_event = EVENT_INITIALIZE(EVENT_NOTIFICATION);
-        Core_PushlockAcquire(&curr->iface->udp_ports_lock, false);
-        RB_INSERT(udp_port_tree, &curr->iface->udp_ports, port);
-        Core_PushlockRelease(&curr->iface->udp_ports_lock, false);
-        udp_header hdr = {};
-        hdr.dest_port = host_to_be16(33434);
-        hdr.src_port = host_to_be16(port->port);
-        hdr.length = host_to_be16(8);
-        hdr.chksum = 0;
-        shared_ptr data = {};
-        OBOS_SharedPtrConstruct(&data, &hdr);
-        NetH_SendIPv4Packet(curr->iface->interface, curr->ent, destination, 0x11, curr->ttl, 0, OBOS_SharedPtrCopy(&data));
-        obos_status status = Core_WaitOnObject(WAITABLE_OBJECT(port->recv_event));
-        if (obos_is_error(status))
-            return status;
-
-        icmp_header* icmp_hdr = port->icmp_header;
-        shared_ptr* icmp_hdr_ptr = port->icmp_header_ptr;
-        port->icmp_header_ptr = nullptr;
-
-        Core_PushlockAcquire(&curr->iface->udp_ports_lock, false);
-        RB_REMOVE(udp_port_tree, &curr->iface->udp_ports, port);
-        Core_PushlockRelease(&curr->iface->udp_ports_lock, false);
-        Free(OBOS_KernelAllocator, port, sizeof(*port));
-
-        bool error = false;
-        
-        if (icmp_hdr)
-        {
-            if (icmp_hdr->type == ICMPv4_TYPE_TIME_EXCEEDED)
-                error = true;
-            else if (icmp_hdr->type == ICMPv4_TYPE_DEST_UNREACHABLE)
-            {
-                if (icmp_hdr->code == ICMPv4_CODE_PORT_UNREACHABLE || icmp_hdr->code == ICMPv4_CODE_PROTOCOL_UNREACHABLE || 
-                    icmp_hdr->code == ICMPv4_CODE_COMMUNICATION_ADMINISTRATIVELY_FILTERED)
-                {
-                    ip_header* ip_hdr = (void*)icmp_hdr->data;
-                    uint8_t hops = curr->ttl - ip_hdr->time_to_live;
-                    if (!optimal_route || optimal_route_hops < hops)
-                    {
-                        optimal_route = curr;
-                        optimal_route_hops = hops;
-                    }
-                }
-                else
-                    error = true;
-            }
-            
-        }
-        if (error)
-        {
-            if (!tried_again)
-            {
-                tried_again = true;
-                curr->ttl *= 2;
-                goto again;
-            }
-            else
-            {
-                struct route* next = LIST_GET_NEXT(route_list, &possible_routes, curr);
-                LIST_REMOVE(route_list, &possible_routes, curr);
-                Free(OBOS_KernelAllocator, curr, sizeof(*curr));
-                curr = next;
-                if (icmp_hdr_ptr)
-                    OBOS_SharedPtrUnref(icmp_hdr_ptr);
-                icmp_hdr_ptr = nullptr;
-                continue;
-            }
-        }
-        if (icmp_hdr_ptr)
-            OBOS_SharedPtrUnref(icmp_hdr_ptr);
-        icmp_hdr_ptr = nullptr;
-        
-        curr = LIST_GET_NEXT(route_list, &possible_routes, curr);
-    }
-
-    done:
-
-    if (optimal_route)
-    {
-        *interface = optimal_route->iface;
-        *routing_entry = optimal_route->ent;
-        *ttl = optimal_route->ttl;
-        optimal_route->hops = optimal_route_hops;
-        Core_PushlockAcquire(&optimal_route->iface->cached_routes_lock, false);
-        RB_FIND(route_tree, &optimal_route->iface->cached_routes, optimal_route);
-        Core_PushlockRelease(&optimal_route->iface->cached_routes_lock, false);
-    }
-
-    for (struct route* curr = LIST_GET_HEAD(route_list, &possible_routes); curr; )
-    {
-        struct route* next = LIST_GET_NEXT(route_list, &possible_routes, curr);
-        LIST_REMOVE(route_list, &possible_routes, curr);
-        if (optimal_route != curr)
-            Free(OBOS_KernelAllocator, curr, sizeof(*curr));
-        curr = next;
-    }
-
-    if (optimal_route)
-        return OBOS_STATUS_SUCCESS;
-    else
+    net_route route = {};
+    if (!NetH_LookupRoute(destination, &route))
         return OBOS_STATUS_NETWORK_UNREACHABLE;
+    *interface = route.iface;
+    *routing_entry = route.ent;
+    *ttl = route.ttl;
+    return OBOS_STATUS_SUCCESS;
 }
 
 static obos_status interface_has_address(net_tables* interface, ip_addr addr, ip_table_entry** oent)
@@ -444,6 +457,23 @@ static gateway* get_gateway(vnode* nic, gateway_user key)
     return nullptr;
 }
 
+// Whether 'request' changes the IP table or the gateways of an interface.
+static bool changes_routes(uint32_t request)
+{
+    switch (request) {
+        case IOCTL_IFACE_ADD_IP_TABLE_ENTRY:
+        case IOCTL_IFACE_REMOVE_IP_TABLE_ENTRY:
+        case IOCTL_IFACE_SET_IP_TABLE_ENTRY:
+        case IOCTL_IFACE_ADD_ROUTING_TABLE_ENTRY:
+        case IOCTL_IFACE_REMOVE_ROUTING_TABLE_ENTRY:
+        case IOCTL_IFACE_SET_DEFAULT_GATEWAY:
+        case IOCTL_IFACE_UNSET_DEFAULT_GATEWAY:
+            return true;
+        default:
+            return false;
+    }
+}
+
 obos_status Net_InterfaceIoctl(vnode* nic, uint32_t request, void* argp)
 {
     if (!nic)
@@ -550,7 +580,7 @@ obos_status Net_InterfaceIoctl(vnode* nic, uint32_t request, void* argp)
             new_ent->dest = ent->dest;
             new_ent->src = ent->src;
             new_ent->dest_ent = dest_ent;
-            if (obos_is_success(status = NetH_ARPRequest(nic, new_ent->dest, nullptr, &new_ent->cache)))
+            if (obos_is_success(status = NetH_ARPRequest(nic, new_ent->dest, nullptr)))
                 LIST_APPEND(gateway_list, &nic->net_tables->gateways, new_ent);
             else
                 Free(OBOS_KernelAllocator, new_ent, sizeof(gateway));
@@ -601,13 +631,12 @@ obos_status Net_InterfaceIoctl(vnode* nic, uint32_t request, void* argp)
             new_gateway.src = (ip_addr){.addr=0};
             new_gateway.dest = *(ip_addr*)argp;
             new_gateway.dest_ent = dest_ent;
-            mac_address tmp = {};
             if (!nic->net_tables->default_gateway)
             {
                 nic->net_tables->default_gateway = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(gateway), nullptr);
                 LIST_APPEND(gateway_list, &nic->net_tables->gateways, nic->net_tables->default_gateway);
             }
-            if (obos_is_success(status = NetH_ARPRequest(nic, new_gateway.dest, &tmp, &new_gateway.cache)))
+            if (obos_is_success(status = NetH_ARPRequest(nic, new_gateway.dest, nullptr)))
                 *nic->net_tables->default_gateway = new_gateway;
             break;
         }
@@ -632,15 +661,7 @@ obos_status Net_InterfaceIoctl(vnode* nic, uint32_t request, void* argp)
             if (obos_is_error(status))
                 break;
 
-            address_table_entry *ent = nullptr, *next = nullptr;
-            Core_PushlockAcquire(&nic->net_tables->arp_cache_lock, false);
-            RB_FOREACH_SAFE(ent, address_table, &nic->net_tables->arp_cache, next)
-            {
-                RB_REMOVE(address_table, &nic->net_tables->arp_cache, ent);
-                Core_EventSet(&ent->sync, false);
-                Free(OBOS_KernelAllocator, ent, sizeof(*ent));
-            }
-            Core_PushlockRelease(&nic->net_tables->arp_cache_lock, false);
+            Net_ARPFlushCache(nic->net_tables);
             break;
         }
         case IOCTL_IFACE_CLEAR_ROUTE_CACHE:
@@ -649,14 +670,7 @@ obos_status Net_InterfaceIoctl(vnode* nic, uint32_t request, void* argp)
             if (obos_is_error(status))
                 break;
 
-            struct route *ent = nullptr, *next = nullptr;
-            Core_PushlockAcquire(&nic->net_tables->cached_routes_lock, false);
-            RB_FOREACH_SAFE(ent, route_tree, &nic->net_tables->cached_routes, next)
-            {
-                RB_REMOVE(route_tree, &nic->net_tables->cached_routes, ent);
-                Free(OBOS_KernelAllocator, ent, sizeof(*ent));
-            }
-            Core_PushlockRelease(&nic->net_tables->cached_routes_lock, false);
+            Net_FlushRouteCache();
             break;
         }
         case IOCTL_IFACE_GET_IP_TABLE:
@@ -695,6 +709,26 @@ obos_status Net_InterfaceIoctl(vnode* nic, uint32_t request, void* argp)
             Core_PushlockRelease(&nic->net_tables->table_lock, true);
             break;
         }
+        case IOCTL_IFACE_GET_DISPATCH_STATS:
+        {
+            struct {
+                net_dispatch_stats* buf;
+                size_t sz;
+            } *buffer = argp;
+
+            net_tables* tables = nic->net_tables;
+            size_t bytesToCopy = tables->nDispatchWorkers*sizeof(net_dispatch_stats);
+            if (buffer->buf && buffer->sz >= sizeof(net_dispatch_stats))
+            {
+                size_t nWorkers = OBOS_MIN(buffer->sz / sizeof(net_dispatch_stats), tables->nDispatchWorkers);
+                for (size_t i = 0; i < nWorkers && obos_is_success(status); i++)
+                    status = memcpy_k_to_usr(&buffer->buf[i], &tables->dispatch_workers[i].stats, sizeof(net_dispatch_stats));
+                if (obos_is_error(status))
+                    break;
+            }
+            buffer->sz = bytesToCopy;
+            break;
+        }
         case IOCTL_IFACE_GET_ROUTING_TABLE:
         {
             status = OBOS_CapabilityCheck("net/get-routing-table", true);
@@ -728,6 +762,21 @@ obos_status Net_InterfaceIoctl(vnode* nic, uint32_t request, void* argp)
 
             break;
         }
+        case IOCTL_IFACE_GET_OFFLOAD_INFO:
+            memcpy(argp, &nic->net_tables->offload, sizeof(net_offload_info));
+            break;
+        case IOCTL_IFACE_GET_ARP_STATS:
+            memcpy(argp, &nic->net_tables->arp_stats, sizeof(net_arp_stats));
+            break;
+        case IOCTL_IFACE_SET_OFFLOADS:
+        {
+            status = OBOS_CapabilityCheck("net/iface-offloads", false);
+            if (obos_is_error(status))
+                break;
+            net_tables* tables = nic->net_tables;
+            tables->offload.enabled = *(uint32_t*)argp & tables->offload.caps.flags;
+            break;
+        }
         case IOCTL_IFACE_INITIALIZE:
         {
             status = OBOS_CapabilityCheck("net/iface-start", false);
@@ -739,6 +788,8 @@ obos_status Net_InterfaceIoctl(vnode* nic, uint32_t request, void* argp)
         default:
             return OBOS_STATUS_INVALID_IOCTL;
     }
+    if (obos_is_success(status) && changes_routes(request))
+        Net_RebuildRoutes();
     return status;
 }
 
@@ -763,8 +814,18 @@ obos_status Net_InterfaceIoctlArgpSize(uint32_t request, size_t* argp_sz)
         case IOCTL_IFACE_SET_DEFAULT_GATEWAY:
             *argp_sz = sizeof(ip_addr);
             break;
+        case IOCTL_IFACE_GET_OFFLOAD_INFO:
+            *argp_sz = sizeof(net_offload_info);
+            break;
+        case IOCTL_IFACE_GET_ARP_STATS:
+            *argp_sz = sizeof(net_arp_stats);
+            break;
+        case IOCTL_IFACE_SET_OFFLOADS:
+            *argp_sz = sizeof(uint32_t);
+            break;
         case IOCTL_IFACE_GET_IP_TABLE:
         case IOCTL_IFACE_GET_ROUTING_TABLE:
+        case IOCTL_IFACE_GET_DISPATCH_STATS:
             *argp_sz = sizeof(struct {void* buf; size_t sz;});
             break;
         default: *argp_sz = 0; return OBOS_STATUS_INVALID_IOCTL;
@@ -0,0 +1,353 @@
+/*
+ * oboskrnl/net/route_trie.c
+ *
+ * Copyright (c) 2026 Omar Berrow
+*/
+
+#include <int.h>
+#include <error.h>
+#include <klog.h>
+#include <memmanip.h>
+
+#include <stdatomic.h>
+
+#include <net/macros.h>
+#include <net/tables.h>
+#include <net/route_trie.h>
+
+#include <locks/mutex.h>
+#include <locks/pushlock.h>
+
+#include <scheduler/schedule.h>
+
+#include <allocators/base.h>
+
+#include <utils/list.h>
+
+typedef struct route_trie_node {
+    // In host byte order, only the first 'len' bits are significant.
+    uint32_t prefix;
+    uint8_t len;
+    // Internal nodes only exist to branch, and have no route.
+    bool has_route;
+    net_route route;
+    // Indexed by the bit after the prefix.
+    struct route_trie_node* child[2];
+} route_trie_node;
+
+typedef struct route_trie {
+    route_trie_node* root;
+    size_t nNodes;
+    size_t maxNodes;
+    size_t sz;
+    route_trie_node nodes[];
+} route_trie;
+
+static route_trie* _Atomic current_trie;
+// Serializes rebuilds.
+static mutex rebuild_lock = MUTEX_INITIALIZE();
+
+// Readers of the trie increment the counter of the current epoch while they use it.
+// Before freeing a trie that was replaced, the writer flips the epoch and waits for the readers
+// of the previous epoch to leave, twice, so that every reader that could have seen the old trie is gone.
+static _Atomic(size_t) trie_readers[2];
+static _Atomic(uint32_t) trie_epoch;
+
+static uint32_t trie_read_lock()
+{
+    uint32_t idx = atomic_load(&trie_epoch) & 1;
+    atomic_fetch_add(&trie_readers[idx], 1);
+    return idx;
+}
+static void trie_read_unlock(uint32_t idx)
+{
+    atomic_fetch_sub(&trie_readers[idx], 1);
+}
+static void wait_for_trie_readers()
+{
+    for (int i = 0; i < 2; i++)
+    {
+        uint32_t idx = atomic_fetch_xor(&trie_epoch, 1) & 1;
+        while (atomic_load(&trie_readers[idx]))
+            Core_Yield();
+    }
+}
+
+static uint32_t prefix_mask(uint8_t len)
+{
+    return len ? ~(uint32_t)0 << (32 - len) : 0;
+}
+
+static uint8_t prefix_bit(uint32_t prefix, uint8_t pos)
+{
+    return (prefix >> (31 - pos)) & 1;
+}
+
+static route_trie_node* alloc_node(route_trie* trie, uint32_t prefix, uint8_t len)
+{
+    if (trie->nNodes >= trie->maxNodes)
+        return nullptr;
+    route_trie_node* node = &trie->nodes[trie->nNodes++];
+    node->prefix = prefix & prefix_mask(len);
+    node->len = len;
+    return node;
+}
+
+// If the prefix already has a route, the route that was inserted first is kept.
+static bool trie_insert(route_trie* trie, uint32_t prefix, uint8_t len, const net_route* route)
+{
+    prefix &= prefix_mask(len);
+    route_trie_node** link = &trie->root;
+    while (1)
+    {
+        route_trie_node* node = *link;
+        if (!node)
+        {
+            node = alloc_node(trie, prefix, len);
+            if (!node)
+                return false;
+            node->has_route = true;
+            node->route = *route;
+            *link = node;
+            return true;
+        }
+
+        uint32_t diff = prefix ^ node->prefix;
+        uint8_t common = diff ? __builtin_clz(diff) : 32;
+        if (common > len)
+            common = len;
+        if (common > node->len)
+            common = node->len;
+
+        if (common == node->len)
+        {
+            if (len == node->len)
+            {
+                if (!node->has_route)
+                {
+                    node->has_route = true;
+                    node->route = *route;
+                }
+                return true;
+            }
+            // The new prefix is below this node.
+            link = &node->child[prefix_bit(prefix, node->len)];
+            continue;
+        }
+
+        // The new prefix diverges from this node's prefix (or is a prefix of it),
+        // so put a node at the point where they diverge.
+        route_trie_node* split = alloc_node(trie, prefix, common);
+        if (!split)
+            return false;
+        split->child[prefix_bit(node->prefix, common)] = node;
+        if (common == len)
+        {
+            split->has_route = true;
+            split->route = *route;
+        }
+        else
+        {
+            route_trie_node* leaf = alloc_node(trie, prefix, len);
+            if (!leaf)
+                return false;
+            leaf->has_route = true;
+            leaf->route = *route;
+            split->child[prefix_bit(prefix, common)] = leaf;
+        }
+        *link = split;
+        return true;
+    }
+}
+
+static const route_trie_node* trie_lookup(const route_trie* trie, uint32_t addr)
+{
+    const route_trie_node* best = nullptr;
+    const route_trie_node* node = trie->root;
+    while (node)
+    {
+        if ((addr ^ node->prefix) & prefix_mask(node->len))
+            break;
+        if (node->has_route)
+            best = node;
+        if (node->len == 32)
+            break;
+        node = node->child[prefix_bit(addr, node->len)];
+    }
+    return best;
+}
+
+static uint8_t subnet_length(uint32_t subnet)
+{
+    subnet = be32_to_host(subnet);
+    // Non-contiguous subnet masks are not supported, anything after the first zero bit is ignored.
+    return ~subnet ? __builtin_clz(~subnet) : 32;
+}
+
+// Per-destination route cache.
+// Each entry is protected by a sequence count, which is odd while the entry is written.
+// Entries filled before the last rebuild or flush have a stale generation, and are ignored.
+
+#define ROUTE_CACHE_SIZE 256
+
+typedef struct route_cache_entry {
+    _Atomic(uint32_t) seq;
+    uint32_t generation;
+    ip_addr destination;
+    net_route route;
+} route_cache_entry;
+
+static route_cache_entry route_cache[ROUTE_CACHE_SIZE];
+// Zero is never a valid generation, so that zeroed entries are never used.
+static _Atomic(uint32_t) route_generation = 1;
+
+static route_cache_entry* route_cache_slot(ip_addr destination)
+{
+    return &route_cache[(destination.addr * 0x9e3779b1) >> 24];
+}
+
+static bool route_cache_find(ip_addr destination, uint32_t generation, net_route* out)
+{
+    route_cache_entry* ent = route_cache_slot(destination);
+    uint32_t seq = atomic_load_explicit(&ent->seq, memory_order_acquire);
+    if (seq & 1)
+        return false;
+    uint32_t ent_generation = ent->generation;
+    ip_addr ent_destination = ent->destination;
+    net_route route = ent->route;
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&ent->seq, memory_order_relaxed) != seq)
+        return false;
+    if (ent_generation != generation || ent_destination.addr != destination.addr)
+        return false;
+    *out = route;
+    return true;
+}
+
+static void route_cache_fill(ip_addr destination, uint32_t generation, const net_route* route)
+{
+    route_cache_entry* ent = route_cache_slot(destination);
+    uint32_t seq = atomic_load_explicit(&ent->seq, memory_order_relaxed);
+    // If someone else is filling this entry, let them.
+    if ((seq & 1) || !atomic_compare_exchange_strong(&ent->seq, &seq, seq + 1))
+        return;
+    atomic_thread_fence(memory_order_release);
+    ent->generation = generation;
+    ent->destination = destination;
+    ent->route = *route;
+    atomic_store_explicit(&ent->seq, seq + 2, memory_order_release);
+}
+
+void Net_FlushRouteCache()
+{
+    uint32_t generation = atomic_fetch_add(&route_generation, 1) + 1;
+    if (!generation)
+        atomic_fetch_add(&route_generation, 1);
+}
+
+bool NetH_LookupRoute(ip_addr destination, net_route* out)
+{
+    if (!out)
+        return false;
+
+    // The generation must be read before the trie, so that a route from an old trie
+    // is never cached with the generation of a newer one.
+    uint32_t generation = atomic_load(&route_generation);
+    if (route_cache_find(destination, generation, out))
+        return true;
+
+    uint32_t idx = trie_read_lock();
+    const route_trie* trie = atomic_load(&current_trie);
+    const route_trie_node* node = trie ? trie_lookup(trie, be32_to_host(destination.addr)) : nullptr;
+    net_route route = {};
+    if (node)
+        route = node->route;
+    trie_read_unlock(idx);
+
+    if (!node)
+        return false;
+    route_cache_fill(destination, generation, &route);
+    *out = route;
+    return true;
+}
+
+static size_t count_routes()
+{
+    size_t nRoutes = 0;
+    for (net_tables* iface = LIST_GET_HEAD(network_interface_list, &Net_Interfaces); iface; )
+    {
+        Core_PushlockAcquire(&iface->table_lock, true);
+        nRoutes += LIST_GET_NODE_COUNT(ip_table, &iface->table);
+        Core_PushlockRelease(&iface->table_lock, true);
+        nRoutes += LIST_GET_NODE_COUNT(gateway_list, &iface->gateways);
+
+        iface = LIST_GET_NEXT(network_interface_list, &Net_Interfaces, iface);
+    }
+    return nRoutes;
+}
+
+static void insert_routes(route_trie* trie)
+{
+    for (net_tables* iface = LIST_GET_HEAD(network_interface_list, &Net_Interfaces); iface; )
+    {
+        Core_PushlockAcquire(&iface->table_lock, true);
+        for (ip_table_entry* ent = LIST_GET_HEAD(ip_table, &iface->table); ent; )
+        {
+            net_route route = {.iface=iface,.ent=ent,.ttl=64};
+            trie_insert(trie, be32_to_host(ent->address.addr), subnet_length(ent->subnet), &route);
+
+            ent = LIST_GET_NEXT(ip_table, &iface->table, ent);
+        }
+        Core_PushlockRelease(&iface->table_lock, true);
+
+        for (gateway* ent = LIST_GET_HEAD(gateway_list, &iface->gateways); ent; )
+        {
+            if (ent->dest_ent)
+            {
+                net_route route = {.iface=iface,.ent=ent->dest_ent,.ttl=60 /* initial TTL */};
+                if (ent == iface->default_gateway)
+                    trie_insert(trie, 0, 0, &route);
+                else
+                    trie_insert(trie, be32_to_host(ent->src.addr), 32, &route);
+            }
+
+            ent = LIST_GET_NEXT(gateway_list, &iface->gateways, ent);
+        }
+
+        iface = LIST_GET_NEXT(network_interface_list, &Net_Interfaces, iface);
+    }
+}
+
+void Net_RebuildRoutes()
+{
+    Core_MutexAcquire(&rebuild_lock);
+
+    // If a table changes between counting and inserting, some routes might not fit,
+    // but whoever changed it will rebuild the trie again.
+    // Every route needs at most two nodes, one for itself, and one to branch.
+    size_t nRoutes = count_routes();
+    size_t maxNodes = nRoutes*2;
+    size_t sz = sizeof(route_trie) + maxNodes*sizeof(route_trie_node);
+    obos_status status = OBOS_STATUS_SUCCESS;
+    route_trie* trie = ZeroAllocate(OBOS_KernelAllocator, 1, sz, &status);
+    if (obos_is_error(status))
+    {
+        OBOS_Error("%s: Could not allocate the routing trie. Status: %d\n", __func__, status);
+        Core_MutexRelease(&rebuild_lock);
+        return;
+    }
+    trie->maxNodes = maxNodes;
+    trie->sz = sz;
+    insert_routes(trie);
+
+    route_trie* old = atomic_exchange(&current_trie, trie);
+    // Must be after the new trie is published (see NetH_LookupRoute).
+    Net_FlushRouteCache();
+    if (old)
+    {
+        wait_for_trie_readers();
+        Free(OBOS_KernelAllocator, old, old->sz);
+    }
+
+    Core_MutexRelease(&rebuild_lock);
+}
@@ -0,0 +1,38 @@
+/*
+ * oboskrnl/net/route_trie.h
+ *
+ * Copyright (c) 2026 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+
+#include <net/ip.h>
+
+struct net_tables;
+struct ip_table_entry;
+
+typedef struct net_route {
+    struct net_tables* iface;
+    // The IP table entry used to send packets on this route.
+    struct ip_table_entry* ent;
+    uint8_t ttl;
+} net_route;
+
+// The routing table is a path-compressed binary trie of the prefixes of every
+// IP table entry (directly reachable subnets) and gateway of every interface.
+// Gateways route a single address (a /32), and the default gateway routes 0.0.0.0/0.
+// Lookups take the route with the longest matching prefix, and never block nor take locks.
+// The trie is immutable once published, and is replaced as a whole when the tables change.
+// In front of the trie is a small per-destination route cache.
+
+// Rebuilds the trie from the IP tables and gateways of every interface, and invalidates
+// the route cache.
+// Must be called after an IP table entry or a gateway was added, removed, or changed.
+void Net_RebuildRoutes();
+// Invalidates every entry of the route cache.
+void Net_FlushRouteCache();
+// Looks up the route to 'destination'.
+// Returns false if there is no route to it.
+bool NetH_LookupRoute(ip_addr destination, net_route* out);
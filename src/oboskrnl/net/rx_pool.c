@@ -0,0 +1,118 @@
+/*
+ * oboskrnl/net/rx_pool.c
+ *
+ * Copyright (c) 2026 Omar Berrow
+ */
+
+#include <int.h>
+#include <error.h>
+#include <klog.h>
+#include <memmanip.h>
+
+#include <net/rx_pool.h>
+#include <net/macros.h>
+
+#include <mm/pmm.h>
+
+#include <locks/spinlock.h>
+
+#include <allocators/base.h>
+
+#include <utils/shared_ptr.h>
+
+DefineNetFreeSharedPtr
+
+static void release_buffer(void* udata, shared_ptr* ptr)
+{
+    OBOS_UNUSED(ptr);
+    net_rx_buffer* buf = udata;
+    net_rx_pool* pool = buf->pool;
+    irql oldIrql = Core_SpinlockAcquire(&pool->lock);
+    buf->next_free = pool->free;
+    pool->free = buf;
+    pool->nFree++;
+    Core_SpinlockRelease(&pool->lock, oldIrql);
+}
+
+obos_status NetH_InitializeRxPool(net_rx_pool* pool, size_t nBuffers, size_t bufferSize)
+{
+    if (!pool || !nBuffers || !bufferSize)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    memzero(pool, sizeof(*pool));
+    if (bufferSize % OBOS_PAGE_SIZE)
+        bufferSize += (OBOS_PAGE_SIZE-(bufferSize%OBOS_PAGE_SIZE));
+    obos_status status = OBOS_STATUS_SUCCESS;
+    pool->buffers = ZeroAllocate(OBOS_NonPagedPoolAllocator, nBuffers, sizeof(net_rx_buffer), &status);
+    if (!pool->buffers)
+        return status;
+    pool->bufferSize = bufferSize;
+    pool->lock = Core_SpinlockCreate();
+    for (size_t i = 0; i < nBuffers; i++)
+    {
+        net_rx_buffer* buf = &pool->buffers[i];
+        buf->phys = Mm_AllocatePhysicalPages(bufferSize / OBOS_PAGE_SIZE, 1, &status);
+        if (!buf->phys)
+        {
+            // Make do with what we have.
+            if (i)
+                break;
+            Free(OBOS_NonPagedPoolAllocator, pool->buffers, nBuffers*sizeof(net_rx_buffer));
+            pool->buffers = nullptr;
+            return status;
+        }
+        buf->virt = MmS_MapVirtFromPhys(buf->phys);
+        buf->pool = pool;
+        buf->next_free = pool->free;
+        pool->free = buf;
+        pool->nFree++;
+        pool->nBuffers++;
+    }
+    return OBOS_STATUS_SUCCESS;
+}
+
+net_rx_buffer* NetH_RxPoolGet(net_rx_pool* pool)
+{
+    if (!pool)
+        return nullptr;
+    irql oldIrql = Core_SpinlockAcquire(&pool->lock);
+    net_rx_buffer* buf = pool->free;
+    if (buf)
+    {
+        pool->free = buf->next_free;
+        pool->nFree--;
+        buf->next_free = nullptr;
+    }
+    Core_SpinlockRelease(&pool->lock, oldIrql);
+    return buf;
+}
+
+shared_ptr* NetH_RxPoolTakeFrame(net_rx_pool* pool, net_rx_buffer** slot, size_t length)
+{
+    if (!pool || !slot || !(*slot) || length > pool->bufferSize)
+        return nullptr;
+    net_rx_buffer* replacement = NetH_RxPoolGet(pool);
+    if (obos_expect(replacement != nullptr, true))
+    {
+        net_rx_buffer* buf = *slot;
+        *slot = replacement;
+        OBOS_SharedPtrConstructSz(&buf->ptr, buf->virt, length);
+        buf->ptr.free = release_buffer;
+        buf->ptr.freeUdata = buf;
+        pool->nZeroCopy++;
+        return &buf->ptr;
+    }
+
+    // Everything is still referenced by the network stack, so the frame
+    // needs to be copied to keep the RX ring full.
+    void* data = Allocate(OBOS_NonPagedPoolAllocator, length, nullptr);
+    if (!data)
+        return nullptr;
+    memcpy(data, (*slot)->virt, length);
+    shared_ptr* ptr = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(shared_ptr), nullptr);
+    OBOS_SharedPtrConstructSz(ptr, data, length);
+    ptr->free = OBOS_SharedPtrDefaultFree;
+    ptr->freeUdata = OBOS_NonPagedPoolAllocator;
+    ptr->onDeref = NetFreeSharedPtr;
+    pool->nCopied++;
+    return ptr;
+}
@@ -0,0 +1,71 @@
+/*
+ * oboskrnl/net/rx_pool.h
+ *
+ * Copyright (c) 2026 Omar Berrow
+ */
+
+#pragma once
+
+#include <int.h>
+#include <error.h>
+
+#include <locks/spinlock.h>
+
+#include <utils/shared_ptr.h>
+
+// A receive buffer owned by a net_rx_pool.
+// The buffer is physically contiguous, so that NICs can DMA into it,
+// and is accessed through the HHDM.
+typedef struct net_rx_buffer {
+    // Only valid while the buffer is handed to the network stack.
+    shared_ptr ptr;
+    uintptr_t phys;
+    void* virt;
+    struct net_rx_pool* pool;
+    struct net_rx_buffer* next_free;
+} net_rx_buffer;
+
+// A pool of preallocated receive buffers for a NIC's RX ring.
+// Each RX descriptor owns one buffer. When a frame is received, the buffer holding it
+// is handed to the network stack as-is, and the descriptor is refilled with a free buffer
+// from the pool. Once the last reference to the frame is dropped, the buffer goes back
+// into the pool, to be put back into the ring.
+typedef struct net_rx_pool {
+    net_rx_buffer* buffers;
+    size_t nBuffers;
+    // The size of each buffer, rounded up to a page.
+    size_t bufferSize;
+    spinlock lock;
+    net_rx_buffer* free;
+    size_t nFree;
+    // Frames handed to the network stack without a copy.
+    size_t nZeroCopy;
+    // Frames that had to be copied, as the pool had no free buffers.
+    size_t nCopied;
+} net_rx_pool;
+
+/// <summary>
+/// Initializes an RX buffer pool.
+/// </summary>
+/// <param name="pool">The pool to initialize.</param>
+/// <param name="nBuffers">The amount of buffers to allocate. This should be the size of the RX ring, plus some spare buffers.</param>
+/// <param name="bufferSize">The size of each buffer.</param>
+/// <returns>The status of the function.</returns>
+OBOS_EXPORT obos_status NetH_InitializeRxPool(net_rx_pool* pool, size_t nBuffers, size_t bufferSize);
+/// <summary>
+/// Takes a free buffer from an RX pool. Used to fill an RX ring.
+/// </summary>
+/// <param name="pool">The pool.</param>
+/// <returns>The buffer, or nullptr if the pool is empty.</returns>
+OBOS_EXPORT net_rx_buffer* NetH_RxPoolGet(net_rx_pool* pool);
+/// <summary>
+/// Takes a received frame out of an RX ring slot.
+/// If the pool has a free buffer, the buffer in *slot is returned without copying, and *slot is replaced
+/// with the free buffer. Otherwise, the frame is copied, and *slot is left untouched.
+/// Either way, the caller must rewrite the slot's descriptor with (*slot)->phys.
+/// </summary>
+/// <param name="pool">The pool that *slot belongs to.</param>
+/// <param name="slot">The RX ring slot that the frame was received into.</param>
+/// <param name="length">The length of the frame.</param>
+/// <returns>A shared_ptr to the frame with no references, or nullptr on failure.</returns>
+OBOS_EXPORT shared_ptr* NetH_RxPoolTakeFrame(net_rx_pool* pool, net_rx_buffer** slot, size_t length);
@@ -12,6 +12,7 @@
 #include <driver_interface/header.h>
 
 #include <vfs/vnode.h>
+#include <vfs/irp.h>
 
 #include <scheduler/thread.h>
 
@@ -21,6 +22,10 @@
 #include <net/tcp.h>
 
 #include <locks/pushlock.h>
+#include <locks/spinlock.h>
+#include <locks/event.h>
+
+#include <irq/timer.h>
 
 #include <utils/list.h>
 #include <utils/string.h>
@@ -32,7 +37,6 @@ typedef struct gateway {
     ip_addr dest; 
     // The IP table entry that would be used to comunicate with dest
     struct ip_table_entry* dest_ent; 
-    struct address_table_entry *cache;
     LIST_NODE(gateway_list, struct gateway) node;
 } gateway;
 typedef LIST_HEAD(gateway_list, gateway) gateway_list;
@@ -67,11 +71,54 @@ typedef struct ip_table_entry {
 typedef LIST_HEAD(ip_table, ip_table_entry) ip_table;
 LIST_PROTOTYPE(ip_table, ip_table_entry, node);
 
+// The states of a neighbor (ARP cache) entry.
+typedef enum neighbor_state {
+    // The address is being resolved, frames sent to it are queued.
+    NEIGHBOR_INCOMPLETE,
+    // The address was confirmed by an ARP reply less than --arp-reachable-time ago.
+    NEIGHBOR_REACHABLE,
+    // The address was not confirmed recently, or was learned from an ARP request.
+    // It is still used, but the next frame sent to it starts a probe.
+    NEIGHBOR_STALE,
+    // Unicast ARP requests are sent to confirm a stale address, which is still used meanwhile.
+    NEIGHBOR_PROBE,
+    // The address could not be resolved.
+    // Frames sent to it are dropped for --arp-failed-time, instead of sending more requests.
+    NEIGHBOR_FAILED,
+} neighbor_state;
+
+// A frame waiting for its neighbor to be resolved.
+typedef struct neighbor_pending_frame {
+    shared_ptr* frame;
+    nic_irp_data offload;
+    bool has_offload;
+    struct neighbor_pending_frame* next;
+} neighbor_pending_frame;
+
 typedef struct address_table_entry {
     ip_addr addr;
     mac_address phys;
-    // Wait on object before using this cache entry.
+    neighbor_state state;
+    // When the entry was last confirmed (REACHABLE/STALE), or when it failed (FAILED), in milliseconds.
+    uint64_t updated;
+    // The amount of ARP requests sent in the current INCOMPLETE or PROBE state.
+    uint32_t nProbes;
+    // Frames sent while INCOMPLETE, sent once the address is resolved.
+    struct {
+        neighbor_pending_frame* head;
+        neighbor_pending_frame* tail;
+        size_t nFrames;
+    } pending;
+    spinlock lock;
+    // Set when the entry leaves the INCOMPLETE state.
     event sync; 
+    // Retransmits ARP requests while INCOMPLETE or PROBE.
+    timer retransmit_timer;
+    bool timer_armed;
+    // Set once the entry is removed from the ARP cache.
+    bool removed;
+    _Atomic(size_t) refs;
+    struct net_tables* owner;
     RB_ENTRY(address_table_entry) node;
 } address_table_entry;
 inline static int cmp_address_table_entry(const address_table_entry* lhs, const address_table_entry* rhs)
@@ -85,29 +132,55 @@ inline static int cmp_address_table_entry(const address_table_entry* lhs, const
 typedef RB_HEAD(address_table, address_table_entry) address_table;
 RB_PROTOTYPE(address_table, address_table_entry, node, cmp_address_table_entry);
 
-struct route {
-    ip_table_entry* ent;
-    struct net_tables* iface;
-    gateway* route;
-    uint8_t ttl;
-    uint8_t hops;
-    ip_addr destination;
-    LIST_NODE(route_list, struct route) node;
-    RB_ENTRY(route) rb_node;
-};
-inline static int route_cmp(struct route* lhs, struct route* rhs)
-{
-    if (lhs->iface < rhs->iface) return -1;
-    if (lhs->iface > rhs->iface) return 1;
-    if (lhs->destination.addr < rhs->destination.addr) return -1;
-    if (lhs->destination.addr > rhs->destination.addr) return 1;
-    return 0;
-}
-typedef RB_HEAD(route_tree, route) route_tree;
-RB_PROTOTYPE(route_tree, route, rb_node, route_cmp);
-
-typedef LIST_HEAD(route_list, struct route) route_list;
-LIST_PROTOTYPE(route_list, struct route, node);
+// Returned by IOCTL_IFACE_GET_ARP_STATS.
+typedef struct net_arp_stats {
+    // The amount of ARP requests sent, broadcast or unicast.
+    size_t nRequests;
+    // The amount of addresses that were resolved.
+    size_t nResolved;
+    // The amount of addresses that could not be resolved.
+    size_t nFailed;
+    // The amount of frames that were queued while their neighbor was resolved.
+    size_t nQueued;
+    // The amount of queued frames that were dropped, because the queue was full or the address could not be resolved.
+    size_t nDropped;
+    // The amount of frames that were dropped because their neighbor recently failed to resolve.
+    size_t nNegativeHits;
+} net_arp_stats;
+
+// Returned by IOCTL_IFACE_GET_DISPATCH_STATS, one per dispatch worker.
+typedef struct net_dispatch_stats {
+    // The CPU the worker is bound to.
+    uint32_t cpu;
+    // The amount of frames processed by the worker.
+    size_t nFrames;
+    // The amount of frames dropped because the worker's queue was full.
+    size_t nDropped;
+    // The highest amount of frames that were queued on the worker at once.
+    size_t maxQueued;
+} net_dispatch_stats;
+
+#define NET_DISPATCH_QUEUE_SIZE 1024
+
+// Protocol processing of received frames is spread across one worker per CPU.
+// Frames are steered to a worker by a hash of their flow (the IPv4 addresses, protocol,
+// and TCP/UDP ports), so that all frames of a connection are processed in order by the same
+// worker, on the same CPU.
+typedef struct net_dispatch_worker {
+    thread* thread;
+    event evnt;
+    spinlock lock;
+    // A ring of received frames, each holding a reference.
+    shared_ptr** queue;
+    size_t head;
+    size_t tail;
+    size_t nQueued;
+    struct net_tables* tables;
+    net_dispatch_stats stats;
+    // Segments of the flows of this worker whose retransmission timer expired, linked through next_retransmit.
+    // Protected by 'lock'.
+    struct tcp_unacked_segment* pending_retransmits;
+} net_dispatch_worker;
 
 typedef struct net_tables {
     ip_table table;
@@ -115,6 +188,8 @@ typedef struct net_tables {
 
     address_table arp_cache;
     pushlock arp_cache_lock;
+    size_t arp_cache_size;
+    net_arp_stats arp_stats;
 
     gateway_list gateways;
     gateway* default_gateway;
@@ -133,9 +208,6 @@ typedef struct net_tables {
         mutex lock;
     } tcp_pending_acks;
 
-    route_tree cached_routes;
-    pushlock cached_routes_lock;
-    
     // Connections made by bind()ing
     // then connect()ing are put here;
     // tcp_port contains connections 
@@ -155,6 +227,12 @@ typedef struct net_tables {
     thread* dispatch_thread;
     bool kill_dispatch;
 
+    net_dispatch_worker* dispatch_workers;
+    size_t nDispatchWorkers;
+
+    // The transmit offloads of the NIC (see IOCTL_IFACE_GET_OFFLOAD_CAPS).
+    net_offload_info offload;
+
     LIST_NODE(network_interface_list, struct net_tables) node;
 } net_tables;
 typedef LIST_HEAD(network_interface_list, net_tables) network_interface_list;
@@ -163,6 +241,16 @@ extern network_interface_list Net_Interfaces;
 
 obos_status Net_Initialize(vnode* nic);
 obos_status NetH_SendEthernetPacket(vnode *nic, shared_ptr* data);
+// Sends a frame that requests the transmit offloads in 'offload', which can be nullptr.
+obos_status NetH_SendEthernetPacketEx(vnode *nic, shared_ptr* data, const nic_irp_data* offload);
+// Returns true if all offloads in 'flags' (NET_OFFLOAD_*) are enabled on the NIC.
+bool NetH_OffloadEnabled(vnode* nic, uint32_t flags);
+// Queues a received frame on the dispatch worker of its flow.
+// The reference held by 'frame' is given to the worker.
+obos_status NetH_DispatchFrame(net_tables* tables, shared_ptr* frame);
+// Returns the dispatch worker that processes the frames received on a flow, or nullptr if there are no workers.
+// 'src' and 'src_port' are those of the remote end, as in the frames received from it.
+net_dispatch_worker* NetH_FlowWorker(net_tables* tables, ip_addr src, ip_addr dest, uint8_t protocol, uint16_t src_port, uint16_t dest_port);
 obos_status NetH_AddressRoute(net_tables** interface, ip_table_entry** routing_entry, uint8_t *ttl, ip_addr destination);
 obos_status NetH_GetLocalAddressInterface(net_tables** interface, ip_addr src);
 
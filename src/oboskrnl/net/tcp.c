@@ -8,10 +8,12 @@
 #include <error.h>
 #include <struct_packing.h>
 #include <memmanip.h>
+#include <cmdline.h>
 
 #include <net/macros.h>
 #include <net/ip.h>
 #include <net/tcp.h>
+#include <net/tcp_cc.h>
 #include <net/tables.h>
 #include <net/icmp.h>
 
@@ -42,8 +44,71 @@
 DefineNetFreeSharedPtr
 
 // TODO(oberrow): Determine MTU
+// The MSS advertised to the remote.
+static uint16_t tcp_mtu_mss()
+{ return 1460; }
+// The maximum payload of a segment, options added to every segment take space from it.
 static uint16_t tcp_get_mss(tcp_connection* con)
-{ OBOS_UNUSED(con); return 1460; }
+{ return tcp_mtu_mss() - (con && con->state.ts_ok ? 12 : 0); }
+uint16_t NetH_TCPGetMSS(tcp_connection* con)
+{ return tcp_get_mss(con); }
+
+static size_t max_recv_buffer()
+{
+    static size_t max = 0;
+    if (!max)
+    {
+        max = OBOS_GetOPTD_Ex("tcp-max-rcvbuf", TCP_DEFAULT_MAX_RECV_BUFFER);
+        if (max < TCP_INITIAL_RECV_BUFFER)
+            max = TCP_INITIAL_RECV_BUFFER;
+        if (max > ((size_t)0xffff << TCP_MAX_WINDOW_SCALE))
+            max = (size_t)0xffff << TCP_MAX_WINDOW_SCALE;
+    }
+    return max;
+}
+
+// The window scale needed to advertise the largest receive buffer.
+static uint8_t recv_window_scale()
+{
+    uint8_t shift = 0;
+    while (shift < TCP_MAX_WINDOW_SCALE && (max_recv_buffer() >> shift) > 0xffff)
+        shift++;
+    return shift;
+}
+
+static uint32_t tcp_timestamp()
+{
+    return (uint32_t)(Net_TCPNow() / 1000);
+}
+
+// Writes the options that are added to every segment of a connection into 'buf'.
+// Returns the size of the options, which is always a multiple of four.
+static size_t connection_options(tcp_connection* con, uint8_t flags, uint8_t* buf)
+{
+    if (!con || (flags & TCP_RST))
+        return 0;
+    size_t sz = 0;
+    if ((flags & TCP_SYN) && con->state.wscale_ok)
+    {
+        buf[sz++] = TCP_OPTION_NOP;
+        buf[sz++] = TCP_OPTION_WINDOW_SCALE;
+        buf[sz++] = 3;
+        buf[sz++] = con->state.rcv_wscale;
+    }
+    if (con->state.ts_ok)
+    {
+        uint32_t val = host_to_be32(tcp_timestamp());
+        uint32_t ecr = host_to_be32(con->state.ts_recent);
+        buf[sz++] = TCP_OPTION_NOP;
+        buf[sz++] = TCP_OPTION_NOP;
+        buf[sz++] = TCP_OPTION_TIMESTAMP;
+        buf[sz++] = 10;
+        memcpy(&buf[sz], &val, 4);
+        memcpy(&buf[sz+4], &ecr, 4);
+        sz += 8;
+    }
+    return sz;
+}
 
 static uint32_t generate_iss(tcp_connection* con)
 {
@@ -90,11 +155,34 @@ static uint16_t tcp_chksum(const void *seg1, size_t sz_seg1, const void* seg2, s
     return ret;
 }
 
+static object_cache unacked_segment_cache = OBJECT_CACHE_INITIALIZE("tcp_unacked_segment", tcp_unacked_segment, nullptr, nullptr, nullptr, OBJECT_CACHE_ZERO);
+static void free_unacked_segment(void* udata, shared_ptr* ptr)
+{
+    OBOS_ObjectCacheFree(udata, ptr->obj);
+}
+
 static void tcp_seg_expired(void* userdata)
 {
     struct tcp_unacked_segment* seg = userdata;
     seg->expired = true;
-    OBOS_SharedPtrUnref(&seg->ptr);
+    net_tables* tables = seg->con->nic->net_tables;
+    if (!tables->nDispatchWorkers || seg->retransmit_queued)
+    {
+        // Retransmitted once an ACK is received.
+        OBOS_SharedPtrUnref(&seg->ptr);
+        return;
+    }
+    // Queue the segment on the worker that processes the frames of its connection,
+    // so that the retransmission is serialized with the ACKs received for it.
+    tcp_connection* con = seg->con;
+    net_dispatch_worker* worker = NetH_FlowWorker(tables, con->dest.addr, con->src.addr, 0x06, con->dest.port, con->src.port);
+    // The timer's reference is given to the retransmission queue.
+    irql oldIrql = Core_SpinlockAcquire(&worker->lock);
+    seg->retransmit_queued = true;
+    seg->next_retransmit = worker->pending_retransmits;
+    worker->pending_retransmits = seg;
+    Core_SpinlockRelease(&worker->lock, oldIrql);
+    Core_EventSet(&worker->evnt, false);
 }
 
 obos_status NetH_SendTCPSegment(vnode* nic, tcp_connection* con, void* ent_ /* ip_table_entry */, ip_addr dest, struct tcp_pseudo_hdr* dat)
@@ -107,10 +195,21 @@ obos_status NetH_SendTCPSegment(vnode* nic, tcp_connection* con, void* ent_ /* i
     size_t payload_size = dat->payload_size;
     if (!dat->ttl)
         dat->ttl = 64;
+    if (con)
+        dat->owner = con;
+    tcp_connection* const owner = dat->owner;
+
+    uint8_t con_options[16];
+    size_t con_options_size = connection_options(owner, dat->flags, con_options);
+    // The option list is padded to a multiple of four bytes with EOL options.
+    size_t options_size = con_options_size + dat->option_list_size;
+    if (options_size % 4)
+        options_size += 4 - (options_size % 4);
 
     shared_ptr* ptr = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(shared_ptr), nullptr);
-    size_t hdr_sz = sizeof(tcp_header) + dat->option_list_size;
-    size_t sz = hdr_sz + (payload ? payload->szObj : 0);
+    size_t hdr_sz = sizeof(tcp_header) + options_size;
+    size_t payload_len = payload ? OBOS_MIN(payload_size, payload->szObj - payload_offset) : 0;
+    size_t sz = hdr_sz + payload_len;
     OBOS_SharedPtrConstructSz(ptr, Allocate(OBOS_KernelAllocator, sz, nullptr), sz);
     ptr->free = OBOS_SharedPtrDefaultFree;
     ptr->freeUdata = OBOS_KernelAllocator;
@@ -118,31 +217,35 @@ obos_status NetH_SendTCPSegment(vnode* nic, tcp_connection* con, void* ent_ /* i
     
     tcp_header* hdr = ptr->obj;
     memzero(hdr, sizeof(*hdr));
-    hdr->window = be16_to_host(dat->window);
+    uint32_t window = dat->window;
+    // Windows in SYN segments are never scaled.
+    if (owner && owner->state.wscale_ok && ~dat->flags & TCP_SYN)
+        window >>= owner->state.rcv_wscale;
+    hdr->window = host_to_be16(OBOS_MIN(window, 0xffffU));
     hdr->flags = dat->flags;
     hdr->ack = be32_to_host(dat->ack);
     hdr->seq = be32_to_host(dat->seq);
     hdr->dest_port = be16_to_host(dat->dest_port);
     hdr->src_port = be16_to_host(dat->src_port);
     hdr->urg_ptr = 0;
-    hdr->data_offset = (hdr_sz/4 + !!(hdr_sz%4)) << 4;
-    struct {
-        uint32_t src_addr;
-        uint32_t dest_addr;
-        uint8_t zero;
-        uint8_t protocol;
-        uint16_t tcp_length;
-    } OBOS_PACK ip_psuedo_header = {.src_addr=ent->address.addr,.dest_addr=dest.addr,.protocol=0x6,.zero=0,.tcp_length=host_to_be16(sz)};
+    hdr->data_offset = (hdr_sz/4) << 4;
+    memzero(hdr->data, options_size);
+    memcpy(hdr->data, con_options, con_options_size);
     if (dat->options)
-        memcpy(hdr->data, dat->options, dat->option_list_size);
+        memcpy(hdr->data + con_options_size, dat->options, dat->option_list_size);
     if (payload)
     {
-        memcpy(hdr->data + dat->option_list_size, payload->obj + payload_offset, OBOS_MIN(payload_size, payload->szObj));
+        memcpy(hdr->data + options_size, payload->obj + payload_offset, payload_len);
         if (!con)
             OBOS_SharedPtrUnref(payload);
     }
-    hdr->chksum = tcp_chksum(&ip_psuedo_header, sizeof(ip_psuedo_header), hdr, sz);
-    hdr->chksum = be16_to_host(hdr->chksum);
+    // The checksum is computed by NetH_SendIPv4PacketEx, or by the NIC.
+    nic_irp_data offload = {.offload=NET_OFFLOAD_TCP_CHECKSUM};
+    if (payload_len > tcp_get_mss(owner))
+    {
+        offload.offload |= NET_OFFLOAD_TCP_TSO;
+        offload.mss = tcp_get_mss(owner);
+    }
     
     //printf("tcp tx segment (%d->%d): hdr->flags=0x%x, hdr->ack=0x%x, hdr->seq=0x%x\n", be16_to_host(hdr->src_port), be16_to_host(hdr->dest_port), hdr->flags, be32_to_host(hdr->ack), be32_to_host(hdr->seq));
 
@@ -159,17 +262,19 @@ obos_status NetH_SendTCPSegment(vnode* nic, tcp_connection* con, void* ent_ /* i
     bool defer_send = false;
     if (dat->check_tx_window && con)
     {
-        uint32_t window_edge = con->state.snd.una + con->state.snd.wnd;
-        defer_send = dat->seq > window_edge;
+        uint32_t window_edge = con->state.snd.una + Net_TCPSendWindow(con);
+        // The oldest outstanding segment is always sent, so that a small window can't stall the connection.
+        defer_send = dat->seq != con->state.snd.una && (dat->seq + dat->payload_size) > window_edge;
         if (!defer_send)
         {
-            con->state.snd.nxt = dat->seq + dat->payload_size;
+            if ((dat->seq + dat->payload_size) > con->state.snd.nxt)
+                con->state.snd.nxt = dat->seq + dat->payload_size;
             con->ack_pending = false;
         }
     }
     
     if (!defer_send)
-        status = NetH_SendIPv4Packet(nic, ent, dest, 0x6, dat->ttl, 0, OBOS_SharedPtrCopy(ptr));
+        status = NetH_SendIPv4PacketEx(nic, ent, dest, 0x6, dat->ttl, 0, OBOS_SharedPtrCopy(ptr), &offload);
     
     if (obos_is_error(status))
     {
@@ -185,10 +290,10 @@ obos_status NetH_SendTCPSegment(vnode* nic, tcp_connection* con, void* ent_ /* i
         return OBOS_STATUS_SUCCESS;
     }
     
-    tcp_unacked_segment* seg = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(tcp_unacked_segment), nullptr);
+    tcp_unacked_segment* seg = OBOS_ObjectCacheAllocate(&unacked_segment_cache, nullptr);
     OBOS_SharedPtrConstructSz(&seg->ptr, seg, sizeof(*seg));
-    seg->ptr.free = OBOS_SharedPtrDefaultFree;
-    seg->ptr.freeUdata = OBOS_KernelAllocator;
+    seg->ptr.free = free_unacked_segment;
+    seg->ptr.freeUdata = &unacked_segment_cache;
     seg->con = con;
     seg->expired = defer_send;
     seg->sent = !defer_send;
@@ -200,10 +305,11 @@ obos_status NetH_SendTCPSegment(vnode* nic, tcp_connection* con, void* ent_ /* i
     seg->segment.options = Allocate(OBOS_KernelAllocator, dat->option_list_size, nullptr);
     memcpy(seg->segment.options, dat->options, dat->option_list_size);
     if(!seg->segment.expiration_ms)
-        seg->segment.expiration_ms = 5*1000 /* 5 second default */;
+        seg->segment.expiration_ms = con->rtt.rto ? con->rtt.rto / 1000 : 5*1000 /* 5 second default */;
     
     if (seg->sent)
     {
+        seg->sent_at = Net_TCPNow();
         OBOS_SharedPtrRef(&seg->ptr);
         seg->expiration_timer.userdata = seg;
         seg->expiration_timer.handler = tcp_seg_expired;
@@ -237,6 +343,16 @@ void tx_tm_hnd(void* udata)
 LIST_GENERATE(tcp_unacked_segment_list, tcp_unacked_segment, node);
 LIST_GENERATE(tcp_unacked_rsegment_list, tcp_unacked_rsegment, node);
 
+// The window advertised by a segment, scaled (RFC 7323, 2.3).
+static uint32_t segment_window(const tcp_connection* con, const tcp_header* hdr)
+{
+    uint32_t wnd = be16_to_host(hdr->window);
+    // The window of a SYN segment is never scaled.
+    if (con->state.wscale_ok && ~hdr->flags & TCP_SYN)
+        wnd <<= con->state.snd_wscale;
+    return wnd;
+}
+
 static void update_send_window(tcp_connection* con, tcp_header* hdr)
 {
     if ((con->state.snd.una < be32_to_host(hdr->ack) && be32_to_host(hdr->ack) <= con->state.snd.nxt) || !con->state.snd.wl1)
@@ -244,9 +360,9 @@ static void update_send_window(tcp_connection* con, tcp_header* hdr)
         // Update the send window
         if (con->state.snd.wl1 < be32_to_host(hdr->seq) || (con->state.snd.wl1 == be32_to_host(hdr->seq) && con->state.snd.wl2 <= be32_to_host(hdr->ack)))
         {
-            con->state.snd.wnd = be16_to_host(hdr->window);
-            con->state.snd.wl1 = be16_to_host(hdr->seq);
-            con->state.snd.wl2 = be16_to_host(hdr->ack);
+            con->state.snd.wnd = segment_window(con, hdr);
+            con->state.snd.wl1 = be32_to_host(hdr->seq);
+            con->state.snd.wl2 = be32_to_host(hdr->ack);
         }
     }
 }
@@ -260,6 +376,7 @@ static void finish_con(tcp_connection* con)
     resp.seq = con->state.snd.nxt;
     resp.ack = ++con->state.rcv.nxt;
     resp.window = con->state.rcv.wnd;
+    resp.owner = con;
     resp.flags = TCP_ACK;
     NetH_SendTCPSegment(con->nic, nullptr, con->ip_ent, con->dest.addr, &resp);
 
@@ -299,14 +416,61 @@ static void finish_con(tcp_connection* con)
     }
 }
 
-static bool check_sack_perm(void* userdata, struct tcp_option* opt, tcp_header* unused)
+static bool check_syn_option(void* userdata, struct tcp_option* opt, tcp_header* unused)
 {
     OBOS_UNUSED(unused);
     tcp_connection* con = userdata;
-    if (opt->kind != TCP_OPTION_SACK_PERM)
+    switch (opt->kind) {
+        case TCP_OPTION_SACK_PERM:
+            con->state.sack_perm = true;
+            break;
+        case TCP_OPTION_WINDOW_SCALE:
+            if (opt->len != 3)
+                break;
+            con->state.wscale_ok = true;
+            con->state.snd_wscale = OBOS_MIN(opt->data[0], TCP_MAX_WINDOW_SCALE);
+            break;
+        case TCP_OPTION_TIMESTAMP:
+        {
+            if (opt->len != 10)
+                break;
+            uint32_t val = 0;
+            memcpy(&val, opt->data, 4);
+            con->state.ts_ok = true;
+            con->state.ts_recent = be32_to_host(val);
+            break;
+        }
+        default:
+            break;
+    }
+    return true;
+}
+
+// Window scaling and timestamps are only used if both sides sent them in their SYN.
+static void process_syn_options(tcp_connection* con, tcp_header* hdr)
+{
+    con->state.wscale_ok = false;
+    con->state.ts_ok = false;
+    Net_TCPProcessOptionList(con, hdr, check_syn_option);
+}
+
+struct tcp_timestamp_option {
+    uint32_t val;
+    uint32_t ecr;
+    bool found;
+};
+static bool find_timestamp(void* userdata, struct tcp_option* opt, tcp_header* unused)
+{
+    OBOS_UNUSED(unused);
+    struct tcp_timestamp_option* ts = userdata;
+    if (opt->kind != TCP_OPTION_TIMESTAMP || opt->len != 10)
         return true;
-    con->state.sack_perm = true;
-    return false;   
+    memcpy(&ts->val, opt->data, 4);
+    memcpy(&ts->ecr, opt->data+4, 4);
+    ts->val = be32_to_host(ts->val);
+    ts->ecr = be32_to_host(ts->ecr);
+    ts->found = true;
+    return false;
 }
 
 static bool process_sack(void* userdata, struct tcp_option* opt, tcp_header* unused)
@@ -322,18 +486,35 @@ static bool process_sack(void* userdata, struct tcp_option* opt, tcp_header* unu
         uint32_t right_edge;
     } OBOS_PACK *cur_ack = (void*)opt->data;
 
-    size_t nProcessed = opt->len - 2, offset = 0;
-    while (nProcessed) {
-        cur_ack = (void*)(opt->data + offset);
-        
-        if (!Net_TCPRemoteACKedSegment(con, cur_ack->left_edge, cur_ack->right_edge))
+    if (opt->len < 2)
+    {
+        con->state.sack_failure = true;
+        return false;
+    }
+    size_t nBlocks = (opt->len - 2) / sizeof(*cur_ack);
+    for (size_t i = 0; i < nBlocks; i++)
+    {
+        cur_ack = (void*)(opt->data + i*sizeof(*cur_ack));
+        uint32_t left_edge = be32_to_host(cur_ack->left_edge);
+        uint32_t right_edge = be32_to_host(cur_ack->right_edge);
+        if (left_edge >= right_edge || right_edge > con->state.snd.nxt)
         {
             con->state.sack_failure = true;
             return false;
         }
-        
-        nProcessed -= 2;
-        offset += 2;
+
+        // Mark the segments that the remote has received, so that they are not retransmitted.
+        // They are only removed once they are cumulatively ACKed, in case the remote reneges.
+        Core_PushlockAcquire(&con->unacked_segments.lock, true);
+        for (tcp_unacked_segment* seg = LIST_GET_HEAD(tcp_unacked_segment_list, &con->unacked_segments.list); seg; )
+        {
+            if (seg->segment.seq >= right_edge)
+                break;
+            if (seg->segment.seq >= left_edge && (seg->segment.seq + seg->nBytesInFlight) <= right_edge)
+                seg->sacked = true;
+            seg = LIST_GET_NEXT(tcp_unacked_segment_list, &con->unacked_segments.list, seg);
+        }
+        Core_PushlockRelease(&con->unacked_segments.lock, true);
     }
 
     return true;
@@ -473,7 +654,7 @@ PacketProcessSignature(TCP, ip_header*)
             con = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(tcp_connection), nullptr);
             con->state.rcv.nxt = be32_to_host(hdr->seq)+1;
             con->state.rcv.irs = be32_to_host(hdr->seq);
-            con->state.rcv.wnd = 0x10000-1;
+            con->state.rcv.wnd = TCP_INITIAL_RECV_BUFFER;
             con->state.state_change_event = EVENT_INITIALIZE(EVENT_NOTIFICATION);
             con->state.state = TCP_STATE_SYN_RECEIVED;
             con->ttl = 64;
@@ -487,12 +668,14 @@ PacketProcessSignature(TCP, ip_header*)
             con->state.snd.iss = generate_iss(con);
             con->state.snd.nxt = con->state.snd.iss + 1;
             con->state.snd.una = con->state.snd.iss;
+            con->state.rcv_wscale = recv_window_scale();
+            Net_TCPCongestionInit(con);
             con->inbound_sig = EVENT_INITIALIZE(EVENT_NOTIFICATION);
             con->inbound_urg_sig = EVENT_INITIALIZE(EVENT_NOTIFICATION);
             con->user_recv_buffer.lock = MUTEX_INITIALIZE();
             con->unacked_segments.lock = PUSHLOCK_INITIALIZE();
 
-            Net_TCPProcessOptionList(con, hdr, check_sack_perm);
+            process_syn_options(con, hdr);
 
             Core_PushlockAcquire(&port->connection_tree_lock, false);
             RB_INSERT(tcp_connection_tree, &port->connections, con);
@@ -506,6 +689,7 @@ PacketProcessSignature(TCP, ip_header*)
             resp.src_port = con->src.port;
             resp.flags = TCP_SYN|TCP_ACK;
             resp.window = con->state.rcv.wnd;
+            resp.owner = con;
             struct {
                 uint8_t kind; 
                 uint8_t len;
@@ -514,7 +698,7 @@ PacketProcessSignature(TCP, ip_header*)
                 uint8_t sack_perm_len;
                 uint8_t eol; 
             } opt = {
-                .kind=TCP_OPTION_MSS, .len=4, .mss=host_to_be16(tcp_get_mss(con)),
+                .kind=TCP_OPTION_MSS, .len=4, .mss=host_to_be16(tcp_mtu_mss()),
                 .sack_perm_kind = con->state.sack_perm ? TCP_OPTION_EOL : TCP_OPTION_SACK_PERM, .sack_perm_len=con->state.sack_perm*2
             };
             resp.options = (void*)&opt;
@@ -563,7 +747,7 @@ PacketProcessSignature(TCP, ip_header*)
             con->state.rcv.irs = be32_to_host(hdr->seq);
             con->state.rcv.nxt = be32_to_host(hdr->seq)+1;
 
-            Net_TCPProcessOptionList(con, hdr, check_sack_perm);
+            process_syn_options(con, hdr);
 
             if (con->state.snd.una > con->state.snd.iss)
             {
@@ -573,6 +757,7 @@ PacketProcessSignature(TCP, ip_header*)
                 resp.ttl = con->ttl;
                 resp.seq = con->state.snd.nxt;
                 resp.window = con->state.rcv.wnd;
+                resp.owner = con;
                 resp.ack = con->state.rcv.nxt;
                 resp.flags = TCP_ACK;
                 NetH_SendTCPSegment(nic, nullptr, ent, con->dest.addr, &resp);
@@ -587,6 +772,7 @@ PacketProcessSignature(TCP, ip_header*)
                 resp.ttl = con->ttl;
                 resp.seq = con->state.snd.iss;
                 resp.window = con->state.rcv.wnd;
+                resp.owner = con;
                 resp.ack = con->state.rcv.nxt;
                 resp.flags = TCP_ACK | TCP_SYN;
                 struct {
@@ -597,7 +783,7 @@ PacketProcessSignature(TCP, ip_header*)
                     uint8_t sack_perm_len;
                     uint8_t eol; 
                 } opt = {
-                    .kind=TCP_OPTION_MSS, .len=4, .mss=host_to_be16(tcp_get_mss(con)),
+                    .kind=TCP_OPTION_MSS, .len=4, .mss=host_to_be16(tcp_mtu_mss()),
                     .sack_perm_kind = con->state.sack_perm ? TCP_OPTION_EOL : TCP_OPTION_SACK_PERM, .sack_perm_len=con->state.sack_perm*2
                 };
                 resp.options = (void*)&opt;
@@ -638,6 +824,13 @@ PacketProcessSignature(TCP, ip_header*)
         else 
             OBOS_UNREACHABLE;
 
+        struct tcp_timestamp_option ts = {};
+        if (con->state.ts_ok)
+            Net_TCPProcessOptionList(&ts, hdr, find_timestamp);
+        // PAWS (RFC 7323, 5.3): a segment with an older timestamp than the last one is an old duplicate.
+        if (acceptable && ts.found && ~hdr->flags & TCP_RST && (int32_t)(ts.val - con->state.ts_recent) < 0)
+            acceptable = false;
+
         if (!acceptable)
         {
             // This is UNACCEPTABLE!
@@ -658,11 +851,25 @@ PacketProcessSignature(TCP, ip_header*)
             resp.seq = con->state.snd.nxt;
             resp.ack = con->state.rcv.nxt;
             resp.window = con->state.rcv.wnd;
+            resp.owner = con;
             resp.flags = TCP_ACK;
             NetH_SendTCPSegment(nic, nullptr, ent, con->dest.addr, &resp);
             DropPacket();
         }
 
+        if (ts.found)
+        {
+            if ((int32_t)(ts.val - con->state.ts_recent) >= 0 && be32_to_host(hdr->seq) <= con->state.rcv.nxt)
+                con->state.ts_recent = ts.val;
+            // The remote echoes the timestamp of our last ACK, which lets us
+            // estimate the RTT even if we aren't sending any data.
+            if (ts.ecr && segment_length)
+            {
+                uint32_t rtt = (tcp_timestamp() - ts.ecr) * 1000;
+                con->recv_buffer.rtt = con->recv_buffer.rtt ? (con->recv_buffer.rtt * 7 + rtt) / 8 : rtt;
+            }
+        }
+
         if (hdr->flags & TCP_RST)
         {
             switch (con->state.state) {
@@ -724,6 +931,11 @@ PacketProcessSignature(TCP, ip_header*)
                 case TCP_STATE_CLOSING:
                 {
                     // Remote acknoledged our packets, probably.
+                    uint32_t old_una = con->state.snd.una;
+                    bool duplicate_ack = be32_to_host(hdr->ack) == old_una && !segment_length &&
+                                         !(hdr->flags & (TCP_SYN|TCP_FIN)) &&
+                                         segment_window(con, hdr) == con->state.snd.wnd &&
+                                         LIST_GET_NODE_COUNT(tcp_unacked_segment_list, &con->unacked_segments.list);
                     if (!con->state.sack_perm)
                     {
                         if (!Net_TCPRemoteACKedSegment(con, con->state.snd.una, be32_to_host(hdr->ack)))
@@ -741,6 +953,14 @@ PacketProcessSignature(TCP, ip_header*)
                             DropPacket();
                     }
                     update_send_window(con, hdr);
+                    // RTTM (RFC 7323, 4.1)
+                    if (ts.found && ts.ecr && con->state.snd.una > old_una)
+                        Net_TCPUpdateRTT(con, (uint64_t)(tcp_timestamp() - ts.ecr) * 1000);
+                    if (duplicate_ack)
+                        Net_TCPCongestionOnDuplicateACK(con);
+                    else if (con->state.snd.una > old_una)
+                        Net_TCPCongestionOnNewACK(con, con->state.snd.una - old_una);
+                    Net_TCPTransmitQueued(con);
                     if (con->state.state == TCP_STATE_FIN_WAIT1)
                     {
                         OBOS_ASSERT(con->fin_segment);
@@ -791,6 +1011,7 @@ PacketProcessSignature(TCP, ip_header*)
                     resp.ttl = con->ttl;
                     resp.seq = con->state.snd.nxt;
                     resp.window = con->state.rcv.wnd;
+                    resp.owner = con;
                     resp.ack = be32_to_host(hdr->seq);
                     resp.flags = TCP_ACK;
                     NetH_SendTCPSegment(nic, nullptr, ent, con->dest.addr, &resp);
@@ -868,6 +1089,7 @@ static void do_ack(tcp_connection* con)
     con->state.rcv.las = con->state.rcv.nxt;
     resp.ack = con->state.rcv.nxt;
     resp.window = con->state.rcv.wnd;
+    resp.owner = con;
     resp.flags = TCP_ACK;
     NetH_SendTCPSegment(con->nic, nullptr, con->ip_ent, con->dest.addr, &resp);
     con->ack_pending = false;
@@ -888,6 +1110,38 @@ void Net_TCPFlushACKs(struct net_tables* nic)
     Core_MutexRelease(&nic->tcp_pending_acks.lock);
 }
 
+// Grows the receive buffer to twice the amount of data received in an RTT (dynamic right-sizing),
+// so that the advertised window doesn't limit the remote as its congestion window grows.
+static void recv_buffer_autotune(tcp_connection* con, uint32_t nBytes)
+{
+    uint64_t now = Net_TCPNow();
+    con->recv_buffer.space_copied += nBytes;
+    if (!con->recv_buffer.space_time)
+    {
+        con->recv_buffer.space_time = now;
+        return;
+    }
+    uint32_t rtt = con->rtt.has_sample ? con->rtt.srtt : con->recv_buffer.rtt;
+    if (!rtt || (now - con->recv_buffer.space_time) < rtt)
+        return;
+
+    size_t target = (size_t)con->recv_buffer.space_copied * 2;
+    con->recv_buffer.space_copied = 0;
+    con->recv_buffer.space_time = now;
+
+    // Without window scaling, the window can't be advertised past 64KiB.
+    size_t max = con->state.wscale_ok ? max_recv_buffer() : TCP_INITIAL_RECV_BUFFER;
+    if (target > max)
+        target = max;
+    if (target <= con->recv_buffer.size)
+        return;
+    void* buf = Reallocate(OBOS_KernelAllocator, con->recv_buffer.buf, target, con->recv_buffer.size, nullptr);
+    if (!buf)
+        return;
+    con->recv_buffer.buf = buf;
+    con->recv_buffer.size = target;
+}
+
 void Net_TCPPushReceivedData(tcp_connection* con, const void* buffer, size_t sz, uint32_t sequence, size_t *nPushed)
 {
     OBOS_ASSERT(sequence >= con->state.rcv.nxt);
@@ -961,6 +1215,7 @@ void Net_TCPPushReceivedData(tcp_connection* con, const void* buffer, size_t sz,
             resp.seq = con->state.snd.nxt;
             resp.ack = con->state.rcv.nxt;
             resp.window = con->state.rcv.wnd;
+            resp.owner = con;
             resp.flags = TCP_ACK;
             struct {
                 uint8_t kind; // SACK
@@ -1009,6 +1264,7 @@ void Net_TCPPushReceivedData(tcp_connection* con, const void* buffer, size_t sz,
             }
             memcpy(con->user_recv_buffer.buf + (con->user_recv_buffer.size - size), con->recv_buffer.buf, size);
             Core_MutexRelease(&con->user_recv_buffer.lock);
+            recv_buffer_autotune(con, size);
             con->state.rcv.wnd = con->recv_buffer.size;
         }
         // if ((con->state.rcv.nxt - con->state.rcv.las) > con->recv_buffer.size/2)
@@ -1064,7 +1320,7 @@ void Net_TCPChangeConnectionState(tcp_connection* con, int state)
     if (state == TCP_STATE_ESTABLISHED)
     {
         if (!con->state.rcv.wnd)
-            con->state.rcv.wnd = 0x10000-1;
+            con->state.rcv.wnd = TCP_INITIAL_RECV_BUFFER;
         con->recv_buffer.size = con->state.rcv.wnd;
         con->recv_buffer.closed = false;
         con->recv_buffer.buf = Allocate(OBOS_KernelAllocator, con->recv_buffer.size, nullptr);
@@ -1099,10 +1355,14 @@ bool Net_TCPRemoteACKedSegment(tcp_connection* con, uint32_t ack_left, uint32_t
     uint32_t nBytesACKed = (ack - ack_left);
     
     tcp_unacked_segment* seg = LIST_GET_HEAD(tcp_unacked_segment_list, &con->unacked_segments.list);
+    bool sampled_rtt = false;
     while (nBytesACKed != 0 && seg)
     {
         if (seg->segment.seq < ack_left)
+        {
+            seg = LIST_GET_NEXT(tcp_unacked_segment_list, &con->unacked_segments.list, seg);
             continue;
+        }
         if (seg->segment.seq >= ack)
             break;
         /*
@@ -1113,6 +1373,13 @@ bool Net_TCPRemoteACKedSegment(tcp_connection* con, uint32_t ack_left, uint32_t
          */
         if ((seg->nBytesInFlight + seg->segment.seq) <= ack)
         {
+            // Only time segments that were not retransmitted (Karn's algorithm).
+            // With timestamps, the RTT is measured by the echoed timestamp instead.
+            if (!sampled_rtt && !con->state.ts_ok && seg->sent && !seg->nRetries && seg->sent_at)
+            {
+                Net_TCPUpdateRTT(con, Net_TCPNow() - seg->sent_at);
+                sampled_rtt = true;
+            }
             nBytesACKed -= seg->nBytesUnACKed;
             if (con->state.snd.una == ack_left)
                 con->state.snd.una += seg->nBytesUnACKed;
@@ -1180,6 +1447,7 @@ bool Net_TCPRemoteACKedSegment(tcp_connection* con, uint32_t ack_left, uint32_t
                 resp.dest_port = con->dest.port;
                 resp.src_port = con->src.port;
                 resp.window = con->state.rcv.wnd;
+                resp.owner = con;
                 resp.flags |= TCP_ACK;
                 resp.ttl = con->ttl;
                 NetH_SendTCPSegment(con->nic, nullptr, con->ip_ent, con->dest.addr, &resp);
@@ -1194,21 +1462,68 @@ bool Net_TCPRemoteACKedSegment(tcp_connection* con, uint32_t ack_left, uint32_t
 
     Core_PushlockRelease(&con->unacked_segments.lock, true);
     
-    seg = LIST_GET_HEAD(tcp_unacked_segment_list, &con->unacked_segments.list);
+    Net_TCPTransmitQueued(con);
+
+    return true;
+}
+
+void Net_TCPTransmitQueued(tcp_connection* con)
+{
+    tcp_unacked_segment* seg = LIST_GET_HEAD(tcp_unacked_segment_list, &con->unacked_segments.list);
     while (seg)
     {
         tcp_unacked_segment* const next = LIST_GET_NEXT(tcp_unacked_segment_list, &con->unacked_segments.list, seg);
         
-        uint32_t window_edge = con->state.snd.una + con->state.snd.wnd;
-        if (!seg->sent && seg->segment.seq < window_edge)
+        uint32_t window_edge = con->state.snd.una + Net_TCPSendWindow(con);
+        if (!seg->sent)
+        {
+            if ((seg->segment.seq + seg->segment.payload_size) > window_edge && seg->segment.seq != con->state.snd.una)
+                break; // Everything after this is outside of the window too.
             Net_TCPRetransmitSegment(seg);
-        if (seg->expired)
+        }
+        else if (seg->expired && !seg->retransmit_queued && !seg->sacked)
             Net_TCPRetransmitSegment(seg);
 
         seg = next;
     }
+}
 
-    return true;
+void Net_TCPFastRetransmitSegment(tcp_unacked_segment* seg)
+{
+    irql oldIrql = Core_RaiseIrql(IRQL_DISPATCH);
+    bool armed = seg->expiration_timer.mode > TIMER_EXPIRED;
+    seg->expired = true;
+    Net_TCPRetransmitSegment(seg);
+    // The timer was re-armed, so the reference taken for its previous deadline is not needed anymore.
+    if (armed)
+        OBOS_SharedPtrUnref(&seg->ptr);
+    Core_LowerIrql(oldIrql);
+}
+
+void Net_TCPRetransmitExpired(struct net_dispatch_worker* worker)
+{
+    irql oldIrql = Core_SpinlockAcquire(&worker->lock);
+    tcp_unacked_segment* seg = worker->pending_retransmits;
+    worker->pending_retransmits = nullptr;
+    Core_SpinlockRelease(&worker->lock, oldIrql);
+
+    while (seg)
+    {
+        tcp_unacked_segment* const next = seg->next_retransmit;
+        seg->next_retransmit = nullptr;
+        seg->retransmit_queued = false;
+        tcp_connection* con = seg->con;
+        // Skip segments that were ACKed (or cancelled) while queued.
+        if (seg->nBytesUnACKed && !seg->sacked && seg->expired && con->state.state != TCP_STATE_CLOSED && !con->reset)
+        {
+            if (seg->segment.seq == con->state.snd.una)
+                Net_TCPCongestionOnTimeout(con);
+            Net_TCPRetransmitSegment(seg);
+        }
+        // Drop the reference of the expired timer.
+        OBOS_SharedPtrUnref(&seg->ptr);
+        seg = next;
+    }
 }
 
 void Net_TCPRetransmitSegment(tcp_unacked_segment* seg)
@@ -1234,17 +1549,25 @@ void Net_TCPRetransmitSegment(tcp_unacked_segment* seg)
         return;
     }
 
+    tcp_connection* con = seg->con;
     if (!seg->sent)
     {
         seg->sent = true;
-        seg->segment.ack = seg->con->state.rcv.nxt;
+        seg->segment.ack = con->state.rcv.nxt;
+        if ((seg->segment.seq + seg->segment.payload_size) > con->state.snd.nxt)
+            con->state.snd.nxt = seg->segment.seq + seg->segment.payload_size;
     }
 
-    OBOS_SharedPtrRef(seg->segment.payload);
-    NetH_SendTCPSegment(seg->con->nic, nullptr, seg->con->ip_ent, seg->con->dest.addr, &seg->segment);
+    if (seg->segment.payload)
+        OBOS_SharedPtrRef(seg->segment.payload);
+    NetH_SendTCPSegment(con->nic, nullptr, con->ip_ent, con->dest.addr, &seg->segment);
+    seg->sent_at = Net_TCPNow();
 
     OBOS_SharedPtrRef(&seg->ptr);
     seg->expiration_timer.userdata = seg;
+    seg->expiration_timer.handler = tcp_seg_expired;
+    if (con->rtt.rto)
+        seg->segment.expiration_ms = OBOS_MAX(con->rtt.rto / 1000, 1U);
     Core_TimerObjectInitialize(&seg->expiration_timer, TIMER_MODE_DEADLINE, seg->segment.expiration_ms * 1000);
     
     if (!seg->sent)
@@ -1255,6 +1578,20 @@ void Net_TCPRetransmitSegment(tcp_unacked_segment* seg)
     seg->expired = false;
 }
 
+// The amount of payload put into each queued segment.
+// With TSO, segments are made as large as the NIC allows, but at most half of
+// the send window, so that a single segment can't stall the connection.
+static uint32_t tcp_send_size(tcp_connection* con, uint32_t mss)
+{
+    if (!NetH_OffloadEnabled(con->nic, NET_OFFLOAD_TCP_TSO))
+        return mss;
+    const uint32_t max_headers = sizeof(ip_header) + sizeof(tcp_header) + 40 /* options */;
+    uint32_t size = con->nic->net_tables->offload.caps.tso_max_size - max_headers;
+    size = OBOS_MIN(size, Net_TCPSendWindow(con) / 2);
+    size -= size % mss;
+    return OBOS_MAX(size, mss);
+}
+
 void Net_TCPPushDataToRemote(tcp_connection* con, const void* buffer, size_t size, bool oob)
 {
     // TODO: Urgent data?
@@ -1263,7 +1600,15 @@ void Net_TCPPushDataToRemote(tcp_connection* con, const void* buffer, size_t siz
     OBOS_ASSERT(con->state.snd.wnd);
 
     // NetH_SendTCPSegment handles all queuing, we just need to segment the packet.
-    uint32_t window_bytes_until_close = con->state.snd.nxt - (con->state.snd.wnd + con->state.snd.una);
+    // New data goes after everything that is queued, including segments that
+    // are still waiting for the window to open.
+    uint32_t seq = con->state.snd.nxt;
+    Core_PushlockAcquire(&con->unacked_segments.lock, true);
+    tcp_unacked_segment* tail = LIST_GET_TAIL(tcp_unacked_segment_list, &con->unacked_segments.list);
+    if (tail && (tail->segment.seq + tail->nBytesInFlight) > seq)
+        seq = tail->segment.seq + tail->nBytesInFlight;
+    Core_PushlockRelease(&con->unacked_segments.lock, true);
+    const uint32_t send_size = tcp_send_size(con, tcp_get_mss(con));
     
     shared_ptr* payload = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(shared_ptr), nullptr);
     OBOS_SharedPtrConstructSz(payload, (void*)Allocate(OBOS_KernelAllocator, size, nullptr), size);
@@ -1273,16 +1618,9 @@ void Net_TCPPushDataToRemote(tcp_connection* con, const void* buffer, size_t siz
     payload->onDeref = NetFreeSharedPtr;
 
     uint32_t offset = 0;
-    bool first_iter = true;
     while (size != 0)
     {
-        uint32_t nToTransfer = 0;
-        if (first_iter)
-            nToTransfer = OBOS_MIN(size, window_bytes_until_close);
-        else if (size <= con->state.snd.wnd)
-            nToTransfer = size;
-        else
-            nToTransfer = con->state.snd.wnd;
+        uint32_t nToTransfer = OBOS_MIN(size, send_size);
 
         struct tcp_pseudo_hdr hdr = {};
         if (nToTransfer)
@@ -1298,14 +1636,14 @@ void Net_TCPPushDataToRemote(tcp_connection* con, const void* buffer, size_t siz
             if (nToTransfer == size)
                 hdr.flags |= TCP_PSH;
             hdr.window = con->state.rcv.wnd;
-            hdr.seq = con->state.snd.nxt + offset;
+            hdr.owner = con;
+            hdr.seq = seq + offset;
             hdr.ack = con->state.rcv.nxt;
             NetH_SendTCPSegment(con->nic, con, con->ip_ent, con->dest.addr, &hdr);
         }
         
         offset += hdr.payload_size;
         size -= hdr.payload_size;
-        first_iter = false;
     }
     
 }
@@ -1334,6 +1672,13 @@ void Net_TCPProcessOptionList(void* userdata, tcp_header* hdr, bool(*cb)(void* u
     struct tcp_option* opt_end = (void*)(hdr->data+options_len);
     while (cur < opt_end && cur->kind != TCP_OPTION_EOL)
     {
+        if (cur->kind == TCP_OPTION_NOP)
+        {
+            cur = (void*)((uintptr_t)cur + 1);
+            continue;
+        }
+        if ((void*)&cur->len >= (void*)opt_end || cur->len < 2)
+            break;
         if ((void*)((uintptr_t)cur + cur->len) > (void*)opt_end)
             break;
         if (!cb(userdata, cur, hdr))
@@ -1705,7 +2050,7 @@ obos_status tcp_connect(socket_desc* socket, struct sockaddr* saddr, size_t addr
     s->connection->src.port = src_port;
     s->connection->dest.addr = addr->addr;
     s->connection->dest.port = be16_to_host(addr->port);
-    s->connection->recv_buffer.size = 0x10000-1;
+    s->connection->recv_buffer.size = TCP_INITIAL_RECV_BUFFER;
     s->connection->state.state_change_event = EVENT_INITIALIZE(EVENT_NOTIFICATION);
     s->connection->inbound_sig = EVENT_INITIALIZE(EVENT_NOTIFICATION);
     s->connection->inbound_urg_sig = EVENT_INITIALIZE(EVENT_NOTIFICATION);
@@ -1717,6 +2062,11 @@ obos_status tcp_connect(socket_desc* socket, struct sockaddr* saddr, size_t addr
     s->connection->state.snd.nxt = s->connection->state.snd.iss+1;
     s->connection->state.snd.una = s->connection->state.snd.iss;
     s->connection->state.snd.up = 0;
+    // Offer window scaling and timestamps, they are turned off again if the remote doesn't support them.
+    s->connection->state.wscale_ok = true;
+    s->connection->state.ts_ok = true;
+    s->connection->state.rcv_wscale = recv_window_scale();
+    Net_TCPCongestionInit(s->connection);
 
     Core_PushlockAcquire(&iface->tcp_connections_lock, false);
     RB_INSERT(tcp_connection_tree, &iface->tcp_outgoing_connections, s->connection);
@@ -1737,7 +2087,7 @@ obos_status tcp_connect(socket_desc* socket, struct sockaddr* saddr, size_t addr
         uint8_t sack_perm_len;
         uint8_t eol; 
     } opt = {
-        .kind=TCP_OPTION_MSS, .len=4, .mss=host_to_be16(tcp_get_mss(s->connection)),
+        .kind=TCP_OPTION_MSS, .len=4, .mss=host_to_be16(tcp_mtu_mss()),
         .sack_perm_kind=TCP_OPTION_SACK_PERM, .sack_perm_len=2
     };
     syn.options = (void*)&opt;
@@ -2065,6 +2415,7 @@ obos_status tcp_shutdown(socket_desc* desc, int how)
             fin.dest_port = s->connection->dest.port;
             fin.src_port = s->connection->src.port;
             fin.window = s->connection->state.rcv.wnd;
+            fin.owner = s->connection;
             fin.seq = s->connection->state.snd.nxt++;
             fin.ack = s->connection->state.rcv.nxt;
             fin.flags = TCP_FIN|TCP_ACK;
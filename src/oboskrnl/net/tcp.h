@@ -27,6 +27,14 @@
 #   define TCP_MAX_RETRANSMISSIONS 10
 #endif
 
+// The amount of duplicate ACKs that trigger a fast retransmit (RFC 5681).
+#define TCP_DUPACK_THRESHOLD 3
+
+// Retransmission timeout bounds, in microseconds (RFC 6298).
+#define TCP_INITIAL_RTO (1000*1000)
+#define TCP_MIN_RTO (200*1000)
+#define TCP_MAX_RTO (60*1000*1000)
+
 enum {
     TCP_FIN = BIT(0),
     TCP_SYN = BIT(1),
@@ -63,10 +71,19 @@ enum {
     TCP_OPTION_EOL = 0,
     TCP_OPTION_NOP = 1,
     TCP_OPTION_MSS = 2,
+    TCP_OPTION_WINDOW_SCALE = 3,
     TCP_OPTION_SACK_PERM = 4,
     TCP_OPTION_SACK = 5,
+    TCP_OPTION_TIMESTAMP = 8,
 };
 
+// The largest window scale allowed by RFC 7323.
+#define TCP_MAX_WINDOW_SCALE 14
+// The initial size of a connection's receive buffer.
+#define TCP_INITIAL_RECV_BUFFER (0x10000-1)
+// The default maximum size a receive buffer can grow to, see --tcp-max-rcvbuf.
+#define TCP_DEFAULT_MAX_RECV_BUFFER (4*1024*1024)
+
 struct tcp_option {
     uint8_t kind;
     uint8_t len;
@@ -78,10 +95,15 @@ struct tcp_pseudo_hdr {
     uint32_t seq;
     uint32_t ack;
     uint8_t flags;
-    uint16_t window;
+    // Unscaled, NetH_SendTCPSegment applies the window scale of 'owner'.
+    uint32_t window;
 
     bool check_tx_window : 1;
 
+    // The connection this segment belongs to, even if it isn't tracked for retransmission.
+    // Used to scale the window, and to add the connection's timestamp option.
+    struct tcp_connection* owner;
+
     // Terminated by an "end of option list" option
     // Is to be copied directly into the tcp header.
     struct tcp_option* options;
@@ -131,6 +153,14 @@ typedef struct tcp_unacked_segment {
     struct tcp_connection* con;
     
     uint8_t nRetries;
+    // Set if the remote has selectively acknowledged this segment.
+    // The segment stays queued until it is cumulatively acknowledged, but is not retransmitted.
+    bool sacked;
+    // Whether the segment is in its interface's pending retransmission queue.
+    bool retransmit_queued;
+    struct tcp_unacked_segment* next_retransmit;
+    // The time the segment was last sent at, in microseconds.
+    uint64_t sent_at;
 } tcp_unacked_segment;
 typedef LIST_HEAD(tcp_unacked_segment_list, tcp_unacked_segment) tcp_unacked_segment_list;
 LIST_PROTOTYPE(tcp_unacked_segment_list, tcp_unacked_segment, node);
@@ -164,6 +194,14 @@ typedef struct tcp_connection {
         // yet been ACKed, as we have not advanced rcv.nxt
         tcp_unacked_rsegment_list rsegments;
         bool closed : 1;
+        // Receive buffer autotuning.
+        // The amount of in-order bytes received since space_time.
+        uint32_t space_copied;
+        // The start of the current measurement, in microseconds.
+        uint64_t space_time;
+        // The RTT measured by echoed timestamps, in microseconds.
+        // Used if the connection has not sent any data to time.
+        uint32_t rtt;
     } recv_buffer;
     struct {
         void* buf;
@@ -216,6 +254,15 @@ typedef struct tcp_connection {
         event state_change_event;
         bool sack_perm : 1;
         bool sack_failure : 1;
+        // RFC 7323
+        bool wscale_ok : 1;
+        bool ts_ok : 1;
+        // The shift applied to windows advertised by the remote.
+        uint8_t snd_wscale;
+        // The shift applied to windows we advertise.
+        uint8_t rcv_wscale;
+        // The most recent timestamp received from the remote.
+        uint32_t ts_recent;
     } state;
     struct {
         tcp_unacked_segment_list list;
@@ -224,6 +271,40 @@ typedef struct tcp_connection {
 
     tcp_unacked_segment* fin_segment;
 
+    // Congestion control state (RFC 5681).
+    struct {
+        const struct tcp_cc_ops* ops;
+        // The congestion window, in bytes.
+        uint32_t cwnd;
+        // The slow start threshold, in bytes.
+        uint32_t ssthresh;
+        // snd.nxt when fast recovery was entered (RFC 6582).
+        uint32_t recover;
+        uint8_t dup_acks;
+        bool in_recovery : 1;
+        // Used by CUBIC (RFC 8312).
+        struct {
+            // The window before the last congestion event, in bytes.
+            uint32_t w_max;
+            uint32_t w_last_max;
+            // The window that the cubic function is centered on, in bytes.
+            uint32_t origin;
+            // The window that standard TCP would have, in bytes.
+            uint32_t w_est;
+            // In milliseconds. Zero if the congestion avoidance epoch has not started.
+            uint64_t epoch_start;
+            uint64_t k;
+        } cubic;
+    } cc;
+
+    // Retransmission timer state (RFC 6298), in microseconds.
+    struct {
+        uint32_t srtt;
+        uint32_t rttvar;
+        uint32_t rto;
+        bool has_sample;
+    } rtt;
+
     uint8_t ttl;
 
     timer time_wait;
@@ -246,6 +327,14 @@ typedef struct tcp_connection {
 // but it does always mean that *something* was sent.
 bool Net_TCPRemoteACKedSegment(tcp_connection* con, uint32_t ack_left, uint32_t ack);
 void Net_TCPRetransmitSegment(tcp_unacked_segment* seg);
+// Retransmits a segment whose timer has not expired yet (fast retransmit).
+void Net_TCPFastRetransmitSegment(tcp_unacked_segment* seg);
+// Sends queued segments that now fit in the send window.
+void Net_TCPTransmitQueued(tcp_connection* con);
+struct net_dispatch_worker;
+// Retransmits the segments whose retransmission timer expired.
+// Called by each dispatch worker for the segments of the flows it owns.
+OBOS_EXPORT void Net_TCPRetransmitExpired(struct net_dispatch_worker* worker);
 void Net_TCPCancelAllOutstandingSegments(tcp_connection* con);
 void Net_TCPChangeConnectionState(tcp_connection* con, int state);
 void Net_TCPPushReceivedData(tcp_connection* con, const void* buffer, size_t size, uint32_t sequence, size_t *nPushed);
@@ -0,0 +1,387 @@
+/*
+ * oboskrnl/net/tcp_cc.c
+ *
+ * Copyright (c) 2026 Omar Berrow
+*/
+
+#include <int.h>
+#include <error.h>
+#include <klog.h>
+#include <cmdline.h>
+#include <memmanip.h>
+
+#include <net/tcp.h>
+#include <net/tcp_cc.h>
+
+#include <irq/timer.h>
+
+#include <locks/pushlock.h>
+
+#include <allocators/base.h>
+
+#include <utils/list.h>
+
+uint64_t Net_TCPNow()
+{
+    return CoreH_TickToNS(CoreS_GetNativeTimerTick(), true) / 1000;
+}
+
+uint32_t Net_TCPFlightSize(tcp_connection* con)
+{
+    if (con->state.snd.nxt < con->state.snd.una)
+        return 0;
+    return con->state.snd.nxt - con->state.snd.una;
+}
+
+uint32_t Net_TCPSendWindow(tcp_connection* con)
+{
+    if (!con->cc.ops)
+        return con->state.snd.wnd;
+    return OBOS_MIN(con->state.snd.wnd, con->cc.cwnd);
+}
+
+// The window to go back to on a congestion event (RFC 5681, equation 4).
+static uint32_t loss_ssthresh(tcp_connection* con)
+{
+    uint32_t mss = NetH_TCPGetMSS(con);
+    return OBOS_MAX(Net_TCPFlightSize(con) / 2, 2*mss);
+}
+
+// The initial window (RFC 3390).
+static uint32_t initial_window(tcp_connection* con)
+{
+    uint32_t mss = NetH_TCPGetMSS(con);
+    return OBOS_MIN(4*mss, OBOS_MAX(2*mss, 4380U));
+}
+
+static void slow_start(tcp_connection* con, uint32_t nBytesACKed)
+{
+    uint32_t mss = NetH_TCPGetMSS(con);
+    con->cc.cwnd += OBOS_MIN(nBytesACKed, mss);
+}
+
+static void newreno_init(tcp_connection* con)
+{
+    con->cc.cwnd = initial_window(con);
+    con->cc.ssthresh = UINT32_MAX;
+}
+
+static void newreno_on_ack(tcp_connection* con, uint32_t nBytesACKed)
+{
+    if (con->cc.cwnd < con->cc.ssthresh)
+    {
+        slow_start(con, nBytesACKed);
+        return;
+    }
+    // Congestion avoidance: about one MSS per RTT.
+    uint32_t mss = NetH_TCPGetMSS(con);
+    con->cc.cwnd += OBOS_MAX(mss*mss / con->cc.cwnd, 1U);
+}
+
+static void newreno_on_congestion(tcp_connection* con)
+{
+    con->cc.ssthresh = loss_ssthresh(con);
+}
+
+static void newreno_on_timeout(tcp_connection* con)
+{
+    con->cc.ssthresh = loss_ssthresh(con);
+    con->cc.cwnd = NetH_TCPGetMSS(con);
+}
+
+const tcp_cc_ops Net_TCPNewReno = {
+    .name = "newreno",
+    .init = newreno_init,
+    .on_ack = newreno_on_ack,
+    .on_congestion = newreno_on_congestion,
+    .on_timeout = newreno_on_timeout,
+};
+
+// CUBIC (RFC 8312)
+// C=0.4, beta=0.7
+// Times are in milliseconds, windows are in bytes.
+
+// Hacker's Delight, icbrt64
+static uint64_t icbrt(uint64_t x)
+{
+    uint64_t y = 0;
+    for (int s = 63; s >= 0; s -= 3)
+    {
+        y *= 2;
+        uint64_t b = 3*y*(y + 1) + 1;
+        if ((x >> s) >= b)
+        {
+            x -= b << s;
+            y++;
+        }
+    }
+    return y;
+}
+
+static uint64_t now_ms()
+{
+    // Never zero, as zero means that the epoch has not started.
+    return Net_TCPNow() / 1000 + 1;
+}
+
+static void cubic_init(tcp_connection* con)
+{
+    newreno_init(con);
+    memzero(&con->cc.cubic, sizeof(con->cc.cubic));
+}
+
+// W_cubic(t), in bytes.
+static uint64_t cubic_window(tcp_connection* con, uint64_t t)
+{
+    uint32_t mss = NetH_TCPGetMSS(con);
+    int64_t d = (int64_t)t - (int64_t)con->cc.cubic.k;
+    // Clamp to 1000 seconds, so that d^3 doesn't overflow.
+    if (d > 1000000)
+        d = 1000000;
+    if (d < -1000000)
+        d = -1000000;
+    // d^3/10^6, then C*mss*d^3 in seconds.
+    int64_t d3 = (d*d/1000)*d/1000;
+    int64_t delta = 4*(int64_t)mss*d3/10000;
+    int64_t w = (int64_t)con->cc.cubic.origin + delta;
+    return w < (int64_t)mss ? mss : (uint64_t)w;
+}
+
+static void cubic_on_ack(tcp_connection* con, uint32_t nBytesACKed)
+{
+    if (con->cc.cwnd < con->cc.ssthresh)
+    {
+        slow_start(con, nBytesACKed);
+        return;
+    }
+
+    uint32_t mss = NetH_TCPGetMSS(con);
+    uint64_t now = now_ms();
+    if (!con->cc.cubic.epoch_start)
+    {
+        con->cc.cubic.epoch_start = now;
+        con->cc.cubic.w_est = con->cc.cwnd;
+        if (con->cc.cwnd < con->cc.cubic.w_max)
+        {
+            // K = cbrt((W_max - cwnd)/C), in ms.
+            uint64_t diff = (con->cc.cubic.w_max - con->cc.cwnd) / mss;
+            con->cc.cubic.k = icbrt(diff * 10 * 1000000000ULL / 4);
+            con->cc.cubic.origin = con->cc.cubic.w_max;
+        }
+        else
+        {
+            con->cc.cubic.k = 0;
+            con->cc.cubic.origin = con->cc.cwnd;
+        }
+    }
+
+    // Look one RTT ahead.
+    uint64_t t = now - con->cc.cubic.epoch_start + con->rtt.srtt / 1000;
+    uint64_t target = cubic_window(con, t);
+
+    // The window standard TCP would have had, with alpha=3*(1-beta)/(1+beta)
+    con->cc.cubic.w_est += OBOS_MAX(9*mss*mss / (17*con->cc.cwnd), 1U);
+    if (con->cc.cubic.w_est > target)
+        target = con->cc.cubic.w_est;
+
+    uint32_t inc = 0;
+    if (target > con->cc.cwnd)
+        inc = (target - con->cc.cwnd) * mss / con->cc.cwnd;
+    else
+        inc = mss*mss / (100*con->cc.cwnd);
+    con->cc.cwnd += OBOS_MAX(inc, 1U);
+}
+
+static void cubic_reduce(tcp_connection* con)
+{
+    uint32_t mss = NetH_TCPGetMSS(con);
+    con->cc.cubic.epoch_start = 0;
+    // Fast convergence.
+    if (con->cc.cwnd < con->cc.cubic.w_last_max)
+    {
+        con->cc.cubic.w_last_max = con->cc.cwnd;
+        con->cc.cubic.w_max = (uint64_t)con->cc.cwnd * 17 / 20;
+    }
+    else
+    {
+        con->cc.cubic.w_last_max = con->cc.cwnd;
+        con->cc.cubic.w_max = con->cc.cwnd;
+    }
+    con->cc.ssthresh = OBOS_MAX((uint64_t)con->cc.cwnd * 7 / 10, 2*mss);
+}
+
+static void cubic_on_congestion(tcp_connection* con)
+{
+    cubic_reduce(con);
+}
+
+static void cubic_on_timeout(tcp_connection* con)
+{
+    cubic_reduce(con);
+    con->cc.cwnd = NetH_TCPGetMSS(con);
+}
+
+const tcp_cc_ops Net_TCPCubic = {
+    .name = "cubic",
+    .init = cubic_init,
+    .on_ack = cubic_on_ack,
+    .on_congestion = cubic_on_congestion,
+    .on_timeout = cubic_on_timeout,
+};
+
+static const tcp_cc_ops* const algorithms[] = {
+    &Net_TCPCubic,
+    &Net_TCPNewReno,
+};
+
+static const tcp_cc_ops* default_algorithm()
+{
+    static const tcp_cc_ops* ops = nullptr;
+    if (ops)
+        return ops;
+    ops = algorithms[0];
+    char* name = OBOS_GetOPTS("tcp-congestion-control");
+    if (!name)
+        return ops;
+    size_t i = 0;
+    for (; i < sizeof(algorithms)/sizeof(*algorithms); i++)
+    {
+        if (strcmp(algorithms[i]->name, name))
+        {
+            ops = algorithms[i];
+            break;
+        }
+    }
+    if (i == sizeof(algorithms)/sizeof(*algorithms))
+        OBOS_Warning("TCP: Unknown congestion control algorithm '%s', using %s\n", name, ops->name);
+    Free(OBOS_KernelAllocator, name, strlen(name)+1);
+    return ops;
+}
+
+void Net_TCPCongestionInit(tcp_connection* con)
+{
+    con->cc.ops = default_algorithm();
+    con->cc.ops->init(con);
+    con->cc.dup_acks = 0;
+    con->cc.in_recovery = false;
+    con->rtt.rto = TCP_INITIAL_RTO;
+    con->rtt.has_sample = false;
+}
+
+void Net_TCPUpdateRTT(tcp_connection* con, uint64_t rtt_us)
+{
+    if (rtt_us > TCP_MAX_RTO)
+        rtt_us = TCP_MAX_RTO;
+    if (!con->rtt.has_sample)
+    {
+        con->rtt.srtt = rtt_us;
+        con->rtt.rttvar = rtt_us / 2;
+        con->rtt.has_sample = true;
+    }
+    else
+    {
+        uint32_t err = con->rtt.srtt > rtt_us ? con->rtt.srtt - rtt_us : rtt_us - con->rtt.srtt;
+        // RTTVAR <- (1 - beta) * RTTVAR + beta * |SRTT - R'|, beta=1/4
+        con->rtt.rttvar = con->rtt.rttvar - con->rtt.rttvar / 4 + err / 4;
+        // SRTT <- (1 - alpha) * SRTT + alpha * R', alpha=1/8
+        con->rtt.srtt = con->rtt.srtt - con->rtt.srtt / 8 + rtt_us / 8;
+    }
+    // RTO <- SRTT + max (G, K*RTTVAR), K=4, G=1ms
+    uint64_t rto = con->rtt.srtt + OBOS_MAX(4*(uint64_t)con->rtt.rttvar, 1000ULL);
+    if (rto < TCP_MIN_RTO)
+        rto = TCP_MIN_RTO;
+    if (rto > TCP_MAX_RTO)
+        rto = TCP_MAX_RTO;
+    con->rtt.rto = rto;
+}
+
+// Returns the oldest segment that the remote has not received, with a reference, or nullptr.
+static tcp_unacked_segment* first_hole(tcp_connection* con)
+{
+    tcp_unacked_segment* found = nullptr;
+    Core_PushlockAcquire(&con->unacked_segments.lock, true);
+    for (tcp_unacked_segment* seg = LIST_GET_HEAD(tcp_unacked_segment_list, &con->unacked_segments.list); seg; )
+    {
+        if (seg->sent && !seg->sacked && seg->nBytesUnACKed)
+        {
+            found = seg;
+            OBOS_SharedPtrRef(&found->ptr);
+            break;
+        }
+        seg = LIST_GET_NEXT(tcp_unacked_segment_list, &con->unacked_segments.list, seg);
+    }
+    Core_PushlockRelease(&con->unacked_segments.lock, true);
+    return found;
+}
+
+static void retransmit_first_hole(tcp_connection* con)
+{
+    tcp_unacked_segment* seg = first_hole(con);
+    if (!seg)
+        return;
+    Net_TCPFastRetransmitSegment(seg);
+    OBOS_SharedPtrUnref(&seg->ptr);
+}
+
+void Net_TCPCongestionOnNewACK(tcp_connection* con, uint32_t nBytesACKed)
+{
+    if (!con->cc.ops)
+        return;
+    uint32_t mss = NetH_TCPGetMSS(con);
+    con->cc.dup_acks = 0;
+    if (con->cc.in_recovery)
+    {
+        if (con->state.snd.una >= con->cc.recover)
+        {
+            // Full acknowledgment, leave fast recovery (RFC 6582, 3.2 step 3).
+            con->cc.in_recovery = false;
+            con->cc.cwnd = OBOS_MIN(con->cc.ssthresh, OBOS_MAX(Net_TCPFlightSize(con), mss) + mss);
+        }
+        else
+        {
+            // Partial acknowledgment, the next hole was lost too.
+            retransmit_first_hole(con);
+            if (con->cc.cwnd > mss)
+                con->cc.cwnd -= OBOS_MIN(nBytesACKed, con->cc.cwnd - mss);
+            if (nBytesACKed >= mss)
+                con->cc.cwnd += mss;
+        }
+        return;
+    }
+    con->cc.ops->on_ack(con, nBytesACKed);
+}
+
+void Net_TCPCongestionOnDuplicateACK(tcp_connection* con)
+{
+    if (!con->cc.ops)
+        return;
+    uint32_t mss = NetH_TCPGetMSS(con);
+    if (con->cc.in_recovery)
+    {
+        // Every duplicate ACK means a segment left the network.
+        con->cc.cwnd += mss;
+        return;
+    }
+    if (++con->cc.dup_acks < TCP_DUPACK_THRESHOLD)
+        return;
+    // Only enter fast recovery once per window of data (RFC 6582, 3.2 step 2).
+    if (con->state.snd.una < con->cc.recover)
+        return;
+    con->cc.ops->on_congestion(con);
+    con->cc.cwnd = con->cc.ssthresh + TCP_DUPACK_THRESHOLD*mss;
+    con->cc.recover = con->state.snd.nxt;
+    con->cc.in_recovery = true;
+    retransmit_first_hole(con);
+}
+
+void Net_TCPCongestionOnTimeout(tcp_connection* con)
+{
+    // Back off the timer (RFC 6298, 5.5).
+    con->rtt.rto = OBOS_MIN((uint64_t)con->rtt.rto * 2, (uint64_t)TCP_MAX_RTO);
+    if (!con->cc.ops)
+        return;
+    con->cc.ops->on_timeout(con);
+    con->cc.dup_acks = 0;
+    con->cc.in_recovery = false;
+    con->cc.recover = con->state.snd.nxt;
+}
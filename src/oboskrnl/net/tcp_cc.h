@@ -0,0 +1,52 @@
+/*
+ * oboskrnl/net/tcp_cc.h
+ *
+ * Copyright (c) 2026 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+
+#include <net/tcp.h>
+
+// A TCP congestion control algorithm.
+// Loss recovery (fast retransmit and fast recovery) is common to all algorithms,
+// the algorithm only decides how the congestion window grows, and how it shrinks
+// on a congestion event.
+typedef struct tcp_cc_ops {
+    const char* name;
+    // Sets the initial congestion window and slow start threshold.
+    void(*init)(tcp_connection* con);
+    // Called when new data was cumulatively acknowledged, outside of fast recovery.
+    void(*on_ack)(tcp_connection* con, uint32_t nBytesACKed);
+    // Called when fast recovery is entered.
+    // Must set cc.ssthresh, cc.cwnd is then set to cc.ssthresh plus the duplicate ACKs.
+    void(*on_congestion)(tcp_connection* con);
+    // Called when the retransmission timer of the oldest outstanding segment expired.
+    void(*on_timeout)(tcp_connection* con);
+} tcp_cc_ops;
+
+extern const tcp_cc_ops Net_TCPNewReno;
+extern const tcp_cc_ops Net_TCPCubic;
+
+// Initializes the congestion control and retransmission timer state of a connection.
+// The algorithm is chosen with --tcp-congestion-control.
+void Net_TCPCongestionInit(tcp_connection* con);
+// Returns the amount of bytes that can be outstanding, i.e., the minimum of the
+// peer's receive window and the congestion window.
+uint32_t Net_TCPSendWindow(tcp_connection* con);
+// Returns the amount of bytes sent, but not yet acknowledged.
+uint32_t Net_TCPFlightSize(tcp_connection* con);
+// Updates the smoothed RTT and the RTO with a new RTT sample.
+void Net_TCPUpdateRTT(tcp_connection* con, uint64_t rtt_us);
+// Called after snd.una advanced by nBytesACKed.
+void Net_TCPCongestionOnNewACK(tcp_connection* con, uint32_t nBytesACKed);
+// Called when a duplicate ACK was received.
+void Net_TCPCongestionOnDuplicateACK(tcp_connection* con);
+// Called when the retransmission timer of the oldest outstanding segment expired.
+void Net_TCPCongestionOnTimeout(tcp_connection* con);
+// Returns the current time in microseconds, used to time segments.
+uint64_t Net_TCPNow();
+// Returns the maximum segment size of a connection.
+uint16_t NetH_TCPGetMSS(tcp_connection* con);
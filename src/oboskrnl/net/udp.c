@@ -21,6 +21,8 @@
 
 #include <utils/list.h>
 
+#include <locks/spinlock.h>
+
 #include <scheduler/thread.h>
 #include <scheduler/process.h>
 #include <scheduler/schedule.h>
@@ -50,10 +52,13 @@ static void pckt_onDeref(struct shared_ptr* ptr)
     if (ptr->refs == 0)
     {
 		OBOS_SharedPtrUnref(&pckt->buffer_ptr);
-        LIST_REMOVE(udp_recv_packet_list, &pckt->bound_to->packets, pckt);
+        if (pckt->queue)
+            LIST_REMOVE(udp_recv_packet_list, pckt->queue, pckt);
     }
 }
 
+static void socket_deliver(struct udp_bound_ports* ports, udp_recv_packet* pckt);
+
 PacketProcessSignature(UDP, ip_header*)
 {
     OBOS_UNUSED(depth && size);
@@ -62,13 +67,15 @@ PacketProcessSignature(UDP, ip_header*)
     void* udp_pckt_data = hdr+1;
     size_t udp_pckt_sz = be16_to_host(hdr->length) - sizeof(udp_header);
     udp_port key = {.port=be16_to_host(hdr->dest_port)};
-    Core_PushlockAcquire(&nic->net_tables->udp_ports_lock, false);
+    // Delivering only touches the queue of the destination, which has its own lock,
+    // so datagrams to different ports (or the same port) can be delivered concurrently.
+    Core_PushlockAcquire(&nic->net_tables->udp_ports_lock, true);
     udp_port* dest = RB_FIND(udp_port_tree, &nic->net_tables->udp_ports, &key);
     if (!dest)
     {
         Net_ICMPv4DestUnreachable(nic, ip_hdr, (ethernet2_header*)buf->obj, hdr, ICMPv4_CODE_PORT_UNREACHABLE);
         NetError("%s: UDP Port %d not bound to any socket.\n", __func__, key.port); 
-        Core_PushlockRelease(&nic->net_tables->udp_ports_lock, false);
+        Core_PushlockRelease(&nic->net_tables->udp_ports_lock, true);
         ExitPacketHandler();
     }
 
@@ -93,11 +100,22 @@ PacketProcessSignature(UDP, ip_header*)
 
     pckt->bound_to = dest;
     
-    LIST_APPEND(udp_recv_packet_list, &dest->packets, pckt);
-    
-    Core_EventSet(&dest->recv_event, false);
-    
-    Core_PushlockRelease(&nic->net_tables->udp_ports_lock, false);
+    if (dest->owner)
+    {
+        socket_deliver(dest->owner, pckt);
+        Core_PushlockRelease(&nic->net_tables->udp_ports_lock, true);
+    }
+    else
+    {
+        // Ports used directly by the kernel have no lock of their own, but are never unbound,
+        // so deliveries to them are serialized by taking the ports lock exclusively instead.
+        Core_PushlockRelease(&nic->net_tables->udp_ports_lock, true);
+        Core_PushlockAcquire(&nic->net_tables->udp_ports_lock, false);
+        pckt->queue = &dest->packets;
+        LIST_APPEND(udp_recv_packet_list, &dest->packets, pckt);
+        Core_EventSet(&dest->recv_event, false);
+        Core_PushlockRelease(&nic->net_tables->udp_ports_lock, false);
+    }
     
     #if __x86_64__
         if (memcmp(udp_pckt_data, "\x03", 1) && udp_pckt_sz == 1)
@@ -133,77 +151,133 @@ RB_GENERATE(udp_port_tree, udp_port, node, udp_port_cmp);
 
 #include <vfs/alloc.h>
 
+// The maximum amount of payload bytes queued on a socket.
+// Datagrams received while the queue is full are dropped.
+#define UDP_RECV_QUEUE_SIZE (256*1024)
+
 struct udp_bound_ports {
     udp_port** ports;
     size_t nPorts;
-    event internal_read_event;
-    event *read_event;
-    udp_port* signaled_port;
-    thread* internal_read_thread;
-    event wake_read_thread;
+    // Datagrams received on any of the ports, in order of arrival.
+    udp_recv_packet_list packets;
+    size_t nQueuedBytes;
+    size_t nDropped;
+    // The status of the last ICMP error received, reported by the next read.
+    obos_status icmp_status;
+    bool got_icmp_msg : 1;
+    bool read_closed : 1;
+    bool write_closed : 1;
+    // Protects everything above, except for ports and nPorts, which never change once the socket is bound.
+    spinlock lock;
+    // Set while a read would not block, that is, while there are queued datagrams or a pending
+    // ICMP error, or once the socket was shut down for reading.
+    event read_event;
     struct {
         ip_addr addr;
         uint16_t port;
     } default_peer;
-    // for the internal read thread
-    bool assume_free : 1;
-    bool read_closed : 1;
-    bool write_closed : 1;
 };
 
-socket_desc* udp_create()
+// Called by the packet handler with the udp_ports_lock of the interface held.
+static void socket_deliver(struct udp_bound_ports* ports, udp_recv_packet* pckt)
 {
-    socket_desc* ret = Vfs_Calloc(1, sizeof(socket_desc));
-    ret->ops = &Net_UDPSocketBackend;
-    ret->protocol = IPPROTO_UDP;
-    ret->protocol_data = nullptr;
-    return ret;
+    irql oldIrql = Core_SpinlockAcquire(&ports->lock);
+    if (ports->read_closed || (ports->nQueuedBytes + pckt->buffer_ptr.szObj) > UDP_RECV_QUEUE_SIZE)
+    {
+        ports->nDropped++;
+        OBOS_SharedPtrUnref(&pckt->packet_ptr);
+        Core_SpinlockRelease(&ports->lock, oldIrql);
+        return;
+    }
+    pckt->queue = &ports->packets;
+    LIST_APPEND(udp_recv_packet_list, &ports->packets, pckt);
+    ports->nQueuedBytes += pckt->buffer_ptr.szObj;
+    Core_EventSet(&ports->read_event, false);
+    Core_SpinlockRelease(&ports->lock, oldIrql);
 }
 
-static void udp_free(socket_desc* socket)
+void NetH_UDPReportICMPError(udp_port* port, shared_ptr* buf, struct icmp_header* hdr)
 {
-    OBOS_ASSERT(!socket->refs);
-    struct udp_bound_ports *ports = socket->protocol_data;
+    struct udp_bound_ports* ports = port->owner;
     if (!ports)
-        goto uninit;
-    ports->read_closed = true;
-    ports->write_closed = true;
-    if (ports->internal_read_thread)
     {
-        if (!(--ports->internal_read_thread->references) && ports->internal_read_thread->free)
-            ports->internal_read_thread->free(ports->internal_read_thread);
+        port->got_icmp_msg = true;
+        port->icmp_header = hdr;
+        if (port->icmp_header_ptr)
+            OBOS_SharedPtrUnref(port->icmp_header_ptr);
+        port->icmp_header_ptr = OBOS_SharedPtrCopy(buf);
+        Core_EventSet(&port->recv_event, false);
+        return;
     }
+
+    // The status is all that is needed, so the frame isn't kept around.
+    obos_status status = NetH_ICMPv4ResponseToStatus(hdr);
+    irql oldIrql = Core_SpinlockAcquire(&ports->lock);
+    ports->icmp_status = status;
+    ports->got_icmp_msg = true;
+    Core_EventSet(&ports->read_event, false);
+    Core_SpinlockRelease(&ports->lock, oldIrql);
+}
+
+static struct udp_bound_ports* alloc_bound_ports(size_t nPorts)
+{
+    struct udp_bound_ports* ports = Vfs_Calloc(1, sizeof(*ports));
+    ports->nPorts = nPorts;
+    ports->ports = Vfs_Calloc(nPorts, sizeof(udp_port*));
+    ports->lock = Core_SpinlockCreate();
+    ports->read_event = EVENT_INITIALIZE(EVENT_NOTIFICATION);
+    return ports;
+}
+
+static void unbind_ports(struct udp_bound_ports* ports)
+{
     for (size_t i = 0; i < ports->nPorts; i++)
     {
         udp_port* const port = ports->ports[i];
-        if (port)
-        {
-            Core_PushlockAcquire(&port->iface->udp_ports_lock, false);
-            RB_REMOVE(udp_port_tree, &port->iface->udp_ports, port);
-            Core_PushlockRelease(&port->iface->udp_ports_lock, false);
-            for (udp_recv_packet* curr = LIST_GET_HEAD(udp_recv_packet_list, &port->packets); curr; )
-            {
-                udp_recv_packet* const next = LIST_GET_NEXT(udp_recv_packet_list, &port->packets, curr);
-                OBOS_SharedPtrUnref(&curr->packet_ptr);
-                curr = next;
-            }
-            CoreH_AbortWaitingThreads(WAITABLE_OBJECT(port->recv_event));
-            Vfs_Free(port);
-            ports->ports[i] = nullptr;
-        }
+        if (!port)
+            continue;
+        // Once the port is out of the tree, no more datagrams can be delivered to it.
+        Core_PushlockAcquire(&port->iface->udp_ports_lock, false);
+        RB_REMOVE(udp_port_tree, &port->iface->udp_ports, port);
+        Core_PushlockRelease(&port->iface->udp_ports_lock, false);
+        Vfs_Free(port);
+        ports->ports[i] = nullptr;
     }
-    if (!ports->internal_read_thread)
+}
+
+static void free_bound_ports(struct udp_bound_ports* ports)
+{
+    unbind_ports(ports);
+    for (udp_recv_packet* curr = LIST_GET_HEAD(udp_recv_packet_list, &ports->packets); curr; )
     {
-        Vfs_Free(ports->ports);
-        Vfs_Free(ports);
+        udp_recv_packet* const next = LIST_GET_NEXT(udp_recv_packet_list, &ports->packets, curr);
+        OBOS_SharedPtrUnref(&curr->packet_ptr);
+        curr = next;
     }
-    else
-        ports->assume_free = true;
-    uninit:
+    CoreH_AbortWaitingThreads(WAITABLE_OBJECT(ports->read_event));
+    Vfs_Free(ports->ports);
+    Vfs_Free(ports);
+}
+
+socket_desc* udp_create()
+{
+    socket_desc* ret = Vfs_Calloc(1, sizeof(socket_desc));
+    ret->ops = &Net_UDPSocketBackend;
+    ret->protocol = IPPROTO_UDP;
+    ret->protocol_data = nullptr;
+    return ret;
+}
+
+static void udp_free(socket_desc* socket)
+{
+    OBOS_ASSERT(!socket->refs);
+    struct udp_bound_ports *ports = socket->protocol_data;
+    if (ports)
+        free_bound_ports(ports);
     Vfs_Free(socket);
 }
 
-static obos_status bind_interface(uint16_t port, net_tables* interface, udp_port** out)
+static obos_status bind_interface(struct udp_bound_ports* owner, uint16_t port, net_tables* interface, udp_port** out)
 {
     udp_port key = {.port=port};
     udp_port *bport = nullptr;
@@ -215,6 +289,7 @@ static obos_status bind_interface(uint16_t port, net_tables* interface, udp_port
     }
     bport = Vfs_Calloc(1, sizeof(udp_port));
     bport->port = port;
+    bport->owner = owner;
     bport->recv_event = EVENT_INITIALIZE(EVENT_NOTIFICATION);
     bport->iface = interface;
     RB_INSERT(udp_port_tree, &interface->udp_ports, bport);
@@ -223,46 +298,6 @@ static obos_status bind_interface(uint16_t port, net_tables* interface, udp_port
     return OBOS_STATUS_SUCCESS;
 }
 
-static void internal_read_thread(void* userdata)
-{
-    struct udp_bound_ports* ports = userdata;
-    struct waitable_header** events = ZeroAllocate(OBOS_KernelAllocator, 1+ports->nPorts, sizeof(struct waitable_header*), nullptr);
-    events[0] = WAITABLE_OBJECT(ports->wake_read_thread);
-    for (size_t i = 1; i < (ports->nPorts+1); i++)
-        events[i] = WAITABLE_OBJECT(ports->ports[i-1]->recv_event);
-    while (!ports->read_closed)
-    {
-        struct waitable_header* signaled = nullptr;
-        obos_status status = Core_WaitOnObjects(1+ports->nPorts, events, &signaled);
-        if (obos_is_error(status))
-        {
-            NetError("Net: %s: Core_WaitOnObjects returned %d, aborting.\n", __func__, status);
-            break;
-        }
-        if (signaled == WAITABLE_OBJECT(ports->wake_read_thread))
-            break;
-        for (size_t i = 0; i < ports->nPorts; i++)
-        {
-            if (WAITABLE_OBJECT(ports->ports[i]->recv_event) == signaled)
-            {
-                ports->signaled_port = ports->ports[i];
-                Core_EventClear(&ports->ports[i]->recv_event);
-                Core_EventSet(&ports->internal_read_event, false);
-                break;
-            }
-            else
-                continue;
-        }
-    }
-    Free(OBOS_KernelAllocator, events, 1+ports->nPorts);
-    if (ports->assume_free)
-    {
-        Vfs_Free(ports->ports);
-        Vfs_Free(ports);
-    }
-    Core_ExitCurrentThread();
-}
-
 obos_status udp_bind(socket_desc* socket, struct sockaddr* saddr, size_t addrlen)
 {
     struct sockaddr_in* addr = (void*)saddr;
@@ -275,21 +310,18 @@ obos_status udp_bind(socket_desc* socket, struct sockaddr* saddr, size_t addrlen
         return OBOS_STATUS_PORT_IN_USE;
     if (!port)
         return OBOS_STATUS_INVALID_ARGUMENT;
-    struct udp_bound_ports* ports = Vfs_Calloc(1, sizeof(*ports));
-    ports->internal_read_event = EVENT_INITIALIZE(EVENT_NOTIFICATION);
-    ports->wake_read_thread = EVENT_INITIALIZE(EVENT_NOTIFICATION);
+    struct udp_bound_ports* ports = nullptr;
     if (addr->addr.addr == 0)
     {
-        ports->nPorts = LIST_GET_NODE_COUNT(network_interface_list, &Net_Interfaces);
-        ports->ports = Vfs_Calloc(ports->nPorts, sizeof(udp_port*));
+        // Every interface gets its own port, but they all deliver to the same queue.
+        ports = alloc_bound_ports(LIST_GET_NODE_COUNT(network_interface_list, &Net_Interfaces));
         size_t i = 0;
         for (net_tables* interface = LIST_GET_HEAD(network_interface_list, &Net_Interfaces); interface && i < ports->nPorts; i++)
         {
-            obos_status status = bind_interface(port, interface, &ports->ports[i]);
+            obos_status status = bind_interface(ports, port, interface, &ports->ports[i]);
             if (obos_is_error(status))
             {
-                Vfs_Free(ports->ports);
-                Vfs_Free(ports);
+                free_bound_ports(ports);
                 return status;
             }
             interface = LIST_GET_NEXT(network_interface_list, &Net_Interfaces, interface);
@@ -297,49 +329,22 @@ obos_status udp_bind(socket_desc* socket, struct sockaddr* saddr, size_t addrlen
     }
     else
     {
-        ports->nPorts = 1;
-        ports->ports = Vfs_Calloc(ports->nPorts, sizeof(udp_port*));
+        ports = alloc_bound_ports(1);
         
         net_tables* interface = nullptr;
         obos_status status = NetH_GetLocalAddressInterface(&interface, addr->addr);
         if (obos_is_error(status))
         {
-            Vfs_Free(ports->ports);
-            Vfs_Free(ports);
+            free_bound_ports(ports);
             return status;
         }
 
-        status = bind_interface(port, interface, &ports->ports[0]);
+        status = bind_interface(ports, port, interface, &ports->ports[0]);
         if (obos_is_error(status))
         {
-            Vfs_Free(ports->ports);
-            Vfs_Free(ports);
+            free_bound_ports(ports);
             return status;
         }
-        ports->read_event = &ports->ports[0]->recv_event;
-        
-        if (!ports->ports[0])
-        {
-            Vfs_Free(ports->ports);
-            Vfs_Free(ports);
-            return OBOS_STATUS_ADDRESS_NOT_AVAILABLE;
-        }
-    }
-
-    if (ports->nPorts == 1)
-        ports->read_event = &ports->ports[0]->recv_event;
-    else
-    {
-        ports->read_event = &ports->internal_read_event;
-        ports->internal_read_thread = CoreH_ThreadAllocate(nullptr);
-        thread_ctx ctx = {};
-        void* stack = Mm_VirtualMemoryAlloc(&Mm_KernelContext, nullptr, 0x1000, 0, VMA_FLAGS_KERNEL_STACK, nullptr, nullptr);
-        CoreS_SetupThreadContext(&ctx, (uintptr_t)internal_read_thread, (uintptr_t)ports, false, stack, 0x1000);
-        CoreH_ThreadInitialize(ports->internal_read_thread, THREAD_PRIORITY_NORMAL, Core_DefaultThreadAffinity, &ctx);
-        ports->internal_read_thread->stackFree = CoreH_VMAStackFree;
-        ports->internal_read_thread->stackFreeUserdata = &Mm_KernelContext;
-        Core_ProcessAppendThread(OBOS_KernelProcess, ports->internal_read_thread);
-        CoreH_ThreadReady(ports->internal_read_thread);
     }
 
     socket->protocol_data = ports;
@@ -355,24 +360,20 @@ obos_status udp_connect(socket_desc* socket, struct sockaddr* saddr, size_t addr
     if (socket->protocol_data)
         return OBOS_STATUS_ALREADY_INITIALIZED;
 
-    struct udp_bound_ports* ports = socket->protocol_data = Vfs_Calloc(1, sizeof(struct udp_bound_ports));
-    ports->nPorts = 1;
-    ports->default_peer.addr = addr->addr;
-    ports->default_peer.port = be16_to_host(addr->port);
-    ports->ports = Vfs_Calloc(1, sizeof(udp_port*));
-    ports->internal_read_event = EVENT_INITIALIZE(EVENT_NOTIFICATION);
-    ports->wake_read_thread = EVENT_INITIALIZE(EVENT_NOTIFICATION);
-
     net_tables* source_interface = nullptr;
     ip_table_entry* source_entry = nullptr;
     obos_status status = NetH_AddressRoute(&source_interface, &source_entry, &socket->opts.ttl, addr->addr);
     if (obos_is_error(status))
         return status;
 
+    struct udp_bound_ports* ports = alloc_bound_ports(1);
+    ports->default_peer.addr = addr->addr;
+    ports->default_peer.port = be16_to_host(addr->port);
+
     ports->ports[0] = Vfs_Calloc(1, sizeof(udp_port));
+    ports->ports[0]->owner = ports;
     ports->ports[0]->recv_event = EVENT_INITIALIZE(EVENT_NOTIFICATION);
     ports->ports[0]->iface = source_interface;
-    ports->read_event = &ports->ports[0]->recv_event;
     Core_PushlockAcquire(&source_interface->udp_ports_lock, false);
     udp_port* found = nullptr;
     uint32_t i = 0;
@@ -380,12 +381,13 @@ obos_status udp_connect(socket_desc* socket, struct sockaddr* saddr, size_t addr
         ports->ports[0]->port = random16() + 1;
         found = RB_FIND(udp_port_tree, &source_interface->udp_ports,ports->ports[0]);
     } while(found && i++ < 0x10000);
-    ports->read_event = &ports->ports[0]->recv_event;
 
     RB_INSERT(udp_port_tree, &source_interface->udp_ports, ports->ports[0]);
 
     Core_PushlockRelease(&source_interface->udp_ports_lock, false);
 
+    socket->protocol_data = ports;
+
     return OBOS_STATUS_SUCCESS;
 }
 
@@ -402,6 +404,8 @@ obos_status udp_irp_write(irp *req)
             return status;
         ports = socket->protocol_data;
     }
+    if (ports->write_closed)
+        return OBOS_STATUS_PIPE_CLOSED;
     uint16_t dest_port_be16 = 0;
     ip_addr dest_addr = {};
     if (req->socket_data)
@@ -442,27 +446,64 @@ obos_status udp_irp_write(irp *req)
     pckt->free = OBOS_SharedPtrDefaultFree;
     pckt->freeUdata = OBOS_KernelAllocator;
     pckt->onDeref = NetFreeSharedPtr;
-    req->status = NetH_SendIPv4Packet(iface->interface, ent, dest_addr, 0x11, ttl, 0, OBOS_SharedPtrCopy(pckt));
+    // UDP checksums are optional, so they are only used if the NIC computes them.
+    nic_irp_data offload = {};
+    if (NetH_OffloadEnabled(iface->interface, NET_OFFLOAD_UDP_CHECKSUM))
+        offload.offload = NET_OFFLOAD_UDP_CHECKSUM;
+    req->status = NetH_SendIPv4PacketEx(iface->interface, ent, dest_addr, 0x11, ttl, 0, OBOS_SharedPtrCopy(pckt), &offload);
     req->nBlkWritten = req->blkCount;
     return OBOS_STATUS_SUCCESS;
 }
 
+// Called after the read event of the socket was set.
+// The event is only a hint, as another reader could have already taken the datagram
+// that set it, in which case the IRP is retried.
 static void irp_event_set(irp* req)
 {
     socket_desc* socket = (void*)req->desc;
     struct udp_bound_ports *ports = socket->protocol_data;
-    udp_port* port = ports->signaled_port ? ports->signaled_port : ports->ports[0];
-    if (port->got_icmp_msg)
+    irql oldIrql = Core_SpinlockAcquire(&ports->lock);
+    if (ports->got_icmp_msg)
     {
-        // Parse the ICMP packet.
-        req->status = NetH_ICMPv4ResponseToStatus(port->icmp_header);
-        OBOS_SharedPtrUnref(port->icmp_header_ptr);
-        port->icmp_header_ptr = nullptr;
-        port->got_icmp_msg = false;
-        port->icmp_header = false;
+        req->status = ports->icmp_status;
+        ports->got_icmp_msg = false;
+        if (!LIST_GET_HEAD(udp_recv_packet_list, &ports->packets) && !ports->read_closed)
+            Core_EventClear(&ports->read_event);
+        Core_SpinlockRelease(&ports->lock, oldIrql);
         return;
     }
-    udp_recv_packet* pckt = LIST_GET_HEAD(udp_recv_packet_list, &port->packets);
+    udp_recv_packet* pckt = LIST_GET_HEAD(udp_recv_packet_list, &ports->packets);
+    if (!pckt)
+    {
+        if (ports->read_closed)
+        {
+            req->nBlkRead = 0;
+            req->status = OBOS_STATUS_SUCCESS;
+        }
+        else
+        {
+            Core_EventClear(&ports->read_event);
+            req->status = OBOS_STATUS_IRP_RETRY;
+        }
+        Core_SpinlockRelease(&ports->lock, oldIrql);
+        return;
+    }
+    if (req->socket_flags & MSG_PEEK)
+    {
+        // Keep the datagram alive while it's copied, as another reader could dequeue it.
+        OBOS_SharedPtrRef(&pckt->packet_ptr);
+    }
+    else
+    {
+        LIST_REMOVE(udp_recv_packet_list, &ports->packets, pckt);
+        pckt->queue = nullptr;
+        ports->nQueuedBytes -= pckt->buffer_ptr.szObj;
+        if (!LIST_GET_HEAD(udp_recv_packet_list, &ports->packets) && !ports->read_closed)
+            Core_EventClear(&ports->read_event);
+    }
+    Core_SpinlockRelease(&ports->lock, oldIrql);
+
+    // The buffer might be user memory, so it is not copied to with the lock held.
     memcpy(req->buff, pckt->buffer_ptr.obj, OBOS_MIN(req->blkCount, pckt->buffer_ptr.szObj));
     if (req->socket_data)
     {
@@ -474,12 +515,11 @@ static void irp_event_set(irp* req)
         memcpy(req->socket_data, &addr, OBOS_MIN(req->sz_socket_data, sizeof(addr)));
     }
     req->nBlkRead = OBOS_MIN(req->blkCount, pckt->buffer_ptr.szObj);
-    if (~req->socket_flags & MSG_PEEK)
-    {
-        OBOS_SharedPtrUnref(&pckt->packet_ptr);
-        Core_EventClear(req->evnt);
-    }
-    ports->signaled_port = nullptr;
+
+    // The reference counts of queued datagrams are only changed with the lock held.
+    oldIrql = Core_SpinlockAcquire(&ports->lock);
+    OBOS_SharedPtrUnref(&pckt->packet_ptr);
+    Core_SpinlockRelease(&ports->lock, oldIrql);
     req->status = OBOS_STATUS_SUCCESS;
 }
 
@@ -489,9 +529,8 @@ obos_status udp_irp_read(irp *req)
     struct udp_bound_ports *ports = socket->protocol_data;
     if (!ports)
         return OBOS_STATUS_UNINITIALIZED;
-    OBOS_ENSURE(ports->read_event);
     req->on_event_set = irp_event_set;
-    req->evnt = ports->read_event;
+    req->evnt = &ports->read_event;
     return OBOS_STATUS_SUCCESS;
 }
 
@@ -517,7 +556,7 @@ obos_status udp_submit_irp(irp* req)
             struct udp_bound_ports *ports = socket->protocol_data;
             if (!ports)
                 return OBOS_STATUS_UNINITIALIZED;
-            req->evnt = ports->read_event;
+            req->evnt = &ports->read_event;
             req->on_event_set = nullptr;
             return OBOS_STATUS_SUCCESS;
         }
@@ -536,18 +575,19 @@ obos_status udp_shutdown(socket_desc* desc, int how)
 {
     if (!desc->protocol_data)
         return OBOS_STATUS_INVALID_ARGUMENT;
+    if (how != SHUT_RD && how != SHUT_WR && how != SHUT_RDWR)
+        return OBOS_STATUS_INVALID_ARGUMENT;
     struct udp_bound_ports* ports = desc->protocol_data;
-    if (how == SHUT_RD)
-        ports->read_closed = true;
-    else if (how == SHUT_WR)
-        ports->write_closed = true;
-    else if (how == SHUT_RDWR)
+    irql oldIrql = Core_SpinlockAcquire(&ports->lock);
+    if (how == SHUT_RD || how == SHUT_RDWR)
     {
-        ports->write_closed = true;
         ports->read_closed = true;
+        // Wake up readers, so that they return end-of-file.
+        Core_EventSet(&ports->read_event, false);
     }
-    else
-        return OBOS_STATUS_INVALID_ARGUMENT;
+    if (how == SHUT_WR || how == SHUT_RDWR)
+        ports->write_closed = true;
+    Core_SpinlockRelease(&ports->lock, oldIrql);
 
     return OBOS_STATUS_SUCCESS;
 }
@@ -36,12 +36,18 @@ typedef struct udp_recv_packet {
         uint16_t port;
     } src;
     struct udp_port* bound_to;
+    // The queue this packet is on, or nullptr if it was already dequeued.
+    struct udp_recv_packet_list* queue;
     LIST_NODE(udp_port, struct udp_recv_packet) node;
 } udp_recv_packet;
 typedef LIST_HEAD(udp_recv_packet_list, struct udp_recv_packet) udp_recv_packet_list;
 LIST_PROTOTYPE(udp_recv_packet_list, udp_recv_packet, node);
 typedef struct udp_port {
     uint16_t port;
+    // The socket this port is bound by, or nullptr if it is used directly by the kernel.
+    // Datagrams and ICMP errors received on ports bound by a socket are queued on the socket
+    // instead of 'packets', and signal the socket's read event instead of 'recv_event'.
+    struct udp_bound_ports* owner;
     udp_recv_packet_list packets;
     event recv_event;
     bool got_icmp_msg : 1;
@@ -61,4 +67,9 @@ RB_PROTOTYPE(udp_port_tree, udp_port, node, udp_port_cmp);
 
 PacketProcessSignature(UDP, ip_header*);
 
+// Reports an ICMP error about a datagram sent from 'port' to whoever reads from it.
+// 'buf' is the frame holding 'hdr'.
+// The caller must hold the udp_ports_lock of the interface 'port' is bound to.
+void NetH_UDPReportICMPError(udp_port* port, shared_ptr* buf, struct icmp_header* hdr);
+
 extern struct socket_ops Net_UDPSocketBackend;
\ No newline at end of file
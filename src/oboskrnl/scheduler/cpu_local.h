@@ -41,8 +41,33 @@ typedef struct cpu_local
 	dpc_queue dpcs;
 	spinlock dpc_queue_lock;
 	void* currentKernelStack; // size: 0x10000
-	size_t nReadyThreads;
+	_Atomic(size_t) nReadyThreads;
 	size_t nMSIRoutedIRQs;
+	// Threads readied by other CPUs are pushed onto this (lock-free) stack instead of
+	// our priority lists, and are moved into priorityLists by this CPU on the next reschedule.
+	_Atomic(thread_node*) remoteReadyQueue;
+	// Set by an idle CPU that wants this CPU to hand it one of its ready threads.
+	_Atomic(struct cpu_local*) stealRequest;
+	// The timer tick at which this CPU next runs the load balancer.
+	uint64_t nextBalanceTick;
+	struct {
+		// The amount of threads migrated to this CPU.
+		_Atomic(size_t) migrationsIn;
+		// The amount of threads migrated away from this CPU.
+		size_t migrationsOut;
+		// The amount of times this CPU asked another CPU for work while idle.
+		size_t stealRequests;
+		// The amount of times the periodic load balancer ran on this CPU.
+		size_t balancerPasses;
+	} balanceStats;
+	// The amount of times a starving thread had its priority raised on this CPU.
+	size_t nStarvationBoosts;
+	// Single pages cached by the PMM for this CPU, linked through their first word.
+	// Only accessed by this CPU at IRQL_DISPATCH.
+	struct {
+		uintptr_t head;
+		size_t nPages;
+	} hotPages;
 
 	struct cpu_local* curr;
 	bool ever_yielded;
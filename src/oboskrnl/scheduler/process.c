@@ -26,6 +26,7 @@
 
 #include <mm/context.h>
 #include <mm/alloc.h>
+#include <mm/reclaim.h>
 
 #include <allocators/base.h>
 
@@ -249,6 +250,7 @@ uintptr_t ExitCurrentProcess(uintptr_t unused)
 					   rng->view_map_address);
 #endif
 
+	Mm_ReclaimForgetContext(proc->ctx);
 	MmS_FreePageTable(proc->ctx->pt);
 	Free(Mm_Allocator, proc->ctx, sizeof(context));
 	CoreS_GetCPULocalPtr()->currentThread->userStack = 0;
@@ -324,17 +324,38 @@ obos_status Sys_ThreadPriority(handle thread_hnd, const thread_priority *new, th
         if (obos_is_error(status))
             return status;
         thread_priority new_priority = 0;
-        thread_priority old_priority = thr->priority;
         memcpy_usr_to_k(&new_priority, new, sizeof(thr->priority));
         status = check_priority(new_priority);
-        if (obos_is_success(status))
-            thr->priority = new_priority;
+        if (obos_is_error(status))
+            return OBOS_STATUS_SUCCESS;
 
-        if (thr->priority != old_priority && thr->masterCPU) 
+        // The thread can be migrated while we wait for the lock, so make sure
+        // it is still on the CPU whose lock we took.
+        cpu_local* cpu = nullptr;
+        irql oldIrql = IRQL_INVALID;
+        while ((cpu = thr->masterCPU))
+        {
+            oldIrql = Core_SpinlockAcquire(&cpu->schedulerLock);
+            if (thr->masterCPU == cpu)
+                break;
+            Core_SpinlockRelease(&cpu->schedulerLock, oldIrql);
+        }
+        if (cpu)
         {
-            CoreH_ThreadListRemove(&thr->masterCPU->priorityLists[old_priority].list, &thr->snode);
-            CoreH_ThreadListAppend(&thr->masterCPU->priorityLists[thr->priority].list, &thr->snode);
+            // The thread might still be in the CPU's remote ready queue, where it is on no priority list.
+            CoreH_DrainRemoteReadyQueue(cpu);
+            if (new_priority != thr->priority)
+            {
+                CoreH_ThreadListRemove(&cpu->priorityLists[thr->priority].list, &thr->snode);
+                CoreH_ThreadListAppend(&cpu->priorityLists[new_priority].list, &thr->snode);
+            }
         }
+        thr->priority = new_priority;
+        // An explicitly set priority replaces any temporary boost.
+        thr->priorityBoost = 0;
+        thr->flags &= ~THREAD_FLAGS_PRIORITY_RAISED;
+        if (cpu)
+            Core_SpinlockRelease(&cpu->schedulerLock, oldIrql);
     }
     return OBOS_STATUS_SUCCESS;
 }
@@ -1087,3 +1108,24 @@ obos_status Sys_GetSid(handle process, uint32_t *out)
     
     return memcpy_k_to_usr(out, &s->sid, sizeof(uint32_t));
 }
+
+// scheduler/schedule.h
+
+obos_status Sys_SchedulerGetCPUStats(uint32_t cpu, sched_cpu_stats* ustats)
+{
+    if (!ustats)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    if (cpu >= Core_CpuCount)
+        return OBOS_STATUS_NOT_FOUND;
+    cpu_local* info = &Core_CpuInfo[cpu];
+    sched_cpu_stats stats = {
+        .id = info->id,
+        .nReadyThreads = info->nReadyThreads,
+        .migrationsIn = info->balanceStats.migrationsIn,
+        .migrationsOut = info->balanceStats.migrationsOut,
+        .stealRequests = info->balanceStats.stealRequests,
+        .balancerPasses = info->balanceStats.balancerPasses,
+        .starvationBoosts = info->nStarvationBoosts,
+    };
+    return memcpy_k_to_usr(ustats, &stats, sizeof(stats));
+}
@@ -82,4 +82,20 @@ obos_status Sys_SetProcessGroup(handle proc, uint32_t pgid);
 obos_status Sys_GetProcessGroup(handle proc, uint32_t* pgid);
 
 obos_status Sys_SetSid(handle proc, uint32_t *out);
-obos_status Sys_GetSid(handle proc, uint32_t *out);
\ No newline at end of file
+obos_status Sys_GetSid(handle proc, uint32_t *out);
+
+// scheduler/schedule.h
+
+typedef struct sched_cpu_stats
+{
+    uint32_t id;
+    // The amount of threads ready on the CPU, including the running thread.
+    size_t nReadyThreads;
+    size_t migrationsIn;
+    size_t migrationsOut;
+    size_t stealRequests;
+    size_t balancerPasses;
+    // The amount of times a starving thread had its priority raised.
+    size_t starvationBoosts;
+} sched_cpu_stats;
+obos_status Sys_SchedulerGetCPUStats(uint32_t cpu, sched_cpu_stats* stats);
@@ -7,6 +7,7 @@
 #include <int.h>
 #include <klog.h>
 #include <signal.h>
+#include <cmdline.h>
 
 #include <scheduler/thread.h>
 #include <scheduler/thread_context_info.h>
@@ -21,6 +22,8 @@
 
 #include <mm/context.h>
 
+#include <stdatomic.h>
+
 #ifdef __x86_64__
 #	include <arch/x86_64/lapic.h>
 #endif
@@ -29,11 +32,11 @@
 #define getIdleThread (CoreS_GetCPULocalPtr()->idleThread)
 #define getSchedulerTicks (CoreS_GetCPULocalPtr()->schedulerTicks)
 #define getPriorityLists (CoreS_GetCPULocalPtr()->priorityLists)
-#define priorityList(priority) ((priority <= THREAD_PRIORITY_MAX_VALUE) ? &getPriorityLists[priority] : nullptr)
+#define priorityList(priority) ((priority >= THREAD_PRIORITY_IDLE && priority <= THREAD_PRIORITY_MAX_VALUE) ? &getPriorityLists[priority] : nullptr)
 #define verifyAffinity(thr, cpuId) (thr->affinity & CoreH_CPUIdToAffinity(cpuId))
 #define threadCanRunThread(thr) ((thr->status == THREAD_STATUS_RUNNING || thr->status == THREAD_STATUS_READY) && verifyAffinity(thr, CoreS_GetCPULocalPtr()->id))
 
-size_t Core_ReadyThreadCount;
+_Atomic(size_t) Core_ReadyThreadCount;
 const uint64_t Core_ThreadPriorityToQuantum[THREAD_PRIORITY_MAX_VALUE+1] = {
 	2, // THREAD_PRIORITY_IDLE
 	4, // THREAD_PRIORITY_LOW
@@ -42,6 +45,14 @@ const uint64_t Core_ThreadPriorityToQuantum[THREAD_PRIORITY_MAX_VALUE+1] = {
 	12, // THREAD_PRIORITY_URGENT
 	UINT64_MAX, // THREAD_PRIORITY_REAL_TIME
 };
+uint64_t Core_ThreadPriorityToStarvationQuantum[THREAD_PRIORITY_MAX_VALUE+1] = {
+	64, // THREAD_PRIORITY_IDLE
+	48, // THREAD_PRIORITY_LOW
+	32, // THREAD_PRIORITY_NORMAL
+	32, // THREAD_PRIORITY_HIGH
+	0, // THREAD_PRIORITY_URGENT, starving threads are never raised to THREAD_PRIORITY_REAL_TIME.
+	0, // THREAD_PRIORITY_REAL_TIME
+};
 
 __attribute__((no_instrument_function)) OBOS_WEAK thread* Core_GetCurrentThread() { if (!CoreS_GetCPULocalPtr()) return nullptr; return getCurrentThread; }
 
@@ -51,9 +62,167 @@ __attribute__((no_instrument_function)) OBOS_WEAK thread* Core_GetCurrentThread(
  * That is wrong, or rather that's not all it should do, in my opinion.
  * It is also a priority manager, it must make sure no threads starve by temporarily raising their priority.
  * The scheduler must do load balancing.
- * TODO: Make this good in our scheduler.
+ * Load balancing is done in two ways:
+ * An idle CPU asks the busiest CPU for a thread (a steal request), which is served by the busy CPU
+ * next time it enters the scheduler.
+ * Every so often, a CPU that has more ready threads than the average pushes its excess threads to
+ * the least loaded CPUs.
+ * Either way, a CPU only ever removes threads from its own priority lists.
  */
 
+// How many times a second the periodic load balancer runs.
+#define BALANCER_FREQUENCY 10
+// The max amount of threads the periodic load balancer migrates in one pass.
+#define BALANCER_MAX_MIGRATIONS 4
+
+static thread* find_migratable_thread(cpu_local* cpu, cpu_local* to)
+{
+	for (thread_priority priority = THREAD_PRIORITY_MAX_VALUE; priority >= THREAD_PRIORITY_IDLE; priority--)
+	{
+		for (thread_node* node = cpu->priorityLists[priority].list.tail; node; node = node->prev)
+		{
+			thread* thr = node->data;
+			if (thr == cpu->currentThread || thr == cpu->idleThread || thr->status != THREAD_STATUS_READY)
+				continue;
+			if (!verifyAffinity(thr, to->id))
+				continue;
+			return thr;
+		}
+	}
+	return nullptr;
+}
+
+static bool migrate_one(cpu_local* cpu, cpu_local* to)
+{
+	// Find and remove the thread under one hold of the lock, so it cannot start running or block in between.
+	irql oldIrql = Core_SpinlockAcquireExplicit(&cpu->schedulerLock, IRQL_DISPATCH, true);
+	thread* thr = find_migratable_thread(cpu, to);
+	bool migrated = thr && obos_is_success(CoreH_ThreadMigrateLocked(thr, to));
+	Core_SpinlockRelease(&cpu->schedulerLock, oldIrql);
+	return migrated;
+}
+
+static void serve_steal_request(cpu_local* cpu)
+{
+	cpu_local* thief = atomic_exchange(&cpu->stealRequest, nullptr);
+	if (thief && thief != cpu && cpu->nReadyThreads > 1)
+		migrate_one(cpu, thief);
+}
+
+static void request_steal(cpu_local* cpu)
+{
+	if (Core_CpuCount == 1)
+		return;
+	cpu_local* victim = nullptr;
+	for (size_t i = 0; i < Core_CpuCount; i++)
+	{
+		cpu_local* curr = &Core_CpuInfo[i];
+		if (curr == cpu || !curr->initialized)
+			continue;
+		// A CPU with one ready thread is just running that thread.
+		if (curr->nReadyThreads < 2)
+			continue;
+		if (!victim || curr->nReadyThreads > victim->nReadyThreads)
+			victim = curr;
+	}
+	if (!victim)
+		return;
+	cpu_local* expected = nullptr;
+	if (!atomic_compare_exchange_strong(&victim->stealRequest, &expected, cpu))
+		return;
+	cpu->balanceStats.stealRequests++;
+	if (CoreS_SendSchedulerIPI)
+		CoreS_SendSchedulerIPI(victim);
+}
+
+static void balance(cpu_local* cpu)
+{
+	if (Core_CpuCount == 1 || !CoreS_TimerFrequency)
+		return;
+	timer_tick now = CoreS_GetTimerTick();
+	if (now < cpu->nextBalanceTick)
+		return;
+	cpu->nextBalanceTick = now + OBOS_MAX(CoreS_TimerFrequency / BALANCER_FREQUENCY, 1UL);
+	cpu->balanceStats.balancerPasses++;
+	for (size_t nMigrated = 0; nMigrated < BALANCER_MAX_MIGRATIONS; nMigrated++)
+	{
+		size_t average = Core_ReadyThreadCount / Core_CpuCount;
+		if (cpu->nReadyThreads <= average + 1)
+			break;
+		cpu_local* target = nullptr;
+		for (size_t i = 0; i < Core_CpuCount; i++)
+		{
+			cpu_local* curr = &Core_CpuInfo[i];
+			if (curr == cpu || !curr->initialized)
+				continue;
+			if (!target || curr->nReadyThreads < target->nReadyThreads)
+				target = curr;
+		}
+		if (!target || target->nReadyThreads + 1 >= cpu->nReadyThreads)
+			break;
+		if (!migrate_one(cpu, target))
+			break;
+	}
+}
+
+// How often (in scheduler ticks) the scheduler looks for starving threads.
+#define AGING_INTERVAL 4
+
+// Raises the priority of every ready thread on this CPU that has not run for its priority's starvation quantum.
+// The thread's wait clock (lastRunTick) is reset on every raise, so a thread that keeps starving keeps climbing.
+static void age_threads(cpu_local* cpu)
+{
+	irql oldIrql = Core_SpinlockAcquireExplicit(&cpu->schedulerLock, IRQL_DISPATCH, true);
+	// Go from the highest priority down, so a thread is raised at most once per pass.
+	for (thread_priority priority = THREAD_PRIORITY_URGENT-1; priority >= THREAD_PRIORITY_IDLE; priority--)
+	{
+		uint64_t starvationQuantum = Core_ThreadPriorityToStarvationQuantum[priority];
+		if (!starvationQuantum)
+			continue;
+		for (thread_node* node = cpu->priorityLists[priority].list.head; node; )
+		{
+			thread_node* next = node->next;
+			thread* thr = node->data;
+			// A wait clock ahead of this CPU's ticks came from another CPU, don't let it wrap around.
+			if (thr != cpu->currentThread && thr != cpu->idleThread && thr->status == THREAD_STATUS_READY &&
+				thr->lastRunTick <= cpu->schedulerTicks && (cpu->schedulerTicks - thr->lastRunTick) >= starvationQuantum)
+			{
+				CoreH_ThreadListRemove(&cpu->priorityLists[priority].list, node);
+				thr->priority++;
+				thr->priorityBoost++;
+				thr->flags |= THREAD_FLAGS_PRIORITY_RAISED;
+				thr->lastRunTick = cpu->schedulerTicks;
+				CoreH_ThreadListAppend(&cpu->priorityLists[thr->priority].list, node);
+				cpu->nStarvationBoosts++;
+			}
+			node = next;
+		}
+	}
+	Core_SpinlockRelease(&cpu->schedulerLock, oldIrql);
+}
+
+void Core_LoadSchedulerTunables()
+{
+	static const char* const names[THREAD_PRIORITY_MAX_VALUE+1] = {
+		"starvation-quantum-idle",
+		"starvation-quantum-low",
+		"starvation-quantum-normal",
+		"starvation-quantum-high",
+		"starvation-quantum-urgent",
+		"starvation-quantum-real-time",
+	};
+	// THREAD_PRIORITY_URGENT and THREAD_PRIORITY_REAL_TIME threads are never raised.
+	for (thread_priority priority = THREAD_PRIORITY_IDLE; priority < THREAD_PRIORITY_URGENT; priority++)
+		Core_ThreadPriorityToStarvationQuantum[priority] =
+			OBOS_GetOPTD_Ex(names[priority], Core_ThreadPriorityToStarvationQuantum[priority]);
+}
+
+void CoreH_ServeStealRequests()
+{
+	if (CoreS_GetCPULocalPtr()->stealRequest)
+		serve_steal_request(CoreS_GetCPULocalPtr());
+}
+
 //static spinlock s_lock;
 // This should be assumed to be called with the current thread's context saved.
 // It does NOT do that on it's own.
@@ -76,6 +245,18 @@ __attribute__((no_instrument_function)) void Core_Schedule()
 		Core_LowerIrql(oldIrql);
 	}
 	getSchedulerTicks++;
+	// Pick up any threads other CPUs readied on this CPU.
+	if (CoreS_GetCPULocalPtr()->remoteReadyQueue)
+	{
+		irql oldIrql = Core_SpinlockAcquireExplicit(&CoreS_GetCPULocalPtr()->schedulerLock, IRQL_DISPATCH, true);
+		CoreH_DrainRemoteReadyQueue(CoreS_GetCPULocalPtr());
+		Core_SpinlockRelease(&CoreS_GetCPULocalPtr()->schedulerLock, oldIrql);
+	}
+	if (CoreS_GetCPULocalPtr()->stealRequest)
+		serve_steal_request(CoreS_GetCPULocalPtr());
+	balance(CoreS_GetCPULocalPtr());
+	if (!(getSchedulerTicks % AGING_INTERVAL))
+		age_threads(CoreS_GetCPULocalPtr());
 	if (!getCurrentThread)
 		goto schedule;
 	getCurrentThread->lastRunTick = getSchedulerTicks;
@@ -87,8 +268,8 @@ __attribute__((no_instrument_function)) void Core_Schedule()
 		if (getCurrentThread->flags & THREAD_FLAGS_PRIORITY_RAISED)
 		{
 			CoreH_ThreadListRemove(&list->list, &getCurrentThread->snode);
-			getCurrentThread->priority--;
-			getCurrentThread->flags &= ~THREAD_FLAGS_PRIORITY_RAISED;
+			// The thread got to run, so drop the priority back down to where it was.
+			CoreH_ThreadDropPriorityBoost(getCurrentThread);
 			CoreH_ThreadListAppend(&(priorityList(getCurrentThread->priority)->list), &getCurrentThread->snode);
 		}
 		if (getCurrentThread->status != THREAD_STATUS_BLOCKED)
@@ -127,6 +308,8 @@ switch_thread:
 	// timer_tick end = CoreS_GetNativeTimerTick();
 	// CoreS_GetCPULocalPtr()->last_sched_algorithm_time = end-start;
 	OBOS_ASSERT(chosenThread);
+	if (chosenThread == getIdleThread)
+		request_steal(CoreS_GetCPULocalPtr());
 	// if (chosenThread == getCurrentThread)
 	// 	return; // We might as well save some time and return.
 	// Or maybe not.....
@@ -145,8 +328,36 @@ switch_thread:
 		CoreS_SetKernelStack(chosenThread->kernelStack);
 	// for (volatile bool b = (chosenThread->tid == 7); b; )
 	// 	asm volatile ("":"=r"(b) :"r"(b) :"memory");
+	CoreH_ProgramSchedulerTimer();
 	CoreS_SwitchToThreadContext(&chosenThread->context);
 }
+
+void CoreH_ProgramSchedulerTimer()
+{
+	if (!CoreS_SetNextSchedulerTick)
+		return;
+	thread* cur = getCurrentThread;
+	if (!cur)
+		return;
+	// The idle thread only needs to wake up when someone readies a thread, which sends an IPI anyway.
+	// Real-time threads run until they block or yield.
+	if (cur == getIdleThread || cur->priority == THREAD_PRIORITY_REAL_TIME)
+	{
+		// Other CPUs still need us to serve their steal requests, and the load balancer needs to run,
+		// so a CPU that has ready threads always gets a tick.
+		if (cur != getIdleThread || !CoreS_GetCPULocalPtr()->nReadyThreads)
+		{
+			CoreS_SetNextSchedulerTick(UINT64_MAX);
+			return;
+		}
+	}
+	uint64_t max_quantum = Core_ThreadPriorityToQuantum[cur->priority];
+	uint64_t remaining = cur->quantum < max_quantum ? max_quantum - cur->quantum : 1;
+	// Aging and load balancing are driven by the scheduler tick, don't let them lag too far behind.
+	if (CoreS_GetCPULocalPtr()->nReadyThreads > 1 && remaining > AGING_INTERVAL)
+		remaining = AGING_INTERVAL;
+	CoreS_SetNextSchedulerTick(remaining);
+}
 struct irq* Core_SchedulerIRQ;
 uint64_t Core_SchedulerTimerFrequency = 1000;
 
@@ -172,6 +383,11 @@ void Core_YieldForce(bool force)
 	{
 		force = false;
 		bool canRunCurrentThread = threadCanRunThread(getCurrentThread);
+		// Don't let the idle thread sit on threads that were readied remotely.
+		if (getCurrentThread == getIdleThread && (CoreS_GetCPULocalPtr()->remoteReadyQueue || CoreS_GetCPULocalPtr()->nReadyThreads))
+			canRunCurrentThread = false;
+		// Hand out work to idle CPUs without waiting for our quantum to end.
+		CoreH_ServeStealRequests();
 		++getCurrentThread->total_quantums;
 		if (!force && 
 			++getCurrentThread->quantum < Core_ThreadPriorityToQuantum[getCurrentThread->priority] &&
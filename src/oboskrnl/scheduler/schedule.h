@@ -43,8 +43,39 @@ OBOS_EXPORT void Core_SuspendScheduler(bool suspended);
 /// Waits for all CPUs (but the current CPU) to suspend their scheduler,
 /// </summary>
 OBOS_EXPORT void Core_WaitForSchedulerSuspend();
+/// <summary>
+/// Moves all threads readied remotely on a CPU into that CPU's priority lists.<para/>
+/// The CPU's scheduler lock must be held.
+/// </summary>
+/// <param name="cpu">The CPU whose remote ready queue to drain.</param>
+void CoreH_DrainRemoteReadyQueue(struct cpu_local* cpu);
+/// <summary>
+/// Loads scheduler tunables (such as the starvation quantum of each priority) from the kernel command line.
+/// </summary>
+void Core_LoadSchedulerTunables();
+/// <summary>
+/// Hands a ready thread to any idle CPU that asked the current CPU for work.
+/// </summary>
+void CoreH_ServeStealRequests();
+/// <summary>
+/// Makes a CPU enter the scheduler as soon as possible.<para/>
+/// Used to make idle CPUs pick up threads readied by other CPUs.
+/// </summary>
+/// <param name="target">The CPU to interrupt.</param>
+OBOS_WEAK void CoreS_SendSchedulerIPI(struct cpu_local* target);
+/// <summary>
+/// Programs the scheduler timer of the current CPU to fire once after a certain amount of scheduler ticks.<para/>
+/// Only implemented by architectures that support tickless scheduling.
+/// </summary>
+/// <param name="ticks">The amount of scheduler ticks until the next interrupt, or UINT64_MAX to stop the timer.</param>
+OBOS_WEAK void CoreS_SetNextSchedulerTick(uint64_t ticks);
+/// <summary>
+/// Programs the next scheduler timer interrupt of the current CPU according to the current thread's remaining quantum.<para/>
+/// Does nothing if the architecture doesn't support tickless scheduling.
+/// </summary>
+void CoreH_ProgramSchedulerTimer();
 
-extern OBOS_EXPORT size_t Core_ReadyThreadCount;
+extern OBOS_EXPORT _Atomic(size_t) Core_ReadyThreadCount;
 extern struct irq* Core_SchedulerIRQ;
 extern OBOS_EXPORT uint64_t Core_SchedulerTimerFrequency;
 extern spinlock Core_SchedulerLock;
@@ -25,6 +25,8 @@
 #include <mm/bare_map.h>
 #include <mm/context.h>
 
+#include <stdatomic.h>
+
 static uint64_t s_nextTID = 1;
 cpu_local* Core_CpuInfo;
 thread_affinity Core_DefaultThreadAffinity = 1;
@@ -64,10 +66,69 @@ obos_status CoreH_ThreadInitialize(thread* thr, thread_priority priority, thread
 	return OBOS_STATUS_SUCCESS;
 }
 
+static bool is_valid_cpu(cpu_local* cpu)
+{
+	// Threads readied before SMP initialization can still reference the boot CPU's old cpu_local.
+	return cpu >= Core_CpuInfo && cpu < (Core_CpuInfo + Core_CpuCount);
+}
+static cpu_local* choose_cpu(thread* thr)
+{
+	// Prefer the CPU the thread last ran on, then the current CPU,
+	// so that the common wakeup path does not need to look at other CPUs.
+	cpu_local* cpu = thr->lastCPU;
+	if (cpu && is_valid_cpu(cpu) && (thr->affinity & CoreH_CPUIdToAffinity(cpu->id)))
+		return cpu;
+	cpu = CoreS_GetCPULocalPtr();
+	if (thr->lastCPU && cpu && is_valid_cpu(cpu) && (thr->affinity & CoreH_CPUIdToAffinity(cpu->id)))
+		return cpu;
+	// This thread was never readied before (or its affinity changed),
+	// find the processor with the least ready threads.
+	cpu_local* cpuFound = nullptr;
+	for (size_t cpui = 0; cpui < Core_CpuCount; cpui++)
+	{
+		cpu = &Core_CpuInfo[cpui];
+		if (!(thr->affinity & CoreH_CPUIdToAffinity(cpu->id)))
+			continue;
+		if (!cpuFound || cpu->nReadyThreads < cpuFound->nReadyThreads)
+			cpuFound = cpu;
+	}
+	return cpuFound;
+}
+static void push_remote_ready(cpu_local* cpu, thread* thr)
+{
+	thread_node* head = atomic_load_explicit(&cpu->remoteReadyQueue, memory_order_relaxed);
+	do {
+		thr->snode.next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&cpu->remoteReadyQueue, &head, &thr->snode, memory_order_release, memory_order_relaxed));
+}
+void CoreH_DrainRemoteReadyQueue(cpu_local* cpu)
+{
+	if (!atomic_load_explicit(&cpu->remoteReadyQueue, memory_order_relaxed))
+		return;
+	thread_node* node = atomic_exchange_explicit(&cpu->remoteReadyQueue, nullptr, memory_order_acquire);
+	// The queue is LIFO, reverse it so threads run in the order they were readied.
+	thread_node* reversed = nullptr;
+	while (node)
+	{
+		thread_node* next = node->next;
+		node->next = reversed;
+		reversed = node;
+		node = next;
+	}
+	while (reversed)
+	{
+		thread_node* next = reversed->next;
+		reversed->next = nullptr;
+		reversed->prev = nullptr;
+		// The thread starts waiting on this CPU now, by this CPU's clock.
+		reversed->data->lastRunTick = cpu->schedulerTicks;
+		CoreH_ThreadListAppend(&cpu->priorityLists[reversed->data->priority].list, reversed);
+		reversed = next;
+	}
+}
+
 obos_status CoreH_ThreadReady(thread* thr)
 {
-	// Find the processor with the least threads using the current thread's priority.
-	// Then, add the node to that list.
 	if (!Core_CpuInfo)
 		return OBOS_STATUS_INVALID_INIT_PHASE;
 	if (!thr )
@@ -78,30 +139,35 @@ obos_status CoreH_ThreadReady(thread* thr)
 		return OBOS_STATUS_SUCCESS;
 	cpu_local* cpuFound = thr->masterCPU;
 	if (!cpuFound)
-	{
-		for (size_t cpui = 0; cpui < Core_CpuCount; cpui++)
-		{
-			cpu_local* cpu = &Core_CpuInfo[cpui];
-			if (!(thr->affinity & CoreH_CPUIdToAffinity(cpu->id)))
-				continue;
-			if (!cpuFound || cpu->nReadyThreads < cpuFound->nReadyThreads)
-				cpuFound = cpu;
-		}
-	}
+		cpuFound = choose_cpu(thr);
 	if (!cpuFound)
 		return OBOS_STATUS_INVALID_AFFINITY;
 
-	irql oldIrql = Core_SpinlockAcquire(&Core_SchedulerLock);
-	irql oldIrql2 = Core_SpinlockAcquire(&cpuFound->schedulerLock);
+	obos_status status = OBOS_STATUS_SUCCESS;
 	thr->snode.data = thr;
 	thr->masterCPU = cpuFound;
-	thr->masterCPU->nReadyThreads++;
 	thr->status = THREAD_STATUS_READY;
-	thread_list* priorityList = &cpuFound->priorityLists[thr->priority].list;
+	cpuFound->nReadyThreads++;
 	Core_ReadyThreadCount++;
-	obos_status status = CoreH_ThreadListAppend(priorityList, &thr->snode);
-	Core_SpinlockRelease(&thr->masterCPU->schedulerLock, oldIrql2);
-	Core_SpinlockRelease(&Core_SchedulerLock, oldIrql);
+	if (cpuFound == CoreS_GetCPULocalPtr() || !cpuFound->initialized)
+	{
+		irql oldIrql = Core_SpinlockAcquire(&cpuFound->schedulerLock);
+		thread_list* priorityList = &cpuFound->priorityLists[thr->priority].list;
+		thr->lastRunTick = cpuFound->schedulerTicks;
+		status = CoreH_ThreadListAppend(priorityList, &thr->snode);
+		Core_SpinlockRelease(&cpuFound->schedulerLock, oldIrql);
+		// With tickless scheduling, an idle CPU might not have a timer interrupt pending.
+		if (cpuFound->initialized && cpuFound->currentThread == cpuFound->idleThread && CoreS_SendSchedulerIPI)
+			CoreS_SendSchedulerIPI(cpuFound);
+	}
+	else
+	{
+		// Hand the thread off to the other CPU without touching its priority lists.
+		thr->snode.prev = nullptr;
+		push_remote_ready(cpuFound, thr);
+		if (cpuFound->currentThread == cpuFound->idleThread && CoreS_SendSchedulerIPI)
+			CoreS_SendSchedulerIPI(cpuFound);
+	}
 
 	return status;
 }
@@ -114,23 +180,95 @@ obos_status CoreH_ThreadBlock(thread* thr, bool canYield)
 	if (thr->status == THREAD_STATUS_BLOCKED)
 		return OBOS_STATUS_SUCCESS;
 	OBOS_ENSURE(thr->masterCPU->idleThread != thr && "Blocking an idle thread can be fatal.");
-	irql oldIrql2 = Core_SpinlockAcquire(&Core_SchedulerLock);
-	irql oldIrql = Core_SpinlockAcquire(&thr->masterCPU->schedulerLock);
+	// The thread can be migrated while we wait for the lock, so make sure
+	// it is still on the CPU whose lock we took.
+	cpu_local* cpu = nullptr;
+	irql oldIrql = IRQL_INVALID;
+	while ((cpu = thr->masterCPU))
+	{
+		oldIrql = Core_SpinlockAcquire(&cpu->schedulerLock);
+		if (thr->masterCPU == cpu)
+			break;
+		Core_SpinlockRelease(&cpu->schedulerLock, oldIrql);
+	}
+	// Someone else blocked the thread in the meantime.
+	if (!cpu)
+		return OBOS_STATUS_SUCCESS;
+	if (thr->status == THREAD_STATUS_BLOCKED)
+	{
+		Core_SpinlockRelease(&cpu->schedulerLock, oldIrql);
+		return OBOS_STATUS_SUCCESS;
+	}
+	// The thread might still be in the CPU's remote ready queue.
+	CoreH_DrainRemoteReadyQueue(cpu);
 	thread_node* node = &thr->snode;
-	CoreH_ThreadListRemove(&thr->masterCPU->priorityLists[thr->priority].list, node);
-	thr->flags &= ~THREAD_FLAGS_PRIORITY_RAISED;
+	CoreH_ThreadListRemove(&cpu->priorityLists[thr->priority].list, node);
+	CoreH_ThreadDropPriorityBoost(thr);
 	thr->status = THREAD_STATUS_BLOCKED;
 	thr->quantum = 0;
 	// TODO: Send an IPI of some sort to make sure the other CPU yields if this current thread is running.
 	Core_ReadyThreadCount--;
-	Core_SpinlockRelease(&thr->masterCPU->schedulerLock, oldIrql);
-	thr->masterCPU->nReadyThreads--;
+	cpu->nReadyThreads--;
+	thr->lastCPU = cpu;
 	thr->masterCPU = nullptr;
-	Core_SpinlockRelease(&Core_SchedulerLock, oldIrql2);
+	Core_SpinlockRelease(&cpu->schedulerLock, oldIrql);
 	if (thr == Core_GetCurrentThread() && canYield)
 		Core_Yield();
 	return OBOS_STATUS_SUCCESS;
 }
+obos_status CoreH_ThreadMigrateLocked(thread* thr, cpu_local* to)
+{
+	if (!thr || !to)
+		return OBOS_STATUS_INVALID_ARGUMENT;
+	cpu_local* from = CoreS_GetCPULocalPtr();
+	if (thr->masterCPU != from || from == to || !to->initialized)
+		return OBOS_STATUS_INVALID_OPERATION;
+	if (thr->status != THREAD_STATUS_READY || thr == from->currentThread || thr == from->idleThread)
+		return OBOS_STATUS_INVALID_ARGUMENT;
+	if (!(thr->affinity & CoreH_CPUIdToAffinity(to->id)))
+		return OBOS_STATUS_INVALID_AFFINITY;
+	obos_status status = CoreH_ThreadListRemove(&from->priorityLists[thr->priority].list, &thr->snode);
+	if (obos_is_error(status))
+		return status;
+	from->nReadyThreads--;
+	from->balanceStats.migrationsOut++;
+	thr->masterCPU = to;
+	thr->lastCPU = to;
+	// Until the thread is drained into the new CPU's lists, it is not aged at all,
+	// but don't leave a tick from this CPU's clock in it either.
+	thr->lastRunTick = to->schedulerTicks;
+	to->nReadyThreads++;
+	to->balanceStats.migrationsIn++;
+	thr->snode.prev = nullptr;
+	push_remote_ready(to, thr);
+	if (to->currentThread == to->idleThread && CoreS_SendSchedulerIPI)
+		CoreS_SendSchedulerIPI(to);
+	return OBOS_STATUS_SUCCESS;
+}
+obos_status CoreH_ThreadMigrate(thread* thr, cpu_local* to)
+{
+	if (!thr || !to)
+		return OBOS_STATUS_INVALID_ARGUMENT;
+	cpu_local* from = CoreS_GetCPULocalPtr();
+	if (thr->masterCPU != from)
+		return OBOS_STATUS_INVALID_OPERATION;
+	// The thread's state is only stable with the lock held, so everything is checked under it.
+	irql oldIrql = Core_SpinlockAcquire(&from->schedulerLock);
+	obos_status status = CoreH_ThreadMigrateLocked(thr, to);
+	Core_SpinlockRelease(&from->schedulerLock, oldIrql);
+	return status;
+}
+void CoreH_ThreadDropPriorityBoost(thread* thr)
+{
+	if (thr->flags & THREAD_FLAGS_PRIORITY_RAISED)
+	{
+		thread_priority boost = thr->priorityBoost ? thr->priorityBoost : 1;
+		// The boost is reset whenever the priority is set explicitly, but never go below the lowest priority anyway.
+		thr->priority = thr->priority > boost ? thr->priority - boost : THREAD_PRIORITY_IDLE;
+	}
+	thr->priorityBoost = 0;
+	thr->flags &= ~THREAD_FLAGS_PRIORITY_RAISED;
+}
 obos_status CoreH_ThreadBoostPriority(thread* thr)
 {
 	if (!thr)
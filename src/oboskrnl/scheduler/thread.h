@@ -70,6 +70,9 @@ typedef uint32_t thread_affinity;
 #endif
 extern OBOS_EXPORT thread_affinity Core_DefaultThreadAffinity;
 extern const uint64_t Core_ThreadPriorityToQuantum[THREAD_PRIORITY_MAX_VALUE+1];
+// The amount of scheduler ticks a ready thread can wait at a priority before the scheduler raises its priority.
+// Zero means threads of that priority are never raised.
+extern OBOS_EXPORT uint64_t Core_ThreadPriorityToStarvationQuantum[THREAD_PRIORITY_MAX_VALUE+1];
 
 typedef struct thread_node
 {
@@ -93,12 +96,15 @@ typedef struct thread
 
 	thread_status status;
 	thread_priority priority;
+	// The amount of levels the scheduler temporarily raised 'priority' by.
+	uint8_t priorityBoost;
 	uint64_t quantum;
 	bool force_yield;
 	thread_affinity affinity;
 	uint64_t lastRunTick;
 
 	struct cpu_local* masterCPU /* the cpu that contain this thread's priority list. */;
+	struct cpu_local* lastCPU /* the cpu that last contained this thread's priority list, used as a hint when readying. */;
 	struct thread_node snode;
 	struct thread_node* pnode;
 	struct process* proc;
@@ -199,6 +205,12 @@ OBOS_EXPORT obos_status CoreH_ThreadBlock(thread* thr, bool canYield);
 /// <returns>The function's status.</returns>
 OBOS_EXPORT obos_status CoreH_ThreadBoostPriority(thread* thr);
 /// <summary>
+/// Drops the temporary priority boost given to a thread by the scheduler, if any.<para/>
+/// The caller must remove the thread from its priority list beforehand, and hold its CPU's scheduler lock.
+/// </summary>
+/// <param name="thr">The thread.</param>
+void CoreH_ThreadDropPriorityBoost(thread* thr);
+/// <summary>
 /// Appends a thread to a thread list.
 /// </summary>
 /// <param name="list">The thread list.</param>
@@ -213,6 +225,20 @@ OBOS_EXPORT obos_status CoreH_ThreadListAppend(thread_list* list, thread_node* n
 /// <returns>The function's status/</returns>
 OBOS_EXPORT obos_status CoreH_ThreadListRemove(thread_list* list, thread_node* node);
 /// <summary>
+/// Moves a ready thread from the current CPU's priority lists to another CPU.
+/// </summary>
+/// <param name="thr">The thread to migrate. Must be ready on the current CPU, and not running.</param>
+/// <param name="to">The CPU to migrate the thread to.</param>
+/// <returns>The function's status.</returns>
+obos_status CoreH_ThreadMigrate(thread* thr, struct cpu_local* to);
+/// <summary>
+/// Same as CoreH_ThreadMigrate, but the current CPU's scheduler lock must already be held.
+/// </summary>
+/// <param name="thr">The thread to migrate. Must be ready on the current CPU, and not running.</param>
+/// <param name="to">The CPU to migrate the thread to.</param>
+/// <returns>The function's status.</returns>
+obos_status CoreH_ThreadMigrateLocked(thread* thr, struct cpu_local* to);
+/// <summary>
 /// Converts a cpu id to an affinity mask.
 /// </summary>
 /// <param name="cpuId">The cpu id.</param>
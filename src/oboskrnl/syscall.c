@@ -519,6 +519,13 @@ uintptr_t OBOS_SyscallTable[] = {
     (uintptr_t)Sys_GetHDADevices,
     (uintptr_t)Sys_SetSid,
     (uintptr_t)Sys_GetSid,
+    (uintptr_t)Sys_SchedulerGetCPUStats,
+    (uintptr_t)Sys_GetPMMStats,
+    (uintptr_t)Sys_GetPageCacheStats,
+    (uintptr_t)Sys_SendMMsg,
+    (uintptr_t)Sys_RecvMMsg,
+    (uintptr_t)Sys_ContextSetFaultAround,
+    (uintptr_t)Sys_GetReclaimStats,
 };
 
 // Arch syscall table is defined per-arch
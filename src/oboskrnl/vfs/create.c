@@ -174,15 +174,18 @@ obos_status Vfs_TruncateFile(vnode* vn, size_t new_size)
         goto failed;
 
     // Nuke all valid pagecache entries with an offset >= new_size
+    // Readahead inserts into the tree concurrently, so hold its lock across the walk.
     page* ent = nullptr, *next = nullptr;
+    irql oldIrql = Core_SpinlockAcquire(&vn->readahead.lock);
     RB_FOREACH_SAFE(ent, pagecache_tree, &vn->cache, next)
     {
         if (ent->file_offset < new_size)
             continue;
         
         ent->flags |= PHYS_PAGE_INVALID;
-        MmH_RemoveFromPagecache(ent);
+        MmH_RemoveFromPagecacheLocked(ent);
     }
+    Core_SpinlockRelease(&vn->readahead.lock, oldIrql);
 
     vn->filesize = new_size;
     
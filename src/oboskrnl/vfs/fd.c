@@ -668,14 +668,15 @@ irp* VfsH_IRPRef(irp* request)
         ++(request->refs);
     return request;
 }
+static object_cache irp_cache = OBJECT_CACHE_INITIALIZE("irp", irp, nullptr, nullptr, nullptr, OBJECT_CACHE_ZERO);
 void VfsH_IRPUnref(irp* request)
 {
     if (request && !(--request->refs))
-        Free(OBOS_NonPagedPoolAllocator, request, sizeof(*request));
+        OBOS_ObjectCacheFree(&irp_cache, request);
 }
 irp* VfsH_IRPAllocate()
 {
-    irp* ret = ZeroAllocate(OBOS_NonPagedPoolAllocator, 1, sizeof(irp), nullptr);
+    irp* ret = OBOS_ObjectCacheAllocate(&irp_cache, nullptr);
     ret->refs = 1;
     return ret;
 }
@@ -39,6 +39,7 @@
 #include <vfs/irp.h>
 #include <vfs/create.h>
 #include <vfs/socket.h>
+#include <vfs/pagecache.h>
 
 #include <locks/event.h>
 #include <locks/wait.h>
@@ -2737,6 +2738,144 @@ obos_status Sys_RecvFrom(handle desc, void* buffer, size_t size, int flags, stru
     return status;
 }
 
+// Maps the buffers and copies the addresses of every message in 'umsgs' into the kernel.
+// On success, *kumsgs is a kernel copy of umsgs, and *kmsgs are the messages to pass to Net_*MMsg.
+static obos_status map_mmsgs(struct sys_socket_mmsg* umsgs, size_t nMsgs, bool recv, struct sys_socket_mmsg** kumsgs, net_mmsg** kmsgs)
+{
+    if (!nMsgs || nMsgs > SYS_SOCKET_MMSG_MAX)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    obos_status status = OBOS_STATUS_SUCCESS;
+    struct sys_socket_mmsg* params = Allocate(OBOS_KernelAllocator, nMsgs*sizeof(*params), nullptr);
+    status = memcpy_usr_to_k(params, umsgs, nMsgs*sizeof(*params));
+    if (obos_is_error(status))
+    {
+        Free(OBOS_KernelAllocator, params, nMsgs*sizeof(*params));
+        return status;
+    }
+    net_mmsg* msgs = ZeroAllocate(OBOS_KernelAllocator, nMsgs, sizeof(*msgs), nullptr);
+    size_t i = 0;
+    for (; i < nMsgs; i++)
+    {
+        if (params[i].addr_length > 32 || (params[i].sock_addr && !params[i].addr_length))
+        {
+            status = OBOS_STATUS_INVALID_ARGUMENT;
+            break;
+        }
+        msgs[i].size = params[i].size;
+        msgs[i].buffer = Mm_MapViewOfUserMemory(CoreS_GetCPULocalPtr()->currentContext, params[i].buffer, nullptr, params[i].size, recv ? 0 : OBOS_PROTECTION_READ_ONLY, true, &status);
+        if (obos_is_error(status))
+            break;
+        if (!params[i].sock_addr)
+            continue;
+        msgs[i].addr_len = params[i].addr_length;
+        msgs[i].addr = Allocate(OBOS_KernelAllocator, msgs[i].addr_len, nullptr);
+        if (!recv)
+        {
+            status = memcpy_usr_to_k(msgs[i].addr, params[i].sock_addr, msgs[i].addr_len);
+            if (obos_is_error(status))
+            {
+                i++;
+                break;
+            }
+        }
+    }
+    if (obos_is_error(status))
+    {
+        for (size_t j = 0; j < i+1 && j < nMsgs; j++)
+        {
+            if (msgs[j].buffer)
+                Mm_VirtualMemoryFree(&Mm_KernelContext, msgs[j].buffer, msgs[j].size);
+            if (msgs[j].addr)
+                Free(OBOS_KernelAllocator, msgs[j].addr, params[j].addr_length);
+        }
+        Free(OBOS_KernelAllocator, msgs, nMsgs*sizeof(*msgs));
+        Free(OBOS_KernelAllocator, params, nMsgs*sizeof(*params));
+        return status;
+    }
+    *kumsgs = params;
+    *kmsgs = msgs;
+    return OBOS_STATUS_SUCCESS;
+}
+
+// Copies the results of the first nCompleted messages back to userspace, then frees everything map_mmsgs allocated.
+static obos_status unmap_mmsgs(struct sys_socket_mmsg* umsgs, size_t nMsgs, size_t nCompleted, bool recv, struct sys_socket_mmsg* params, net_mmsg* msgs)
+{
+    obos_status status = OBOS_STATUS_SUCCESS;
+    for (size_t i = 0; i < nMsgs; i++)
+    {
+        const size_t addr_alloc_length = params[i].addr_length;
+        if (i < nCompleted)
+        {
+            params[i].nTransferred = msgs[i].nTransferred;
+            if (recv && msgs[i].addr)
+            {
+                obos_status copy_status = memcpy_k_to_usr(params[i].sock_addr, msgs[i].addr, OBOS_MIN(params[i].addr_length, msgs[i].addr_len));
+                if (obos_is_error(copy_status))
+                    status = copy_status;
+                params[i].addr_length = msgs[i].addr_len;
+            }
+        }
+        Mm_VirtualMemoryFree(&Mm_KernelContext, msgs[i].buffer, msgs[i].size);
+        if (msgs[i].addr)
+            Free(OBOS_KernelAllocator, msgs[i].addr, addr_alloc_length);
+    }
+    if (nCompleted)
+    {
+        obos_status copy_status = memcpy_k_to_usr(umsgs, params, nCompleted*sizeof(*params));
+        if (obos_is_error(copy_status))
+            status = copy_status;
+    }
+    Free(OBOS_KernelAllocator, msgs, nMsgs*sizeof(*msgs));
+    Free(OBOS_KernelAllocator, params, nMsgs*sizeof(*params));
+    return status;
+}
+
+static obos_status socket_mmsg(handle desc, struct sys_socket_mmsg* umsgs, size_t nMsgs, int flags, size_t* unCompleted, bool recv)
+{
+    OBOS_LockHandleTable(OBOS_CurrentHandleTable());
+    obos_status status = OBOS_STATUS_SUCCESS;
+    handle_desc* fd = OBOS_HandleLookup(OBOS_CurrentHandleTable(), desc, HANDLE_TYPE_FD, false, &status);
+    if (!fd)
+    {
+        OBOS_UnlockHandleTable(OBOS_CurrentHandleTable());
+        return status;
+    }
+    OBOS_UnlockHandleTable(OBOS_CurrentHandleTable());
+
+    struct sys_socket_mmsg* params = nullptr;
+    net_mmsg* msgs = nullptr;
+    status = map_mmsgs(umsgs, nMsgs, recv, &params, &msgs);
+    if (obos_is_error(status))
+        return status;
+
+    size_t nCompleted = 0;
+    if (recv)
+        status = Net_RecvMMsg(fd->un.fd, msgs, nMsgs, flags, &nCompleted);
+    else
+        status = Net_SendMMsg(fd->un.fd, msgs, nMsgs, flags, &nCompleted);
+
+    obos_status copy_status = unmap_mmsgs(umsgs, nMsgs, nCompleted, recv, params, msgs);
+    if (obos_is_success(status))
+        status = copy_status;
+    if (unCompleted && obos_is_success(status))
+        status = memcpy_k_to_usr(unCompleted, &nCompleted, sizeof(nCompleted));
+
+    if (CoreS_ForceYieldOnSyscallReturn)
+        CoreS_ForceYieldOnSyscallReturn();
+
+    return status;
+}
+
+obos_status Sys_SendMMsg(handle desc, struct sys_socket_mmsg* umsgs, size_t nMsgs, int flags, size_t* unSent)
+{
+    return socket_mmsg(desc, umsgs, nMsgs, flags, unSent, false);
+}
+
+obos_status Sys_RecvMMsg(handle desc, struct sys_socket_mmsg* umsgs, size_t nMsgs, int flags, size_t* unReceived)
+{
+    return socket_mmsg(desc, umsgs, nMsgs, flags, unReceived, true);
+}
+
 obos_status Sys_Listen(handle desc, int backlog)
 {
     OBOS_LockHandleTable(OBOS_CurrentHandleTable());
@@ -3252,3 +3391,9 @@ void Sys_UMask(uint32_t mask, uint32_t* oldmask)
         memcpy_k_to_usr(oldmask, &Core_GetCurrentThread()->proc->umask, sizeof(*oldmask));
     Core_GetCurrentThread()->proc->umask = mask;
 }
+
+obos_status Sys_GetPageCacheStats(pagecache_stats* ustats)
+{
+    pagecache_stats stats = Vfs_PageCacheStats;
+    return memcpy_k_to_usr(ustats, &stats, sizeof(stats));
+}
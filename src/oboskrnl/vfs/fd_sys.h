@@ -14,6 +14,7 @@
 #include <vfs/limits.h>
 #include <vfs/irp.h>
 #include <vfs/socket.h>
+#include <vfs/pagecache.h>
 
 #include <driver_interface/header.h>
 
@@ -494,6 +495,20 @@ struct sys_socket_io_params {
 };
 obos_status Sys_SendTo(handle fd, const void* buffer, size_t size, int flags, struct sys_socket_io_params *params);
 obos_status Sys_RecvFrom(handle fd, void* buffer, size_t size, int flags, struct sys_socket_io_params *params);
+// Maximum amount of messages per Sys_SendMMsg/Sys_RecvMMsg call.
+#define SYS_SOCKET_MMSG_MAX 1024
+struct sys_socket_mmsg {
+    void* buffer;
+    size_t size;
+    sockaddr* sock_addr;
+    // Untouched in sendmmsg, modified in recvmmsg
+    size_t addr_length;
+    // Set to the amount of bytes sent or received.
+    size_t nTransferred;
+};
+// Sends or receives several datagrams in one system call (see Net_SendMMsg and Net_RecvMMsg).
+obos_status Sys_SendMMsg(handle fd, struct sys_socket_mmsg* msgs, size_t nMsgs, int flags, size_t* nSent);
+obos_status Sys_RecvMMsg(handle fd, struct sys_socket_mmsg* msgs, size_t nMsgs, int flags, size_t* nReceived);
 obos_status Sys_Listen(handle fd, int backlog);
 obos_status Sys_Accept(handle fd, handle new_fd, sockaddr* addr_ptr, size_t *addr_length, int flags);
 obos_status Sys_Bind(handle fd, const sockaddr *addr, size_t addr_length);
@@ -503,3 +518,5 @@ obos_status Sys_PeerName(handle fd, sockaddr* addr, size_t addr_length, size_t*
 obos_status Sys_GetSockOpt(handle fd, int layer, int number, void *buffer, size_t *size);
 obos_status Sys_SetSockOpt(handle fd, int layer, int number, const void *buffer, size_t size);
 obos_status Sys_ShutdownSocket(handle fd, int how);
+
+obos_status Sys_GetPageCacheStats(pagecache_stats* stats);
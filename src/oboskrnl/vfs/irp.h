@@ -21,10 +21,26 @@ enum irp_op {
     IRP_WRITE,
 };
 
-// typedef struct nic_irp_data
-// {
-//     size_t packet_size;
-// } nic_irp_data;
+// Describes the transmit offloads requested for a frame written to a NIC.
+// The offload flags are the NET_OFFLOAD_* flags in net/eth.h.
+// Frames that request any offload do not have an FCS appended, the NIC must
+// insert it. The TCP/UDP checksum field of such frames holds the sum of the
+// IPv4 pseudo header (including the length of the TCP/UDP packet), which the
+// NIC must complete.
+typedef struct nic_irp_data
+{
+    uint32_t offload;
+    // The offset of the IPv4 header in the frame.
+    uint16_t l3_offset;
+    // The offset of the TCP/UDP header in the frame.
+    uint16_t l4_offset;
+    // The offset of the TCP payload in the frame.
+    // Only valid with NET_OFFLOAD_TCP_TSO.
+    uint16_t payload_offset;
+    // The maximum amount of TCP payload in each segment sent by the NIC.
+    // Only valid with NET_OFFLOAD_TCP_TSO.
+    uint16_t mss;
+} nic_irp_data;
 
 // Before using data from the IRP, make sure to call VfsH_IRPWait on the IRP.
 // Do not try to manually wait on the IRP, as there is tedious logic, and 
@@ -32,10 +48,9 @@ enum irp_op {
 // If you do, then good luck,
 // and godspeed.
 typedef struct irp {
-    // // Only valid for NIC drivers
-    // // Must be allocated with OBOS_KernelAllocator, the 
-    // // IRP submitter is responsible for freeing the object.
-    // nic_irp_data* nic_data;
+    // Only valid for writes to NIC drivers, can be nullptr.
+    // Owned by the IRP submitter, and must be alive until the IRP is complete.
+    const nic_irp_data* nic_data;
     // Set when the operation is complete.
     // The lifetime of the pointed object is completely controlled
     // by the driver, but needs to be alive until the event is set.
@@ -0,0 +1,401 @@
+/*
+ * oboskrnl/vfs/pagecache.c
+ *
+ * Copyright (c) 2025-2026 Omar Berrow
+*/
+
+#include <int.h>
+#include <error.h>
+#include <klog.h>
+#include <memmanip.h>
+
+#include <allocators/base.h>
+
+#include <locks/event.h>
+#include <locks/wait.h>
+#include <locks/spinlock.h>
+
+#include <irq/irql.h>
+
+#include <mm/page.h>
+#include <mm/pmm.h>
+#include <mm/swap.h>
+
+#include <vfs/irp.h>
+#include <vfs/vnode.h>
+#include <vfs/pagecache.h>
+
+#include <driver_interface/header.h>
+
+#include <stdatomic.h>
+
+/*
+ * On a miss, the page cache reads a window of pages instead of a single page.
+ * The window grows while a vnode is read sequentially, and falls back to a single page
+ * on random access. The pages of a window are allocated physically contiguous, so that
+ * the whole window is read with one command into the HHDM.
+ * The first readahead page of a window is marked, and accessing it starts reading
+ * the next window through an IRP, so that a sequential reader does not wait on the disk.
+ */
+
+#define READAHEAD_MIN_PAGES ((size_t)4)
+#define READAHEAD_MAX_PAGES ((size_t)32)
+
+typedef struct pagecache_ra_request
+{
+    vnode* vn;
+    irp* req;
+    uintptr_t phys;
+    size_t offset;
+    size_t nPages;
+    // Set once the IRP was submitted, or once it is known that the driver cannot take one.
+    event submitted;
+    // Set once the pages are filled.
+    event done;
+    atomic_flag claimed;
+    _Atomic(size_t) refs;
+} pagecache_ra_request;
+
+pagecache_stats Vfs_PageCacheStats;
+
+static obos_status get_driver(vnode* vn, driver_header** out)
+{
+    driver_header* driver = Vfs_GetVnodeDriver(vn);
+    if (!driver)
+        return OBOS_STATUS_INVALID_OPERATION;
+    if (!vn->blkSize)
+    {
+        driver->ftable.get_blk_size(vn->desc, &vn->blkSize);
+        OBOS_ASSERT(vn->blkSize);
+    }
+    if (out)
+        *out = driver;
+    return OBOS_STATUS_SUCCESS;
+}
+
+// vn->readahead.lock must be held.
+static page* find_page_locked(vnode* vn, size_t offset)
+{
+    page key = {.file_offset=offset, .backing_vn=vn};
+    return RB_FIND(pagecache_tree, &vn->cache, &key);
+}
+
+static page* find_page(vnode* vn, size_t offset)
+{
+    irql oldIrql = Core_SpinlockAcquire(&vn->readahead.lock);
+    page* pg = find_page_locked(vn, offset);
+    Core_SpinlockRelease(&vn->readahead.lock, oldIrql);
+    return pg;
+}
+
+static size_t next_window(size_t window)
+{
+    if (window < READAHEAD_MIN_PAGES)
+        return READAHEAD_MIN_PAGES;
+    return OBOS_MIN(window * 2, READAHEAD_MAX_PAGES);
+}
+
+// Makes page cache entries for up to nPages pages starting at offset, stopping before
+// the first page that is already cached. The pages are physically contiguous.
+// Returns the amount of entries made.
+static size_t make_run(vnode* vn, size_t offset, size_t nPages, phys_page_flags firstFlags, phys_page_flags flags, page** first, uintptr_t* physp)
+{
+    const size_t maxPages = (vn->filesize - offset + OBOS_PAGE_SIZE - 1) / OBOS_PAGE_SIZE;
+    if (nPages > maxPages)
+        nPages = maxPages;
+    OBOS_ASSERT(nPages <= READAHEAD_MAX_PAGES);
+    for (size_t i = 1; i < nPages; i++)
+    {
+        if (find_page(vn, offset + i*OBOS_PAGE_SIZE))
+        {
+            nPages = i;
+            break;
+        }
+    }
+    uintptr_t phys = 0;
+    for (; nPages > 1 && !phys; nPages /= 2)
+        if ((phys = Mm_AllocatePhysicalPages(nPages, 1, nullptr)))
+            break;
+    if (!phys)
+    {
+        nPages = 1;
+        phys = Mm_AllocatePhysicalPages(1, 1, nullptr);
+    }
+    if (!phys)
+        return 0;
+    // Allocating can block, so make the page structs before taking the lock.
+    page* pages[READAHEAD_MAX_PAGES] = {};
+    for (size_t i = 0; i < nPages; i++)
+        pages[i] = MmH_AllocatePage(phys + i*OBOS_PAGE_SIZE, false);
+
+    // Someone else might have cached some of these pages since they were looked up,
+    // so look them up again with the tree locked, and stop at the first one that exists.
+    size_t nInserted = 0;
+    irql oldIrql = Core_SpinlockAcquire(&vn->readahead.lock);
+    for (; nInserted < nPages; nInserted++)
+    {
+        const size_t pg_offset = offset + nInserted*OBOS_PAGE_SIZE;
+        if (find_page_locked(vn, pg_offset))
+            break;
+        page* pg = pages[nInserted];
+        pg->backing_vn = vn;
+        pg->file_offset = pg_offset;
+        pg->end_offset = OBOS_MIN(pg->file_offset + OBOS_PAGE_SIZE, vn->filesize);
+        pg->flags |= nInserted ? flags : firstFlags;
+        vn->refs++;
+        RB_INSERT(pagecache_tree, &vn->cache, pg);
+        Mm_CachedBytes += pg->end_offset - pg->file_offset;
+    }
+    Core_SpinlockRelease(&vn->readahead.lock, oldIrql);
+    // Give back the pages that lost the race.
+    for (size_t i = nInserted; i < nPages; i++)
+        MmH_DerefPage(pages[i]);
+    if (nInserted && first)
+        *first = pages[0];
+    *physp = phys;
+    return nInserted;
+}
+
+static obos_status read_run_sync(vnode* vn, driver_header* driver, uintptr_t phys, size_t offset, size_t nPages)
+{
+    const size_t base_offset = vn->flags & VFLAGS_PARTITION ? (vn->partitions[0].off/vn->blkSize) : 0;
+    Vfs_PageCacheStats.nReadCommands++;
+    return driver->ftable.read_sync(vn->desc, MmS_MapVirtFromPhys(phys), nPages * OBOS_PAGE_SIZE / vn->blkSize, offset / vn->blkSize + base_offset, nullptr);
+}
+
+static void ra_unref(pagecache_ra_request* r)
+{
+    if (!(--r->refs))
+        Free(OBOS_KernelAllocator, r, sizeof(*r));
+}
+
+// Waits for an asynchronous readahead to fill its pages.
+// The first thread to get here finishes the request, and the others wait for it to do so.
+static void complete_readahead(pagecache_ra_request* r)
+{
+    if (atomic_flag_test_and_set(&r->claimed))
+    {
+        (void)Core_WaitOnObject(WAITABLE_OBJECT(r->done));
+        return;
+    }
+    (void)Core_WaitOnObject(WAITABLE_OBJECT(r->submitted));
+    vnode* const vn = r->vn;
+    obos_status status = OBOS_STATUS_SUCCESS;
+    const bool hadIrp = r->req != nullptr;
+    if (hadIrp)
+    {
+        status = VfsH_IRPWait(r->req);
+        if (obos_is_success(status) && r->req->nBlkRead != r->req->blkCount)
+            status = OBOS_STATUS_INTERNAL_ERROR;
+        VfsH_IRPUnref(r->req);
+        r->req = nullptr;
+    }
+    // Drivers without IRP support are read synchronously on first access instead.
+    driver_header* driver = nullptr;
+    if (r->nPages && (!hadIrp || obos_is_error(status)) && obos_is_success(get_driver(vn, &driver)))
+        status = read_run_sync(vn, driver, r->phys, r->offset, r->nPages);
+    for (size_t i = 0; i < r->nPages; i++)
+    {
+        page* pg = MmH_LookupPage(r->phys + i*OBOS_PAGE_SIZE);
+        if (!pg || pg->backing_vn != vn)
+            continue;
+        if (obos_is_error(status))
+            pg->flags |= PHYS_PAGE_INVALID;
+        pg->flags &= ~PHYS_PAGE_READ_PENDING;
+    }
+    irql oldIrql = Core_SpinlockAcquire(&vn->readahead.lock);
+    const bool wasPending = vn->readahead.pending == r;
+    if (wasPending)
+        vn->readahead.pending = nullptr;
+    Core_SpinlockRelease(&vn->readahead.lock, oldIrql);
+    Core_EventSet(&r->done, false);
+    if (wasPending)
+        ra_unref(r);
+}
+
+static void wait_for_readahead(vnode* vn)
+{
+    irql oldIrql = Core_SpinlockAcquire(&vn->readahead.lock);
+    pagecache_ra_request* r = vn->readahead.pending;
+    if (r)
+        r->refs++;
+    Core_SpinlockRelease(&vn->readahead.lock, oldIrql);
+    if (!r)
+        return;
+    complete_readahead(r);
+    ra_unref(r);
+}
+
+// Starts reading the next readahead window of vn.
+static void start_async_readahead(vnode* vn)
+{
+    driver_header* driver = nullptr;
+    if (obos_is_error(get_driver(vn, &driver)))
+        return;
+    pagecache_readahead* const ra = &vn->readahead;
+    pagecache_ra_request* r = ZeroAllocate(OBOS_KernelAllocator, 1, sizeof(*r), nullptr);
+    if (!r)
+        return;
+    r->vn = vn;
+    r->submitted = EVENT_INITIALIZE(EVENT_NOTIFICATION);
+    r->done = EVENT_INITIALIZE(EVENT_NOTIFICATION);
+    r->refs = 2; // One for ra->pending, and one for us.
+
+    irql oldIrql = Core_SpinlockAcquire(&ra->lock);
+    while (ra->pending)
+    {
+        // Only one readahead can be in progress per vnode, so finish the last one first.
+        pagecache_ra_request* last = ra->pending;
+        last->refs++;
+        Core_SpinlockRelease(&ra->lock, oldIrql);
+        complete_readahead(last);
+        ra_unref(last);
+        oldIrql = Core_SpinlockAcquire(&ra->lock);
+    }
+    const size_t offset = ra->nextOffset;
+    if (offset >= vn->filesize || find_page_locked(vn, offset))
+    {
+        Core_SpinlockRelease(&ra->lock, oldIrql);
+        Free(OBOS_KernelAllocator, r, sizeof(*r));
+        return;
+    }
+    ra->window = next_window(ra->window);
+    size_t nPages = ra->window;
+    ra->nextOffset = offset + nPages*OBOS_PAGE_SIZE;
+    ra->pending = r;
+    Core_SpinlockRelease(&ra->lock, oldIrql);
+
+    page* first = nullptr;
+    uintptr_t phys = 0;
+    const size_t nWanted = nPages;
+    nPages = make_run(vn, offset, nPages, PHYS_PAGE_READAHEAD|PHYS_PAGE_READ_PENDING|PHYS_PAGE_READAHEAD_MARK, PHYS_PAGE_READAHEAD|PHYS_PAGE_READ_PENDING, &first, &phys);
+    r->phys = phys;
+    r->offset = offset;
+    r->nPages = nPages;
+    if (nPages != nWanted)
+    {
+        oldIrql = Core_SpinlockAcquire(&ra->lock);
+        if (ra->nextOffset == offset + nWanted*OBOS_PAGE_SIZE)
+            ra->nextOffset = offset + nPages*OBOS_PAGE_SIZE;
+        Core_SpinlockRelease(&ra->lock, oldIrql);
+    }
+    if (nPages)
+    {
+        Vfs_PageCacheStats.nReadaheadPages += nPages;
+        irp* req = VfsH_IRPAllocate();
+        req->vn = vn;
+        req->buff = MmS_MapVirtFromPhys(phys);
+        req->op = IRP_READ;
+        req->dryOp = false;
+        req->status = OBOS_STATUS_SUCCESS;
+        req->blkCount = nPages * OBOS_PAGE_SIZE / vn->blkSize;
+        req->blkOffset = offset / vn->blkSize;
+        if (obos_is_success(VfsH_IRPSubmit(req, nullptr)))
+        {
+            r->req = req;
+            Vfs_PageCacheStats.nAsyncReadaheads++;
+            Vfs_PageCacheStats.nReadCommands++;
+        }
+        else
+            VfsH_IRPUnref(req);
+    }
+    Core_EventSet(&r->submitted, false);
+    ra_unref(r);
+}
+
+page* VfsH_PageCacheLookup(vnode* vn, size_t offset, bool canWait)
+{
+    offset -= (offset % OBOS_PAGE_SIZE);
+    page* pg = find_page(vn, offset);
+    if (!pg)
+        return nullptr;
+    if (pg->flags & PHYS_PAGE_READ_PENDING)
+    {
+        if (!canWait)
+            return nullptr;
+        wait_for_readahead(vn);
+    }
+    Vfs_PageCacheStats.nHits++;
+    if (pg->flags & PHYS_PAGE_READAHEAD)
+    {
+        pg->flags &= ~PHYS_PAGE_READAHEAD;
+        Vfs_PageCacheStats.nReadaheadHits++;
+    }
+    if (canWait && (pg->flags & PHYS_PAGE_READAHEAD_MARK))
+    {
+        pg->flags &= ~PHYS_PAGE_READAHEAD_MARK;
+        start_async_readahead(vn);
+    }
+    return pg;
+}
+
+page* VfsH_PageCacheCreateEntry(vnode* vn, size_t offset)
+{
+    if (vn->flags & VFLAGS_FB)
+        return nullptr;
+    if (vn->filesize <= offset)
+        return nullptr;
+    offset -= (offset % OBOS_PAGE_SIZE);
+    page* pg = find_page(vn, offset);
+    if (pg)
+        return (pg->flags & PHYS_PAGE_READ_PENDING) ? nullptr : pg;
+    driver_header* driver = nullptr;
+    if (obos_is_error(get_driver(vn, &driver)))
+        return nullptr;
+
+    // Readahead can block on allocations, so only do it when we are allowed to block.
+    size_t nPages = 1;
+    pagecache_readahead* const ra = &vn->readahead;
+    const bool readahead = Core_GetIrql() < IRQL_DISPATCH;
+    if (readahead)
+    {
+        irql oldIrql = Core_SpinlockAcquire(&ra->lock);
+        if (offset == ra->nextOffset)
+            ra->window = next_window(ra->window);
+        else
+            ra->window = 1;
+        nPages = ra->window;
+        Core_SpinlockRelease(&ra->lock, oldIrql);
+    }
+
+    uintptr_t phys = 0;
+    nPages = make_run(vn, offset, nPages, 0, PHYS_PAGE_READAHEAD, &pg, &phys);
+    if (!nPages)
+    {
+        // Either we are out of memory, or someone else cached the page first.
+        pg = find_page(vn, offset);
+        return (pg && !(pg->flags & PHYS_PAGE_READ_PENDING)) ? pg : nullptr;
+    }
+    if (nPages > 1)
+        MmH_LookupPage(phys + OBOS_PAGE_SIZE)->flags |= PHYS_PAGE_READAHEAD_MARK;
+    if (readahead)
+    {
+        irql oldIrql = Core_SpinlockAcquire(&ra->lock);
+        ra->nextOffset = offset + nPages*OBOS_PAGE_SIZE;
+        Core_SpinlockRelease(&ra->lock, oldIrql);
+    }
+    Vfs_PageCacheStats.nMisses++;
+    Vfs_PageCacheStats.nReadaheadPages += nPages - 1;
+    OBOS_ENSURE(obos_is_success(read_run_sync(vn, driver, phys, offset, nPages)));
+    return pg;
+}
+
+void* VfsH_PageCacheGetEntry(vnode* vn, size_t offset, page** ent)
+{
+    if (obos_is_error(get_driver(vn, nullptr)))
+        return nullptr;
+    uintptr_t pg_offset = offset % OBOS_PAGE_SIZE;
+    offset -= (offset % OBOS_PAGE_SIZE);
+    page* phys = VfsH_PageCacheLookup(vn, offset, true);
+    if (!phys)
+    {
+        phys = VfsH_PageCacheCreateEntry(vn, offset);
+        if (!phys)
+            return nullptr;
+    }
+    else if (phys->flags & PHYS_PAGE_INVALID)
+        return nullptr;
+    if (ent)
+        *ent = phys;
+    return MmS_MapVirtFromPhys(phys->phys) + pg_offset;
+}
@@ -23,57 +23,30 @@
 
 #include <driver_interface/header.h>
 
-static inline page* VfsH_PageCacheCreateEntry(vnode* vn, size_t offset)
+// Updated concurrently by every reader of the page cache.
+typedef struct pagecache_stats
 {
-    if (vn->flags & VFLAGS_FB)
-        return nullptr;
-    if (vn->filesize <= offset)
-        return nullptr;
-    vn->refs++;
-    page* phys = MmH_PgAllocatePhysical(false, false);
-    phys->backing_vn = vn;
-    phys->file_offset = offset;
-    phys->file_offset -= (phys->file_offset % OBOS_PAGE_SIZE);
-    phys->end_offset = OBOS_MIN(phys->file_offset + OBOS_PAGE_SIZE, vn->filesize);
-    RB_INSERT(pagecache_tree, &vn->cache, phys);
-    driver_header* driver = Vfs_GetVnodeDriver(vn);
-    if (!driver) return nullptr;
-    if (!vn->blkSize)
-    {
-        driver->ftable.get_blk_size(vn->desc, &vn->blkSize);
-        OBOS_ASSERT(vn->blkSize);
-    }
-    Mm_CachedBytes += phys->end_offset - phys->file_offset;
-    const size_t base_offset = vn->flags & VFLAGS_PARTITION ? (vn->partitions[0].off/vn->blkSize) : 0;
-    offset /= vn->blkSize;
-    OBOS_ENSURE(obos_is_success(driver->ftable.read_sync(vn->desc, MmS_MapVirtFromPhys(phys->phys), OBOS_PAGE_SIZE / vn->blkSize, offset+base_offset, nullptr)));
-    return phys;
-}
-static inline void* VfsH_PageCacheGetEntry(vnode* vn, size_t offset, page** ent)
-{
-    if (!vn->blkSize)
-    {
-        driver_header* driver = Vfs_GetVnodeDriver(vn);
-        if (!driver) return nullptr;
-        driver->ftable.get_blk_size(vn->desc, &vn->blkSize);
-        OBOS_ASSERT(vn->blkSize);
-    }
-    uintptr_t pg_offset = offset % OBOS_PAGE_SIZE;
-    offset -= (offset % OBOS_PAGE_SIZE);
-    page key = {.file_offset=offset, .backing_vn=vn};
-    page* phys = RB_FIND(pagecache_tree, &vn->cache, &key);
-    if (!phys)
-    {
-        phys = VfsH_PageCacheCreateEntry(vn, offset);
-        if (!phys)
-            return nullptr;
-        if (ent)
-            *ent = phys;
-        return MmS_MapVirtFromPhys(phys->phys) + pg_offset;
-    }
-    if (phys->flags & PHYS_PAGE_INVALID)
-        return nullptr;
-    if (ent)
-        *ent = phys;
-    return MmS_MapVirtFromPhys(phys->phys) + pg_offset;
-}
\ No newline at end of file
+    // The amount of page cache lookups that found the page.
+    _Atomic(size_t) nHits;
+    // The amount of page cache lookups that had to read the page.
+    _Atomic(size_t) nMisses;
+    // The amount of pages read ahead of a reader.
+    _Atomic(size_t) nReadaheadPages;
+    // The amount of pages read ahead of a reader that were accessed afterwards.
+    _Atomic(size_t) nReadaheadHits;
+    // The amount of readahead windows read through IRPs.
+    _Atomic(size_t) nAsyncReadaheads;
+    // The amount of read commands sent to drivers to fill the page cache.
+    _Atomic(size_t) nReadCommands;
+} pagecache_stats;
+OBOS_EXPORT extern pagecache_stats Vfs_PageCacheStats;
+
+// Looks up the page cache entry of offset, without reading it if it isn't cached.
+// If canWait is false, entries that are still being read are treated as not cached.
+OBOS_EXPORT page* VfsH_PageCacheLookup(vnode* vn, size_t offset, bool canWait);
+// Reads the page at offset into the page cache, along with the readahead window of the vnode.
+// Returns nullptr if the offset is out of bounds, or if the page is already being read.
+OBOS_EXPORT page* VfsH_PageCacheCreateEntry(vnode* vn, size_t offset);
+// Gets the page cache entry of offset, reading it if needed.
+// Returns the address of offset in the HHDM.
+OBOS_EXPORT void* VfsH_PageCacheGetEntry(vnode* vn, size_t offset, page** ent);
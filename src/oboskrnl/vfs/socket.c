@@ -498,9 +498,7 @@ obos_status Net_RecvFrom(fd* socket, void* buffer, size_t sz, int flags, size_t
         VfsH_IRPUnref(req);
         return status;
     }
-    // if (((flags & MSG_DONTWAIT) || (socket->flags & FD_FLAGS_NOBLOCK)))
-    //     printf("ohwowanonblockingsockethownice\n");
-    if (socket->flags & FD_FLAGS_NOBLOCK)
+    if ((flags & MSG_DONTWAIT) || (socket->flags & FD_FLAGS_NOBLOCK))
     {
         if ((req->evnt && req->evnt->hdr.signaled) || !req->evnt)
             status = VfsH_IRPWait(req);
@@ -541,6 +539,48 @@ obos_status Net_SendTo(fd* socket, const void* buffer, size_t sz, int flags, siz
     return status;
 }
 
+obos_status Net_RecvMMsg(fd* socket, net_mmsg* msgs, size_t nMsgs, int flags, size_t* nReceived)
+{
+    validate_fd_status(socket);
+    if (!msgs && nMsgs)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    obos_status status = OBOS_STATUS_SUCCESS;
+    size_t i = 0;
+    for (; i < nMsgs; i++)
+    {
+        int msg_flags = flags & ~MSG_WAITFORONE;
+        if (i && (flags & MSG_WAITFORONE))
+            msg_flags |= MSG_DONTWAIT;
+        msgs[i].nTransferred = 0;
+        status = Net_RecvFrom(socket, msgs[i].buffer, msgs[i].size, msg_flags, &msgs[i].nTransferred, msgs[i].addr, msgs[i].addr ? &msgs[i].addr_len : nullptr);
+        if (obos_is_error(status))
+            break;
+    }
+    if (nReceived)
+        *nReceived = i;
+    // Like recvmmsg, an error is only reported if no message was received.
+    return i ? OBOS_STATUS_SUCCESS : status;
+}
+
+obos_status Net_SendMMsg(fd* socket, net_mmsg* msgs, size_t nMsgs, int flags, size_t* nSent)
+{
+    validate_fd_status(socket);
+    if (!msgs && nMsgs)
+        return OBOS_STATUS_INVALID_ARGUMENT;
+    obos_status status = OBOS_STATUS_SUCCESS;
+    size_t i = 0;
+    for (; i < nMsgs; i++)
+    {
+        msgs[i].nTransferred = 0;
+        status = Net_SendTo(socket, msgs[i].buffer, msgs[i].size, flags, &msgs[i].nTransferred, msgs[i].addr, msgs[i].addr_len);
+        if (obos_is_error(status))
+            break;
+    }
+    if (nSent)
+        *nSent = i;
+    return i ? OBOS_STATUS_SUCCESS : status;
+}
+
 obos_status Net_Shutdown(fd* socket, int how)
 {
     validate_fd_status(socket);
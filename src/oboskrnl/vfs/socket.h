@@ -69,6 +69,24 @@ obos_status Net_RecvFrom(fd* socket, void* buffer, size_t sz, int flags, size_t
 obos_status Net_SendTo(fd* socket, const void* buffer, size_t sz, int flags, size_t *nWritten, sockaddr* addr, size_t addr_len);
 #define Net_Recv(socket,buffer,sz,flags,nRead) Net_RecvFrom(socket,buffer,sz,flags,nRead,nullptr,0)
 #define Net_Send(socket,buffer,sz,flags,nWritten) Net_SendTo(socket,buffer,sz,flags,nWritten,nullptr,0)
+// A message for Net_RecvMMsg and Net_SendMMsg.
+typedef struct net_mmsg {
+    void* buffer;
+    size_t size;
+    // The peer address, can be nullptr.
+    sockaddr* addr;
+    size_t addr_len;
+    // Set to the amount of bytes received or sent.
+    size_t nTransferred;
+} net_mmsg;
+// Receives up to nMsgs datagrams, like calling Net_RecvFrom for each message.
+// If MSG_WAITFORONE is set, only the first message is waited for, and receiving
+// stops at the first message that would block.
+// Returns an error only if no message was received, and sets *nReceived to the amount of messages received.
+obos_status Net_RecvMMsg(fd* socket, net_mmsg* msgs, size_t nMsgs, int flags, size_t* nReceived);
+// Sends up to nMsgs datagrams, like calling Net_SendTo for each message.
+// Returns an error only if no message was sent, and sets *nSent to the amount of messages sent.
+obos_status Net_SendMMsg(fd* socket, net_mmsg* msgs, size_t nMsgs, int flags, size_t* nSent);
 obos_status Net_Shutdown(fd* desc, int how);
 obos_status Net_SockAtMark(fd* desc);
 
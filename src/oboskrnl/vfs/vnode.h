@@ -18,6 +18,7 @@
 #include <mm/page.h>
 
 #include <locks/mutex.h>
+#include <locks/spinlock.h>
 
 enum
 {
@@ -74,6 +75,20 @@ struct file_times
     long birth;
 };
 
+// The sequential access detection and readahead state of a vnode's page cache.
+// See vfs/pagecache.c
+typedef struct pagecache_readahead
+{
+    // Also protects the vnode's page cache tree.
+    spinlock lock;
+    // The file offset that the next page cache miss is at if the file is being read sequentially.
+    size_t nextOffset;
+    // The current readahead window, in pages.
+    size_t window;
+    // The asynchronous readahead in progress, if any.
+    struct pagecache_ra_request* pending;
+} pagecache_readahead;
+
 typedef driver_file_perm file_perm;
 typedef struct vnode
 {
@@ -116,6 +131,7 @@ typedef struct vnode
     int seals;
 
     pagecache_tree cache;
+    pagecache_readahead readahead;
 } vnode;
 
 OBOS_EXPORT vnode* Drv_AllocateVNode(driver_id* drv, dev_desc desc, size_t filesize, vdev** dev, uint32_t type);
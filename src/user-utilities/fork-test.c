@@ -1,16 +1,121 @@
+/*
+ * user-utilities/fork-test.c
+ *
+ * Copyright (c) 2024-2026 Omar Berrow
+ *
+ * Fork latency benchmark.
+ * Touches a buffer of anonymous memory, then repeatedly forks a child
+ * that exits right away (or after writing to every page of the buffer),
+ * and measures how long fork() takes to return in the parent.
+*/
+
 #include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+const char* usage = "Usage: %s [-m megabytes] [-n iterations] [-w]\n";
+
+static uint64_t now_ns()
+{
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-int main(int argc, char** argv, char** envp)
+int main(int argc, char** argv)
 {
-    printf("testing fork\n");
-    pid_t pid = fork();
-    if (pid == 0)
-        printf("in child, we are %d\n", getpid());
-    else if (pid > 0)
-        printf("in parent, child is %d\n", pid);
-    else
-        printf("error\n");
+    size_t megabytes = 64;
+    long iterations = 20;
+    bool child_writes = false;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "hm:n:w")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                megabytes = strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                iterations = strtol(optarg, NULL, 0);
+                break;
+            case 'w':
+                child_writes = true;
+                break;
+            case 'h':
+            default:
+                fprintf(stderr, usage, argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (iterations < 1)
+        iterations = 1;
+
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t size = megabytes * 1024 * 1024;
+    uint8_t* buf = NULL;
+    if (size)
+    {
+        buf = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED)
+        {
+            perror("mmap");
+            return 1;
+        }
+        // Make every page resident, so that fork has something to copy.
+        for (size_t off = 0; off < size; off += page_size)
+            buf[off] = 1;
+    }
+
+    printf("forking %ld times with %zu MiB of resident anonymous memory%s\n", iterations, megabytes, child_writes ? ", child writes every page" : "");
+    uint64_t fork_min = UINT64_MAX, fork_max = 0, fork_total = 0;
+    uint64_t round_trip_total = 0;
+    for (long i = 0; i < iterations; i++)
+    {
+        const uint64_t start = now_ns();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            if (child_writes)
+                for (size_t off = 0; off < size; off += page_size)
+                    buf[off] = 2;
+            _exit(0);
+        }
+        const uint64_t forked = now_ns();
+        if (pid < 0)
+        {
+            perror("fork");
+            return 1;
+        }
+        int wstatus = 0;
+        while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR)
+            ;
+        const uint64_t end = now_ns();
+
+        const uint64_t elapsed = forked - start;
+        fork_total += elapsed;
+        round_trip_total += end - start;
+        if (elapsed < fork_min)
+            fork_min = elapsed;
+        if (elapsed > fork_max)
+            fork_max = elapsed;
+    }
+
+    printf("fork:       min %llu us, avg %llu us, max %llu us\n",
+        (unsigned long long)fork_min / 1000, (unsigned long long)fork_total / iterations / 1000, (unsigned long long)fork_max / 1000);
+    printf("round trip: avg %llu us (fork, exit, and wait)\n",
+        (unsigned long long)round_trip_total / iterations / 1000);
+    if (size)
+        printf("per MiB:    %llu ns\n", (unsigned long long)(fork_total / iterations / (megabytes ? megabytes : 1)));
+
+    if (buf)
+        munmap(buf, size);
     return 0;
 }
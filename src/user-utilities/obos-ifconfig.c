@@ -34,8 +34,85 @@ enum {
     IOCTL_IFACE_SET_DEFAULT_GATEWAY,
     IOCTL_IFACE_UNSET_DEFAULT_GATEWAY,
     IOCTL_IFACE_INITIALIZE,
+    IOCTL_IFACE_GET_POLL_STATS,
+    IOCTL_IFACE_GET_DISPATCH_STATS,
+    IOCTL_IFACE_GET_OFFLOAD_CAPS,
+    IOCTL_IFACE_GET_OFFLOAD_INFO,
+    IOCTL_IFACE_SET_OFFLOADS,
+    IOCTL_IFACE_GET_ARP_STATS,
 };
 
+// See oboskrnl/net/poll.h
+typedef struct net_poll_stats {
+    size_t nPolls;
+    size_t nFrames;
+    size_t nInterrupts;
+    size_t nInterruptsAvoided;
+    size_t nBudgetExhausted;
+} net_poll_stats;
+
+// See oboskrnl/net/tables.h
+typedef struct net_dispatch_stats {
+    uint32_t cpu;
+    size_t nFrames;
+    size_t nDropped;
+    size_t maxQueued;
+} net_dispatch_stats;
+
+// See oboskrnl/net/tables.h
+typedef struct net_arp_stats {
+    size_t nRequests;
+    size_t nResolved;
+    size_t nFailed;
+    size_t nQueued;
+    size_t nDropped;
+    size_t nNegativeHits;
+} net_arp_stats;
+
+// See oboskrnl/net/eth.h
+enum {
+    NET_OFFLOAD_IPv4_CHECKSUM = 0b0001,
+     NET_OFFLOAD_TCP_CHECKSUM = 0b0010,
+     NET_OFFLOAD_UDP_CHECKSUM = 0b0100,
+          NET_OFFLOAD_TCP_TSO = 0b1000,
+};
+
+typedef struct net_offload_info {
+    struct {
+        uint32_t flags;
+        uint32_t tso_max_size;
+    } caps;
+    uint32_t enabled;
+    struct {
+        size_t nChecksumOffloaded;
+        size_t nChecksumSoftware;
+        size_t nTSOSends;
+        size_t nTSOSegments;
+        size_t nSoftwareSplits;
+        size_t nSoftwareSegments;
+    } stats;
+} net_offload_info;
+
+static const struct {
+    const char* name;
+    uint32_t flag;
+} offload_names[] = {
+    { "ipv4-csum", NET_OFFLOAD_IPv4_CHECKSUM },
+    { "tcp-csum", NET_OFFLOAD_TCP_CHECKSUM },
+    { "udp-csum", NET_OFFLOAD_UDP_CHECKSUM },
+    { "tso", NET_OFFLOAD_TCP_TSO },
+};
+
+static void print_offloads(uint32_t flags)
+{
+    if (!flags)
+        printf(" none");
+    for (size_t i = 0; i < sizeof(offload_names)/sizeof(*offload_names); i++)
+        if (flags & offload_names[i].flag)
+            printf(" %s", offload_names[i].name);
+    printf("\n");
+}
+
 typedef union ip_addr {
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
     struct {
@@ -196,6 +273,93 @@ int main(int argc, char** argv)
             free(flags_str);
         }
     }
+    else if (strcasecmp(cmd, "dispatch-stats") == 0)
+    {
+        struct {
+            net_dispatch_stats* buf;
+            size_t sz;
+        } workers = {
+            .buf = NULL,
+            .sz = 0,
+        };
+        res = ioctl(dev, IOCTL_IFACE_GET_DISPATCH_STATS, &workers);
+        if (res < 0) goto fail;
+        workers.buf = malloc(workers.sz);
+        res = ioctl(dev, IOCTL_IFACE_GET_DISPATCH_STATS, &workers);
+        if (res < 0) goto fail;
+        printf("Dispatch workers for %s:\n", iface);
+        for (size_t i = 0; i < (workers.sz / sizeof(net_dispatch_stats)); i++)
+            printf("  cpu %u: frames: %zu, dropped: %zu, max queued: %zu\n",
+                workers.buf[i].cpu, workers.buf[i].nFrames, workers.buf[i].nDropped, workers.buf[i].maxQueued);
+        free(workers.buf);
+    }
+    else if (strcasecmp(cmd, "offloads") == 0)
+    {
+        net_offload_info info = {};
+        res = ioctl(dev, IOCTL_IFACE_GET_OFFLOAD_INFO, &info);
+        if (res < 0) goto fail;
+        printf("Transmit offloads for %s:\n", iface);
+        printf("  supported:");
+        print_offloads(info.caps.flags);
+        printf("  enabled:");
+        print_offloads(info.enabled);
+        if (info.caps.flags & NET_OFFLOAD_TCP_TSO)
+            printf("  max TSO packet size: %u\n", info.caps.tso_max_size);
+        printf("  packets with offloaded checksums: %zu, with software checksums: %zu\n",
+            info.stats.nChecksumOffloaded, info.stats.nChecksumSoftware);
+        printf("  TSO sends: %zu (%zu segments)\n", info.stats.nTSOSends, info.stats.nTSOSegments);
+        printf("  software segmentations: %zu (%zu segments)\n", info.stats.nSoftwareSplits, info.stats.nSoftwareSegments);
+    }
+    else if (strcasecmp(cmd, "set-offloads") == 0)
+    {
+        if (cmd_argc < 2)
+        {
+            fprintf(stderr, "%s needs at least 1 argument\n", cmd);
+            fprintf(stderr, "Usage: %s none|offload...\n", cmd);
+            fprintf(stderr, "Offloads: ipv4-csum tcp-csum udp-csum tso\n");
+            goto fail;
+        }
+        uint32_t flags = 0;
+        for (int i = 1; i < cmd_argc; i++)
+        {
+            if (strcasecmp(cmd_argv[i], "none") == 0)
+                continue;
+            size_t j = 0;
+            for (; j < sizeof(offload_names)/sizeof(*offload_names); j++)
+                if (strcasecmp(cmd_argv[i], offload_names[j].name) == 0)
+                    break;
+            if (j == sizeof(offload_names)/sizeof(*offload_names))
+            {
+                fprintf(stderr, "%s: unknown offload %s\n", cmd, cmd_argv[i]);
+                goto fail;
+            }
+            flags |= offload_names[j].flag;
+        }
+        res = ioctl(dev, IOCTL_IFACE_SET_OFFLOADS, &flags);
+    }
+    else if (strcasecmp(cmd, "arp-stats") == 0)
+    {
+        net_arp_stats stats = {};
+        res = ioctl(dev, IOCTL_IFACE_GET_ARP_STATS, &stats);
+        if (res < 0) goto fail;
+        printf("ARP statistics for %s:\n", iface);
+        printf("  requests sent: %zu, addresses resolved: %zu, failed: %zu\n", stats.nRequests, stats.nResolved, stats.nFailed);
+        printf("  frames queued while resolving: %zu, dropped: %zu\n", stats.nQueued, stats.nDropped);
+        printf("  frames dropped to unreachable addresses: %zu\n", stats.nNegativeHits);
+    }
+    else if (strcasecmp(cmd, "poll-stats") == 0)
+    {
+        net_poll_stats stats = {};
+        res = ioctl(dev, IOCTL_IFACE_GET_POLL_STATS, &stats);
+        if (res < 0) goto fail;
+        printf("RX polling statistics for %s:\n", iface);
+        printf("  polls: %zu, frames: %zu (%zu.%02zu frames/poll)\n",
+            stats.nPolls, stats.nFrames,
+            stats.nPolls ? stats.nFrames / stats.nPolls : 0,
+            stats.nPolls ? (stats.nFrames * 100 / stats.nPolls) % 100 : 0);
+        printf("  interrupts: %zu, interrupts avoided: %zu\n", stats.nInterrupts, stats.nInterruptsAvoided);
+        printf("  polls that exhausted their budget: %zu\n", stats.nBudgetExhausted);
+    }
     else if (strcasecmp(cmd, "routing-table") == 0)
     {
         mac_address iface_phys = {};
@@ -418,7 +582,7 @@ int main(int argc, char** argv)
         if (res < 0) goto fail;
     }
     else if (strcasecmp(cmd, "help") == 0)
-        printf("Valid commands: init, clear-arp-cache, clear-route-cache, unset-default-router, ip-table, routing-table, ip-address-add, ip-address-delete, set-default-router, router-add, router-delete, help\n");
+        printf("Valid commands: init, clear-arp-cache, arp-stats, clear-route-cache, unset-default-router, ip-table, routing-table, ip-address-add, ip-address-delete, set-default-router, router-add, router-delete, help\n");
     else
         fprintf(stderr, "Unrecognized command %s\n", cmd);
     
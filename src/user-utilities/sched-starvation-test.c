@@ -0,0 +1,125 @@
+/*
+ * user-utilities/sched-starvation-test.c
+ *
+ * Copyright (c) 2026 Omar Berrow
+ *
+ * Scheduler starvation stress test.
+ * Starts a number of THREAD_PRIORITY_HIGH threads that never block, then
+ * measures how long a THREAD_PRIORITY_NORMAL thread goes without running.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <obos/syscall.h>
+
+const char* usage = "Usage: %s [-t threads] [-s seconds] [-b max_wait_ms]\n";
+
+// See oboskrnl/scheduler/thread.h
+#define PRIORITY_NORMAL 2
+#define PRIORITY_HIGH 3
+// See oboskrnl/handle.h
+#ifndef HANDLE_CURRENT
+#   define HANDLE_CURRENT ((uint32_t)0xfe << 24)
+#endif
+
+static volatile bool s_stop = false;
+
+static uint64_t now_ns()
+{
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* hog(void* udata)
+{
+    (void)udata;
+    int priority = PRIORITY_HIGH;
+    if (syscall3(Sys_ThreadPriority, HANDLE_CURRENT, &priority, NULL) != 0)
+        fprintf(stderr, "Could not raise the priority of a hog thread. Are you root?\n");
+    while (!s_stop)
+        asm volatile ("" : : : "memory");
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    long nThreads = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+    long seconds = 5;
+    uint64_t max_wait_ms = 500;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "ht:s:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                nThreads = strtol(optarg, NULL, 0);
+                break;
+            case 's':
+                seconds = strtol(optarg, NULL, 0);
+                break;
+            case 'b':
+                max_wait_ms = strtoull(optarg, NULL, 0);
+                break;
+            case 'h':
+            default:
+                fprintf(stderr, usage, argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (nThreads < 1)
+        nThreads = 1;
+
+    int priority = PRIORITY_NORMAL;
+    syscall3(Sys_ThreadPriority, HANDLE_CURRENT, &priority, NULL);
+
+    pthread_t* threads = calloc(nThreads, sizeof(pthread_t));
+    for (long i = 0; i < nThreads; i++)
+        pthread_create(&threads[i], NULL, hog, NULL);
+
+    printf("Running %ld THREAD_PRIORITY_HIGH hogs for %ld seconds...\n", nThreads, seconds);
+
+    // Any gap between two iterations of this loop is time this thread spent waiting to run.
+    uint64_t start = now_ns();
+    uint64_t last = start;
+    uint64_t max_wait = 0;
+    uint64_t total_wait = 0;
+    size_t nWaits = 0;
+    const uint64_t wait_threshold = 100000 /* 100us */;
+    while ((last - start) < (uint64_t)seconds * 1000000000)
+    {
+        uint64_t curr = now_ns();
+        uint64_t wait = curr - last;
+        if (wait > wait_threshold)
+        {
+            total_wait += wait;
+            nWaits++;
+            if (wait > max_wait)
+                max_wait = wait;
+        }
+        last = curr;
+    }
+
+    s_stop = true;
+    for (long i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    printf("Waited %zu times, max wait: %llu ms, average wait: %llu us\n",
+           nWaits,
+           (unsigned long long)(max_wait / 1000000),
+           (unsigned long long)(nWaits ? (total_wait / nWaits / 1000) : 0));
+    if (max_wait / 1000000 > max_wait_ms)
+    {
+        printf("FAIL: max wait exceeded the bound of %llu ms\n", (unsigned long long)max_wait_ms);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}